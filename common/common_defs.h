@@ -7,6 +7,8 @@
 
 	//#define		USE_JPEG
 
+	//#define		NO_GL				// Simulation only, OpenGL drawing compiled out (batch builds define it).
+
 	#define TEX_SIZE		2048	
 	#define LIGHT_NEAR		0.5
 	#define LIGHT_FAR		300.0
@@ -30,6 +30,7 @@
 GeomX::GeomX ()
 {
 	mHeap = 0x0;
+	SetSeed ( RANDOM_SEED );
 }
 
 void GeomX::FreeBuffers ()
@@ -135,6 +136,7 @@ void GeomX::CopyAttributes ( GeomX& src )
 		attr = src.GetAttribute ( n );
 		a = AddAttribute ( (uchar) attr->buf, attr->name, attr->stride, false );
 		mAttribute[a].offset = attr->offset;
+		mAttribute[a].dtype = attr->dtype;
 	}
 }
 		
@@ -179,6 +181,18 @@ int GeomX::AddAttribute ( uchar b, std::string name, ushort stride, bool bExtend
 	return (int) mAttribute.size()-1;
 }
 
+int GeomX::AddAttribute ( uchar b, std::string name, ushort stride, ushort offset, uchar dtype )
+{
+	GeomAttr attr;
+	attr.buf = b;
+	attr.name = name;
+	attr.offset = offset;
+	attr.stride = stride;
+	attr.dtype = dtype;
+	mAttribute.push_back ( attr );
+	return (int) mAttribute.size()-1;
+}
+
 int GeomX::GetAttribute ( std::string name )
 {
 	for (int n=0; n < (int) mAttribute.size(); n++) {
@@ -242,9 +256,30 @@ char* GeomX::AddElem ( uchar b, href& ndx )
 	return mBuf[b].data + ndx*mBuf[b].stride;
 }
 
+char* GeomX::AddElems ( uchar b, int cnt, href& first )
+{
+	if ( mBuf[b].num + cnt > mBuf[b].max ) {
+		int new_max = mBuf[b].max > 0 ? mBuf[b].max : 1;
+		while ( new_max < mBuf[b].num + cnt ) new_max *= 2;
+		if ( long(new_max) > ELEM_MAX ) {
+			error.PrintF ( "geom", "Maximum number of elements reached.\n" );
+			error.Exit ();
+		}
+		mBuf[b].max = new_max;
+		char* new_data = (char*) malloc ( mBuf[b].max * mBuf[b].stride );
+		memcpy ( new_data, mBuf[b].data, mBuf[b].num*mBuf[b].stride );
+		free ( mBuf[b].data );
+		mBuf[b].data = new_data;
+	}
+	first = mBuf[b].num;
+	mBuf[b].num += cnt;
+	mBuf[b].size += cnt * mBuf[b].stride;
+	return mBuf[b].data + first*mBuf[b].stride;
+}
+
 char* GeomX::RandomElem ( uchar b, href& ndx )
 {
-	ndx = mBuf[b].num * rand() / RAND_MAX;
+	ndx = mRandom.Range ( mBuf[b].num );
 	return mBuf[b].data + ndx*mBuf[b].stride;
 }
 
@@ -25,6 +25,8 @@
 
 	#include <vector>
 
+	#include "mrandom.h"
+
 	#define	HEAP_MAX			2147483640	// largest heap size (range of hpos)
 
 	#define	ELEM_MAX			2147483640	// largest number of elements in a buffer (range of hval)
@@ -32,6 +34,10 @@
 
 	#define BUF_UNDEF			255
 
+	#define ATTR_BYTES			0			// element type of an attribute, for readers
+	#define ATTR_FLOAT			1			// of raw data (stride / 4 components)
+	#define ATTR_INT			2
+
 	#define FPOS				2			// free position offsets
 	typedef unsigned char		uchar;
 	typedef unsigned short		ushort;
@@ -46,11 +52,12 @@
 	
 	class GeomAttr {
 	public:
-		GeomAttr()	{ name = ""; buf = 0; stride = 0; offset = 0; }
+		GeomAttr()	{ name = ""; buf = 0; stride = 0; offset = 0; dtype = ATTR_BYTES; }
 		std::string	name;
 		ushort		buf;
 		ushort		stride;
 		ushort		offset;
+		uchar		dtype;
 	};
 
 	class GeomBuf {
@@ -83,15 +90,18 @@
 		int AddBuffer ( uchar typ, ushort stride, int max );
 		int AddAttribute ( uchar b, std::string name, ushort stride );
 		int AddAttribute ( uchar b, std::string name, ushort stride, bool bExtend );
+		int AddAttribute ( uchar b, std::string name, ushort stride, ushort offset, uchar dtype );	// field of the existing stride
 		int GetAttribute ( std::string name );
 		int GetAttrOffset ( std::string name );
 		int NumElem ( uchar b )				{ if ( b==BUF_UNDEF) return 0; else return mBuf[b].num; }
 		int MaxElem ( uchar b )				{ if ( b==BUF_UNDEF) return 0; else return mBuf[b].max; } 		
 		int GetStride ( uchar b )			{ return mBuf[b].stride; }
 		char* GetElem ( uchar b, int n )	{ return mBuf[b].data + n*mBuf[b].stride; }
-		char* RandomElem ( uchar b, href& ndx );
+		char* RandomElem ( uchar b, href& ndx );		// from mRandom, see SetSeed
+		void SetSeed ( unsigned long long seed )	{ mRandom.Seed ( seed, RANDOM_STREAM_ELEM ); }
 		char* AddElem ( uchar b, href& pos );
 		int AddElem ( uchar b, char* data );		
+		char* AddElems ( uchar b, int cnt, href& first );	// cnt contiguous, uninitialized elements
 		bool DelElem ( uchar b, int n );
 		char* GetStart ( uchar b )			{ return mBuf[b].data; }
 		char* GetEnd ( uchar b )			{ return mBuf[b].data + mBuf[b].num*mBuf[b].stride; }
@@ -120,6 +130,8 @@
 		hpos						mHeapMax;
 		hpos						mHeapFree;
 		hval*						mHeap;
+
+		mint::Random				mRandom;
 	};
 
 #endif
@@ -0,0 +1,323 @@
+#include <math.h>
+#include <string.h>
+
+#include "mcodec.h"
+
+using namespace mint;
+
+#define MODE_BYTE		0			// byte values, lossless
+#define MODE_QUANT		1			// floats quantized to step
+#define MODE_WORD		2			// 32-bit words, lossless
+
+#define RICE_ZERO		31			// block parameter of an all-zero block
+#define RICE_ESCAPE		32			// quotient that escapes to a raw value
+
+#pragma pack(push)
+#pragma pack(1)
+struct codec_stream {
+	unsigned char	mode;
+	unsigned char	key;
+	unsigned short	comps;
+	float			step;
+};
+#pragma pack(pop)
+
+//------------------------------------------------------ bit streams
+
+namespace {
+
+class BitWriter {
+public:
+	BitWriter ( std::vector<char>& out ) : m_Out(out), m_Acc(0), m_Num(0)	{}
+
+	void Put ( unsigned int bits, int count )
+	{
+		m_Acc |= (unsigned long long) bits << m_Num;
+		m_Num += count;
+		while ( m_Num >= 8 ) {
+			m_Out.push_back ( (char) (m_Acc & 0xFF) );
+			m_Acc >>= 8;
+			m_Num -= 8;
+		}
+	}
+	void Flush ()
+	{
+		if ( m_Num > 0 ) m_Out.push_back ( (char) (m_Acc & 0xFF) );
+		m_Acc = 0;
+		m_Num = 0;
+	}
+
+private:
+	std::vector<char>&	m_Out;
+	unsigned long long	m_Acc;
+	int					m_Num;
+};
+
+class BitReader {
+public:
+	BitReader ( const char* in, size_t size ) : m_In((const unsigned char*) in), m_End((const unsigned char*) in + size), m_Acc(0), m_Num(0), m_bOverrun(false)	{}
+
+	unsigned int Get ( int count )
+	{
+		while ( m_Num < count ) {
+			if ( m_In < m_End )	m_Acc |= (unsigned long long) *m_In++ << m_Num;
+			else				m_bOverrun = true;
+			m_Num += 8;
+		}
+		unsigned int bits = (unsigned int) ( m_Acc & ((1ULL << count) - 1) );
+		m_Acc >>= count;
+		m_Num -= count;
+		return bits;
+	}
+	bool Overrun ()		{ return m_bOverrun; }
+
+private:
+	const unsigned char*	m_In;
+	const unsigned char*	m_End;
+	unsigned long long		m_Acc;
+	int						m_Num;
+	bool					m_bOverrun;
+};
+
+inline unsigned int ZigZag ( unsigned int r )		{ return (r << 1) ^ (unsigned int) ( (int) r >> 31 ); }
+inline unsigned int UnZigZag ( unsigned int z )		{ return (z >> 1) ^ ( 0u - (z & 1) ); }
+
+// Bits to Rice code v with parameter k
+inline int RiceCost ( unsigned int v, int k )
+{
+	unsigned int q = v >> k;
+	return ( q < RICE_ESCAPE ) ? (int) q + 1 + k : RICE_ESCAPE + 32;
+}
+
+void RiceEncode ( BitWriter& bw, const unsigned int* v, int num )
+{
+	for (int b=0; b < num; b += CODEC_BLOCK) {
+		int m = ( num - b < CODEC_BLOCK ) ? num - b : CODEC_BLOCK;
+		const unsigned int* blk = v + b;
+
+		unsigned long long sum = 0;
+		for (int n=0; n < m; n++) sum += blk[n];
+		if ( sum == 0 ) {
+			bw.Put ( RICE_ZERO, 5 );
+			continue;
+		}
+		// Parameter near log2 of the mean, refined by the exact cost
+		unsigned long long mean = sum / m;
+		int k0 = 0;
+		while ( k0 < 30 && (mean >> (k0+1)) != 0 ) k0++;
+		int best = k0, best_cost = -1;
+		for (int k = (k0 > 0 ? k0-1 : 0); k <= k0+1 && k <= 30; k++) {
+			int cost = 0;
+			for (int n=0; n < m; n++) cost += RiceCost ( blk[n], k );
+			if ( best_cost < 0 || cost < best_cost ) { best = k; best_cost = cost; }
+		}
+
+		bw.Put ( best, 5 );
+		for (int n=0; n < m; n++) {
+			unsigned int q = blk[n] >> best;
+			if ( q >= RICE_ESCAPE ) {
+				bw.Put ( 0xFFFFFFFF, 32 );
+				bw.Put ( blk[n], 32 );
+				continue;
+			}
+			if ( q > 0 ) bw.Put ( (1u << q) - 1, q );
+			bw.Put ( 0, 1 );
+			if ( best > 0 ) bw.Put ( blk[n] & ((1u << best) - 1), best );
+		}
+	}
+	bw.Flush ();
+}
+
+bool RiceDecode ( BitReader& br, unsigned int* v, int num )
+{
+	for (int b=0; b < num; b += CODEC_BLOCK) {
+		int m = ( num - b < CODEC_BLOCK ) ? num - b : CODEC_BLOCK;
+		unsigned int* blk = v + b;
+		int k = (int) br.Get ( 5 );
+		if ( k == RICE_ZERO ) {
+			memset ( blk, 0, m * sizeof(unsigned int) );
+			continue;
+		}
+		for (int n=0; n < m; n++) {
+			unsigned int q = 0;
+			while ( q < RICE_ESCAPE && br.Get ( 1 ) )
+				q++;
+			if ( q == RICE_ESCAPE )
+				blk[n] = br.Get ( 32 );
+			else
+				blk[n] = ( k > 0 ) ? ( (q << k) | br.Get ( k ) ) : q;
+		}
+		if ( br.Overrun() ) return false;
+	}
+	return true;
+}
+
+}
+
+//------------------------------------------------------ ColumnCodec
+
+ColumnCodec::ColumnCodec ()
+{
+	Setup ( CODEC_BYTES, 1, 0 );
+}
+
+void ColumnCodec::Setup ( int dtype, int elem_size, double error )
+{
+	m_Type = dtype;
+	m_ElemSize = elem_size;
+	if ( dtype != CODEC_BYTES && elem_size % 4 == 0 ) {
+		m_CompSize = 4;
+		m_Comps = elem_size / 4;
+	} else {
+		m_Type = CODEC_BYTES;
+		m_CompSize = 1;
+		m_Comps = elem_size;
+	}
+	m_Error = ( m_Type == CODEC_FLOAT && error > 0 ) ? error : 0;
+	Reset ();
+}
+
+void ColumnCodec::Reset ()
+{
+	m_Prev.clear ();
+	m_PrevNum = -1;
+	m_PrevMode = -1;
+}
+
+bool ColumnCodec::IsKey ( const char* in, size_t size )
+{
+	return size >= sizeof(codec_stream) && ((const codec_stream*) in)->key != 0;
+}
+
+void ColumnCodec::Encode ( const char* data, int num, bool key, std::vector<char>& out, int stride )
+{
+	if ( stride <= 0 ) stride = m_ElemSize;
+	size_t count = (size_t) num * m_Comps;
+	std::vector<int> cur ( count );
+
+	// Gather the values component-major, quantizing floats
+	codec_stream hdr;
+	hdr.mode = ( m_CompSize == 1 ) ? MODE_BYTE : MODE_WORD;
+	hdr.comps = (unsigned short) m_Comps;
+	hdr.step = 0;
+	if ( m_Error > 0 ) {
+		hdr.mode = MODE_QUANT;
+		// A step a little under 2e leaves room for the float rounding of the
+		// decoded value up to magnitudes of about 2^18 e
+		hdr.step = (float) (2.0 * m_Error * (1.0 - 1.0/64));
+		double step = hdr.step;
+		for (int c=0; c < m_Comps && hdr.mode == MODE_QUANT; c++) {
+			const char* src = data + c*4;
+			int* dst = count ? &cur[(size_t) c*num] : 0x0;
+			for (int n=0; n < num; n++, src += stride) {
+				float v;
+				memcpy ( &v, src, 4 );
+				double q = floor ( v / step + 0.5 );
+				// NaN, out of range, or below float precision: store the frame exactly
+				if ( !( fabs(q) < 1073741824.0 ) || fabs ( (float) ( q * step ) - v ) > m_Error ) {
+					hdr.mode = MODE_WORD;
+					hdr.step = 0;
+					break;
+				}
+				dst[n] = (int) q;
+			}
+		}
+	}
+	if ( hdr.mode != MODE_QUANT ) {
+		for (int c=0; c < m_Comps; c++) {
+			const char* src = data + c*m_CompSize;
+			int* dst = count ? &cur[(size_t) c*num] : 0x0;
+			if ( m_CompSize == 1 ) {
+				for (int n=0; n < num; n++, src += stride)
+					dst[n] = (unsigned char) *src;
+			} else {
+				for (int n=0; n < num; n++, src += stride)
+					memcpy ( dst + n, src, 4 );
+			}
+		}
+	}
+
+	key = key || num != m_PrevNum || hdr.mode != m_PrevMode;
+	hdr.key = key ? 1 : 0;
+
+	// Residuals against the previous frame
+	m_Resid.resize ( count );
+	if ( key ) {
+		// Key frames predict from the previous particle instead
+		for (int c=0; c < m_Comps; c++) {
+			const int* v = count ? &cur[(size_t) c*num] : 0x0;
+			unsigned int* r = count ? &m_Resid[(size_t) c*num] : 0x0;
+			for (int n=0; n < num; n++)
+				r[n] = ZigZag ( (unsigned int) v[n] - ( n ? (unsigned int) v[n-1] : 0u ) );
+		}
+	} else {
+		for (size_t i=0; i < count; i++)
+			m_Resid[i] = ZigZag ( (unsigned int) cur[i] - (unsigned int) m_Prev[i] );
+	}
+
+	size_t at = out.size();
+	out.resize ( at + sizeof(hdr) );
+	memcpy ( &out[at], &hdr, sizeof(hdr) );
+	BitWriter bw ( out );
+	RiceEncode ( bw, count ? &m_Resid[0] : 0x0, (int) count );
+
+	m_Prev.swap ( cur );
+	m_PrevNum = num;
+	m_PrevMode = hdr.mode;
+}
+
+bool ColumnCodec::Decode ( const char* in, size_t size, int num, char* out, int stride )
+{
+	if ( stride <= 0 ) stride = m_ElemSize;
+	codec_stream hdr;
+	if ( size < sizeof(hdr) ) return false;
+	memcpy ( &hdr, in, sizeof(hdr) );
+	if ( hdr.comps != m_Comps || hdr.mode > MODE_WORD || ( hdr.mode == MODE_BYTE ) != ( m_CompSize == 1 ) )
+		return false;
+	if ( !hdr.key && ( num != m_PrevNum || hdr.mode != m_PrevMode ) )
+		return false;
+
+	size_t count = (size_t) num * m_Comps;
+	m_Resid.resize ( count );
+	BitReader br ( in + sizeof(hdr), size - sizeof(hdr) );
+	if ( !RiceDecode ( br, count ? &m_Resid[0] : 0x0, (int) count ) ) {
+		Reset ();
+		return false;
+	}
+
+	std::vector<int> cur ( count );
+	if ( hdr.key ) {
+		for (int c=0; c < m_Comps; c++) {
+			int* v = count ? &cur[(size_t) c*num] : 0x0;
+			const unsigned int* r = count ? &m_Resid[(size_t) c*num] : 0x0;
+			for (int n=0; n < num; n++)
+				v[n] = (int) ( ( n ? (unsigned int) v[n-1] : 0u ) + UnZigZag ( r[n] ) );
+		}
+	} else {
+		for (size_t i=0; i < count; i++)
+			cur[i] = (int) ( (unsigned int) m_Prev[i] + UnZigZag ( m_Resid[i] ) );
+	}
+
+	double step = hdr.step;
+	for (int c=0; c < m_Comps; c++) {
+		char* dst = out + c*m_CompSize;
+		const int* src = count ? &cur[(size_t) c*num] : 0x0;
+		if ( hdr.mode == MODE_BYTE ) {
+			for (int n=0; n < num; n++, dst += stride)
+				*dst = (char) src[n];
+		} else if ( hdr.mode == MODE_QUANT ) {
+			for (int n=0; n < num; n++, dst += stride) {
+				float v = (float) ( src[n] * step );
+				memcpy ( dst, &v, 4 );
+			}
+		} else {
+			for (int n=0; n < num; n++, dst += stride)
+				memcpy ( dst, src + n, 4 );
+		}
+	}
+
+	m_Prev.swap ( cur );
+	m_PrevNum = num;
+	m_PrevMode = hdr.mode;
+	return true;
+}
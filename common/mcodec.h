@@ -0,0 +1,69 @@
+#ifndef DEF_MCODEC
+	#define DEF_MCODEC
+
+	#include <vector>
+	#include <stddef.h>
+
+	namespace mint {
+
+	// Column element types, same values as the GeomX ATTR_* types
+	#define CODEC_BYTES			0
+	#define CODEC_FLOAT			1
+	#define CODEC_INT			2
+
+	#define CODEC_BLOCK			128			// residuals per Rice parameter
+
+	// Error-bounded compression of one particle attribute column, frame
+	// after frame.
+	//
+	// A float column with an error bound e is quantized to integer multiples
+	// of a step just under 2e, so every decoded value is within e of the
+	// original (a frame that cannot be, e.g. with a NaN, is stored exactly);
+	// with e = 0, and for int and byte columns, the column is lossless. Each
+	// value is then predicted from the same particle's value in the previous
+	// frame and the residuals, component by component, are Rice coded in
+	// blocks of CODEC_BLOCK with a per-block parameter.
+	//
+	// A key frame predicts from the previous particle of the same frame
+	// instead, which suits the spatially ordered seeding. A codec decodes delta
+	// frames only right after the frame they refer to, so readers seek to a
+	// key frame first. Encode and Decode keep the previous frame's values,
+	// hence one codec per column and direction.
+	//
+	// Stream:  uchar mode, uchar key, ushort components, float step,
+	//          then the Rice coded residuals.
+	class ColumnCodec {
+	public:
+		ColumnCodec ();
+
+		void Setup ( int dtype, int elem_size, double error );
+		void Reset ();							// next frame is coded as a key frame
+
+		// Appends the encoded column of num elements to out. Codes a key frame
+		// when asked to, after Reset, or when the particle count changed.
+		// Elements are stride bytes apart, elem_size when 0, so a field can
+		// be coded in place within particle records.
+		void Encode ( const char* data, int num, bool key, std::vector<char>& out, int stride = 0 );
+
+		// Decodes a stream of Encode into num elements at out. Fails on a
+		// corrupt stream and on a delta frame without its previous frame.
+		bool Decode ( const char* in, size_t size, int num, char* out, int stride = 0 );
+
+		static bool IsKey ( const char* in, size_t size );
+		double GetError ()				{ return m_Error; }
+
+	private:
+		int						m_Type;
+		int						m_ElemSize;
+		int						m_Comps;			// values per element
+		int						m_CompSize;			// bytes per value, 1 or 4
+		double					m_Error;
+		std::vector<int>		m_Prev;				// previous frame, quantized
+		int						m_PrevNum;			// -1 when there is none
+		int						m_PrevMode;
+		std::vector<unsigned int>	m_Resid;
+	};
+
+	}
+
+#endif
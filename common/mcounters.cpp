@@ -0,0 +1,218 @@
+#include <string.h>
+
+#include "mcounters.h"
+
+#ifndef _MSC_VER
+	#include <unistd.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+#endif
+
+using namespace mint;
+
+static THREAD_LOCAL void*	t_Group = 0x0;		// of the calling thread, once opened
+static THREAD_LOCAL void*	t_Scope = 0x0;		// innermost CounterScope of the calling thread
+
+const char* mint::CounterName ( int counter )
+{
+	static const char* names[COUNTER_NUM] = { "cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses" };
+	return ( counter >= 0 && counter < COUNTER_NUM ) ? names[counter] : "";
+}
+
+Counters& mint::GetCounters ()
+{
+	static Counters counters;
+	return counters;
+}
+
+Counters::Counters ()
+{
+	m_bEnabled = false;
+	m_bDTLB = false;
+}
+
+void Counters::SetEnabled ( bool on, bool dtlb )
+{
+	ScopedLock lock ( m_Lock );
+	m_bDTLB = dtlb;
+	m_bEnabled = on;
+}
+
+CounterSink::CounterSink ( CounterSink* parent )
+{
+	m_Parent = parent;
+	if ( m_Parent ) m_Parent->Retain ();
+	for (int n=0; n < COUNTER_NUM; n++) m_Count[n] = -1;
+	m_Refs = 1;
+}
+
+CounterSink::~CounterSink ()
+{
+	if ( m_Parent ) m_Parent->Release ();
+}
+
+void CounterSink::Retain ()
+{
+	AtomicAdd ( &m_Refs, 1 );
+}
+
+void CounterSink::Release ()
+{
+	if ( AtomicAdd ( &m_Refs, -1 ) == 0 ) delete this;
+}
+
+void CounterSink::Add ( const long long* values )
+{
+	{
+		ScopedLock lock ( m_Lock );
+		for (int n=0; n < COUNTER_NUM; n++) {
+			if ( values[n] < 0 ) continue;
+			if ( m_Count[n] < 0 ) m_Count[n] = 0;
+			m_Count[n] += values[n];
+		}
+	}
+	if ( m_Parent ) m_Parent->Add ( values );
+}
+
+void CounterSink::Get ( long long* values )
+{
+	ScopedLock lock ( m_Lock );
+	for (int n=0; n < COUNTER_NUM; n++) values[n] = m_Count[n];
+}
+
+void CounterScope::Enter ( CounterSink* sink )
+{
+	m_Sink = sink;
+	m_Prev = (CounterScope*) t_Scope;
+	m_bEntered = true;
+	t_Scope = this;
+}
+
+void CounterScope::Leave ()
+{
+	if ( !m_bEntered ) return;
+	t_Scope = m_Prev;
+	m_bEntered = false;
+}
+
+CounterSink* CounterScope::Current ()
+{
+	CounterScope* s = (CounterScope*) t_Scope;
+	return s != 0x0 ? s->m_Sink : 0x0;
+}
+
+bool CounterScope::IsCounting ( CounterSink* sink )
+{
+	for ( CounterScope* s = (CounterScope*) t_Scope; s != 0x0; s = s->m_Prev )
+		if ( s->m_Sink == sink ) return true;
+	return false;
+}
+
+bool Counters::IsAvailable ()
+{
+	long long v[COUNTER_NUM];
+	return Read ( v );
+}
+
+#ifdef _MSC_VER
+
+Counters::~Counters ()
+{
+}
+
+Counters::Group* Counters::Open ()
+{
+	return 0x0;
+}
+
+bool Counters::Read ( long long* values )
+{
+	for (int n=0; n < COUNTER_NUM; n++) values[n] = -1;
+	return false;
+}
+
+#else
+
+Counters::~Counters ()
+{
+	for (int n=0; n < (int) m_Groups.size(); n++) {
+		for (int c=0; c < COUNTER_NUM; c++)
+			if ( m_Groups[n]->fd[c] >= 0 ) close ( m_Groups[n]->fd[c] );
+		delete m_Groups[n];
+	}
+}
+
+static int OpenEvent ( unsigned int type, unsigned long long config, int group )
+{
+	struct perf_event_attr attr;
+	memset ( &attr, 0, sizeof(attr) );
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = ( group < 0 ) ? 1 : 0;		// the leader starts the group
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return (int) syscall ( __NR_perf_event_open, &attr, 0, -1, group, 0 );
+}
+
+// The events of the calling thread, as one group so they count over the
+// same intervals. A counter the processor lacks is left out.
+Counters::Group* Counters::Open ()
+{
+	static const unsigned long long llc = PERF_COUNT_HW_CACHE_LL | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+	static const unsigned long long dtlb = PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+	const unsigned int type[COUNTER_NUM] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+	const unsigned long long config[COUNTER_NUM] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, llc, PERF_COUNT_HW_BRANCH_MISSES, dtlb };
+
+	Group* g = new Group;
+	g->leader = -1;
+	g->num = 0;
+	bool with_dtlb;
+	{
+		ScopedLock lock ( m_Lock );
+		with_dtlb = m_bDTLB;
+	}
+	for (int c=0; c < COUNTER_NUM; c++) {
+		g->fd[c] = -1;
+		g->slot[c] = -1;
+		if ( c == COUNTER_DTLB_MISSES && !with_dtlb ) continue;
+		int fd = OpenEvent ( type[c], config[c], g->leader );
+		if ( fd < 0 ) continue;
+		if ( g->leader < 0 ) g->leader = fd;
+		g->fd[c] = fd;
+		g->slot[c] = g->num++;
+	}
+	if ( g->leader >= 0 ) {
+		ioctl ( g->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+		ioctl ( g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+	}
+	ScopedLock lock ( m_Lock );
+	m_Groups.push_back ( g );
+	return g;
+}
+
+bool Counters::Read ( long long* values )
+{
+	for (int n=0; n < COUNTER_NUM; n++) values[n] = -1;
+	if ( !m_bEnabled ) return false;
+	Group* g = (Group*) t_Group;
+	if ( g == 0x0 ) {
+		g = Open ();
+		t_Group = g;
+	}
+	if ( g->leader < 0 ) return false;
+
+	// nr, time enabled, time running, then one value per counter in the group
+	unsigned long long buf[3 + COUNTER_NUM];
+	ssize_t want = (ssize_t) ( ( 3 + g->num ) * sizeof(buf[0]) );
+	if ( read ( g->leader, buf, want ) != want ) return false;
+	if ( buf[2] == 0 ) return false;		// never scheduled, e.g. more events than the PMU fits
+	double scale = ( buf[2] < buf[1] ) ? double ( buf[1] ) / buf[2] : 1.0;
+	for (int c=0; c < COUNTER_NUM; c++)
+		if ( g->slot[c] >= 0 ) values[c] = (long long) ( buf[3 + g->slot[c]] * scale );
+	return true;
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef DEF_MCOUNTERS
+	#define DEF_MCOUNTERS
+
+	#include <vector>
+
+	#include "mthread.h"
+
+	// Hardware Counters
+	//
+	// CPU event counts of the calling thread, from Linux perf_event_open:
+	// cycles, instructions, last-level cache misses, branch misses and,
+	// optionally, data TLB misses. Each thread opens its own counters the
+	// first time it reads them. Counts are of user code only, and scaled up
+	// when the kernel had to share the hardware counters between groups.
+	// Where counters cannot be opened (other systems, a VM without a PMU,
+	// perf_event_paranoid too high) Read returns false and the profiler
+	// reports timings alone.
+	//
+	//   mint::GetCounters().SetEnabled ( true, false );
+	//   long long a[COUNTER_NUM], b[COUNTER_NUM];
+	//   GetCounters().Read ( a );  ...  GetCounters().Read ( b );
+
+	namespace mint {
+
+	#define COUNTER_CYCLES			0
+	#define COUNTER_INSTRUCTIONS	1
+	#define COUNTER_LLC_MISSES		2
+	#define COUNTER_BRANCH_MISSES	3
+	#define COUNTER_DTLB_MISSES		4
+	#define COUNTER_NUM				5
+
+	const char* CounterName ( int counter );		// "cycles", "instructions", ...
+
+	class Counters {
+	public:
+		Counters ();
+		~Counters ();
+
+		// Turns reading on or off for every thread; dtlb adds the data TLB
+		// misses, which some processors cannot count next to the others.
+		// Threads that opened counters keep them for the life of the process.
+		void SetEnabled ( bool on, bool dtlb = false );
+		bool IsEnabled ()				{ return m_bEnabled; }
+
+		// Counts of the calling thread since it opened its counters, -1 for
+		// those it could not open. False if none could be opened, the
+		// kernel has not yet scheduled them, or counting is off.
+		bool Read ( long long* values );
+
+		bool IsAvailable ();			// opens the calling thread's counters if needed
+
+	private:
+		struct Group {
+			int			fd[COUNTER_NUM];	// -1 if not open
+			int			slot[COUNTER_NUM];	// position in the group read, -1 if not open
+			int			leader;				// fd the others are grouped under
+			int			num;				// counters open
+		};
+		Group* Open ();
+
+		std::vector<Group*>		m_Groups;
+		Mutex					m_Lock;
+		volatile bool			m_bEnabled;
+		bool					m_bDTLB;
+	};
+
+	// The counters of the process, read by every Profiler
+	Counters& GetCounters ();
+
+	// Counts of work done on behalf of a timer by other threads. While a
+	// sink is current on a thread, the pool jobs that thread submits carry
+	// it, and each is counted on the worker that runs it and added to the
+	// sink (see ThreadPool::Execute); jobs those jobs submit carry it too.
+	// What a sink gets it also adds to its parent, so a timer sees the jobs
+	// of the timers nested in it. Reference counted, since a job may outlive
+	// the timer that queued it.
+	class CounterSink {
+	public:
+		CounterSink ( CounterSink* parent );	// one reference, the caller's
+		void Retain ();
+		void Release ();					// the last deletes the sink
+
+		void Add ( const long long* values );
+		void Get ( long long* values );		// summed so far, -1 where nothing was counted
+
+	private:
+		~CounterSink ();
+		CounterSink*	m_Parent;
+		long long		m_Count[COUNTER_NUM];
+		Mutex			m_Lock;
+		volatile long	m_Refs;
+	};
+
+	// Makes a sink current on the calling thread from Enter to Leave. The
+	// scopes of a thread nest, innermost current.
+	class CounterScope {
+	public:
+		CounterScope () : m_Sink ( 0x0 ), m_Prev ( 0x0 ), m_bEntered ( false )	{}
+		void Enter ( CounterSink* sink );
+		void Leave ();
+
+		static CounterSink* Current ();					// of the calling thread, 0x0 if none
+		static bool IsCounting ( CounterSink* sink );	// current in any scope of the calling thread
+
+	private:
+		CounterSink*	m_Sink;
+		CounterScope*	m_Prev;
+		bool			m_bEntered;
+	};
+
+	}
+
+#endif
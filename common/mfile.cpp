@@ -0,0 +1,155 @@
+
+#include <string>
+#include <string.h>
+#include <stdio.h>
+
+#include "mfile.h"
+
+#ifndef _MSC_VER
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+using namespace mint;
+
+MappedFile::MappedFile ()
+{
+	m_Data = 0x0;
+	m_Size = 0;
+	m_bOpen = false;
+	#ifdef _MSC_VER
+		m_File = INVALID_HANDLE_VALUE;
+		m_Mapping = 0x0;
+	#else
+		m_File = -1;
+	#endif
+}
+
+MappedFile::~MappedFile ()
+{
+	Close ();
+}
+
+#ifdef _MSC_VER
+
+bool MappedFile::Open ( const char* filename )
+{
+	LARGE_INTEGER size;
+
+	Close ();
+	m_File = CreateFileA ( filename, GENERIC_READ, FILE_SHARE_READ, 0x0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0x0 );
+	if ( m_File == INVALID_HANDLE_VALUE ) return false;
+	if ( !GetFileSizeEx ( m_File, &size ) ) { Close (); return false; }
+
+	m_Size = (size_t) size.QuadPart;
+	m_bOpen = true;
+	if ( m_Size == 0 ) return true;			// nothing to map
+
+	m_Mapping = CreateFileMappingA ( m_File, 0x0, PAGE_READONLY, 0, 0, 0x0 );
+	if ( m_Mapping == 0x0 ) { Close (); return false; }
+	m_Data = (const char*) MapViewOfFile ( m_Mapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( m_Data == 0x0 ) { Close (); return false; }
+	return true;
+}
+
+void MappedFile::Close ()
+{
+	if ( m_Data ) UnmapViewOfFile ( m_Data );
+	if ( m_Mapping ) CloseHandle ( m_Mapping );
+	if ( m_File != INVALID_HANDLE_VALUE ) CloseHandle ( m_File );
+	m_Data = 0x0;
+	m_Mapping = 0x0;
+	m_File = INVALID_HANDLE_VALUE;
+	m_Size = 0;
+	m_bOpen = false;
+}
+
+#else
+
+bool MappedFile::Open ( const char* filename )
+{
+	struct stat st;
+
+	Close ();
+	m_File = open ( filename, O_RDONLY );
+	if ( m_File < 0 ) return false;
+	if ( fstat ( m_File, &st ) != 0 ) { Close (); return false; }
+
+	m_Size = (size_t) st.st_size;
+	m_bOpen = true;
+	if ( m_Size == 0 ) return true;			// mmap rejects empty mappings
+
+	void* p = mmap ( 0x0, m_Size, PROT_READ, MAP_PRIVATE, m_File, 0 );
+	if ( p == MAP_FAILED ) { Close (); return false; }
+	madvise ( p, m_Size, MADV_SEQUENTIAL );
+	m_Data = (const char*) p;
+	return true;
+}
+
+void MappedFile::Close ()
+{
+	if ( m_Data ) munmap ( (void*) m_Data, m_Size );
+	if ( m_File >= 0 ) close ( m_File );
+	m_Data = 0x0;
+	m_File = -1;
+	m_Size = 0;
+	m_bOpen = false;
+}
+
+#endif
+
+//------------------------------------------------------ Directories
+
+bool mint::IsFramePattern ( const char* fmt )
+{
+	int conversions = 0;
+	for ( const char* c = fmt; *c != '\0'; c++ ) {
+		if ( *c != '%' ) continue;
+		c++;
+		if ( *c == '%' ) continue;
+		while ( *c != '\0' && strchr ( "-+ #0", *c ) != 0x0 ) c++;
+		while ( *c >= '0' && *c <= '9' ) c++;
+		if ( *c == '.' ) {
+			c++;
+			while ( *c >= '0' && *c <= '9' ) c++;
+		}
+		if ( *c == '\0' || strchr ( "diuxXo", *c ) == 0x0 ) return false;
+		if ( ++conversions > 1 ) return false;
+	}
+	return true;
+}
+
+bool mint::FramePath ( char* buf, size_t size, const char* fmt, int frame )
+{
+	if ( size == 0 ) return false;
+	#ifdef _MSC_VER
+		int n = _snprintf ( buf, size, fmt, frame );		// no terminator when it does not fit
+	#else
+		int n = snprintf ( buf, size, fmt, frame );
+	#endif
+	buf[size-1] = '\0';
+	return n >= 0 && (size_t) n < size;
+}
+
+bool mint::MakeDir ( const char* path )
+{
+	std::string dir ( path );
+	for (size_t n=1; n <= dir.size(); n++) {
+		if ( n < dir.size() && dir[n] != '/' && dir[n] != '\\' ) continue;
+		std::string part = dir.substr ( 0, n );		// fails harmlessly on existing parts
+		#ifdef _MSC_VER
+			CreateDirectoryA ( part.c_str(), 0x0 );
+		#else
+			mkdir ( part.c_str(), 0777 );
+		#endif
+	}
+	#ifdef _MSC_VER
+		DWORD attr = GetFileAttributesA ( path );
+		return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY) != 0;
+	#else
+		struct stat st;
+		return stat ( path, &st ) == 0 && S_ISDIR ( st.st_mode );
+	#endif
+}
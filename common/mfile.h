@@ -0,0 +1,57 @@
+#ifndef DEF_MFILE
+	#define DEF_MFILE
+
+	#include <stddef.h>
+
+	#ifdef _MSC_VER
+		#include <windows.h>
+	#endif
+
+	// Read-only memory mapped file.
+	//
+	// Lets loaders walk a whole file as one byte array instead of issuing a
+	// read call per record; the OS pages it in as the parser advances.
+
+	namespace mint {
+
+	class MappedFile {
+	public:
+		MappedFile ();
+		~MappedFile ();
+
+		bool Open ( const char* filename );
+		void Close ();
+
+		bool IsOpen ()						{ return m_bOpen; }
+		const char* GetData ()				{ return m_Data; }
+		size_t GetSize ()					{ return m_Size; }
+
+	private:
+		const char*		m_Data;
+		size_t			m_Size;
+		bool			m_bOpen;
+		#ifdef _MSC_VER
+			HANDLE			m_File;
+			HANDLE			m_Mapping;
+		#else
+			int				m_File;
+		#endif
+		MappedFile ( const MappedFile& );
+		MappedFile& operator= ( const MappedFile& );
+	};
+
+	// Creates a directory, parents included; true if it exists afterwards.
+	bool MakeDir ( const char* path );
+
+	// True if fmt is a file name pattern printf can be given one int, e.g.
+	// "OBJ/Melting%04d.obj": at most one conversion, of d, i, u, x or o,
+	// with flags, width and precision but no '*' or length. "%%" is allowed.
+	bool IsFramePattern ( const char* fmt );
+
+	// The file name of frame from such a pattern into buf; false, with buf
+	// cut short, if it did not fit.
+	bool FramePath ( char* buf, size_t size, const char* fmt, int frame );
+
+	}
+
+#endif
@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "mprofile.h"
+
+#ifdef _MSC_VER
+	#include <psapi.h>
+#endif
+
+using namespace mint;
+
+Profiler::Profiler ()
+{
+	m_bEnabled = true;
+}
+
+int Profiler::AddPhase ( const char* name )
+{
+	ScopedLock lock ( m_Lock );
+	for (int n=0; n < (int) m_Phases.size(); n++)
+		if ( m_Phases[n].name == name ) return n;
+	Phase ph;
+	ph.name = name;
+	ph.trace = GetTracer().Intern ( name );
+	ph.count = 0;
+	ph.total = 0;
+	ph.last = 0;
+	ph.next = 0;
+	ph.items = 0;
+	for (int c=0; c < COUNTER_NUM; c++) ph.counter[c] = -1;
+	ph.ring.reserve ( PROFILE_WINDOW );
+	m_Phases.push_back ( ph );
+	return (int) m_Phases.size() - 1;
+}
+
+int Profiler::FindPhase ( const char* name )
+{
+	ScopedLock lock ( m_Lock );
+	for (int n=0; n < (int) m_Phases.size(); n++)
+		if ( m_Phases[n].name == name ) return n;
+	return -1;
+}
+
+int Profiler::NumPhases ()
+{
+	ScopedLock lock ( m_Lock );
+	return (int) m_Phases.size();
+}
+
+std::string Profiler::GetName ( int phase )
+{
+	ScopedLock lock ( m_Lock );
+	return ( phase >= 0 && phase < (int) m_Phases.size() ) ? m_Phases[phase].name : std::string();
+}
+
+const char* Profiler::GetTraceName ( int phase )
+{
+	ScopedLock lock ( m_Lock );
+	return ( phase >= 0 && phase < (int) m_Phases.size() ) ? m_Phases[phase].trace : 0x0;
+}
+
+void Profiler::Record ( int phase, sjtime nsec, const long long* counters, double items )
+{
+	ScopedLock lock ( m_Lock );
+	if ( phase < 0 || phase >= (int) m_Phases.size() ) return;
+	Phase& ph = m_Phases[phase];
+	ph.count++;
+	ph.total += nsec;
+	ph.last = nsec;
+	if ( (int) ph.ring.size() < PROFILE_WINDOW )
+		ph.ring.push_back ( nsec );
+	else
+		ph.ring[ph.next] = nsec;
+	ph.next = ( ph.next + 1 ) % PROFILE_WINDOW;
+	ph.items += items;
+	if ( counters != 0x0 ) {
+		for (int c=0; c < COUNTER_NUM; c++) {
+			if ( counters[c] < 0 ) continue;
+			if ( ph.counter[c] < 0 ) ph.counter[c] = 0;
+			ph.counter[c] += counters[c];
+		}
+	}
+}
+
+void Profiler::Reset ()
+{
+	ScopedLock lock ( m_Lock );
+	for (int n=0; n < (int) m_Phases.size(); n++) {
+		Phase& ph = m_Phases[n];
+		ph.count = 0;
+		ph.total = 0;
+		ph.last = 0;
+		ph.next = 0;
+		ph.items = 0;
+		for (int c=0; c < COUNTER_NUM; c++) ph.counter[c] = -1;
+		ph.ring.clear ();
+	}
+}
+
+void Profiler::GetStats ( int phase, PhaseStats& st )
+{
+	memset ( &st, 0, sizeof(st) );
+	st.ipc = -1;
+	for (int c=0; c < COUNTER_NUM; c++) st.counter[c] = st.per_item[c] = -1;
+	std::vector<sjtime> win;
+	{
+		ScopedLock lock ( m_Lock );
+		if ( phase < 0 || phase >= (int) m_Phases.size() ) return;
+		const Phase& ph = m_Phases[phase];
+		st.count = ph.count;
+		st.total = double ( ph.total ) / SEC_SCALAR;
+		st.last = double ( ph.last ) / SEC_SCALAR;
+		st.items = ph.items;
+		for (int c=0; c < COUNTER_NUM; c++) st.counter[c] = (double) ph.counter[c];
+		win = ph.ring;
+	}
+	if ( st.counter[COUNTER_CYCLES] > 0 && st.counter[COUNTER_INSTRUCTIONS] >= 0 )
+		st.ipc = st.counter[COUNTER_INSTRUCTIONS] / st.counter[COUNTER_CYCLES];
+	for (int c=0; c < COUNTER_NUM; c++)
+		if ( st.counter[c] >= 0 && st.items > 0 ) st.per_item[c] = st.counter[c] / st.items;
+	st.window = (int) win.size();
+	if ( win.empty() ) return;
+
+	sjtime sum = 0;
+	for (int n=0; n < (int) win.size(); n++) sum += win[n];
+	st.mean = double ( sum ) / win.size() / SEC_SCALAR;
+	std::sort ( win.begin(), win.end() );
+	st.min = double ( win.front() ) / SEC_SCALAR;
+	st.max = double ( win.back() ) / SEC_SCALAR;
+	// Nearest rank: the smallest sample with at least 99% of the window at or below it
+	int rank = (int) ( ( 99 * win.size() + 99 ) / 100 );
+	st.p99 = double ( win[rank - 1] ) / SEC_SCALAR;
+}
+
+bool Profiler::WriteCSV ( const char* filename )
+{
+	FILE* fp = fopen ( filename, "w" );
+	if ( fp == 0x0 ) return false;
+	fprintf ( fp, "phase,count,total_ms,window,min_ms,mean_ms,p99_ms,max_ms,items" );
+	for (int c=0; c < COUNTER_NUM; c++) fprintf ( fp, ",%s", CounterName ( c ) );
+	fprintf ( fp, ",ipc" );
+	for (int c=COUNTER_LLC_MISSES; c < COUNTER_NUM; c++) fprintf ( fp, ",%s_per_item", CounterName ( c ) );
+	fprintf ( fp, "\n" );
+	for (int n=0; n < NumPhases(); n++) {
+		PhaseStats st;
+		GetStats ( n, st );
+		fprintf ( fp, "%s,%d,%.6f,%d,%.6f,%.6f,%.6f,%.6f,%.0f", GetName(n).c_str(), st.count, st.total*1000.0,
+				  st.window, st.min*1000.0, st.mean*1000.0, st.p99*1000.0, st.max*1000.0, st.items );
+		for (int c=0; c < COUNTER_NUM; c++) fprintf ( fp, ",%.0f", st.counter[c] );
+		fprintf ( fp, ",%.4f", st.ipc );
+		for (int c=COUNTER_LLC_MISSES; c < COUNTER_NUM; c++) fprintf ( fp, ",%.4f", st.per_item[c] );
+		fprintf ( fp, "\n" );
+	}
+	return fclose ( fp ) == 0;
+}
+
+bool Profiler::WriteJSON ( const char* filename )
+{
+	FILE* fp = fopen ( filename, "w" );
+	if ( fp == 0x0 ) return false;
+	fprintf ( fp, "{\n  \"window\": %d,\n  \"phases\": [\n", PROFILE_WINDOW );
+	int num = NumPhases ();
+	for (int n=0; n < num; n++) {
+		PhaseStats st;
+		GetStats ( n, st );
+		fprintf ( fp, "    { \"phase\": \"%s\", \"count\": %d, \"total_ms\": %.6f, \"window\": %d, "
+					  "\"min_ms\": %.6f, \"mean_ms\": %.6f, \"p99_ms\": %.6f, \"max_ms\": %.6f, \"items\": %.0f",
+				  GetName(n).c_str(), st.count, st.total*1000.0, st.window, st.min*1000.0, st.mean*1000.0,
+				  st.p99*1000.0, st.max*1000.0, st.items );
+		for (int c=0; c < COUNTER_NUM; c++) fprintf ( fp, ", \"%s\": %.0f", CounterName ( c ), st.counter[c] );
+		fprintf ( fp, ", \"ipc\": %.4f", st.ipc );
+		for (int c=COUNTER_LLC_MISSES; c < COUNTER_NUM; c++) fprintf ( fp, ", \"%s_per_item\": %.4f", CounterName ( c ), st.per_item[c] );
+		fprintf ( fp, " }%s\n", n+1 < num ? "," : "" );
+	}
+	fprintf ( fp, "  ]\n}\n" );
+	return fclose ( fp ) == 0;
+}
+
+bool Profiler::Write ( const char* filename )
+{
+	size_t len = strlen ( filename );
+	if ( len >= 5 && strcmp ( filename + len - 5, ".json" ) == 0 )
+		return WriteJSON ( filename );
+	return WriteCSV ( filename );
+}
+
+void Profiler::Print ( const char* title )
+{
+	if ( title != 0x0 ) printf ( "%s\n", title );
+	printf ( "  %-14s %8s %11s %9s %9s %9s %9s\n", "phase", "count", "total ms", "min", "mean", "p99", "max" );
+	for (int n=0; n < NumPhases(); n++) {
+		PhaseStats st;
+		GetStats ( n, st );
+		printf ( "  %-14s %8d %11.1f %9.3f %9.3f %9.3f %9.3f\n", GetName(n).c_str(), st.count, st.total*1000.0,
+				 st.min*1000.0, st.mean*1000.0, st.p99*1000.0, st.max*1000.0 );
+	}
+
+	// Counters, for the phases that have them; misses per work item
+	bool counted = false;
+	for (int n=0; n < NumPhases() && !counted; n++) {
+		PhaseStats st;
+		GetStats ( n, st );
+		counted = ( st.ipc >= 0 );
+	}
+	if ( !counted ) return;
+	printf ( "  %-14s %12s %9s %7s %11s %11s %11s\n", "counters", "items", "Gcycles", "ipc", "llc/item", "branch/item", "dtlb/item" );
+	for (int n=0; n < NumPhases(); n++) {
+		PhaseStats st;
+		GetStats ( n, st );
+		if ( st.ipc < 0 ) continue;
+		printf ( "  %-14s %12.0f %9.3f %7.2f", GetName(n).c_str(), st.items, st.counter[COUNTER_CYCLES] * 1e-9, st.ipc );
+		for (int c=COUNTER_LLC_MISSES; c < COUNTER_NUM; c++) {
+			if ( st.per_item[c] >= 0 ) printf ( " %11.3f", st.per_item[c] );
+			else printf ( " %11s", "-" );
+		}
+		printf ( "\n" );
+	}
+}
+
+MemoryReport::MemoryReport ()
+{
+	Reset ();
+}
+
+void MemoryReport::Set ( const char* name, size_t resident, size_t reserved )
+{
+	ScopedLock lock ( m_Lock );
+	int n = 0;
+	while ( n < (int) m_Items.size() && m_Items[n].name != name ) n++;
+	if ( n == (int) m_Items.size() ) {
+		MemoryItem it;
+		it.name = name;
+		it.resident = it.reserved = 0;
+		it.peak_resident = it.peak_reserved = 0;
+		m_Items.push_back ( it );
+	}
+	MemoryItem& it = m_Items[n];
+	m_Total.resident += resident - it.resident;
+	m_Total.reserved += reserved - it.reserved;
+	it.resident = resident;
+	it.reserved = reserved;
+	if ( resident > it.peak_resident ) it.peak_resident = resident;
+	if ( reserved > it.peak_reserved ) it.peak_reserved = reserved;
+	if ( m_Total.resident > m_Total.peak_resident ) m_Total.peak_resident = m_Total.resident;
+	if ( m_Total.reserved > m_Total.peak_reserved ) m_Total.peak_reserved = m_Total.reserved;
+}
+
+void MemoryReport::Reset ()
+{
+	ScopedLock lock ( m_Lock );
+	m_Items.clear ();
+	m_Total.name = "total";
+	m_Total.resident = m_Total.reserved = 0;
+	m_Total.peak_resident = m_Total.peak_reserved = 0;
+}
+
+int MemoryReport::NumItems ()
+{
+	ScopedLock lock ( m_Lock );
+	return (int) m_Items.size();
+}
+
+MemoryItem MemoryReport::GetItem ( int n )
+{
+	ScopedLock lock ( m_Lock );
+	return ( n >= 0 && n < (int) m_Items.size() ) ? m_Items[n] : m_Total;
+}
+
+MemoryItem MemoryReport::GetTotal ()
+{
+	ScopedLock lock ( m_Lock );
+	return m_Total;
+}
+
+bool MemoryReport::WriteCSV ( const char* filename )
+{
+	FILE* fp = fopen ( filename, "w" );
+	if ( fp == 0x0 ) return false;
+	fprintf ( fp, "subsystem,resident,reserved,peak_resident,peak_reserved\n" );
+	int num = NumItems ();
+	for (int n=0; n <= num; n++) {
+		MemoryItem it = ( n < num ) ? GetItem ( n ) : GetTotal ();
+		fprintf ( fp, "%s,%lu,%lu,%lu,%lu\n", it.name.c_str(), (unsigned long) it.resident, (unsigned long) it.reserved,
+				  (unsigned long) it.peak_resident, (unsigned long) it.peak_reserved );
+	}
+	return fclose ( fp ) == 0;
+}
+
+bool MemoryReport::WriteJSON ( const char* filename )
+{
+	FILE* fp = fopen ( filename, "w" );
+	if ( fp == 0x0 ) return false;
+	fprintf ( fp, "{\n  \"subsystems\": [\n" );
+	int num = NumItems ();
+	for (int n=0; n <= num; n++) {
+		MemoryItem it = ( n < num ) ? GetItem ( n ) : GetTotal ();
+		fprintf ( fp, "    { \"subsystem\": \"%s\", \"resident\": %lu, \"reserved\": %lu, \"peak_resident\": %lu, \"peak_reserved\": %lu }%s\n",
+				  it.name.c_str(), (unsigned long) it.resident, (unsigned long) it.reserved,
+				  (unsigned long) it.peak_resident, (unsigned long) it.peak_reserved, n < num ? "," : "" );
+	}
+	fprintf ( fp, "  ]\n}\n" );
+	return fclose ( fp ) == 0;
+}
+
+bool MemoryReport::Write ( const char* filename )
+{
+	size_t len = strlen ( filename );
+	if ( len >= 5 && strcmp ( filename + len - 5, ".json" ) == 0 )
+		return WriteJSON ( filename );
+	return WriteCSV ( filename );
+}
+
+void MemoryReport::Print ( const char* title )
+{
+	const double mb = 1.0 / ( 1024.0 * 1024.0 );
+	if ( title != 0x0 ) printf ( "%s\n", title );
+	printf ( "  %-18s %10s %10s %10s %10s\n", "subsystem", "resident", "reserved", "peak res", "peak rsv" );
+	int num = NumItems ();
+	for (int n=0; n <= num; n++) {
+		MemoryItem it = ( n < num ) ? GetItem ( n ) : GetTotal ();
+		printf ( "  %-18s %10.2f %10.2f %10.2f %10.2f\n", it.name.c_str(), it.resident * mb, it.reserved * mb,
+				 it.peak_resident * mb, it.peak_reserved * mb );
+	}
+}
+
+#ifdef _MSC_VER
+
+size_t mint::ResidentMemory ()
+{
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( !GetProcessMemoryInfo ( GetCurrentProcess(), &pmc, sizeof(pmc) ) ) return 0;
+	return pmc.WorkingSetSize;
+}
+
+size_t mint::PeakMemory ()
+{
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( !GetProcessMemoryInfo ( GetCurrentProcess(), &pmc, sizeof(pmc) ) ) return 0;
+	return pmc.PeakWorkingSetSize;
+}
+
+bool mint::ResetPeakMemory ()
+{
+	return false;
+}
+
+#else
+
+// VmRSS or VmHWM from /proc/self/status, given in kB
+static size_t ProcStatus ( const char* key )
+{
+	FILE* fp = fopen ( "/proc/self/status", "r" );
+	if ( fp == 0x0 ) return 0;
+	char line[256];
+	size_t kb = 0;
+	size_t len = strlen ( key );
+	while ( fgets ( line, sizeof(line), fp ) != 0x0 ) {
+		if ( strncmp ( line, key, len ) == 0 && line[len] == ':' ) {
+			kb = (size_t) strtoul ( line + len + 1, 0x0, 10 );
+			break;
+		}
+	}
+	fclose ( fp );
+	return kb * 1024;
+}
+
+size_t mint::ResidentMemory ()
+{
+	return ProcStatus ( "VmRSS" );
+}
+
+size_t mint::PeakMemory ()
+{
+	return ProcStatus ( "VmHWM" );
+}
+
+bool mint::ResetPeakMemory ()
+{
+	FILE* fp = fopen ( "/proc/self/clear_refs", "w" );
+	if ( fp == 0x0 ) return false;
+	bool ok = fputs ( "5", fp ) >= 0;
+	if ( fclose ( fp ) != 0 ) ok = false;
+	return ok;
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef DEF_MPROFILE
+	#define DEF_MPROFILE
+
+	#include <string>
+	#include <vector>
+
+	#include "mtime.h"
+	#include "mthread.h"
+	#include "mtrace.h"
+	#include "mcounters.h"
+
+	// Phase Timing
+	//
+	// A Profiler holds a set of named phases and the durations recorded for
+	// each. The last PROFILE_WINDOW samples of a phase give rolling min, mean,
+	// p99 and max; count and total cover every sample since Reset. Recording
+	// takes a lock, so phases may be timed from any thread, e.g. meshers.
+	// While the tracer records, timers also mark their phases on the timeline.
+	// While hardware counters are on (see mcounters.h), each sample also
+	// carries the counts of the timing thread and of the pool jobs it
+	// submitted, on whichever workers ran them, and the work items it
+	// covered, e.g. particles, for IPC and misses per item.
+	//
+	//   int press = prof.AddPhase ( "pressure" );
+	//   { mint::ScopedTimer t ( prof, press );  SPH_ComputePressureGrid (); }
+
+	namespace mint {
+
+	#define PROFILE_WINDOW		512			// samples per phase in the rolling statistics
+
+	struct PhaseStats {
+		int			count;					// samples since Reset
+		double		total;					// seconds, since Reset
+		double		last;
+		int			window;					// samples in the rolling statistics
+		double		min, mean, p99, max;	// seconds, over the window
+		double		items;					// work items, since Reset
+		double		counter[COUNTER_NUM];	// since Reset, -1 if not counted
+		double		ipc;					// instructions per cycle, -1 if not counted
+		double		per_item[COUNTER_NUM];	// counter / items, -1 if not counted
+	};
+
+	class Profiler {
+	public:
+		Profiler ();
+
+		int AddPhase ( const char* name );		// index of the phase, existing or new
+		int FindPhase ( const char* name );		// -1 if none
+		int NumPhases ();
+		std::string GetName ( int phase );
+		const char* GetTraceName ( int phase );	// the name in the tracer, 0x0 if none
+
+		void SetEnabled ( bool on )		{ m_bEnabled = on; }
+		bool IsEnabled ()				{ return m_bEnabled; }
+
+		void Record ( int phase, sjtime nsec, const long long* counters = 0x0, double items = 0 );
+		void Reset ();							// drops the samples, keeps the phases
+		void GetStats ( int phase, PhaseStats& st );
+
+		// One row per phase, times in milliseconds, then the counters. Write
+		// picks JSON for a .json filename and CSV otherwise.
+		bool WriteCSV ( const char* filename );
+		bool WriteJSON ( const char* filename );
+		bool Write ( const char* filename );
+		void Print ( const char* title = 0x0 );
+
+	private:
+		struct Phase {
+			std::string			name;
+			const char*			trace;			// name interned in the tracer
+			int					count;
+			sjtime				total;
+			sjtime				last;
+			std::vector<sjtime>	ring;			// last PROFILE_WINDOW samples
+			int					next;			// ring slot of the next sample
+			double				items;
+			long long			counter[COUNTER_NUM];	// -1 until counted
+		};
+		std::vector<Phase>		m_Phases;
+		Mutex					m_Lock;
+		bool					m_bEnabled;
+	};
+
+	// Times its own scope into a phase. Costs two clock reads when the
+	// profiler is enabled, two more while tracing, and while counting two
+	// counter reads here and two around each pool job it submits.
+	class ScopedTimer {
+	public:
+		ScopedTimer ( Profiler& prof, int phase ) : m_Prof ( prof ), m_Phase ( phase ), m_Trace ( 0x0 )
+		{
+			if ( GetTracer().IsEnabled () ) {
+				m_Trace = m_Prof.GetTraceName ( phase );
+				if ( m_Trace != 0x0 ) GetTracer().Begin ( m_Trace );
+			}
+			m_Items = 0;
+			m_bCounted = false;
+			m_Sink = 0x0;
+			if ( m_Prof.IsEnabled () ) {
+				if ( GetCounters().IsEnabled () ) m_bCounted = GetCounters().Read ( m_Count );
+				if ( m_bCounted ) {
+					m_Sink = new CounterSink ( CounterScope::Current () );	// counts of the jobs this scope submits
+					m_Scope.Enter ( m_Sink );
+				}
+				m_Start.SetSystemTime ( ACC_NSEC );
+			} else
+				m_Phase = -1;
+		}
+		~ScopedTimer ()				{ Stop (); }
+
+		void Items ( double n )		{ m_Items += n; }		// work of this sample, e.g. particles
+
+		void Stop ()				// records now rather than at the end of the scope
+		{
+			if ( m_Trace != 0x0 ) {
+				GetTracer().End ( m_Trace );
+				m_Trace = 0x0;
+			}
+			if ( m_Phase < 0 ) return;
+			Time stop;
+			stop.SetSystemTime ( ACC_NSEC );
+			long long count[COUNTER_NUM], jobs[COUNTER_NUM];
+			m_Scope.Leave ();
+			if ( m_bCounted && GetCounters().Read ( count ) ) {
+				m_Sink->Get ( jobs );
+				for (int n=0; n < COUNTER_NUM; n++) {
+					count[n] = ( count[n] >= 0 && m_Count[n] >= 0 ) ? count[n] - m_Count[n] : -1;
+					if ( count[n] >= 0 && jobs[n] >= 0 ) count[n] += jobs[n];
+				}
+				m_Prof.Record ( m_Phase, stop.GetSJT() - m_Start.GetSJT(), count, m_Items );
+			} else
+				m_Prof.Record ( m_Phase, stop.GetSJT() - m_Start.GetSJT(), 0x0, m_Items );
+			if ( m_Sink != 0x0 ) m_Sink->Release ();
+			m_Sink = 0x0;
+			m_Phase = -1;
+		}
+	private:
+		Profiler&	m_Prof;
+		int			m_Phase;
+		const char*	m_Trace;
+		Time		m_Start;
+		double		m_Items;
+		bool		m_bCounted;
+		long long	m_Count[COUNTER_NUM];	// at the start
+		CounterSink*	m_Sink;				// while counting
+		CounterScope	m_Scope;
+		ScopedTimer ( const ScopedTimer& );
+		ScopedTimer& operator= ( const ScopedTimer& );
+	};
+
+	// Memory by Subsystem
+	//
+	// Resident bytes hold live data; reserved bytes are allocated whether in
+	// use or not, e.g. vector capacity or fixed-size tables. Setting an item
+	// again keeps its high-water marks, so a report updated every step holds
+	// the peaks of the run. The peaks of the total are taken as items are set.
+	struct MemoryItem {
+		std::string		name;
+		size_t			resident, reserved;
+		size_t			peak_resident, peak_reserved;
+	};
+
+	class MemoryReport {
+	public:
+		MemoryReport ();
+
+		void Set ( const char* name, size_t resident, size_t reserved );
+		void Reset ();							// drops the items and the peaks
+		int NumItems ();
+		MemoryItem GetItem ( int n );
+		MemoryItem GetTotal ();
+
+		// One row per item and a total, in bytes. Write picks JSON for a
+		// .json filename and CSV otherwise.
+		bool WriteCSV ( const char* filename );
+		bool WriteJSON ( const char* filename );
+		bool Write ( const char* filename );
+		void Print ( const char* title = 0x0 );
+
+	private:
+		std::vector<MemoryItem>	m_Items;
+		MemoryItem				m_Total;
+		Mutex					m_Lock;
+	};
+
+	// Memory of the whole process, in bytes; 0 where the OS does not say.
+	// ResetPeakMemory restarts the high-water mark (Linux only; elsewhere the
+	// peak covers the life of the process and it returns false).
+	size_t ResidentMemory ();
+	size_t PeakMemory ();
+	bool ResetPeakMemory ();
+
+	}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef DEF_MRANDOM
+	#define DEF_MRANDOM
+
+	// Seeded Random Streams
+	//
+	// A small PCG32 generator (O'Neill, pcg-random.org) in place of rand().
+	// Each generator holds its own state, so the numbers one user draws do
+	// not depend on what other users, threads or libraries draw in between,
+	// and a run repeats exactly from the same seed. Generators with the same
+	// seed and different streams give independent sequences.
+	//
+	//   mint::Random rnd ( RANDOM_SEED, RANDOM_STREAM_EMIT );
+	//   float a = rnd.Uniform ();				// [0,1)
+
+	namespace mint {
+
+	#define RANDOM_SEED				0x853c49e6748fea9bULL	// default seed of every stream
+
+	// Stream ids of the random users, one each so they stay independent
+	#define RANDOM_STREAM_ELEM		1			// GeomX::RandomElem
+	#define RANDOM_STREAM_EMIT		2			// PointSet::Emit
+
+	class Random {
+	public:
+		Random ( unsigned long long seed = RANDOM_SEED, unsigned long long stream = 0 )	{ Seed ( seed, stream ); }
+
+		void Seed ( unsigned long long seed, unsigned long long stream = 0 )
+		{
+			m_State = 0;
+			m_Inc = ( stream << 1 ) | 1;
+			Next ();
+			m_State += seed;
+			Next ();
+		}
+
+		unsigned int Next ()						// 32 uniform bits
+		{
+			unsigned long long old = m_State;
+			m_State = old * 6364136223846793005ULL + m_Inc;
+			unsigned int xorshifted = (unsigned int) ( ( ( old >> 18 ) ^ old ) >> 27 );
+			unsigned int rot = (unsigned int) ( old >> 59 );
+			return ( xorshifted >> rot ) | ( xorshifted << ( ( 32 - rot ) & 31 ) );
+		}
+
+		double Uniform ()							{ return Next () * ( 1.0 / 4294967296.0 ); }	// [0,1)
+		int Range ( int n )							{ return n > 0 ? (int) ( Uniform () * n ) : 0; }	// [0,n)
+
+	private:
+		unsigned long long	m_State;
+		unsigned long long	m_Inc;				// odd; selects the stream
+	};
+
+	}
+
+#endif
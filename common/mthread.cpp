@@ -0,0 +1,581 @@
+
+#include "mthread.h"
+#include "mtrace.h"
+#include "mcounters.h"
+
+#ifdef _MSC_VER
+	#include <process.h>
+#else
+	#ifndef _GNU_SOURCE
+		#define _GNU_SOURCE
+	#endif
+	#include <unistd.h>
+	#include <sched.h>
+#endif
+
+using namespace mint;
+
+int mint::NumProcessors ()
+{
+	#ifdef _MSC_VER
+		SYSTEM_INFO info;
+		GetSystemInfo ( &info );
+		return (int) info.dwNumberOfProcessors;
+	#else
+		long n = sysconf ( _SC_NPROCESSORS_ONLN );
+		return ( n < 1 ) ? 1 : (int) n;
+	#endif
+}
+
+bool mint::PinProcess ( int first, int count )
+{
+	if ( first < 0 || count < 1 ) return false;
+	#ifdef _MSC_VER
+		if ( first + count > (int) sizeof(DWORD_PTR) * 8 ) return false;
+		DWORD_PTR mask = 0;
+		for (int n = first; n < first + count; n++) mask |= (DWORD_PTR) 1 << n;
+		return SetProcessAffinityMask ( GetCurrentProcess (), mask ) != 0;
+	#else
+		if ( first + count > CPU_SETSIZE ) return false;
+		cpu_set_t set;
+		CPU_ZERO ( &set );
+		for (int n = first; n < first + count; n++) CPU_SET ( n, &set );
+		return sched_setaffinity ( 0, sizeof(set), &set ) == 0;
+	#endif
+}
+
+bool mint::PinThread ( int processor )
+{
+	if ( processor < 0 ) return false;
+	#ifdef _MSC_VER
+		if ( processor >= (int) sizeof(DWORD_PTR) * 8 ) return false;
+		return SetThreadAffinityMask ( GetCurrentThread (), (DWORD_PTR) 1 << processor ) != 0;
+	#else
+		if ( processor >= CPU_SETSIZE ) return false;
+		cpu_set_t set;
+		CPU_ZERO ( &set );
+		CPU_SET ( processor, &set );
+		return sched_setaffinity ( 0, sizeof(set), &set ) == 0;		// 0 is the calling thread
+	#endif
+}
+
+long mint::AtomicAdd ( volatile long* value, long delta )
+{
+	#ifdef _MSC_VER
+		return InterlockedExchangeAdd ( value, delta ) + delta;
+	#else
+		return __sync_add_and_fetch ( value, delta );
+	#endif
+}
+
+void mint::FullBarrier ()
+{
+	#ifdef _MSC_VER
+		MemoryBarrier ();
+	#else
+		__sync_synchronize ();
+	#endif
+}
+
+//------------------------------------------------------ Mutex / Condition
+
+#ifdef _MSC_VER
+
+Mutex::Mutex ()					{ InitializeCriticalSection ( &m_Handle ); }
+Mutex::~Mutex ()				{ DeleteCriticalSection ( &m_Handle ); }
+void Mutex::Lock ()				{ EnterCriticalSection ( &m_Handle ); }
+void Mutex::Unlock ()			{ LeaveCriticalSection ( &m_Handle ); }
+
+Condition::Condition ()			{ InitializeConditionVariable ( &m_Handle ); }
+Condition::~Condition ()		{ }
+void Condition::Wait ( Mutex& m )	{ SleepConditionVariableCS ( &m_Handle, &m.m_Handle, INFINITE ); }
+void Condition::Signal ()		{ WakeConditionVariable ( &m_Handle ); }
+void Condition::Broadcast ()	{ WakeAllConditionVariable ( &m_Handle ); }
+
+#else
+
+Mutex::Mutex ()					{ pthread_mutex_init ( &m_Handle, 0x0 ); }
+Mutex::~Mutex ()				{ pthread_mutex_destroy ( &m_Handle ); }
+void Mutex::Lock ()				{ pthread_mutex_lock ( &m_Handle ); }
+void Mutex::Unlock ()			{ pthread_mutex_unlock ( &m_Handle ); }
+
+Condition::Condition ()			{ pthread_cond_init ( &m_Handle, 0x0 ); }
+Condition::~Condition ()		{ pthread_cond_destroy ( &m_Handle ); }
+void Condition::Wait ( Mutex& m )	{ pthread_cond_wait ( &m_Handle, &m.m_Handle ); }
+void Condition::Signal ()		{ pthread_cond_signal ( &m_Handle ); }
+void Condition::Broadcast ()	{ pthread_cond_broadcast ( &m_Handle ); }
+
+#endif
+
+//------------------------------------------------------ Thread
+
+Thread::Thread ()
+{
+	m_Func = 0x0;
+	m_Arg = 0x0;
+	m_bRunning = false;
+}
+
+Thread::~Thread ()
+{
+	Join ();
+}
+
+#ifdef _MSC_VER
+
+unsigned __stdcall Thread::Entry ( void* self )
+{
+	Thread* t = (Thread*) self;
+	t->m_Func ( t->m_Arg );
+	return 0;
+}
+
+bool Thread::Start ( ThreadFunc func, void* arg )
+{
+	if ( m_bRunning ) return false;
+	m_Func = func;
+	m_Arg = arg;
+	m_Handle = (HANDLE) _beginthreadex ( 0x0, 0, Entry, this, 0, 0x0 );
+	m_bRunning = ( m_Handle != 0 );
+	return m_bRunning;
+}
+
+void Thread::Join ()
+{
+	if ( !m_bRunning ) return;
+	WaitForSingleObject ( m_Handle, INFINITE );
+	CloseHandle ( m_Handle );
+	m_bRunning = false;
+}
+
+#else
+
+void* Thread::Entry ( void* self )
+{
+	Thread* t = (Thread*) self;
+	t->m_Func ( t->m_Arg );
+	return 0x0;
+}
+
+bool Thread::Start ( ThreadFunc func, void* arg )
+{
+	if ( m_bRunning ) return false;
+	m_Func = func;
+	m_Arg = arg;
+	m_bRunning = ( pthread_create ( &m_Handle, 0x0, Entry, this ) == 0 );
+	return m_bRunning;
+}
+
+void Thread::Join ()
+{
+	if ( !m_bRunning ) return;
+	pthread_join ( m_Handle, 0x0 );
+	m_bRunning = false;
+}
+
+#endif
+
+//------------------------------------------------------ JobGroup
+
+JobGroup::JobGroup ()
+{
+	m_Count = 0;
+}
+
+void JobGroup::Add ()
+{
+	ScopedLock lock ( m_Lock );
+	m_Count++;
+}
+
+void JobGroup::Done ()
+{
+	ScopedLock lock ( m_Lock );
+	if ( --m_Count == 0 ) m_Finished.Broadcast ();
+}
+
+bool JobGroup::IsDone ()
+{
+	ScopedLock lock ( m_Lock );
+	return m_Count == 0;
+}
+
+void JobGroup::Wait ()
+{
+	ScopedLock lock ( m_Lock );
+	while ( m_Count > 0 )
+		m_Finished.Wait ( m_Lock );
+}
+
+//------------------------------------------------------ ThreadPool
+
+static THREAD_LOCAL void*	t_Worker = 0x0;		// ThreadPool::Worker of the calling thread
+
+ThreadPool::ThreadPool ()
+{
+	m_bStop = false;
+	m_Name = "worker";
+	m_PinFirst = -1;
+	m_Pending = 0;
+	m_Sleeping = 0;
+}
+
+ThreadPool::~ThreadPool ()
+{
+	Stop ();
+}
+
+void ThreadPool::Start ( int num )
+{
+	if ( !m_Workers.empty() ) return;
+	if ( num <= 0 ) num = NumProcessors ();
+
+	m_bStop = false;
+	for (int n=0; n < num; n++) {
+		Worker* w = new Worker;
+		w->pool = this;
+		w->index = n;
+		m_Workers.push_back ( w );
+	}
+	for (int n=0; n < num; n++)				// every deque exists before any worker steals
+		m_Workers[n]->thread.Start ( WorkerEntry, m_Workers[n] );
+}
+
+void ThreadPool::Stop ()
+{
+	m_Lock.Lock ();
+	m_bStop = true;
+	m_Ready.Broadcast ();
+	m_Lock.Unlock ();
+
+	for (int n=0; n < (int) m_Workers.size(); n++)
+		m_Workers[n]->thread.Join ();
+	for (int n=0; n < (int) m_Workers.size(); n++)
+		delete m_Workers[n];
+	m_Workers.clear ();
+}
+
+ThreadPool::Worker* ThreadPool::Current ()
+{
+	Worker* w = (Worker*) t_Worker;
+	return ( w != 0x0 && w->pool == this ) ? w : 0x0;
+}
+
+void ThreadPool::Submit ( Job* job, JobGroup* group )
+{
+	job->m_Group = group;
+	if ( group ) group->Add ();
+	job->m_Sink = CounterScope::Current ();
+	if ( job->m_Sink ) job->m_Sink->Retain ();
+
+	Worker* w = Current ();
+	if ( w != 0x0 ) {
+		ScopedLock lock ( w->lock );
+		w->jobs.push_back ( job );
+	} else {
+		ScopedLock lock ( m_QueueLock );
+		m_Queue.push_back ( job );
+	}
+	AtomicAdd ( &m_Pending, 1 );
+
+	// A worker going to sleep checks m_Pending under m_Lock, so it either
+	// sees the job or is counted in m_Sleeping here
+	ScopedLock lock ( m_Lock );
+	if ( m_Sleeping > 0 ) m_Ready.Signal ();
+}
+
+// Own deque newest first, then the shared queue and the other deques
+// oldest first, starting after self so thieves spread out
+Job* ThreadPool::TryPop ( Worker* self )
+{
+	Job* job = 0x0;
+	if ( self != 0x0 ) {
+		ScopedLock lock ( self->lock );
+		if ( !self->jobs.empty() ) {
+			job = self->jobs.back ();
+			self->jobs.pop_back ();
+		}
+	}
+	if ( job == 0x0 ) {
+		ScopedLock lock ( m_QueueLock );
+		if ( !m_Queue.empty() ) {
+			job = m_Queue.front ();
+			m_Queue.pop_front ();
+		}
+	}
+	int num = (int) m_Workers.size();
+	int first = self != 0x0 ? self->index + 1 : 0;
+	for (int n=0; n < num && job == 0x0; n++) {
+		Worker* victim = m_Workers[ (first + n) % num ];
+		if ( victim == self ) continue;
+		ScopedLock lock ( victim->lock );
+		if ( !victim->jobs.empty() ) {
+			job = victim->jobs.front ();
+			victim->jobs.pop_front ();
+		}
+	}
+	if ( job != 0x0 ) AtomicAdd ( &m_Pending, -1 );
+	return job;
+}
+
+// A job submitted under a counter sink is counted here, unless this thread
+// already counts for the sink, e.g. the timer's own thread helping in Wait.
+// The counts are in the sink before Done() lets the timer go on.
+void ThreadPool::Execute ( Job* job )
+{
+	JobGroup* group = job->m_Group;		// job may be gone once Done() fires
+	CounterSink* sink = job->m_Sink;
+	if ( sink == 0x0 ) {
+		job->Run ();
+		if ( group ) group->Done ();
+		return;
+	}
+	long long before[COUNTER_NUM], after[COUNTER_NUM];
+	bool counted = !CounterScope::IsCounting ( sink ) && GetCounters().Read ( before );
+	CounterScope scope;
+	scope.Enter ( sink );
+	job->Run ();
+	scope.Leave ();
+	if ( counted && GetCounters().Read ( after ) ) {
+		for (int n=0; n < COUNTER_NUM; n++)
+			after[n] = ( after[n] >= 0 && before[n] >= 0 ) ? after[n] - before[n] : -1;
+		sink->Add ( after );
+	}
+	sink->Release ();
+	if ( group ) group->Done ();
+}
+
+void ThreadPool::Wait ( JobGroup& group )
+{
+	Worker* self = Current ();
+	Job* job;
+	while ( !group.IsDone() ) {
+		job = TryPop ( self );
+		if ( job == 0x0 ) {					// all remaining jobs are already running
+			group.Wait ();
+			return;
+		}
+		Execute ( job );
+	}
+}
+
+int ThreadPool::NumQueued ()
+{
+	return (int) m_Pending;
+}
+
+void ThreadPool::WorkerEntry ( void* arg )
+{
+	Worker* w = (Worker*) arg;
+	w->pool->WorkerLoop ( w );
+}
+
+void ThreadPool::WorkerLoop ( Worker* w )
+{
+	Job* job;
+	t_Worker = w;
+	GetTracer().SetThreadName ( m_Name );
+	if ( m_PinFirst >= 0 ) PinThread ( ( m_PinFirst + w->index ) % NumProcessors () );
+	for (;;) {
+		job = TryPop ( w );
+		if ( job != 0x0 ) {
+			Execute ( job );
+			continue;
+		}
+		m_Lock.Lock ();
+		m_Sleeping++;
+		while ( m_Pending == 0 && !m_bStop )
+			m_Ready.Wait ( m_Lock );
+		m_Sleeping--;
+		bool done = ( m_bStop && m_Pending == 0 );		// stopping and drained
+		m_Lock.Unlock ();
+		if ( done ) return;
+	}
+}
+
+//------------------------------------------------------ ParallelFor
+
+namespace {
+	class RangeJob : public Job {
+	public:
+		virtual void Run ()		{ body->Run ( begin, end ); }
+		ParallelBody*	body;
+		int				begin, end;
+	};
+
+	class ReduceJob : public Job {
+	public:
+		virtual void Run ()		{ body->Run ( begin, end ); }
+		ReduceBody*		body;
+		int				begin, end;
+	};
+}
+
+void mint::ParallelFor ( ThreadPool* pool, int begin, int end, int grain, ParallelBody& body )
+{
+	int count = end - begin;
+	if ( count <= 0 ) return;
+	if ( grain < 1 ) grain = 1;
+	if ( pool == 0x0 || pool->NumThreads() == 0 || count <= grain ) {
+		body.Run ( begin, end );
+		return;
+	}
+
+	// A few chunks per worker so uneven chunks even out
+	int chunks = count / grain;
+	int most = pool->NumThreads() * 4;
+	if ( chunks > most ) chunks = most;
+	if ( chunks < 1 ) chunks = 1;
+
+	std::vector< RangeJob > jobs ( chunks );
+	JobGroup group;
+	for (int n=0; n < chunks; n++) {
+		jobs[n].body = &body;
+		jobs[n].begin = begin + (int) ( (long long) count * n / chunks );
+		jobs[n].end = begin + (int) ( (long long) count * (n+1) / chunks );
+		pool->Submit ( &jobs[n], &group );
+	}
+	pool->Wait ( group );
+}
+
+void mint::ParallelFor ( ThreadPool* pool, const std::vector<int>& bounds, ParallelBody& body )
+{
+	int ranges = (int) bounds.size() - 1;
+	if ( ranges < 1 ) return;
+	if ( pool == 0x0 || pool->NumThreads() == 0 || ranges == 1 ) {
+		if ( bounds[ranges] > bounds[0] ) body.Run ( bounds[0], bounds[ranges] );
+		return;
+	}
+	std::vector< RangeJob > jobs ( ranges );
+	JobGroup group;
+	for (int n=0; n < ranges; n++) {
+		if ( bounds[n+1] <= bounds[n] ) continue;
+		jobs[n].body = &body;
+		jobs[n].begin = bounds[n];
+		jobs[n].end = bounds[n+1];
+		pool->Submit ( &jobs[n], &group );
+	}
+	pool->Wait ( group );
+}
+
+void mint::ParallelReduce ( ThreadPool* pool, int begin, int end, int grain, ReduceBody& body )
+{
+	int count = end - begin;
+	if ( count <= 0 ) return;
+	if ( grain < 1 ) grain = 1;
+	int chunks = count / grain;
+	if ( chunks > REDUCE_CHUNKS ) chunks = REDUCE_CHUNKS;
+	if ( chunks < 1 ) chunks = 1;
+
+	std::vector<int> bounds ( chunks + 1 );
+	for (int n=0; n <= chunks; n++)
+		bounds[n] = begin + (int) ( (long long) count * n / chunks );
+	ParallelReduce ( pool, bounds, body );
+}
+
+void mint::ParallelReduce ( ThreadPool* pool, const std::vector<int>& bounds, ReduceBody& body )
+{
+	int chunks = (int) bounds.size() - 1;
+	if ( chunks < 1 ) return;
+
+	// The first range goes into body itself, the others into forks
+	std::vector< ReduceJob > jobs ( chunks );
+	for (int n=0; n < chunks; n++) {
+		jobs[n].body = ( n == 0 ) ? &body : body.Fork ();
+		jobs[n].begin = bounds[n];
+		jobs[n].end = bounds[n+1];
+	}
+	if ( pool == 0x0 || pool->NumThreads() == 0 || chunks == 1 ) {
+		for (int n=0; n < chunks; n++)
+			jobs[n].Run ();
+	} else {
+		JobGroup group;
+		for (int n=0; n < chunks; n++)
+			pool->Submit ( &jobs[n], &group );
+		pool->Wait ( group );
+	}
+	for (int n=1; n < chunks; n++) {
+		body.Join ( *jobs[n].body );
+		delete jobs[n].body;
+	}
+}
+
+//------------------------------------------------------ TaskGraph
+
+TaskGraph::TaskGraph ()
+{
+	m_Pool = 0x0;
+}
+
+TaskGraph::~TaskGraph ()
+{
+	Clear ();
+}
+
+void TaskGraph::Clear ()
+{
+	for (int n=0; n < (int) m_Nodes.size(); n++)
+		delete m_Nodes[n];
+	m_Nodes.clear ();
+}
+
+int TaskGraph::Add ( Job* job )
+{
+	Node* node = new Node;
+	node->graph = this;
+	node->job = job;
+	node->preds = 0;
+	node->waiting = 0;
+	m_Nodes.push_back ( node );
+	return (int) m_Nodes.size() - 1;
+}
+
+void TaskGraph::Depend ( int task, int on )
+{
+	if ( task < 0 || on < 0 || task >= (int) m_Nodes.size() || on >= (int) m_Nodes.size() ) return;
+	m_Nodes[on]->next.push_back ( task );
+	m_Nodes[task]->preds++;
+}
+
+// Submits the tasks this one was the last to hold back. Their group count
+// goes up before this task's goes down, so Wait cannot return early.
+void TaskGraph::Node::Run ()
+{
+	job->Run ();
+	for (int n=0; n < (int) next.size(); n++) {
+		Node* succ = graph->m_Nodes[ next[n] ];
+		if ( AtomicAdd ( &succ->waiting, -1 ) == 0 )
+			graph->m_Pool->Submit ( succ, &graph->m_Group );
+	}
+}
+
+bool TaskGraph::Run ( ThreadPool* pool )
+{
+	// Topological order, which also finds cycles
+	int num = (int) m_Nodes.size();
+	std::vector<int> order, waiting ( num );
+	for (int n=0; n < num; n++) {
+		waiting[n] = m_Nodes[n]->preds;
+		if ( waiting[n] == 0 ) order.push_back ( n );
+	}
+	for (int k=0; k < (int) order.size(); k++) {
+		const std::vector<int>& next = m_Nodes[ order[k] ]->next;
+		for (int n=0; n < (int) next.size(); n++)
+			if ( --waiting[ next[n] ] == 0 ) order.push_back ( next[n] );
+	}
+	if ( (int) order.size() < num ) return false;
+
+	if ( pool == 0x0 || pool->NumThreads() == 0 ) {
+		for (int k=0; k < num; k++)
+			m_Nodes[ order[k] ]->job->Run ();
+		return true;
+	}
+	m_Pool = pool;
+	for (int n=0; n < num; n++)
+		m_Nodes[n]->waiting = m_Nodes[n]->preds;
+	for (int n=0; n < num; n++)
+		if ( m_Nodes[n]->preds == 0 ) pool->Submit ( m_Nodes[n], &m_Group );
+	pool->Wait ( m_Group );
+	m_Pool = 0x0;
+	return true;
+}
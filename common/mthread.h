@@ -0,0 +1,298 @@
+#ifndef DEF_MTHREAD
+	#define DEF_MTHREAD
+
+	#include <deque>
+	#include <vector>
+
+	#ifdef _MSC_VER
+		#include <windows.h>			// CONDITION_VARIABLE needs Vista or later
+	#else
+		#include <pthread.h>
+	#endif
+
+	// Threading Primitives
+	//
+	// Thin wrappers over Win32 and pthreads so the simulation, the surface
+	// mesher and the writers can run work off the main (GLUT) thread without
+	// depending on a compiler newer than VS2008.
+
+	// Storage of its own in every thread, for plain data only
+	#ifdef _MSC_VER
+		#define THREAD_LOCAL	__declspec(thread)
+	#else
+		#define THREAD_LOCAL	__thread
+	#endif
+
+	namespace mint {
+
+	int NumProcessors ();
+
+	// Restricts the process to processors [first, first+count). On Linux
+	// this binds the calling thread, and the threads it starts after, so call
+	// it before starting any pool.
+	bool PinProcess ( int first, int count );
+	bool PinThread ( int processor );			// binds the calling thread alone
+
+	// Adds delta to value in one step, as seen by every thread, and returns
+	// the sum. A full memory barrier.
+	long AtomicAdd ( volatile long* value, long delta );
+
+	// Full memory barrier: no load or store moves across it, by the
+	// compiler or the processor, e.g. between filling a record and
+	// publishing the index that makes it visible.
+	void FullBarrier ();
+
+	class Mutex {
+	public:
+		Mutex ();
+		~Mutex ();
+		void Lock ();
+		void Unlock ();
+	private:
+		friend class Condition;
+		#ifdef _MSC_VER
+			CRITICAL_SECTION	m_Handle;
+		#else
+			pthread_mutex_t		m_Handle;
+		#endif
+		Mutex ( const Mutex& );
+		Mutex& operator= ( const Mutex& );
+	};
+
+	class ScopedLock {
+	public:
+		ScopedLock ( Mutex& m ) : m_Mutex ( m )	{ m_Mutex.Lock (); }
+		~ScopedLock ()							{ m_Mutex.Unlock (); }
+	private:
+		Mutex&		m_Mutex;
+	};
+
+	class Condition {
+	public:
+		Condition ();
+		~Condition ();
+		void Wait ( Mutex& m );					// m must be locked by the caller
+		void Signal ();
+		void Broadcast ();
+	private:
+		#ifdef _MSC_VER
+			CONDITION_VARIABLE	m_Handle;
+		#else
+			pthread_cond_t		m_Handle;
+		#endif
+	};
+
+	typedef void (*ThreadFunc) ( void* arg );
+
+	class Thread {
+	public:
+		Thread ();
+		~Thread ();
+		bool Start ( ThreadFunc func, void* arg );
+		void Join ();
+		bool IsRunning ()			{ return m_bRunning; }
+	private:
+		ThreadFunc		m_Func;
+		void*			m_Arg;
+		bool			m_bRunning;
+		#ifdef _MSC_VER
+			HANDLE			m_Handle;
+			static unsigned __stdcall Entry ( void* self );
+		#else
+			pthread_t		m_Handle;
+			static void* Entry ( void* self );
+		#endif
+	};
+
+	// Counts outstanding jobs so a caller can wait for a batch of them.
+	class JobGroup {
+	public:
+		JobGroup ();
+		void Add ();
+		void Done ();
+		bool IsDone ();
+		void Wait ();
+	private:
+		Mutex		m_Lock;
+		Condition	m_Finished;
+		int			m_Count;
+	};
+
+	class CounterSink;						// mcounters.h
+
+	// Unit of work handed to a ThreadPool. The pool does not own jobs;
+	// whoever submits one keeps it alive until Run() has returned.
+	class Job {
+	public:
+		Job () : m_Group ( 0x0 ), m_Sink ( 0x0 )	{}
+		virtual ~Job ()		{}
+		virtual void Run () = 0;
+	private:
+		friend class ThreadPool;
+		JobGroup*		m_Group;
+		CounterSink*	m_Sink;				// of the submitting thread, while counting
+	};
+
+	// Fixed set of worker threads, each with its own deque of jobs. A job
+	// submitted from a worker goes on that worker's deque, one submitted
+	// from any other thread on a shared queue. A worker runs the newest job
+	// of its own deque first, so nested work stays in its cache; when that
+	// is empty it takes the oldest job of the shared queue, then steals the
+	// oldest of another worker's. Idle workers sleep until a job arrives.
+	//
+	// One pool can serve the simulation passes, the mesher and the encoders
+	// at once (see SurfacePipeline::SetPool), rather than each starting its
+	// own threads and oversubscribing the processors.
+	class ThreadPool {
+	public:
+		ThreadPool ();
+		~ThreadPool ();
+
+		void Start ( int num );					// num <= 0 starts one worker per processor
+		void Stop ();							// finishes queued jobs, then joins
+		int NumThreads ()				{ return (int) m_Workers.size(); }
+		void SetName ( const char* name )	{ m_Name = name; }	// of the workers on the timeline, see mtrace.h; before Start
+
+		// Binds worker n to processor first + n, wrapping around the
+		// processors; -1, the default, leaves them free. Before Start.
+		void SetPinning ( int first )	{ m_PinFirst = first; }
+
+		void Submit ( Job* job, JobGroup* group = 0x0 );
+		int NumQueued ();
+
+		// Waits for every job of the group, running queued jobs on the
+		// calling thread meanwhile. Safe to call from inside a job.
+		void Wait ( JobGroup& group );
+
+	private:
+		struct Worker {
+			ThreadPool*			pool;
+			int					index;
+			Thread				thread;
+			std::deque< Job* >	jobs;			// newest at the back
+			Mutex				lock;
+		};
+		static void WorkerEntry ( void* arg );
+		void WorkerLoop ( Worker* w );
+		Worker* Current ();						// the calling thread if it is one of ours
+		Job* TryPop ( Worker* self );
+		static void Execute ( Job* job );
+
+		std::vector< Worker* >	m_Workers;
+		std::deque< Job* >		m_Queue;		// submitted from other threads
+		Mutex					m_QueueLock;
+		const char*				m_Name;
+		int						m_PinFirst;
+		volatile long			m_Pending;		// jobs queued anywhere
+		Mutex					m_Lock;			// guards the rest, for sleeping
+		Condition				m_Ready;
+		int						m_Sleeping;
+		bool					m_bStop;
+	};
+
+
+	// Body of a ParallelFor: called with disjoint [begin,end) subranges,
+	// possibly from several threads at once.
+	class ParallelBody {
+	public:
+		virtual ~ParallelBody ()	{}
+		virtual void Run ( int begin, int end ) = 0;
+	};
+
+	// Splits [begin,end) into chunks of at least grain items and runs them
+	// on the pool. Runs serially when pool is null or not started.
+	void ParallelFor ( ThreadPool* pool, int begin, int end, int grain, ParallelBody& body );
+
+	// Runs each range [bounds[k], bounds[k+1]) as one job, e.g. ranges of
+	// equal cost from PartitionByCost.
+	void ParallelFor ( ThreadPool* pool, const std::vector<int>& bounds, ParallelBody& body );
+
+	// Splits [0,num) into ranges of about equal cost, item i costing
+	// base + cost[i], by a prefix sum of the costs. bounds gets ranges+1
+	// entries, 0 first and num last; a costly item may leave a range empty.
+	template <class T>
+	void PartitionByCost ( const T* cost, int num, double base, int ranges, std::vector<int>& bounds )
+	{
+		if ( ranges < 1 ) ranges = 1;
+		double total = 0;
+		for (int i=0; i < num; i++) total += base + cost[i];
+		bounds.resize ( ranges + 1 );
+		bounds[0] = 0;
+		double sum = 0;
+		int i = 0;
+		for (int k=1; k < ranges; k++) {
+			double target = total * k / ranges;
+			while ( i < num && sum + ( base + cost[i] ) * 0.5 < target )	// past the item's middle
+				sum += base + cost[i++];
+			bounds[k] = i;
+		}
+		bounds[ranges] = num;
+	}
+
+	// Body of a ParallelReduce. Run accumulates [begin,end) into the body;
+	// Fork makes an empty body of the same reduction, for another range;
+	// Join adds in the result of a body that covered the ranges just after
+	// this one's.
+	class ReduceBody {
+	public:
+		virtual ~ReduceBody ()	{}
+		virtual ReduceBody* Fork () = 0;
+		virtual void Run ( int begin, int end ) = 0;
+		virtual void Join ( ReduceBody& later ) = 0;
+	};
+
+	#define REDUCE_CHUNKS		64			// most ranges of a ParallelReduce
+
+	// Splits [begin,end) into ranges of at least grain items, reduces them on
+	// the pool and joins them into body in index order. The ranges depend on
+	// the count and grain alone, so even a floating point sum comes out the
+	// same for any number of workers, or none.
+	void ParallelReduce ( ThreadPool* pool, int begin, int end, int grain, ReduceBody& body );
+
+	// The same over the ranges [bounds[k], bounds[k+1]), joined in order.
+	// Unless the reduction is exact, e.g. of integers, the result now
+	// depends on the bounds.
+	void ParallelReduce ( ThreadPool* pool, const std::vector<int>& bounds, ReduceBody& body );
+
+	// Jobs with dependencies, each run on the pool once every job it
+	// depends on has finished. The graph does not own the jobs and can be
+	// run again.
+	//
+	//   mint::TaskGraph g;
+	//   int field = g.Add ( &fieldJob ), march = g.Add ( &marchJob );
+	//   g.Depend ( march, field );				// march after field
+	//   g.Run ( &pool );
+	class TaskGraph {
+	public:
+		TaskGraph ();
+		~TaskGraph ();
+
+		int Add ( Job* job );					// returns the task's id
+		void Depend ( int task, int on );		// task runs after on
+		void Clear ();
+
+		// Returns when every task has run; serially, in an order the
+		// dependencies allow, if pool is null or not started. False, with
+		// nothing run, if the dependencies form a cycle.
+		bool Run ( ThreadPool* pool );
+
+	private:
+		class Node : public Job {
+		public:
+			virtual void Run ();
+			TaskGraph*			graph;
+			Job*				job;
+			std::vector<int>	next;			// tasks that depend on this one
+			int					preds;
+			volatile long		waiting;		// preds not yet finished, while running
+		};
+		std::vector<Node*>		m_Nodes;
+		ThreadPool*				m_Pool;
+		JobGroup				m_Group;
+		TaskGraph ( const TaskGraph& );
+		TaskGraph& operator= ( const TaskGraph& );
+	};
+
+	}
+
+#endif
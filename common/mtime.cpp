@@ -17,6 +17,8 @@
 	#pragma comment ( lib, "winmm.lib" )
 	LARGE_INTEGER	m_BaseCount;
 	LARGE_INTEGER	m_BaseFreq;
+#else
+	sjtime			m_BaseCount;				// CLOCK_MONOTONIC, nanoseconds
 #endif
 
 using namespace mint;
@@ -38,6 +40,9 @@ void mint::start_timing ( sjtime base )
 		struct timeval tv;
 		gettimeofday(&tv, NULL);
 		m_BaseTicks = ((sjtime) tv.tv_sec * 1000000LL) + (sjtime) tv.tv_usec;		
+		struct timespec ts;
+		clock_gettime ( CLOCK_MONOTONIC, &ts );
+		m_BaseCount = ((sjtime) ts.tv_sec * SEC_SCALAR) + (sjtime) ts.tv_nsec;
 	#endif
 }
 
@@ -63,7 +68,9 @@ void Time::SetSystemTime ( int accuracy )
 			QueryPerformanceCounter ( &currCount );
 			m_CurrTime = m_BaseTime + sjtime( (double(currCount.QuadPart-m_BaseCount.QuadPart) / m_BaseFreq.QuadPart) * SEC_SCALAR);
 		#else
-			debug.Printf ( "mtime", "ERROR: ACC_NSEC NOT IMPLEMENTED for Time::SetSystemTime\n" );
+			struct timespec ts;
+			clock_gettime ( CLOCK_MONOTONIC, &ts );
+			m_CurrTime = m_BaseTime + ( ((sjtime) ts.tv_sec * SEC_SCALAR) + (sjtime) ts.tv_nsec - m_BaseCount );
 		#endif
 		} break;	
 	}
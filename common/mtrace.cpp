@@ -0,0 +1,152 @@
+#include <stdio.h>
+
+#include "mtrace.h"
+
+using namespace mint;
+
+// The ring of the calling thread, and its name until the ring exists
+static THREAD_LOCAL void*		t_Ring = 0x0;
+static THREAD_LOCAL const char*	t_Name = 0x0;
+
+Tracer& mint::GetTracer ()
+{
+	static Tracer tracer;					// first used while static objects are built, before any thread
+	return tracer;
+}
+
+Tracer::Tracer ()
+{
+	m_bEnabled = false;
+	m_Capacity = TRACE_EVENTS;
+	m_Start.SetSystemTime ( ACC_NSEC );
+}
+
+Tracer::~Tracer ()
+{
+	m_bEnabled = false;
+	for (int n=0; n < (int) m_Rings.size(); n++)
+		delete m_Rings[n];
+}
+
+void Tracer::SetEnabled ( bool on )
+{
+	m_bEnabled = on;
+}
+
+void Tracer::SetThreadName ( const char* name )
+{
+	t_Name = name;
+	Ring* r = (Ring*) t_Ring;
+	if ( r != 0x0 ) {
+		ScopedLock lock ( m_Lock );
+		r->name = name;
+	}
+}
+
+const char* Tracer::Intern ( const std::string& name )
+{
+	ScopedLock lock ( m_Lock );
+	return m_Names.insert ( name ).first->c_str();
+}
+
+Tracer::Ring* Tracer::Register ()
+{
+	Ring* r = new Ring;
+	r->events.resize ( m_Capacity );
+	r->head = 0;
+	r->name = t_Name;
+	{
+		ScopedLock lock ( m_Lock );
+		r->tid = (int) m_Rings.size() + 1;
+		m_Rings.push_back ( r );
+	}
+	t_Ring = r;
+	return r;
+}
+
+// Only the owning thread writes a ring. The barrier keeps the event's
+// stores ahead of the store to head that publishes it; Write loads head
+// and then reads only the events before it.
+void Tracer::Record ( const char* name, char type )
+{
+	Ring* r = (Ring*) t_Ring;
+	if ( r == 0x0 ) r = Register ();
+	Time now;
+	now.SetSystemTime ( ACC_NSEC );
+	unsigned int n = r->head;
+	Event& e = r->events[n % r->events.size()];
+	e.time = now.GetSJT() - m_Start.GetSJT();
+	e.name = name;
+	e.type = type;
+	FullBarrier ();
+	r->head = n + 1;
+}
+
+void Tracer::Clear ()
+{
+	ScopedLock lock ( m_Lock );
+	for (int n=0; n < (int) m_Rings.size(); n++)
+		m_Rings[n]->head = 0;
+}
+
+static void WriteString ( FILE* fp, const char* s )
+{
+	fputc ( '"', fp );
+	for ( ; *s != '\0'; s++ ) {
+		if ( *s == '"' || *s == '\\' ) fputc ( '\\', fp );
+		if ( (unsigned char) *s >= ' ' ) fputc ( *s, fp );
+	}
+	fputc ( '"', fp );
+}
+
+bool Tracer::Write ( const char* filename )
+{
+	FILE* fp = fopen ( filename, "w" );
+	if ( fp == 0x0 ) return false;
+	fprintf ( fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	fprintf ( fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"melt\"}}" );
+
+	ScopedLock lock ( m_Lock );
+	for (int n=0; n < (int) m_Rings.size(); n++) {
+		Ring* r = m_Rings[n];
+		char buf[32];
+		sprintf ( buf, "thread %d", r->tid );
+		fprintf ( fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", r->tid );
+		WriteString ( fp, r->name != 0x0 ? r->name : buf );
+		fprintf ( fp, "}}" );
+		fprintf ( fp, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", r->tid, r->tid );
+
+		// The events in the ring, copied out between two loads of head: a
+		// thread still recording may overwrite the oldest while they are
+		// copied, so those the second load shows were reached are dropped
+		unsigned int head = r->head;
+		FullBarrier ();
+		unsigned int size = (unsigned int) r->events.size();
+		unsigned int first = head > size ? head - size : 0;
+		std::vector<Event> events;
+		for (unsigned int k = first; k < head; k++)
+			events.push_back ( r->events[k % size] );
+		FullBarrier ();
+		unsigned int now = r->head;
+		unsigned int kept = now > size ? now - size : 0;
+		if ( kept < first ) kept = first;
+
+		// An end whose begin was overwritten is dropped so the viewer nests
+		// the rest correctly
+		int depth = 0;
+		for (unsigned int k = kept; k < head; k++) {
+			const Event& e = events[k - first];
+			if ( e.type == 'E' ) {
+				if ( depth == 0 ) continue;
+				depth--;
+			} else {
+				depth++;
+			}
+			fprintf ( fp, ",\n{\"name\":" );
+			WriteString ( fp, e.name );
+			fprintf ( fp, ",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", e.type, r->tid, e.time / 1000.0 );
+		}
+	}
+	fprintf ( fp, "\n]}\n" );
+	return fclose ( fp ) == 0;
+}
@@ -0,0 +1,97 @@
+#ifndef DEF_MTRACE
+	#define DEF_MTRACE
+
+	#include <string>
+	#include <vector>
+	#include <set>
+
+	#include "mtime.h"
+	#include "mthread.h"
+
+	// Event Timeline
+	//
+	// Begin and end events of phases, slabs and writes, per thread, for a
+	// timeline viewer (chrome://tracing or ui.perfetto.dev). Each thread
+	// records into its own ring of the last TRACE_EVENTS events, without
+	// locks; a lock is taken once, when a thread records its first event.
+	// Write saves every ring as Chrome trace JSON. Recording is off until
+	// SetEnabled, and then costs a clock read per event.
+	//
+	// Every ScopedTimer of a Profiler records its phase; other spans use
+	// ScopedTrace with a name that lives as long as the process, e.g. a
+	// literal or a name from Intern.
+	//
+	//   mint::GetTracer().SetEnabled ( true );
+	//   { mint::ScopedTrace t ( "slab" );  ... }
+	//   mint::GetTracer().Write ( "melt_trace.json" );
+
+	namespace mint {
+
+	#define TRACE_EVENTS		65536		// events kept per thread, the oldest are overwritten
+
+	class Tracer {
+	public:
+		Tracer ();
+		~Tracer ();
+
+		void SetEnabled ( bool on );
+		bool IsEnabled ()				{ return m_bEnabled; }
+		void SetCapacity ( int events )	{ m_Capacity = events > 0 ? events : 1; }	// for threads that have not recorded yet
+
+		// Names the calling thread's row, e.g. "mesher"; name must outlive the tracer
+		void SetThreadName ( const char* name );
+		const char* Intern ( const std::string& name );		// a copy that lives as long as the tracer
+
+		void Begin ( const char* name )	{ if ( m_bEnabled ) Record ( name, 'B' ); }
+		void End ( const char* name )	{ if ( m_bEnabled ) Record ( name, 'E' ); }
+
+		// Chrome trace JSON of every thread's events so far. Events being
+		// recorded while this runs may be left out.
+		bool Write ( const char* filename );
+		void Clear ();							// drops the events; call while no thread records
+
+	private:
+		struct Event {
+			sjtime			time;				// since the tracer started, ns
+			const char*		name;
+			char			type;				// 'B' or 'E'
+		};
+		struct Ring {
+			std::vector<Event>		events;
+			volatile unsigned int	head;		// events recorded; slot head % size is next
+			int						tid;
+			const char*				name;
+		};
+
+		void Record ( const char* name, char type );
+		Ring* Register ();
+
+		std::vector<Ring*>		m_Rings;
+		std::set<std::string>	m_Names;
+		Mutex					m_Lock;
+		Time					m_Start;
+		volatile bool			m_bEnabled;
+		int						m_Capacity;
+	};
+
+	// The tracer of the process, shared by every Profiler
+	Tracer& GetTracer ();
+
+	// Records its own scope. Nothing but a flag test while tracing is off.
+	class ScopedTrace {
+	public:
+		ScopedTrace ( const char* name ) : m_Name ( 0x0 )
+		{
+			Tracer& tr = GetTracer ();
+			if ( tr.IsEnabled () ) { m_Name = name; tr.Begin ( name ); }
+		}
+		~ScopedTrace ()				{ if ( m_Name != 0x0 ) GetTracer().End ( m_Name ); }
+	private:
+		const char*	m_Name;
+		ScopedTrace ( const ScopedTrace& );
+		ScopedTrace& operator= ( const ScopedTrace& );
+	};
+
+	}
+
+#endif
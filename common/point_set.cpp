@@ -20,7 +20,9 @@
   3. This notice may not be removed or altered from any source distribution.
 */
 
-#include "gl_helper.h"
+#ifndef NO_GL
+	#include "gl_helper.h"
+#endif
 
 #include "point_set.h"
 
@@ -30,9 +32,16 @@ PointSet::PointSet ()
 {	
 	m_GridRes.Set ( 0, 0, 0 );
 	m_pcurr = -1;
+	SetSeed ( RANDOM_SEED );
 	Reset ();
 }
 
+void PointSet::SetSeed ( unsigned long long seed )
+{
+	GeomX::SetSeed ( seed );
+	m_EmitRandom.Seed ( seed, RANDOM_STREAM_EMIT );
+}
+
 int PointSet::GetGridCell ( int x, int y, int z )
 {
 	return (int) ( (z*m_GridRes.y + y)*m_GridRes.x + x);
@@ -64,6 +73,25 @@ unsigned short* PointSet::getNeighborTable ( int n, int& cnt )
 	return &m_Neighbor[n][0];
 }
 
+void PointSet::GetMemory ( mint::MemoryReport& rep )
+{
+	size_t resident = mAttribute.size() * sizeof(GeomAttr);
+	size_t reserved = mAttribute.capacity() * sizeof(GeomAttr);
+	for (int n=0; n < (int) mBuf.size(); n++) {
+		resident += (size_t) mBuf[n].num * mBuf[n].stride;
+		reserved += (size_t) mBuf[n].max * mBuf[n].stride;
+	}
+	resident += (size_t) mHeapNum * sizeof(hval);
+	reserved += (size_t) mHeapMax * sizeof(hval);
+	rep.Set ( "particles", resident, reserved );
+
+	size_t row = sizeof(m_NC[0]) + sizeof(m_Neighbor[0]) + sizeof(m_NDist[0]);
+	rep.Set ( "neighbor table", NumPoints() * row, sizeof(m_NC) + sizeof(m_Neighbor) + sizeof(m_NDist) );
+
+	rep.Set ( "spatial grid", ( m_Grid.size() + m_GridCnt.size() ) * sizeof(int),
+			  ( m_Grid.capacity() + m_GridCnt.capacity() ) * sizeof(int) );
+}
+
 float PointSet::GetValue ( float x, float y, float z )
 {
 	float dx, dy, dz, dsq;
@@ -253,6 +281,7 @@ void PointSet::AddVolume ( Vector3DF min, Vector3DF max, float spacing )
 
 void PointSet::Draw ( float* view_mat, float rad )
 {
+#ifndef NO_GL
 	char* dat;
 	Point* p;
 	glEnable ( GL_NORMALIZE );	
@@ -282,6 +311,7 @@ void PointSet::Draw ( float* view_mat, float rad )
 		}
 		glEnd ();
 	}
+#endif
 }
 
 void PointSet::Emit ( float spacing )
@@ -294,8 +324,8 @@ void PointSet::Emit ( float spacing )
 	int x = (int) sqrt(m_Vec[EMIT_RATE].y);
 
 	for ( int n = 0; n < m_Vec[EMIT_RATE].y; n++ ) {
-		ang_rand = (float(rand()*2.0/RAND_MAX) - 1.0) * m_Vec[EMIT_SPREAD].x;
-		tilt_rand = (float(rand()*2.0/RAND_MAX) - 1.0) * m_Vec[EMIT_SPREAD].y;
+		ang_rand = (float(m_EmitRandom.Uniform()*2.0) - 1.0) * m_Vec[EMIT_SPREAD].x;
+		tilt_rand = (float(m_EmitRandom.Uniform()*2.0) - 1.0) * m_Vec[EMIT_SPREAD].y;
 		dir.x = cos ( ( m_Vec[EMIT_ANG].x + ang_rand) * DEGtoRAD ) * sin( ( m_Vec[EMIT_ANG].y + tilt_rand) * DEGtoRAD ) * m_Vec[EMIT_ANG].z;
 		dir.y = sin ( ( m_Vec[EMIT_ANG].x + ang_rand) * DEGtoRAD ) * sin( ( m_Vec[EMIT_ANG].y + tilt_rand) * DEGtoRAD ) * m_Vec[EMIT_ANG].z;
 		dir.z = cos ( ( m_Vec[EMIT_ANG].y + tilt_rand) * DEGtoRAD ) * m_Vec[EMIT_ANG].z;
@@ -421,6 +451,7 @@ void PointSet::Grid_Draw ( float* view_mat )
 	float x2, y2, z2;
 	int g = 0;
 
+#ifndef NO_GL
 	glLoadMatrixf ( view_mat );
 	glColor3f ( 0.7, 0.7, 0.7 );
 
@@ -459,6 +490,7 @@ void PointSet::Grid_Draw ( float* view_mat )
 	//}
 
 	glEnd ();
+#endif
 }
 
 void PointSet::Grid_InsertParticles ()
@@ -494,6 +526,40 @@ void PointSet::Grid_InsertParticles ()
 	}
 }
 
+void PointSet::Grid_FindCells ( Vector3DF p, float radius, int* cells ) const
+{
+	Vector3DI sph_min;
+
+	sph_min.x = (int)((-radius + p.x - m_GridMin.x) * m_GridDelta.x);
+	sph_min.y = (int)((-radius + p.y - m_GridMin.y) * m_GridDelta.y);
+	sph_min.z = (int)((-radius + p.z - m_GridMin.z) * m_GridDelta.z);
+	if ( sph_min.x < 0 ) sph_min.x = 0;
+	if ( sph_min.y < 0 ) sph_min.y = 0;
+	if ( sph_min.z < 0 ) sph_min.z = 0;
+
+	cells[0] = (int)((sph_min.z * m_GridRes.y + sph_min.y) * m_GridRes.x + sph_min.x);
+	cells[1] = cells[0] + 1;
+	cells[2] = (int)(cells[0] + m_GridRes.x);
+	cells[3] = cells[2] + 1;
+
+	if ( sph_min.z+1 < m_GridRes.z ) {
+		cells[4] = (int)(cells[0] + m_GridRes.y*m_GridRes.x);
+		cells[5] = cells[4] + 1;
+		cells[6] = (int)(cells[4] + m_GridRes.x);
+		cells[7] = cells[6] + 1;
+	} else {
+		cells[4] = cells[5] = cells[6] = cells[7] = -1;
+	}
+	if ( sph_min.x+1 >= m_GridRes.x ) {
+		cells[1] = -1;		cells[3] = -1;
+		cells[5] = -1;		cells[7] = -1;
+	}
+	if ( sph_min.y+1 >= m_GridRes.y ) {
+		cells[2] = -1;		cells[3] = -1;
+		cells[6] = -1;		cells[7] = -1;
+	}
+}
+
 int PointSet::Grid_FindCell ( Vector3DF p )
 {
 	int gc;
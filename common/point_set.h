@@ -32,10 +32,12 @@
 	#include "common_defs.h"
 	#include "geomx.h"
 	#include "vector.h"	
+	#include "mprofile.h"
 
 	typedef signed int		xref;
 	
 	#define MAX_NEIGHBOR		80
+	#define MAX_NEIGHBOR_ROWS	65536		// particles the neighbor table has rows for
 	
 	#define MAX_PARAM			21
 
@@ -99,6 +101,7 @@
 		virtual void Run ();
 		virtual void Advance ();		
 		virtual void Emit ( float spacing );			
+		void SetSeed ( unsigned long long seed );		// restarts the random streams of Emit and RandomElem
 
 		// Misc
 		virtual void AddVolume ( Vector3DF min, Vector3DF max, float spacing );
@@ -113,6 +116,7 @@
 		bool GetToggle ( int p )			{ return m_Toggle[p]; }
 
 		float GetDT()						{ return (float) m_DT; }
+		double GetTime()					{ return m_Time; }
 
 		// Spatial Subdivision
 		void Grid_Setup ( Vector3DF min, Vector3DF max, float sim_scale, float cell_size, float border );		
@@ -120,6 +124,7 @@
 		void Grid_InsertParticles ();	
 		void Grid_Draw ( float* view_mat );		
 		void Grid_FindCells ( Vector3DF p, float radius );
+		void Grid_FindCells ( Vector3DF p, float radius, int* cells ) const;	// into cells[8], -1 for none; safe from any thread
 		int Grid_FindCell ( Vector3DF p );
 		Vector3DF GetGridRes ()		{ return m_GridRes; }
 		Vector3DF GetGridMin ()		{ return m_GridMin; }
@@ -130,6 +135,11 @@
 		Point* nextGridParticle ( int& p );
 		unsigned short* getNeighborTable ( int n, int& cnt );
 
+		// Sets "particles", "neighbor table" and "spatial grid" in rep. The
+		// neighbor table is reserved in full; rows past NumPoints are never
+		// touched, so only the used rows count as resident.
+		void GetMemory ( mint::MemoryReport& rep );
+
 	protected:
 		int							m_Frame;		
 
@@ -141,6 +151,7 @@
 		// Particle System
 		double						m_DT;
 		double						m_Time;
+		mint::Random				m_EmitRandom;			// spread of Emit
 
 		// Spatial Grid
 		std::vector< int >			m_Grid;
@@ -155,9 +166,9 @@
 		int							m_GridCell[27];
 
 		// Neighbor Table
-		unsigned short				m_NC[65536];			// neighbor table (600k)
-		unsigned short				m_Neighbor[65536][MAX_NEIGHBOR];	
-		float						m_NDist[65536][MAX_NEIGHBOR];
+		unsigned short				m_NC[MAX_NEIGHBOR_ROWS];			// neighbor table (600k)
+		unsigned short				m_Neighbor[MAX_NEIGHBOR_ROWS][MAX_NEIGHBOR];	
+		float						m_NDist[MAX_NEIGHBOR_ROWS][MAX_NEIGHBOR];
 
 		static int m_pcurr;
 	};
@@ -0,0 +1,70 @@
+// Compact file format for voxelized models (.vxc)
+//
+// The file begins with a voxelcompact_header. Occupancy follows as runs:
+// the grid is split into rows along i, one row per (j,k), stored in order
+// of k, then j. Each row is a sequence of unsigned LEB128 run lengths that
+// alternate empty, occupied, empty, ... starting with an empty run (which
+// may be zero). Runs stop once they cover voxel_resolution[0]; a trailing
+// empty run is left out, so an empty row takes no bytes at all.
+//
+// A table of (rows + 1) unsigned ints gives each row's start within the
+// run data, so rows can be decoded independently.
+//
+// Optional side channels list one value per occupied voxel, in the same
+// order the runs visit them:
+//   VOXELCOMPACT_DISTANCE   float distance_to_surface
+//   VOXELCOMPACT_BORDER     one bit is_on_border, least significant first
+//
+// All offsets are in bytes from the start of the file. All data is aligned
+// to one byte (no padding) and little-endian.
+
+#ifndef _VOXEL_COMPACT_FORMAT_H_
+#define _VOXEL_COMPACT_FORMAT_H_
+
+#define VOXELCOMPACT_MAGIC		"VXC1"
+#define VOXELCOMPACT_VERSION	1
+
+// Side channel flags
+#define VOXELCOMPACT_DISTANCE	0x1
+#define VOXELCOMPACT_BORDER		0x2
+
+#pragma pack(push)
+#pragma pack(1)
+
+struct voxelcompact_header {
+
+  // VOXELCOMPACT_MAGIC, not null terminated
+  char magic[4];
+
+  int version;
+
+  // Size of this structure
+  int header_size;
+
+  // VOXELCOMPACT_* flags of the side channels present
+  int channels;
+
+  // Same meaning as in voxelfile_object_header
+  int num_voxels;
+  int voxel_resolution[3];
+  float voxel_size[3];
+  float model_scale_factor;
+  float model_offset[3];
+  float zero_coordinate[3];
+
+  // Row start table: voxel_resolution[1]*voxel_resolution[2] + 1 entries,
+  // relative to runs_offset
+  unsigned int rows_offset;
+
+  unsigned int runs_offset;
+  unsigned int runs_size;
+
+  // Side channels, 0 when absent
+  unsigned int distance_offset;
+  unsigned int border_offset;
+
+};
+
+#pragma pack(pop)
+
+#endif
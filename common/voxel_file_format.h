@@ -34,6 +34,11 @@
 #define _VOXEL_FILE_FORMAT_H_
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifndef _MAX_PATH
+#define _MAX_PATH 260		// Windows value; the file layout depends on it
+#endif
 
 // No voxel at this coordinate
 #define ASCIIVOXEL_NOVOXEL '0'
@@ -0,0 +1,155 @@
+#include <stdio.h>
+
+#ifdef _MSC_VER
+	#include <windows.h>
+#endif
+
+#include "checkpoint.h"
+#include "fluid_system.h"
+#include "mtrace.h"
+#include "mfile.h"
+
+bool WriteCheckpointFile ( const char* filename, const std::vector<char>& image )
+{
+	mint::ScopedTrace t ( "checkpoint write" );
+	std::string tmp = std::string ( filename ) + ".tmp";
+	FILE* fp = fopen ( tmp.c_str(), "wb" );
+	if ( fp == 0x0 ) {
+		printf ( "Checkpoint: cannot open %s for writing.\n", tmp.c_str() );
+		return false;
+	}
+	bool ok = image.empty() || fwrite ( &image[0], 1, image.size(), fp ) == image.size();
+	if ( fclose ( fp ) != 0 ) ok = false;
+	if ( !ok ) {
+		printf ( "Checkpoint: error writing %s.\n", tmp.c_str() );
+		remove ( tmp.c_str() );
+		return false;
+	}
+	#ifdef _MSC_VER
+		ok = MoveFileExA ( tmp.c_str(), filename, MOVEFILE_REPLACE_EXISTING ) != 0;
+	#else
+		ok = rename ( tmp.c_str(), filename ) == 0;
+	#endif
+	if ( !ok ) printf ( "Checkpoint: cannot replace %s.\n", filename );
+	return ok;
+}
+
+CheckpointWriter::CheckpointWriter ()
+{
+	m_Frame = 0;
+	m_Interval = 0;
+	m_Error = -1;
+	m_bPending = false;
+	m_bRunning = false;
+	m_bStop = false;
+	m_Written = 0;
+}
+
+CheckpointWriter::~CheckpointWriter ()
+{
+	Stop ();
+}
+
+bool CheckpointWriter::Start ( const char* path_fmt, int interval )
+{
+	if ( m_bRunning ) return true;
+	if ( !mint::IsFramePattern ( path_fmt ) ) {
+		printf ( "Checkpoint: %s may take one integer frame number, e.g. melt_%%06d.mck.\n", path_fmt );
+		return false;
+	}
+	m_PathFmt = path_fmt;
+	m_Interval = interval;
+	m_Written = 0;
+	m_FirstFile.clear ();
+	m_LastFile.clear ();
+	m_bPending = false;
+	m_bStop = false;
+	m_Writer.Start ( WriterEntry, this );
+	m_bRunning = true;
+	return true;
+}
+
+void CheckpointWriter::Stop ()
+{
+	if ( !m_bRunning ) return;
+	m_Lock.Lock ();
+	m_bStop = true;
+	m_Ready.Signal ();
+	m_Lock.Unlock ();
+	m_Writer.Join ();
+	m_Image.clear ();
+	m_bRunning = false;
+}
+
+bool CheckpointWriter::Step ( FluidSystem& psys, int frame )
+{
+	if ( m_Interval <= 0 || frame % m_Interval != 0 ) return false;
+	return Submit ( psys, frame );
+}
+
+bool CheckpointWriter::Submit ( FluidSystem& psys, int frame )
+{
+	mint::ScopedLock lock ( m_Lock );
+	if ( !m_bRunning || m_bPending ) return false;
+	// The writer only touches m_Image while m_bPending is set
+	psys.SnapshotCheckpoint ( m_Image, frame, m_Error );
+	m_Frame = frame;
+	m_bPending = true;
+	m_Ready.Signal ();
+	return true;
+}
+
+std::string CheckpointWriter::FirstFile ()
+{
+	mint::ScopedLock lock ( m_Lock );
+	return m_FirstFile;
+}
+
+std::string CheckpointWriter::LastFile ()
+{
+	mint::ScopedLock lock ( m_Lock );
+	return m_LastFile;
+}
+
+void CheckpointWriter::Flush ()
+{
+	mint::ScopedLock lock ( m_Lock );
+	while ( m_bPending )
+		m_Done.Wait ( m_Lock );
+}
+
+void CheckpointWriter::WriterEntry ( void* arg )
+{
+	mint::GetTracer().SetThreadName ( "checkpoint writer" );
+	((CheckpointWriter*) arg)->WriterLoop ();
+}
+
+void CheckpointWriter::WriterLoop ()
+{
+	char filename[2048];
+	for (;;) {
+		m_Lock.Lock ();
+		while ( !m_bPending && !m_bStop )
+			m_Ready.Wait ( m_Lock );
+		if ( !m_bPending ) {
+			m_Lock.Unlock ();
+			return;
+		}
+		m_Lock.Unlock ();
+
+		bool ok = mint::FramePath ( filename, sizeof(filename), m_PathFmt.c_str(), m_Frame );
+		if ( !ok )
+			printf ( "Checkpoint: file name of frame %d too long.\n", m_Frame );
+		else
+			ok = WriteCheckpointFile ( filename, m_Image );
+
+		m_Lock.Lock ();
+		if ( ok ) {
+			if ( m_Written++ == 0 ) m_FirstFile = filename;
+			m_LastFile = filename;
+		}
+		m_bPending = false;
+		m_Done.Broadcast ();
+		m_Lock.Unlock ();
+	}
+}
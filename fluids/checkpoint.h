@@ -0,0 +1,63 @@
+#ifndef DEF_CHECKPOINT
+	#define DEF_CHECKPOINT
+
+	#include <vector>
+	#include <string>
+
+	#include "mthread.h"
+
+	class FluidSystem;
+
+	// Writes a checkpoint image to filename.tmp and renames it over filename,
+	// so an interrupted write never replaces the previous checkpoint.
+	bool WriteCheckpointFile ( const char* filename, const std::vector<char>& image );
+
+	// Periodic checkpoints off the simulation thread.
+	//
+	// Step() copies the state into the writer's image every interval frames
+	// (a memcpy of the particle buffer and voxel grid, or with compression a
+	// parallel pass coding the particles) and returns; the file is written
+	// by a background thread. If the previous checkpoint is still being
+	// written the frame is skipped rather than stalling the simulation.
+	class CheckpointWriter {
+	public:
+		CheckpointWriter ();
+		~CheckpointWriter ();
+
+		// path_fmt may take the frame number, e.g. "melt_%06d.mck"; without
+		// one every checkpoint replaces the last. False if it is not a frame
+		// pattern (see mint::IsFramePattern).
+		bool Start ( const char* path_fmt, int interval );
+		void SetCompression ( double error )	{ m_Error = error; }	// see SnapshotCheckpoint
+		void Stop ();							// finishes a pending write, then joins
+		bool IsRunning ()				{ return m_bRunning; }
+
+		bool Step ( FluidSystem& psys, int frame );		// checkpoints when frame is due
+		bool Submit ( FluidSystem& psys, int frame );	// checkpoints now, unless busy
+		void Flush ();
+
+		int NumWritten ()				{ return m_Written; }
+		std::string FirstFile ();				// names of the checkpoints written, "" before any
+		std::string LastFile ();
+
+	private:
+		static void WriterEntry ( void* arg );
+		void WriterLoop ();
+
+		std::vector<char>		m_Image;
+		int						m_Frame;
+		std::string				m_PathFmt;
+		std::string				m_FirstFile, m_LastFile;
+		int						m_Interval;
+		double					m_Error;
+		mint::Thread			m_Writer;
+		mint::Mutex				m_Lock;
+		mint::Condition			m_Ready;
+		mint::Condition			m_Done;
+		bool					m_bPending;
+		bool					m_bRunning;
+		bool					m_bStop;
+		int						m_Written;
+	};
+
+#endif
@@ -0,0 +1,105 @@
+// Checkpoint file format for the melting simulation (.mck)
+//
+// The file begins with a checkpoint_header; every section after it starts
+// on a CHECKPOINT_ALIGN byte boundary, so a mapped file can be read in
+// place. Sections, at the offsets given in the header:
+//
+//   params     double m_Param[param_count]
+//   vecs       float  m_Vec[param_count][3]
+//   toggles    char   m_Toggle[param_count]
+//   particles  num_particles raw Fluid records of particle_stride bytes,
+//              or with CHECKPOINT_QUANT, for each GeomX attribute of the
+//              particle buffer in registration order, an unsigned int byte
+//              count and a key frame mint::ColumnCodec stream (mcodec.h)
+//   voxels     VoxelGrid occupancy words, voxel_words_per_row words per
+//              row, rows y-fastest then z (see voxel_grid.h)
+//   adjacency  short per voxel cell, x-fastest, then y, then z
+//   melt       MeltParams in config file form (melt_params.h), melt_size
+//              bytes of text, not null terminated
+//
+// Particle records are the in-memory Fluid struct, so a checkpoint is only
+// restored by a build with the same particle_stride. A coded particle
+// section restores float attributes to within particle_error (exactly when
+// it is 0) and bytes outside the attributes as zero. Derived state (the
+// spatial grid and neighbor tables) is rebuilt on restore. All data
+// is in host byte order (little-endian on every supported platform).
+
+#ifndef _CHECKPOINT_FORMAT_H_
+#define _CHECKPOINT_FORMAT_H_
+
+#define CHECKPOINT_MAGIC		"MCK1"
+#define CHECKPOINT_VERSION		3
+#define CHECKPOINT_ALIGN		64
+
+// Particle section codecs
+#define CHECKPOINT_RAW			0
+#define CHECKPOINT_QUANT		1
+
+#pragma pack(push)
+#pragma pack(1)
+
+struct checkpoint_header {
+
+  // CHECKPOINT_MAGIC, not null terminated
+  char magic[4];
+
+  int version;
+
+  // Size of this structure
+  int header_size;
+
+  // Total size of the file, to detect truncated writes
+  unsigned int file_size;
+
+  // Frame counter of the caller at the time of the checkpoint
+  int frame;
+
+  double time;
+  double dt;
+
+  // MAX_PARAM of the writer
+  int param_count;
+
+  int num_particles;
+  int max_particles;
+  int particle_stride;
+
+  // CHECKPOINT_* codec of the particle section, its absolute error bound
+  // and stored size
+  int particle_codec;
+  float particle_error;
+  unsigned int particles_size;
+
+  // Voxel grid, world axes
+  int voxel_dim[3];
+  float voxel_size[3];
+  float voxel_offset[3];
+  int voxel_words_per_row;
+
+  // SPH kernel constants as in use, which need not match m_Param (they
+  // are computed once at setup)
+  double kernel_r2;
+  double kernel_poly6;
+  double kernel_lap;
+  double kernel_spiky;
+
+  // FluidSystem rigid-body state
+  int on_ground;
+  float center_of_mass[3];
+  float particle_inertia[3];
+
+  // Section offsets, in bytes from the start of the file
+  unsigned int params_offset;
+  unsigned int vecs_offset;
+  unsigned int toggles_offset;
+  unsigned int particles_offset;
+  unsigned int voxels_offset;
+  unsigned int adjacency_offset;
+  unsigned int melt_offset;
+  unsigned int melt_size;
+
+};
+
+#pragma pack(pop)
+
+#endif
@@ -0,0 +1,509 @@
+#include "decimate.h"
+#include "mtrace.h"
+#include <math.h>
+#include <queue>
+#include <algorithm>
+
+/*
+ * Quadric: symmetric 4x4 matrix of a sum of squared plane distances, stored
+ * as  aa ab ac ad bb bc bd cc cd dd.
+ */
+void Decimator::Quadric::clear ()
+{
+	for (int i = 0; i < 10; ++i)
+		q[i] = 0.0;
+}
+
+void Decimator::Quadric::addPlane (double a, double b, double c, double d, double w)
+{
+	q[0] += w*a*a;	q[1] += w*a*b;	q[2] += w*a*c;	q[3] += w*a*d;
+	q[4] += w*b*b;	q[5] += w*b*c;	q[6] += w*b*d;
+	q[7] += w*c*c;	q[8] += w*c*d;
+	q[9] += w*d*d;
+}
+
+void Decimator::Quadric::add (const Quadric& o)
+{
+	for (int i = 0; i < 10; ++i)
+		q[i] += o.q[i];
+}
+
+double Decimator::Quadric::error (const double* x) const
+{
+	return x[0]*(q[0]*x[0] + 2*(q[1]*x[1] + q[2]*x[2] + q[3]))
+		 + x[1]*(q[4]*x[1] + 2*(q[5]*x[2] + q[6]))
+		 + x[2]*(q[7]*x[2] + 2*q[8])
+		 + q[9];
+}
+
+/*
+ * Minimizes the error by solving the 3x3 system (Cramer's rule). Fails on
+ * (near) singular systems, e.g. flat or cylindrical neighborhoods.
+ */
+bool Decimator::Quadric::optimum (double* x) const
+{
+	double a = q[0], b = q[1], c = q[2];
+	double d = q[4], e = q[5], f = q[7];
+	double c0 = d*f - e*e;
+	double c1 = c*e - b*f;
+	double c2 = b*e - c*d;
+	double det = a*c0 + b*c1 + c*c2;
+	double tr = a + d + f;
+
+	if (fabs(det) <= 1e-9 * tr * tr * tr)
+		return false;
+
+	double inv = 1.0 / det;
+	double rx = -q[3], ry = -q[6], rz = -q[8];
+	x[0] = inv * (c0*rx + c1*ry + c2*rz);
+	x[1] = inv * (c1*rx + (a*f - c*c)*ry + (b*c - a*e)*rz);
+	x[2] = inv * (c2*rx + (b*c - a*e)*ry + (a*d - b*b)*rz);
+	return true;
+}
+
+class Decimator::SlabJob : public mint::ParallelBody
+{
+public:
+	SlabJob (Decimator* owner_) : owner(owner_) {}
+	virtual void Run (int begin, int end)
+	{
+		for (int s = begin; s < end; ++s) {
+			mint::ScopedTrace t("decimate slab");
+			owner->simplifySlab(s);
+		}
+	}
+private:
+	Decimator*	owner;
+};
+
+Decimator::Decimator ()
+{
+	maxCost = 0.0;
+	partitions = 0;
+}
+
+Decimator::~Decimator ()
+{
+}
+
+int Decimator::decimate (IsoSurface& surface, int targetFaces, Double maxError, mint::ThreadPool* pool)
+{
+	int numF = (int) surface.getFaces().size();
+
+	if (numF == 0 || (targetFaces <= 0 && maxError <= 0) || targetFaces >= numF)
+		return numF;
+	maxCost = (maxError > 0) ? maxError * maxError : 1e300;
+
+	int numSlabs = partitions;
+	if (numSlabs <= 0)
+		numSlabs = (pool && pool->NumThreads() > 0) ? pool->NumThreads() * 2 : 1;
+
+	/*
+	 * The second pass shifts the slabs by half a slab, so the borders
+	 * locked in the first pass land inside a slab and get simplified too.
+	 */
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		load(surface);
+		numF = (int) tris.size() / 3;
+		buildQuadrics();
+		buildSlabs(numSlabs, pass * 0.5);
+
+		for (int s = 0; s < (int) slabFaces.size(); ++s)
+			slabTarget[s] = (targetFaces > 0) ? (int) ((long long) targetFaces * slabFaces[s] / numF) : 0;
+
+		SlabJob job(this);
+		mint::ParallelFor(pool, 0, (int) slabFaces.size(), 1, job);
+
+		writeBack(surface);
+		if ((int) surface.getFaces().size() <= targetFaces || (int) surface.getFaces().size() == numF)
+			break;
+	}
+	return (int) surface.getFaces().size();
+}
+
+void Decimator::load (IsoSurface& surface)
+{
+	const vector<Point3d>& verts = surface.getVertices();
+	const vector<MeshTriangle>& faces = surface.getFaces();
+	int numV = (int) verts.size();
+	int numF = (int) faces.size();
+
+	pos.resize(numV * 3);
+	for (int i = 0; i < numV; ++i)
+	{
+		pos[i*3] = verts[i][0];
+		pos[i*3 + 1] = verts[i][1];
+		pos[i*3 + 2] = verts[i][2];
+	}
+	tris.resize(numF * 3);
+	for (int i = 0; i < numF; ++i)
+	{
+		tris[i*3] = (int) faces[i][0];
+		tris[i*3 + 1] = (int) faces[i][1];
+		tris[i*3 + 2] = (int) faces[i][2];
+	}
+}
+
+/*
+ * Area weighted plane quadrics per vertex, plus the vertex -> face lists.
+ */
+void Decimator::buildQuadrics ()
+{
+	int numV = (int) pos.size() / 3;
+	int numF = (int) tris.size() / 3;
+
+	quadrics.resize(numV);
+	for (int i = 0; i < numV; ++i)
+		quadrics[i].clear();
+	vertFaces.assign(numV, std::vector<int>());
+	faceDead.assign(numF, 0);
+	stamp.assign(numV, 0);
+
+	for (int f = 0; f < numF; ++f)
+	{
+		const double* p0 = &pos[tris[f*3] * 3];
+		const double* p1 = &pos[tris[f*3 + 1] * 3];
+		const double* p2 = &pos[tris[f*3 + 2] * 3];
+		double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		double n[3] = { e1[1]*e2[2] - e1[2]*e2[1],
+						e1[2]*e2[0] - e1[0]*e2[2],
+						e1[0]*e2[1] - e1[1]*e2[0] };
+		double len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+
+		for (int k = 0; k < 3; ++k)
+			vertFaces[tris[f*3 + k]].push_back(f);
+		if (len <= 0)
+			continue;
+		n[0] /= len; n[1] /= len; n[2] /= len;
+		double d = -(n[0]*p0[0] + n[1]*p0[1] + n[2]*p0[2]);
+		for (int k = 0; k < 3; ++k)
+			quadrics[tris[f*3 + k]].addPlane(n[0], n[1], n[2], d, 0.5 * len);
+	}
+}
+
+/*
+ * Slabs along the longest axis of the bounding box, shifted by offset slab
+ * widths. A face belongs to a slab when all its corners do; the corners of
+ * every other face are locked.
+ */
+void Decimator::buildSlabs (int numSlabs, double offset)
+{
+	int numV = (int) pos.size() / 3;
+	int numF = (int) tris.size() / 3;
+	double lo[3] = { 1e300, 1e300, 1e300 }, hi[3] = { -1e300, -1e300, -1e300 };
+
+	for (int i = 0; i < numV; ++i)
+		for (int k = 0; k < 3; ++k)
+		{
+			lo[k] = std::min(lo[k], pos[i*3 + k]);
+			hi[k] = std::max(hi[k], pos[i*3 + k]);
+		}
+	int axis = 0;
+	for (int k = 1; k < 3; ++k)
+		if (hi[k] - lo[k] > hi[axis] - lo[axis])
+			axis = k;
+	double extent = hi[axis] - lo[axis];
+	double scale = (extent > 0) ? numSlabs / extent : 0.0;
+
+	if (offset > 0)
+		++numSlabs;
+	vertSlab.resize(numV);
+	for (int i = 0; i < numV; ++i)
+	{
+		int s = (int) ((pos[i*3 + axis] - lo[axis]) * scale + offset);
+		vertSlab[i] = std::min(std::max(s, 0), numSlabs - 1);
+	}
+
+	locked.assign(numV, 0);
+	slabFaces.assign(numSlabs, 0);
+	slabTarget.assign(numSlabs, 0);
+	for (int f = 0; f < numF; ++f)
+	{
+		int s0 = vertSlab[tris[f*3]];
+		if (s0 == vertSlab[tris[f*3 + 1]] && s0 == vertSlab[tris[f*3 + 2]])
+			slabFaces[s0]++;
+		else
+			for (int k = 0; k < 3; ++k)
+				locked[tris[f*3 + k]] = 1;
+	}
+
+	slabVerts.assign(numSlabs, std::vector<int>());
+	for (int i = 0; i < numV; ++i)
+		if (!locked[i] && !vertFaces[i].empty())
+			slabVerts[vertSlab[i]].push_back(i);
+}
+
+void Decimator::neighbors (int vert, std::vector<int>& out)
+{
+	out.clear();
+	const std::vector<int>& vf = vertFaces[vert];
+	for (int i = 0; i < (int) vf.size(); ++i)
+	{
+		if (faceDead[vf[i]])
+			continue;
+		for (int k = 0; k < 3; ++k)
+		{
+			int w = tris[vf[i]*3 + k];
+			if (w != vert)
+				out.push_back(w);
+		}
+	}
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+/*
+ * Cost of collapsing the edge u-v. On return c.u is the vertex removed and
+ * c.v the one kept; a locked vertex is always the one kept, in place.
+ */
+bool Decimator::evalEdge (int u, int v, Candidate& c, double* x)
+{
+	if (locked[u] && locked[v])
+		return false;
+	if (locked[u])
+		std::swap(u, v);
+
+	Quadric q = quadrics[u];
+	const double* pu = &pos[u*3];
+	const double* pv = &pos[v*3];
+	q.add(quadrics[v]);
+
+	if (locked[v])
+	{
+		x[0] = pv[0]; x[1] = pv[1]; x[2] = pv[2];
+	}
+	else
+	{
+		double mid[3] = { 0.5*(pu[0] + pv[0]), 0.5*(pu[1] + pv[1]), 0.5*(pu[2] + pv[2]) };
+		double len2 = (pu[0]-pv[0])*(pu[0]-pv[0]) + (pu[1]-pv[1])*(pu[1]-pv[1]) + (pu[2]-pv[2])*(pu[2]-pv[2]);
+		bool ok = q.optimum(x);
+		if (ok)
+		{
+			// keep the optimum near the edge; far solutions are numerical noise
+			double dx = x[0]-mid[0], dy = x[1]-mid[1], dz = x[2]-mid[2];
+			ok = (dx*dx + dy*dy + dz*dz <= len2);
+		}
+		if (!ok)
+		{
+			const double* choice[3] = { pu, pv, mid };
+			double best = 1e300;
+			for (int i = 0; i < 3; ++i)
+			{
+				double e = q.error(choice[i]);
+				if (e < best)
+				{
+					best = e;
+					x[0] = choice[i][0]; x[1] = choice[i][1]; x[2] = choice[i][2];
+				}
+			}
+		}
+	}
+
+	c.cost = std::max(q.error(x), 0.0);
+	c.u = u;
+	c.v = v;
+	c.stampU = stamp[u];
+	c.stampV = stamp[v];
+	return true;
+}
+
+/*
+ * True if moving vert to x would turn over or squash one of its faces that
+ * does not also contain other (those disappear with the collapse).
+ */
+bool Decimator::flips (int vert, int other, const double* x)
+{
+	const std::vector<int>& vf = vertFaces[vert];
+	for (int i = 0; i < (int) vf.size(); ++i)
+	{
+		int f = vf[i];
+		if (faceDead[f])
+			continue;
+		const int* t = &tris[f*3];
+		if (t[0] == other || t[1] == other || t[2] == other)
+			continue;
+
+		const double* p[3];
+		const double* q[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			p[k] = &pos[t[k]*3];
+			q[k] = (t[k] == vert) ? x : p[k];
+		}
+		double a1[3] = { p[1][0]-p[0][0], p[1][1]-p[0][1], p[1][2]-p[0][2] };
+		double a2[3] = { p[2][0]-p[0][0], p[2][1]-p[0][1], p[2][2]-p[0][2] };
+		double b1[3] = { q[1][0]-q[0][0], q[1][1]-q[0][1], q[1][2]-q[0][2] };
+		double b2[3] = { q[2][0]-q[0][0], q[2][1]-q[0][1], q[2][2]-q[0][2] };
+		double n0[3] = { a1[1]*a2[2]-a1[2]*a2[1], a1[2]*a2[0]-a1[0]*a2[2], a1[0]*a2[1]-a1[1]*a2[0] };
+		double n1[3] = { b1[1]*b2[2]-b1[2]*b2[1], b1[2]*b2[0]-b1[0]*b2[2], b1[0]*b2[1]-b1[1]*b2[0] };
+		double dot = n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2];
+		double l0 = n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2];
+		double l1 = n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2];
+
+		if (dot <= 0 || dot * dot < 0.04 * l0 * l1)		// more than ~78 degrees
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Link condition: an interior edge shared by exactly two faces whose ends
+ * have exactly those two opposite vertices in common. Anything else would
+ * leave the mesh non-manifold.
+ */
+bool Decimator::linkOk (int u, int v)
+{
+	std::vector<int> nu, nv;
+	neighbors(u, nu);
+	neighbors(v, nv);
+
+	int common = 0;
+	for (int i = 0, j = 0; i < (int) nu.size() && j < (int) nv.size(); )
+	{
+		if (nu[i] < nv[j]) ++i;
+		else if (nv[j] < nu[i]) ++j;
+		else { ++common; ++i; ++j; }
+	}
+	if (common != 2)
+		return false;
+
+	int shared = 0;
+	const std::vector<int>& vf = vertFaces[u];
+	for (int i = 0; i < (int) vf.size(); ++i)
+	{
+		const int* t = &tris[vf[i]*3];
+		if (!faceDead[vf[i]] && (t[0] == v || t[1] == v || t[2] == v))
+			++shared;
+	}
+	return (shared == 2);
+}
+
+void Decimator::collapse (int u, int v, const double* x)
+{
+	std::vector<int>& uf = vertFaces[u];
+	std::vector<int>& vf = vertFaces[v];
+
+	for (int i = 0; i < (int) uf.size(); ++i)
+	{
+		int f = uf[i];
+		if (faceDead[f])
+			continue;
+		int* t = &tris[f*3];
+		if (t[0] == v || t[1] == v || t[2] == v)
+		{
+			faceDead[f] = 1;
+			continue;
+		}
+		for (int k = 0; k < 3; ++k)
+			if (t[k] == u)
+				t[k] = v;
+		vf.push_back(f);
+	}
+	uf.clear();
+
+	int live = 0;
+	for (int i = 0; i < (int) vf.size(); ++i)
+		if (!faceDead[vf[i]])
+			vf[live++] = vf[i];
+	vf.resize(live);
+
+	if (!locked[v])
+	{
+		pos[v*3] = x[0]; pos[v*3 + 1] = x[1]; pos[v*3 + 2] = x[2];
+		quadrics[v].add(quadrics[u]);
+	}
+	++stamp[u];
+	++stamp[v];
+}
+
+/*
+ * Greedy cheapest-first edge collapse inside one slab. Only unlocked
+ * vertices of the slab and faces owned by it are modified, so slabs run
+ * concurrently. Stale heap entries are skipped by comparing stamps.
+ */
+void Decimator::simplifySlab (int slab)
+{
+	std::priority_queue<Candidate> heap;
+	std::vector<int> nb;
+	Candidate c;
+	double x[3];
+
+	const std::vector<int>& verts = slabVerts[slab];
+	for (int i = 0; i < (int) verts.size(); ++i)
+	{
+		int u = verts[i];
+		neighbors(u, nb);
+		for (int j = 0; j < (int) nb.size(); ++j)
+			if ((u < nb[j] || locked[nb[j]]) && evalEdge(u, nb[j], c, x))
+				heap.push(c);
+	}
+
+	int live = slabFaces[slab];
+	while (!heap.empty() && live > slabTarget[slab])
+	{
+		c = heap.top();
+		heap.pop();
+		if (c.stampU != stamp[c.u] || c.stampV != stamp[c.v])
+			continue;
+		if (c.cost > maxCost)
+			break;
+		if (!evalEdge(c.u, c.v, c, x) || !linkOk(c.u, c.v))
+			continue;
+		if (flips(c.u, c.v, x) || (!locked[c.v] && flips(c.v, c.u, x)))
+			continue;
+
+		int kept = c.v;
+		collapse(c.u, kept, x);
+		live -= 2;
+
+		neighbors(kept, nb);
+		for (int j = 0; j < (int) nb.size(); ++j)
+			if (evalEdge(kept, nb[j], c, x))
+				heap.push(c);
+	}
+}
+
+/*
+ * Drops dead faces and unreferenced vertices. Surviving vertices keep
+ * their normal, if the surface has them.
+ */
+void Decimator::writeBack (IsoSurface& surface)
+{
+	vector<Point3d>& verts = surface.getVertices();
+	vector<MeshTriangle>& faces = surface.getFaces();
+	vector<Vector3d>& normals = surface.getVNormals();
+	int numV = (int) verts.size();
+	int numF = (int) faceDead.size();
+	bool hasNormals = ((int) normals.size() == numV);
+
+	std::vector<int> remap(numV, -1);
+	int next = 0;
+	for (int f = 0; f < numF; ++f)
+	{
+		if (faceDead[f])
+			continue;
+		for (int k = 0; k < 3; ++k)
+			if (remap[tris[f*3 + k]] < 0)
+				remap[tris[f*3 + k]] = next++;
+	}
+
+	vector<Point3d> newVerts(next);
+	vector<Vector3d> newNormals(hasNormals ? next : 0);
+	for (int i = 0; i < numV; ++i)
+	{
+		if (remap[i] < 0)
+			continue;
+		newVerts[remap[i]] = Point3d(pos[i*3], pos[i*3 + 1], pos[i*3 + 2]);
+		if (hasNormals)
+			newNormals[remap[i]] = normals[i];
+	}
+
+	faces.clear();
+	for (int f = 0; f < numF; ++f)
+		if (!faceDead[f])
+			faces.push_back(MeshTriangle(remap[tris[f*3]], remap[tris[f*3 + 1]], remap[tris[f*3 + 2]]));
+	verts.swap(newVerts);
+	normals.swap(newNormals);
+}
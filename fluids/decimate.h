@@ -0,0 +1,85 @@
+#ifndef DECIMATE_H
+#define DECIMATE_H
+
+#include <vector>
+#include "impsurface.h"
+#include "mthread.h"
+
+/*
+ * Quadric error metric simplification (Garland & Heckbert) of an IsoSurface.
+ *
+ * The mesh is cut into slabs along its longest axis. Triangles whose corners
+ * fall in different slabs form the borders; their vertices are locked, so
+ * every slab can collapse edges on its own thread without touching anything
+ * another slab reads. Each slab stops once it reaches its share of the
+ * target triangle count or its cheapest collapse exceeds the error bound;
+ * a second pass with shifted slabs then works on the old borders.
+ */
+class Decimator
+{
+public:
+	Decimator	();
+	~Decimator	();
+
+	/*
+	 * targetFaces <= 0 disables the count target and maxError <= 0 the error
+	 * bound (in world units); with both disabled nothing is collapsed.
+	 * Returns the number of triangles left.
+	 */
+	int		decimate	(IsoSurface& surface,
+						 int targetFaces,
+						 Double maxError,
+						 mint::ThreadPool* pool);
+
+	void	setPartitions	(int num)	{ partitions = num; }
+
+private:
+	struct Quadric
+	{
+		double	q[10];		// upper triangle of the symmetric 4x4 matrix
+
+		void	clear		();
+		void	addPlane	(double a, double b, double c, double d, double w);
+		void	add			(const Quadric& o);
+		double	error		(const double* x) const;
+		bool	optimum		(double* x) const;
+	};
+
+	struct Candidate
+	{
+		double	cost;
+		int		u, v;
+		int		stampU, stampV;
+		bool	operator <	(const Candidate& o) const	{ return cost > o.cost; }
+	};
+
+	class SlabJob;
+	friend class SlabJob;
+
+	void	load			(IsoSurface& surface);
+	void	buildQuadrics	();
+	void	buildSlabs		(int numSlabs, double offset);
+	void	simplifySlab	(int slab);
+	bool	evalEdge		(int u, int v, Candidate& c, double* x);
+	bool	flips			(int vert, int other, const double* x);
+	bool	linkOk			(int u, int v);
+	void	collapse		(int u, int v, const double* x);
+	void	neighbors		(int vert, std::vector<int>& out);
+	void	writeBack		(IsoSurface& surface);
+
+	std::vector<double>				pos;		// 3 per vertex
+	std::vector<int>				tris;		// 3 per face
+	std::vector<char>				faceDead;
+	std::vector<char>				locked;
+	std::vector<int>				vertSlab;
+	std::vector<int>				stamp;
+	std::vector<Quadric>			quadrics;
+	std::vector< std::vector<int> >	vertFaces;
+	std::vector< std::vector<int> >	slabVerts;
+	std::vector<int>				slabFaces;	// live faces owned by each slab
+	std::vector<int>				slabTarget;
+	double							maxCost;
+	int								partitions;
+};
+
+#endif // DECIMATE_H
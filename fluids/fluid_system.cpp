@@ -20,25 +20,51 @@
   3. This notice may not be removed or altered from any source distribution.
 */
 
-#include <conio.h>
+#include <stddef.h>
 #include <iostream>
 #include <fstream>
 
-
-#ifdef _MSC_VER
-	#include <gl/glut.h>
-#else
-	#include <GL/glut.h>
+#ifndef NO_GL
+	#ifdef _MSC_VER
+		#include <gl/glut.h>
+	#else
+		#include <GL/glut.h>
+	#endif
 #endif
 
 #include "common_defs.h"
 #include "mtime.h"
 #include "fluid_system.h"
+#include "surface_pipeline.h"
+#include "checkpoint.h"
+#include "checkpoint_format.h"
+#include "mfile.h"
+#include "mcodec.h"
+#include "mprofile.h"
 
 #define EPSILON			0.00001f			//for collision detection
 
 FluidSystem::FluidSystem ()
 {
+	vgrid = 0x0;
+	m_marchCube = 0x0;
+	m_surface = 0x0;
+	m_Scene = OBJECT_PATH;
+	m_bDeterministic = false;
+	m_BalanceAge = 0;
+	memset ( m_NC, 0, sizeof(m_NC) );			// no neighbor counts before the first step
+
+	// In PHASE_* order
+	const char* phases[] = { "step", "insert", "pressure", "boundary", "force", "advance", "surface", "snapshot", "checkpoint" };
+	for (int n=0; n < PHASE_COUNT; n++)
+		m_Profile.AddPhase ( phases[n] );
+}
+
+void FluidSystem::SetThreads ( int num )
+{
+	m_Workers.Stop ();
+	m_Workers.Start ( num );
+	m_Balance.clear ();
 }
 
 void FluidSystem::Initialize ( int mode, int total )
@@ -50,27 +76,28 @@ void FluidSystem::Initialize ( int mode, int total )
 	
 	FreeBuffers ();
 	AddBuffer ( BFLUID, sizeof ( Fluid ), total );
-	AddAttribute ( 0, "pos", sizeof ( Vector3DF ), false );	
-	AddAttribute ( 0, "color", sizeof ( DWORD ), false );
-	AddAttribute ( 0, "vel", sizeof ( Vector3DF ), false );
-	AddAttribute ( 0, "ndx", sizeof ( unsigned short ), false );
-	AddAttribute ( 0, "age", sizeof ( unsigned short ), false );
-
-	AddAttribute ( 0, "pressure", sizeof ( double ), false );
-	AddAttribute ( 0, "density", sizeof ( double ), false );
-	AddAttribute ( 0, "sph_force", sizeof ( Vector3DF ), false );
-	AddAttribute ( 0, "next", sizeof ( Fluid* ), false );
-	AddAttribute ( 0, "tag", sizeof ( bool ), false );
-
-	AddAttribute ( 0, "temp", sizeof ( float ), false );
-    AddAttribute ( 0, "state", sizeof ( enum Status ), false );
-	AddAttribute ( 0, "mass", sizeof ( float ), false );
-    AddAttribute ( 0, "adjacents", sizeof ( int ), false );
-
-	AddAttribute ( 0, "torque", sizeof ( Vector3 ), false);
-	AddAttribute ( 0, "angular_velocity", sizeof ( Vector3 ), false);
-	AddAttribute ( 0, "angular_momentum", sizeof( Vector3 ), false);
-	AddAttribute ( 0, "m_transformation", sizeof ( Matrix4 ), false);
+	// Named fields of Fluid, for readers such as TrajectoryWriter
+	AddAttribute ( 0, "pos", sizeof ( Vector3DF ), offsetof ( Fluid, pos ), ATTR_FLOAT );
+	AddAttribute ( 0, "color", sizeof ( DWORD ), offsetof ( Fluid, clr ), ATTR_BYTES );
+	AddAttribute ( 0, "next", sizeof ( int ), offsetof ( Fluid, next ), ATTR_INT );
+	AddAttribute ( 0, "vel", sizeof ( Vector3DF ), offsetof ( Fluid, vel ), ATTR_FLOAT );
+	AddAttribute ( 0, "vel_eval", sizeof ( Vector3DF ), offsetof ( Fluid, vel_eval ), ATTR_FLOAT );
+	AddAttribute ( 0, "age", sizeof ( unsigned short ), offsetof ( Fluid, age ), ATTR_BYTES );
+	AddAttribute ( 0, "index", sizeof ( Vector3DI ), offsetof ( Fluid, index ), ATTR_INT );
+
+	AddAttribute ( 0, "pressure", sizeof ( float ), offsetof ( Fluid, pressure ), ATTR_FLOAT );
+	AddAttribute ( 0, "density", sizeof ( float ), offsetof ( Fluid, density ), ATTR_FLOAT );		// inverse density
+	AddAttribute ( 0, "sph_force", sizeof ( Vector3DF ), offsetof ( Fluid, sph_force ), ATTR_FLOAT );
+
+	AddAttribute ( 0, "temp", sizeof ( float ), offsetof ( Fluid, temp ), ATTR_FLOAT );
+	AddAttribute ( 0, "temp_eval", sizeof ( float ), offsetof ( Fluid, temp_eval ), ATTR_FLOAT );
+	AddAttribute ( 0, "state", sizeof ( enum Status ), offsetof ( Fluid, state ), ATTR_INT );
+	AddAttribute ( 0, "mass", sizeof ( float ), offsetof ( Fluid, mass ), ATTR_FLOAT );
+
+	AddAttribute ( 0, "torque", sizeof ( Vector3 ), offsetof ( Fluid, torque ), ATTR_FLOAT );
+	AddAttribute ( 0, "angular_velocity", sizeof ( Vector3 ), offsetof ( Fluid, angular_velocity ), ATTR_FLOAT );
+	AddAttribute ( 0, "angular_momentum", sizeof( Vector3 ), offsetof ( Fluid, angular_momentum ), ATTR_FLOAT );
+	AddAttribute ( 0, "m_transformation", sizeof ( Matrix4 ), offsetof ( Fluid, m_transformation ), ATTR_FLOAT );
 	SPH_Setup ();
 	Reset ( total );
    
@@ -84,6 +111,9 @@ void FluidSystem::Reset ( int nmax )
 	ResetBuffer ( 0, nmax );
 
 	m_DT = 0.003; //  0.001;			// .001 = for point grav
+	m_Time = 0;
+	memset ( &m_NStats, 0, sizeof(m_NStats) );
+	m_Balance.clear ();
 
 	// Reset parameters
 	m_Param [ MAX_FRAC ] = 1.0;
@@ -97,10 +127,10 @@ void FluidSystem::Reset ( int nmax )
 	m_Toggle [ WALL_BARRIER ] = false;
 	m_Toggle [ LEVY_BARRIER ] = false;
 	m_Toggle [ DRAIN_BARRIER ] = false;
-	m_Param [ SPH_INTSTIFF ] = INT_STIFF_WATER;        //  1.00;
-	m_Param [ SPH_VISC ] = VISC_WATER;
-	m_Param [ SPH_EXTSTIFF ] = EXT_STIFF; // 10000; //20000;
-	m_Param [ SPH_SMOOTHRADIUS ] = EFFECTIVE_RADIUS;
+	m_Param [ SPH_INTSTIFF ] = m_Melt.int_stiff_water;        //  1.00;
+	m_Param [ SPH_VISC ] = m_Melt.visc_water;
+	m_Param [ SPH_EXTSTIFF ] = m_Melt.ext_stiff; // 10000; //20000;
+	m_Param [ SPH_SMOOTHRADIUS ] = m_Melt.effective_radius;
 	
 	m_Vec [ POINT_GRAV_POS ].Set ( 0, 0, 0 );
 	m_Vec [ PLANE_GRAV_DIR ].Set ( 0, 0, -9.8 );
@@ -120,7 +150,7 @@ int FluidSystem::AddPoint ()
 	f->next = 0x0;
 	f->pressure = 0;
 	f->density = 0;
-    f->temp = MIN_T;
+    f->temp = m_Melt.min_t;
     f->state = LIQUID; //SOLID;
     f->mass = 0; // mucho problem?
 	f->torque = Vector3::ZERO; //Vector3(1.0f, 1.0f, 1.0f);
@@ -129,36 +159,41 @@ int FluidSystem::AddPoint ()
 	return ndx;
 }
 
-int FluidSystem::AddPointReuse ()
+// Starting state of a seeded ice particle
+static void InitSolid ( Fluid* f, float temp )
 {
-	xref ndx;
-	Fluid* f;
-    if ( NumPoints() <= mBuf[0].max-2 ) {
-		f = (Fluid*) AddElem ( 0, ndx );
-    } else {
-		f = (Fluid*) RandomElem ( 0, ndx );
-    }
-
 	f->sph_force.Set(0,0,0);
 	f->vel.Set(0,0,0);
 	f->vel_eval.Set(0,0,0);
 	f->next = 0x0;
 	f->pressure = 0;
 	f->density = 0; 
-	f->temp = MIN_T;
+	f->temp = temp;
     f->state = SOLID;
 	f->mass = 1;
 	f->torque = Vector3(1.0f, 1.0f, 1.0f);
 	f->angular_momentum =  Vector3(1.0f, 1.0f, 1.0f);
 	f->m_transformation = Matrix4::IDENTITY;
+}
+
+int FluidSystem::AddPointReuse ()
+{
+	xref ndx;
+	Fluid* f;
+    if ( NumPoints() <= mBuf[0].max-2 ) {
+		f = (Fluid*) AddElem ( 0, ndx );
+    } else {
+		f = (Fluid*) RandomElem ( 0, ndx );
+    }
+
+	InitSolid ( f, m_Melt.min_t );
 	return ndx;
 }
 
 void FluidSystem::Run ()
 {
-	bool bTiming = true;
-
-	mint::Time start, stop;
+	mint::ScopedTimer step ( m_Profile, PHASE_STEP );
+	step.Items ( NumPoints() );					// particles, for counts per particle
 	
 	//float ss = vgrid->voxelSize[0]*2;// m_Param [ SPH_PDIST ] / m_Param[ SPH_SIMSCALE ];		// simulation scale (not Schutzstaffel)
 	
@@ -169,33 +204,88 @@ void FluidSystem::Run ()
 	#else
     // -- CPU only --
 
-    start.SetSystemTime ( ACC_NSEC );
-    Grid_InsertParticles ();
-    //if ( bTiming) { stop.SetSystemTime ( ACC_NSEC ); stop = stop - start; printf ( "INSERT: %s\n", stop.GetReadableTime().c_str() ); }
-		
-    start.SetSystemTime ( ACC_NSEC );
-    SPH_ComputePressureGrid ();
-    //if ( bTiming) { stop.SetSystemTime ( ACC_NSEC ); stop = stop - start; printf ( "PRESS: %s\n", stop.GetReadableTime().c_str() ); }
+	{
+		mint::ScopedTimer t ( m_Profile, PHASE_INSERT );
+		t.Items ( NumPoints() );
+		Grid_InsertParticles ();
+	}
+	{
+		mint::ScopedTimer t ( m_Profile, PHASE_PRESSURE );
+		t.Items ( NumPoints() );
+		Balance ();
+		SPH_ComputePressureGrid ();
+	}
 
-    start.SetSystemTime ( ACC_NSEC );
-    SPH_ComputeForceGridNC ();
+	SPH_ComputeForceGridNC ();					// times PHASE_BOUNDARY and PHASE_FORCE itself
 
 	// Torque
 	//ComputeAngularVelocity();
-    //if ( bTiming) { stop.SetSystemTime ( ACC_NSEC ); stop = stop - start; printf ( "FORCE: %s\n", stop.GetReadableTime().c_str() ); }
 
-    SPH_DrawDomain();
-
-    start.SetSystemTime ( ACC_NSEC );
-    on_ground = false;
-    Advance();
-    //if ( bTiming) { stop.SetSystemTime ( ACC_NSEC ); stop = stop - start; printf ( "ADV: %s\n", stop.GetReadableTime().c_str() ); }
+	{
+		mint::ScopedTimer t ( m_Profile, PHASE_ADVANCE );
+		t.Items ( NumPoints() );
+		on_ground = false;
+		Advance();
+	}
 		
 	#endif
+
+	UpdateMemory ();
 }
 
+// Footprint of the simulation by subsystem; keeps the high-water marks in
+// m_Memory. A few size queries, cheap enough for every step.
+void FluidSystem::UpdateMemory ()
+{
+	size_t resident = 0, reserved = 0;
+	GetMemory ( m_Memory );						// particles, neighbor table, spatial grid
+	if ( vgrid != 0x0 ) vgrid->getMemory ( resident, reserved );
+	m_Memory.Set ( "voxel grid", resident, reserved );
+	resident = reserved = 0;
+	if ( m_marchCube != 0x0 ) m_marchCube->getMemory ( resident, reserved );
+	m_Memory.Set ( "march cubes", resident, reserved );
+	resident = reserved = 0;
+	if ( m_surface != 0x0 ) m_surface->getMemory ( resident, reserved );
+	m_Memory.Set ( "iso surface", resident, reserved );
+}
 
 
+// FNV-1a, 64 bit
+static unsigned long long HashBytes ( unsigned long long h, const void* data, size_t len )
+{
+	const unsigned char* b = (const unsigned char*) data;
+	for ( size_t n = 0; n < len; n++ ) {
+		h ^= b[n];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// Hash of the state the next step starts from: the time, each particle's
+// simulated members (not its padding) and the voxels. Equal hashes of two
+// runs step by step mean they stayed bitwise identical.
+unsigned long long FluidSystem::StateHash ()
+{
+	unsigned long long h = 14695981039346656037ULL;
+	int num = NumPoints();
+	h = HashBytes ( h, &num, sizeof(num) );
+	h = HashBytes ( h, &m_Time, sizeof(m_Time) );
+	for ( int n = 0; n < num; n++ ) {
+		const Fluid* p = GetFluid ( n );
+		const float f[17] = { p->pos.x, p->pos.y, p->pos.z, p->vel.x, p->vel.y, p->vel.z,
+			p->vel_eval.x, p->vel_eval.y, p->vel_eval.z, p->sph_force.x, p->sph_force.y, p->sph_force.z,
+			p->pressure, p->density, p->temp, p->temp_eval, p->mass };
+		const int k[4] = { p->index.x, p->index.y, p->index.z, (int) p->state };
+		h = HashBytes ( h, f, sizeof(f) );
+		h = HashBytes ( h, k, sizeof(k) );
+	}
+	if ( vgrid != 0x0 ) {
+		if ( !vgrid->data.empty() ) h = HashBytes ( h, &vgrid->data[0], vgrid->data.size() * sizeof(vgrid->data[0]) );
+		if ( !vgrid->adj.empty() ) h = HashBytes ( h, &vgrid->adj[0], vgrid->adj.size() * sizeof(vgrid->adj[0]) );
+	}
+	return h;
+}
+
 void FluidSystem::SPH_DrawDomain ()
 {
 	Vector3DF min, max;
@@ -203,6 +293,7 @@ void FluidSystem::SPH_DrawDomain ()
 	max = m_Vec[SPH_VOLMAX];
 	min.z += 0.5;
 
+#ifndef NO_GL
 	glColor3f ( 0.0, 0.0, 1.0 );
 	glBegin ( GL_LINES );
 	glVertex3f ( min.x, min.y, min.z );	glVertex3f ( max.x, min.y, min.z );
@@ -220,6 +311,7 @@ void FluidSystem::SPH_DrawDomain ()
     glVertex3f ( max.x, min.y, min.z ); glVertex3f ( max.x, min.y, max.z );
     glVertex3f ( max.x, max.y, min.z ); glVertex3f ( max.x, max.y, max.z );
 	glEnd ();
+#endif
 }
 
 void FluidSystem::Advance ()
@@ -414,24 +506,25 @@ void FluidSystem::Advance ()
 		if (m_Param[CLR_MODE] == 0.0) {
 			// Color according to temperature
 			float v = p->temp;
-            float dv = MAX_T - MIN_T;
+			float min_t = m_Melt.min_t, max_t = m_Melt.max_t;
+            float dv = max_t - min_t;
             float rgba[4] = {1.0f, 1.0f, 1.0f, 1.0f};
 		    //float rgba[4] = {0.0f, 0.0f, 0.0f, 1.0f};
          
-			if (v < MIN_T) v = MIN_T;
-            if (v > MAX_T) v = MAX_T;
+			if (v < min_t) v = min_t;
+            if (v > max_t) v = max_t;
 
-            if (v < (MIN_T + 0.25 * dv)) {
+            if (v < (min_t + 0.25 * dv)) {
                 rgba[0] = 0.0;
-                rgba[1] = 4 * (v - MIN_T) / dv;
-            } else if (v < (MIN_T + 0.5 * dv)) {
+                rgba[1] = 4 * (v - min_t) / dv;
+            } else if (v < (min_t + 0.5 * dv)) {
                 rgba[0] = 0.0;
-                rgba[2] = 1.0 + 4.0 * (MIN_T + 0.25 * dv - v) / dv;
-            } else if (v < (MIN_T + 0.75 * dv)) {
-                rgba[0] = 4.0 * (v - MIN_T - 0.5 * dv) / dv;
+                rgba[2] = 1.0 + 4.0 * (min_t + 0.25 * dv - v) / dv;
+            } else if (v < (min_t + 0.75 * dv)) {
+                rgba[0] = 4.0 * (v - min_t - 0.5 * dv) / dv;
                 rgba[2] = 0.0;
             } else {
-                rgba[1] = 1.0 + 4.0 * (MIN_T + 0.75 * dv - v) / dv;
+                rgba[1] = 1.0 + 4.0 * (min_t + 0.75 * dv - v) / dv;
                 rgba[2] = 0.0;
             }
 
@@ -489,14 +582,14 @@ void FluidSystem::Advance ()
 void FluidSystem::SPH_Setup ()
 {
 	m_Param [ SPH_SIMSCALE ] =		0.004;			// unit size
-	m_Param [ SPH_VISC ] =			VISC_WATER;			// pascal-second (Pa.s) = 1 kg m^-1 s^-1  (see wikipedia page on viscosity)
+	m_Param [ SPH_VISC ] =			m_Melt.visc_water;			// pascal-second (Pa.s) = 1 kg m^-1 s^-1  (see wikipedia page on viscosity)
 	m_Param [ SPH_RESTDENSITY ] =	600.0;			// kg / m^3
 	m_Param [ SPH_PMASS ] =			0.00020543;		// kg
 	m_Param [ SPH_PRADIUS ] =		0.002;          //0.004			// m
 	m_Param [ SPH_PDIST ] =			0.0059;			// m
 	m_Param [ SPH_SMOOTHRADIUS ] =	0.01;			// m 
-	m_Param [ SPH_INTSTIFF ] =		INT_STIFF_WATER;              // 1.00;
-	m_Param [ SPH_EXTSTIFF ] =		 EXT_STIFF; //10000.0;
+	m_Param [ SPH_INTSTIFF ] =		m_Melt.int_stiff_water;              // 1.00;
+	m_Param [ SPH_EXTSTIFF ] =		 m_Melt.ext_stiff; //10000.0;
 	m_Param [ SPH_EXTDAMP ] =		256.0;
 	m_Param [ SPH_LIMIT ] =			200.0;			// m / s
 
@@ -515,36 +608,118 @@ void FluidSystem::SPH_ComputeKernels ()
 	m_LapKern = 45.0f / (3.141592 * pow( m_Param[SPH_SMOOTHRADIUS], 6) );
 }
 
-void FluidSystem::AddVolume ( Vector3DF min, Vector3DF max, float spacing,VoxelGrid* vgrid )
-{
-	Vector3DF pos;
-	Fluid* p;
-	float dx, dy, dz;
-	dx = max.x-min.x;
-	dy = max.y-min.y;
-	dz = max.z-min.z;
-
-	// temp counter
-	int count = 0;
-	for (float z = min.z; z <= max.z; z += spacing ) {
-		for (float y = min.y; y <= max.y; y += spacing ) {	
-			for (float x = min.x; x <= max.x; x += spacing ) {
-                Vector3DF index = vgrid->inVoxelGrid(x,y,z);
-				if(index.x >= 0 && index.y >= 0 && index.z >= 0){
-					count++;
-					p = (Fluid*)GetPoint ( AddPointReuse () );
-					pos.Set ( x, y, z);
-                    p->index = index;
-					//pos.x += -0.05 + float( rand() * 0.1 ) / RAND_MAX;
-					//pos.y += -0.05 + float( rand() * 0.1 ) / RAND_MAX;
-					//pos.z += -0.05 + float( rand() * 0.1 ) / RAND_MAX;
-					p->pos = pos;
-					p->clr = COLORA( (x-min.x)/dx, (y-min.y)/dy, (z-min.z)/dz, 1);
+namespace {
+	// Lattice samples min + n*spacing along one axis, grouped by the voxel
+	// inVoxelGrid would put them in: voxel v owns samples [start[v], start[v+1]).
+	// Samples usually sit on voxel faces, so rounding error is absorbed toward
+	// the upper voxel; otherwise two samples can land in one voxel.
+	void SampleAxis ( float min, float max, float spacing, float offset, float voxel, int dim, std::vector<int>& start )
+	{
+		start.assign ( dim + 1, 0 );
+		int n = 0;
+		for ( ; min + n*spacing <= max; n++ ) {
+			int v = int ( (min + n*spacing - offset) / voxel + 1e-3f );
+			if ( v < 0 ) start[0] = n + 1;
+			else if ( v < dim ) start[v+1] = n + 1;
+		}
+		for ( int v = 1; v <= dim; v++ )			// voxels without samples
+			if ( start[v] < start[v-1] ) start[v] = start[v-1];
+	}
 
+	// Seeds particles one z layer of voxels at a time. The first pass counts
+	// each layer's particles, the second writes them from that layer's offset,
+	// so layers fill disjoint ranges of the buffer.
+	class SeedJob : public mint::ParallelBody {
+	public:
+		SeedJob ( VoxelGrid* grid, Vector3DF min, Vector3DF max, float spacing, float temp )
+			: m_Grid ( grid ), m_Min ( min ), m_Max ( max ), m_Spacing ( spacing ), m_Temp ( temp ), m_Dest ( 0x0 ), m_Stride ( 0 )
+		{
+			float lo[3] = { min.x, min.y, min.z };
+			float hi[3] = { max.x, max.y, max.z };
+			for ( int a = 0; a < 3; a++ )
+				SampleAxis ( lo[a], hi[a], spacing, grid->offset[a], grid->voxelSize[a], grid->theDim[a], m_Start[a] );
+			m_Count.assign ( grid->theDim[2] + 1, 0 );
+		}
+		int Prefix ()
+		{
+			int total = 0;
+			for ( int z = 0; z < (int) m_Count.size(); z++ ) {
+				int c = m_Count[z]; m_Count[z] = total; total += c;
+			}
+			return total;
+		}
+		void SetDest ( char* dest, int stride )		{ m_Dest = dest; m_Stride = stride; }
+
+		virtual void Run ( int begin, int end )
+		{
+			for ( int z = begin; z < end; z++ )
+				if ( m_Dest == 0x0 ) m_Count[z] = Layer ( z, 0x0 );
+				else Layer ( z, m_Dest + m_Count[z] * m_Stride );
+		}
+
+	private:
+		int Layer ( int z, char* dest )
+		{
+			const std::vector<int>& sx = m_Start[0];
+			const std::vector<int>& sy = m_Start[1];
+			const std::vector<int>& sz = m_Start[2];
+			VoxelGrid& g = *m_Grid;
+			Vector3DF d = m_Max;
+			d -= m_Min;
+			int count = 0;
+			for ( int nz = sz[z]; nz < sz[z+1]; nz++ ) {
+				for ( int y = 0; y < g.theDim[1]; y++ ) {
+					if ( sy[y] == sy[y+1] ) continue;
+					const VoxelGrid::VoxelWord* row = &g.data[ (z*g.theDim[1] + y) * g.wordsPerRow ];
+					for ( int ny = sy[y]; ny < sy[y+1]; ny++ ) {
+						for ( int w = 0; w < g.wordsPerRow; w++ ) {
+							VoxelGrid::VoxelWord bits = row[w];
+							for ( int x = w*64; bits != 0; x++, bits >>= 1 ) {
+								if ( !(bits & 1) ) continue;
+								if ( dest == 0x0 ) { count += sx[x+1] - sx[x]; continue; }
+								for ( int nx = sx[x]; nx < sx[x+1]; nx++, count++ ) {
+									Fluid* p = (Fluid*) (dest + count * m_Stride);
+									InitSolid ( p, m_Temp );
+									p->pos.Set ( m_Min.x + nx*m_Spacing, m_Min.y + ny*m_Spacing, m_Min.z + nz*m_Spacing );
+									p->index.Set ( x, y, z );
+									p->clr = COLORA( (p->pos.x-m_Min.x)/d.x, (p->pos.y-m_Min.y)/d.y, (p->pos.z-m_Min.z)/d.z, 1);
+								}
+							}
+						}
+					}
 				}
 			}
+			return count;
 		}
+
+		VoxelGrid*			m_Grid;
+		Vector3DF			m_Min, m_Max;
+		float				m_Spacing;
+		float				m_Temp;				// of the seeded particles
+		std::vector<int>	m_Start[3];
+		std::vector<int>	m_Count;			// per layer; offsets after Prefix()
+		char*				m_Dest;
+		int					m_Stride;
+	};
+}
+
+// Places a particle at every lattice point min + n*spacing inside the box
+// whose voxel is occupied. Only occupied voxels are visited, and the buffer
+// is grown once to the final count before the layers fill it in parallel.
+// Seeds nothing if the count is more than the neighbor table holds.
+void FluidSystem::AddVolume ( Vector3DF min, Vector3DF max, float spacing,VoxelGrid* vgrid )
+{
+	SeedJob job ( vgrid, min, max, spacing, m_Melt.min_t );
+	mint::ParallelFor ( &m_Workers, 0, vgrid->theDim[2], 1, job );
+	int count = job.Prefix ();
+	if ( count > MAX_NEIGHBOR_ROWS ) {
+		printf ( "ERROR: %s has %d particles, more than the neighbor table holds (%d).\n", m_Scene.c_str(), count, MAX_NEIGHBOR_ROWS );
+		return;
 	}
+
+	href first;
+	job.SetDest ( AddElems ( 0, count, first ), mBuf[0].stride );
+	mint::ParallelFor ( &m_Workers, 0, vgrid->theDim[2], 1, job );
 	std::cout << "count " <<count << std::endl;
 }
 
@@ -553,14 +728,21 @@ void FluidSystem::SPH_CreateExample ( int n, int nmax )  //currently creates a c
 	Vector3DF min, max;
 
 	// Testing loading dragon
-	m_Vec [ SPH_VOLMIN ].Set ( VOLMIN_X, VOLMIN_Y, VOLMIN_Z );
-	m_Vec [ SPH_VOLMAX ].Set ( VOLMAX_X, VOLMAX_Y, VOLMAX_Z );
-	m_Vec [ SPH_INITMIN ].Set ( INITMIN_X, INITMIN_Y, INITMIN_Z);
-	m_Vec [ SPH_INITMAX ].Set ( INITMAX_X, INITMAX_Y, INITMAX_Z );
-
-    vgrid = new VoxelGrid(OBJECT_PATH);
-
-	if (!vgrid) {
+	m_Vec [ SPH_VOLMIN ] = m_Melt.volmin;
+	m_Vec [ SPH_VOLMAX ] = m_Melt.volmax;
+	m_Vec [ SPH_INITMIN ] = m_Melt.initmin;
+	m_Vec [ SPH_INITMAX ] = m_Melt.initmax;
+
+	delete vgrid;
+	int cube = 0;
+	if ( sscanf ( m_Scene.c_str(), "cube:%d", &cube ) == 1 && cube > 0 ) {
+		vgrid = new VoxelGrid ();
+		vgrid->makeCube ( cube, CUBE_SCENE_SIZE );
+	} else
+		vgrid = new VoxelGrid(m_Scene.c_str());
+
+	if ( vgrid->theDim[0] * vgrid->theDim[1] * vgrid->theDim[2] == 0 ) {
+		printf ( "ERROR: no voxels loaded from %s.\n", m_Scene.c_str() );
 		return;
 	}
  	nmax = vgrid->theDim[0] * vgrid->theDim[1] * vgrid->theDim[2];
@@ -570,28 +752,8 @@ void FluidSystem::SPH_CreateExample ( int n, int nmax )  //currently creates a c
 	Reset ( nmax );
 
     // Init our adjacency list
-    short neighbors;
-    vgrid->adj[1][1][1] = 0;
-    for (int i = 0; i < vgrid->theDim[0]; i++) {
-        for (int j = 0; j < vgrid->theDim[2]; j++) {
-            for (int k = 0; k < vgrid->theDim[1]; k++) {
-                neighbors = 0;
-                if (vgrid->data[i][j][k]) { // if there is a voxel in that location
-                    if (i > 0 && vgrid->data[i-1][j][k]) neighbors++;
-                    if (i < vgrid->theDim[0] - 1 && vgrid->data[i+1][j][k]) neighbors++;
-
-                    if (j > 0 && vgrid->data[i][j-1][k]) neighbors++;
-                    if (j < vgrid->theDim[2] - 1 && vgrid->data[i][j+1][k]) neighbors++;
-
-                    if (k > 0 && vgrid->data[i][j][k-1]) neighbors++;
-                    if (k < vgrid->theDim[1] - 1 && vgrid->data[i][j][k+1]) neighbors++;
-                } else {
-                    neighbors = -1; //error state
-                }
-                vgrid->adj[i][j][k] = neighbors;
-            }
-        }
-    }
+	if ( m_Workers.NumThreads() == 0 ) m_Workers.Start ( 0 );
+    vgrid->computeAdjacency ( &m_Workers );
 
 	m_Param [ SPH_SIMSIZE ] = m_Param [ SPH_SIMSCALE ] * (m_Vec[SPH_VOLMAX].z - m_Vec[SPH_VOLMIN].z);
 	m_Param [ SPH_PDIST ] = pow ( m_Param[SPH_PMASS] / m_Param[SPH_RESTDENSITY], 1/3.0 );
@@ -613,7 +775,7 @@ void FluidSystem::SPH_CreateExample ( int n, int nmax )  //currently creates a c
 	// Local torque inertia of each particle
 	float radius = ((float)m_Param[SPH_PRADIUS]);
 	float mass = ((float)m_Param[SPH_PMASS]);
-	local_particle_inertia = Vector3(1.0f,1.0f,1.0f) * (0.4f * mass * radius * radius) * INERTIA_FACTOR;
+	local_particle_inertia = Vector3(1.0f,1.0f,1.0f) * (0.4f * mass * radius * radius) * m_Melt.inertia_factor;
 
 	float cell_size = m_Param[SPH_SMOOTHRADIUS]*2.0;			// Grid cell size (2r)
 	Grid_Setup ( m_Vec[SPH_VOLMIN], m_Vec[SPH_VOLMAX], m_Param[SPH_SIMSCALE], cell_size, 1.0 ); // Setup grid
@@ -624,6 +786,9 @@ void FluidSystem::SPH_CreateExample ( int n, int nmax )  //currently creates a c
 	vmin -= Vector3DF(2,2,2);
 	vmax =  m_Vec[SPH_VOLMAX];
 	vmax += Vector3DF(2,2,-2);
+
+	m_Memory.Reset ();
+	UpdateMemory ();
 }
 
 Matrix3 FluidSystem::ComputeInverseInertia(const Fluid* p) {
@@ -643,77 +808,309 @@ Matrix3 FluidSystem::ComputeInverseInertia(const Fluid* p) {
 }
 
 // Compute Pressures - Using spatial grid, and also create neighbor table
+namespace {
+	// Density, pressure and the neighbor table of a range of particles, and
+	// the neighbor counts of the range. Each particle writes only its own
+	// entries, and the counts are integers, so ranges can run on any thread
+	// and join in any grouping with the serial result.
+	class PressureJob : public mint::ReduceBody {
+	public:
+		PressureJob ( FluidSystem* sys ) : m_Sys ( sys )	{ Zero (); }
+
+		virtual ReduceBody* Fork ()
+		{
+			PressureJob* f = new PressureJob ( *this );
+			f->Zero ();
+			return f;
+		}
+
+		virtual void Run ( int begin, int end )
+		{
+			int cells[8];
+			for ( int i = begin; i < end; i++ ) {
+				Fluid* p = (Fluid*) (data + i*stride);
+				double sum = 1E-15;
+				int found = 0, candidates = 0;
+				nc[i] = 0;
+
+				m_Sys->Grid_FindCells ( p->pos, (float) radius, cells );
+				for (int cell=0; cell < 8; cell++) {
+					if ( cells[cell] == -1 ) continue;
+					int pndx = grid [ cells[cell] ];
+					while ( pndx != -1 ) {
+						Fluid* pcurr = (Fluid*) (data + pndx*stride);
+						if ( pcurr == p ) { pndx = pcurr->next; continue; }
+						candidates++;
+						double dx = ( p->pos.x - pcurr->pos.x)*d;		// dist in cm
+						double dy = ( p->pos.y - pcurr->pos.y)*d;
+						double dz = ( p->pos.z - pcurr->pos.z)*d;
+						double dsq = (dx*dx + dy*dy + dz*dz);
+						if ( mR2 > dsq ) {
+							double c = r2 - dsq;
+							sum += c * c * c;
+							found++;
+							if ( nc[i] < MAX_NEIGHBOR ) {
+								neighbor[i][ nc[i] ] = pndx;
+								ndist[i][ nc[i] ] = sqrt(dsq);
+								nc[i]++;
+							}
+						}
+						pndx = pcurr->next;
+					}
+				}
+				hist [ found < NEIGHBOR_BINS ? found : NEIGHBOR_BINS-1 ]++;
+				total += found;
+				if ( found > max ) max = found;
+				if ( found > MAX_NEIGHBOR ) {
+					overflow++;
+					dropped += found - MAX_NEIGHBOR;
+				}
+				if ( candidates > max_candidates ) max_candidates = candidates;
+				p->density = sum * pmass * poly6;
+				if (p->state == LIQUID)
+					p->pressure = ( p->density - restdensity ) * intstiff;
+				else
+					p->pressure = ( p->density - restdensity ) * int_stiff_ice;
+				p->density = 1.0f / p->density;
+			}
+		}
+
+		virtual void Join ( ReduceBody& later )
+		{
+			PressureJob& o = (PressureJob&) later;
+			for (int n=0; n < NEIGHBOR_BINS; n++) hist[n] += o.hist[n];
+			total += o.total;
+			if ( o.max > max ) max = o.max;
+			overflow += o.overflow;
+			dropped += o.dropped;
+			if ( o.max_candidates > max_candidates ) max_candidates = o.max_candidates;
+		}
+
+		char*			data;
+		int				stride;
+		int*			grid;
+		unsigned short*	nc;					// neighbor table
+		unsigned short	(*neighbor)[MAX_NEIGHBOR];
+		float			(*ndist)[MAX_NEIGHBOR];
+		double			radius, d, mR2, r2, pmass, poly6, restdensity, intstiff;
+		float			int_stiff_ice;
+
+		// Counts of the range
+		int				hist[NEIGHBOR_BINS];
+		double			total;
+		int				max, overflow, dropped, max_candidates;
+
+	private:
+		void Zero ()
+		{
+			memset ( hist, 0, sizeof(hist) );
+			total = 0;
+			max = overflow = dropped = max_candidates = 0;
+		}
+		FluidSystem*	m_Sys;
+	};
+}
+
+// Splits the particles into ranges of about equal work for the pressure
+// and boundary passes. Both loop over neighbors, so a particle costs its
+// neighbor count of the last step, plus BALANCE_BASE for the work every
+// particle has: once water pools, the ranges over the puddles get shorter
+// than those over sparse spray. The counts change slowly, so the ranges
+// are kept for BALANCE_INTERVAL steps, or until the particles change.
+void FluidSystem::Balance ()
+{
+	int num = NumPoints();
+	if ( !m_Balance.empty() && m_Balance.back() == num && ++m_BalanceAge < BALANCE_INTERVAL ) return;
+	int ranges = m_Workers.NumThreads() * 4;	// a few per worker, for stealing
+	if ( ranges > num / PRESSURE_GRAIN ) ranges = num / PRESSURE_GRAIN;
+	if ( ranges < 1 ) ranges = 1;
+	mint::PartitionByCost ( m_NC, num, BALANCE_BASE, ranges, m_Balance );
+	m_BalanceAge = 0;
+}
+
 void FluidSystem::SPH_ComputePressureGrid ()
 {
-	char *dat1, *dat1_end;
-	Fluid* p;
-	Fluid* pcurr;
-	int pndx;
-	int i, cnt = 0;
-	double dx, dy, dz, sum, dsq, c;
-	double d, d2, mR, mR2;
-	double radius = m_Param[SPH_SMOOTHRADIUS] / m_Param[SPH_SIMSCALE];
-	d = m_Param[SPH_SIMSCALE];
-	d2 = d*d;
-	mR = m_Param[SPH_SMOOTHRADIUS];
-	mR2 = mR*mR;	
+	NeighborStats& ns = m_NStats;
+	ns.particles = NumPoints();
+	ns.max_cell = 0;
+	for (int n=0; n < m_GridTotal; n++)
+		if ( m_GridCnt[n] > ns.max_cell ) ns.max_cell = m_GridCnt[n];
+
+	PressureJob job ( this );
+	job.data = mBuf[0].data;
+	job.stride = mBuf[0].stride;
+	job.grid = m_Grid.empty() ? 0x0 : &m_Grid[0];
+	job.nc = m_NC;
+	job.neighbor = m_Neighbor;
+	job.ndist = m_NDist;
+	job.radius = m_Param[SPH_SMOOTHRADIUS] / m_Param[SPH_SIMSCALE];
+	job.d = m_Param[SPH_SIMSCALE];
+	job.mR2 = m_Param[SPH_SMOOTHRADIUS] * m_Param[SPH_SMOOTHRADIUS];
+	job.r2 = m_R2;
+	job.pmass = m_Param[SPH_PMASS];
+	job.poly6 = m_Poly6Kern;
+	job.restdensity = m_Param[SPH_RESTDENSITY];
+	job.intstiff = m_Param[SPH_INTSTIFF];
+	job.int_stiff_ice = m_Melt.int_stiff_ice;
+	if ( m_Balance.empty() || m_Balance.back() != NumPoints() ) Balance ();
+	mint::ParallelReduce ( &m_Workers, m_Balance, job );
+
+	memcpy ( ns.hist, job.hist, sizeof(ns.hist) );
+	ns.max = job.max;
+	ns.overflow = job.overflow;
+	ns.dropped = job.dropped;
+	ns.max_candidates = job.max_candidates;
+	ns.mean = ns.particles > 0 ? job.total / ns.particles : 0;
+	if ( ns.overflow > 0 ) {
+		if ( ns.overflow_steps++ == 0 )
+			printf ( "WARNING: %d particles have more than MAX_NEIGHBOR (%d) neighbors, up to %d; the rest are left out of the forces.\n",
+					 ns.overflow, MAX_NEIGHBOR, ns.max );
+	}
+}
 
-	dat1_end = mBuf[0].data + NumPoints()*mBuf[0].stride;
-	i = 0;
-	for ( dat1 = mBuf[0].data; dat1 < dat1_end; dat1 += mBuf[0].stride, i++ ) {
-		p = (Fluid*) dat1;
+void FluidSystem::PrintNeighborStats ()
+{
+	const NeighborStats& ns = m_NStats;
+	printf ( "neighbors      %.1f mean, %d max of %d kept; %d particles over (%d neighbors dropped), %d steps with overflow\n",
+			 ns.mean, ns.max, MAX_NEIGHBOR, ns.overflow, ns.dropped, ns.overflow_steps );
+	printf ( "grid cells     %d particles in the fullest cell, %d candidates tested for one particle\n", ns.max_cell, ns.max_candidates );
+
+	// The histogram in groups of ten counts, the last group open-ended
+	printf ( "histogram     " );
+	for (int n=0; n < NEIGHBOR_BINS; n += 10) {
+		int cnt = 0;
+		for (int k=n; k < n+10 && k < NEIGHBOR_BINS; k++) cnt += ns.hist[k];
+		if ( n+10 < NEIGHBOR_BINS )	printf ( " %d-%d:%d", n, n+9, cnt );
+		else						printf ( " %d+:%d", n, cnt );
+	}
+	printf ( "\n" );
+}
+
+namespace {
+	// Boundary pass over one block of particles: the block's first solid
+	// particle touching a wall along each axis, and its share of the
+	// ice-water force. Blocks are combined in index order, so the first
+	// contact is the one the serial loop finds, and the sums depend on the
+	// block size only, not on which thread ran which block.
+	struct BoundaryPartial {
+		bool		hit[3];				// contact with a z, x or y wall
+		Vector3DF	wall[3];			// its force
+		Vector3DF	ice;				// x and y of the ice-water force
+		double		ice_z;
+		bool		liquid;				// a solid particle has a liquid neighbor
+	};
+
+	class BoundaryJob : public mint::ParallelBody {
+	public:
+		virtual void Run ( int begin, int end )
+		{
+			for ( int b = begin; b < end; b++ ) {
+				mint::ScopedTrace t ( "boundary block" );
+				Block ( bounds[b], bounds[b+1], part[b] );
+			}
+		}
+
+		char*			data;
+		int				stride;
+		std::vector<int>	bounds;			// particles of block b are [bounds[b], bounds[b+1])
+		unsigned short*	nc;					// neighbor table
+		unsigned short	(*neighbor)[MAX_NEIGHBOR];
+		double			radius, stiff, damp, ss, pmass, time;
+		double			zmin_slope, xmin_sin, xmax_sin;
+		bool			wrap_x;
+		Vector3DF		min, max;
+		float			ice_water, k_ice;
+		std::vector<BoundaryPartial>	part;
+
+	private:
+		void Wall ( BoundaryPartial& bp, int axis, Vector3DF norm, double adj )
+		{
+			bp.wall[axis] = norm;
+			bp.wall[axis] *= adj;
+			bp.wall[axis] /= pmass;
+			bp.hit[axis] = true;
+		}
 
-		sum = 1E-15;	
-		m_NC[i] = 0;
-
-		Grid_FindCells ( p->pos, radius );
-		for (int cell=0; cell < 8; cell++) {
-			if ( m_GridCell[cell] != -1 ) {
-				pndx = m_Grid [ m_GridCell[cell] ];				
-				while ( pndx != -1 ) {					
-					pcurr = (Fluid*) (mBuf[0].data + pndx*mBuf[0].stride);					
-					if ( pcurr == p ) {pndx = pcurr->next; continue; }
-					dx = ( p->pos.x - pcurr->pos.x)*d;		// dist in cm
-					dy = ( p->pos.y - pcurr->pos.y)*d;
-					dz = ( p->pos.z - pcurr->pos.z)*d;
-					dsq = (dx*dx + dy*dy + dz*dz);
-					if ( mR2 > dsq ) {
-						c =  m_R2 - dsq;
-						sum += c * c * c;
-						if ( m_NC[i] < MAX_NEIGHBOR ) {
-							m_Neighbor[i][ m_NC[i] ] = pndx;
-							m_NDist[i][ m_NC[i] ] = sqrt(dsq);
-							m_NC[i]++;
+		void Block ( int first, int last, BoundaryPartial& bp )
+		{
+			Vector3DF norm, dist;
+			double diff_dist;
+			bp.hit[0] = bp.hit[1] = bp.hit[2] = false;
+			bp.ice.Set ( 0, 0, 0 );
+			bp.ice_z = 0;
+			bp.liquid = false;
+
+			for ( int i = first; i < last; i++ ) {
+				Fluid* p = (Fluid*) (data + i*stride);
+				if ( p->state != SOLID ) continue;
+
+				// Z-axis walls
+				if ( !bp.hit[0] ) {
+					diff_dist = 2 * radius - ( p->pos.z - min.z - (p->pos.x - min.x) * zmin_slope )*ss;
+					if (diff_dist > EPSILON) {
+						norm.Set ( -zmin_slope, 0, 1.0 - zmin_slope );
+						Wall ( bp, 0, norm, stiff * diff_dist - damp * norm.Dot ( p->vel_eval ) );
+					} else {
+						diff_dist = 2 * radius - ( max.z - p->pos.z )*ss;
+						if (diff_dist > EPSILON) {
+							norm.Set ( 0, 0, -1 );
+							Wall ( bp, 0, norm, stiff * diff_dist - damp * norm.Dot ( p->vel_eval ) );
 						}
 					}
-					pndx = pcurr->next;
+				}
+				// X-axis walls
+				if ( !bp.hit[1] && !wrap_x ) {
+					diff_dist = 2 * radius - ( p->pos.x - min.x + (sin(time*10.0)-1+(p->pos.y*0.025)*0.25) * xmin_sin )*ss;
+					if (diff_dist > EPSILON) {
+						norm.Set ( 1.0, 0, 0 );
+						Wall ( bp, 1, norm, (xmin_sin + 1) * stiff * diff_dist - damp * norm.Dot ( p->vel_eval ) );
+					} else {
+						diff_dist = 2 * radius - ( max.x - p->pos.x + (sin(time*10.0)-1) * xmax_sin )*ss;
+						if (diff_dist > EPSILON) {
+							norm.Set ( -1, 0, 0 );
+							Wall ( bp, 1, norm, (xmax_sin + 1) * stiff * diff_dist - damp * norm.Dot ( p->vel_eval ) );
+						}
+					}
+				}
+				// Y-axis walls
+				if ( !bp.hit[2] ) {
+					diff_dist = 2 * radius - ( p->pos.y - min.y )*ss;
+					if (diff_dist > EPSILON) {
+						norm.Set ( 0, 1, 0 );
+						Wall ( bp, 2, norm, stiff * diff_dist - damp * norm.Dot ( p->vel_eval ) );
+					} else {
+						diff_dist = 2 * radius - ( max.y - p->pos.y )*ss;
+						if (diff_dist > EPSILON) {
+							norm.Set ( 0, -1, 0 );
+							Wall ( bp, 2, norm, stiff * diff_dist - damp * norm.Dot ( p->vel_eval ) );
+						}
+					}
+				}
+
+				// Ice-water force from the liquid neighbors
+				for (int j = 0; j < nc[i]; ++j) {
+					Fluid* pcurr = (Fluid*) (data + neighbor[i][j]*stride);
+					if (pcurr->state == LIQUID){
+						dist = pcurr->pos;
+						dist -= p->pos;
+						float length  = dist.Length();
+						dist /= (length * length);
+
+						bp.ice.x += ice_water * k_ice * dist.x;
+						bp.ice.y += ice_water * k_ice * dist.y;
+						bp.ice_z += ice_water * k_ice * dist.z;
+						bp.liquid = true;
+					}
 				}
 			}
-			m_GridCell[cell] = -1;
 		}
-		p->density = sum * m_Param[SPH_PMASS] * m_Poly6Kern;
-
-        if (p->state == LIQUID) {
-			p->pressure = ( p->density - m_Param[SPH_RESTDENSITY] ) * m_Param[SPH_INTSTIFF];
-        } else {
-			p->pressure = ( p->density - m_Param[SPH_RESTDENSITY] ) * INT_STIFF_ICE;
-        }
-		//if(p->density != 0)
-		//	std::cout << "NONZero"  << std::endl;
-       // if (p->density != 0) {
-           p->density = 1.0f / p->density;
-        //p->density = 1.0;
-		//} else {
-		 // p->density = 1.0f / (p->density + 1E-10);
-		//}
-    }
+	};
 }
 
 // Compute Forces - Using spatial grid with saved neighbor table. Fastest.
 void FluidSystem::SPH_ComputeForceGridNC ()
 {
 	char *dat1, *dat1_end;	
-    char* dat2;
 	Fluid *p, *pcurr;
 	Vector3DF force, fcurr;
 	register float pterm, vterm, dterm;
@@ -733,13 +1130,22 @@ void FluidSystem::SPH_ComputeForceGridNC ()
 	mR2 = (mR*mR);
 	visc = m_Param[SPH_VISC];
 
+	// Melt parameters, read once per step
+	const MeltParams& mp = m_Melt;
+	float k_ice = mp.k_ice, k_water = mp.k_water, ice_water = mp.ice_water;
+	float bound_liquid = mp.bound_liquid;
+	float c_ice = mp.c_ice, c_water = mp.c_water;
+	float conductivity = mp.thermal_conductivity, ambient_t = mp.ambient_t, ice_t = mp.ice_t;
+	float cap_ice = mp.heat_capacity_ice * mp.mass_h2o, cap_water = mp.heat_capacity_water * mp.mass_h2o;
+	float heat_radius = mp.p_pradius;
+	double heat_kern = 45.0f/(3.141592 * pow(heat_radius, 6));
+
 	dat1_end = mBuf[0].data + NumPoints()*mBuf[0].stride;
     i = 0;
 	int count = 1; 
     Vector3DF anti_grav;
     
     // Checking the boundary
-    double diff_dist, adj;
 	double stiff = m_Param[SPH_EXTSTIFF];
 	double damp = m_Param[SPH_EXTDAMP];
 	double radius = m_Param[SPH_PRADIUS];
@@ -748,132 +1154,72 @@ void FluidSystem::SPH_ComputeForceGridNC ()
     bool touch_ground = false;
     Vector3DF anti_gravity;
 	Vector3DF ice_force;
-    Vector3DF norm;
 	Vector3DF min = m_Vec[SPH_VOLMIN];
 	Vector3DF max = m_Vec[SPH_VOLMAX];
 	Vector3DF dist;
 	Vector3DF diff;
 	anti_gravity.Set(0.0f, 0.0f, 0.0f);
 
-	// Calculate the anti-gravity force
-    for( dat2 = mBuf[0].data; dat2 < dat1_end; dat2 += mBuf[0].stride) {
-    	// Z-axis walls
-        p = (Fluid*) dat2;
-		diff_dist = 2 * radius - ( p->pos.z - min.z - (p->pos.x - m_Vec[SPH_VOLMIN].x) * m_Param[BOUND_ZMIN_SLOPE] )*ss;
-		if (diff_dist > EPSILON && p->state == SOLID) {			
-			norm.Set ( -m_Param[BOUND_ZMIN_SLOPE], 0, 1.0 - m_Param[BOUND_ZMIN_SLOPE] );
-			adj = stiff * diff_dist - damp * norm.Dot ( p->vel_eval );
-            anti_gravity = norm;
-            anti_gravity *= adj;
-            anti_gravity /= m_Param[SPH_PMASS];
-            touch_ground = true;
-			break;
-		}
-		diff_dist = 2 * radius - ( max.z - p->pos.z )*ss;
-		if (diff_dist > EPSILON && p->state == SOLID) {
-			norm.Set ( 0, 0, -1 );
-			adj = stiff * diff_dist - damp * norm.Dot ( p->vel_eval );
-			anti_gravity = norm;
-			anti_gravity *= adj;
-			anti_gravity /= m_Param[SPH_PMASS];
-			touch_ground = true;
-			break;
-		}
-    }
-
-	Vector3DF force_x;
-	for( dat2 = mBuf[0].data; dat2 < dat1_end; dat2 += mBuf[0].stride) {
-		// X-axis walls
-		p = (Fluid*) dat2;
-		if ( !m_Toggle[WRAP_X] ) {
-			diff_dist = 2 * radius - ( p->pos.x - min.x + (sin(m_Time*10.0)-1+(p->pos.y*0.025)*0.25) * m_Param[FORCE_XMIN_SIN] )*ss;	
-			if (diff_dist > EPSILON && p->state == SOLID) {
-				norm.Set ( 1.0, 0, 0 );
-				adj = (m_Param[ FORCE_XMIN_SIN ] + 1) * stiff * diff_dist - damp * norm.Dot ( p->vel_eval ) ;
-				force_x = norm;
-				force_x *= adj;
-				force_x /= m_Param[SPH_PMASS];
-				anti_gravity += force_x;
-				touch_ground = true;
-				break;
-			}
-			diff_dist = 2 * radius - ( max.x - p->pos.x + (sin(m_Time*10.0)-1) * m_Param[FORCE_XMAX_SIN] )*ss;	
-			if (diff_dist > EPSILON && p->state == SOLID) {
-				norm.Set ( -1, 0, 0 );
-				adj = (m_Param[ FORCE_XMAX_SIN ]+1) * stiff * diff_dist - damp * norm.Dot ( p->vel_eval );
-				force_x = norm;
-				force_x *= adj;
-				force_x /= m_Param[SPH_PMASS];
-				anti_gravity += force_x;
-				touch_ground = true;
-				break;
-			}
-		}  // END IF TOGGLE WRAP_X
-	}  // END FOR LOOP
-
-	Vector3DF force_y;
-	for( dat2 = mBuf[0].data; dat2 < dat1_end; dat2 += mBuf[0].stride) {
-		// Y-axis walls
-		p = (Fluid*) dat2;
-		diff_dist = 2 * radius - ( p->pos.y - min.y )*ss;			
-		if (diff_dist > EPSILON && p->state == SOLID) {
-			norm.Set ( 0, 1, 0 );
-			adj = stiff * diff_dist - damp * norm.Dot ( p->vel_eval );
-			force_y = norm;
-			force_y *= adj;
-			force_y /= m_Param[SPH_PMASS];
-			anti_gravity += force_y;
-			touch_ground = true;
-			break;
-		}
-		diff_dist = 2 * radius - ( max.y - p->pos.y )*ss;
-		if (diff_dist > EPSILON && p->state == SOLID) {
-			norm.Set ( 0, -1, 0 );
-			adj = stiff * diff_dist - damp * norm.Dot ( p->vel_eval );
-			force_y = norm;
-			force_y *= adj;
-			force_y /= m_Param[SPH_PMASS];
-			anti_gravity += force_y;
-			touch_ground = true;
-			break;
-		}
-	}  // END FOR LOOP
-
-
-
-	// Calculate the ice-water force
-	i = 0;
-	double z_ice_force;
+	mint::ScopedTimer boundary ( m_Profile, PHASE_BOUNDARY );
+	boundary.Items ( NumPoints() );
+
+	// Wall contacts and the ice-water force, in blocks of particles. In
+	// deterministic mode the blocks have REDUCE_BLOCK particles whatever the
+	// number of workers; otherwise they are the balanced ranges of Balance.
+	BoundaryJob job;
+	job.data = mBuf[0].data;
+	job.stride = mBuf[0].stride;
+	job.nc = m_NC;
+	job.neighbor = m_Neighbor;
+	job.radius = radius;	job.stiff = stiff;	job.damp = damp;	job.ss = ss;
+	job.pmass = m_Param[SPH_PMASS];
+	job.time = m_Time;
+	job.zmin_slope = m_Param[BOUND_ZMIN_SLOPE];
+	job.xmin_sin = m_Param[FORCE_XMIN_SIN];
+	job.xmax_sin = m_Param[FORCE_XMAX_SIN];
+	job.wrap_x = m_Toggle[WRAP_X];
+	job.min = min;
+	job.max = max;
+	job.ice_water = ice_water;
+	job.k_ice = k_ice;
+	int num = NumPoints();
+	if ( m_bDeterministic || m_Balance.empty() || m_Balance.back() != num ) {
+		for (int b = 0; b < num; b += REDUCE_BLOCK)
+			job.bounds.push_back ( b );
+		job.bounds.push_back ( num );
+	} else
+		job.bounds = m_Balance;
+	int blocks = (int) job.bounds.size() - 1;
+	job.part.resize ( blocks );
+	mint::ParallelFor ( &m_Workers, 0, blocks, 1, job );
+
+	// Combined in block order: the first contact along each axis, and the sums
+	int first[3] = { -1, -1, -1 };
+	double z_ice_force = 0;
 	bool liquid = false;
-	for ( dat2 = mBuf[0].data; dat2 < dat1_end; dat2 += mBuf[0].stride, ++i) {
-		p = (Fluid*) dat2; 
-		if (p->state == SOLID) {
-			for (int j = 0; j < m_NC[i]; ++j) {
-				pcurr = (Fluid*) (mBuf[0].data + m_Neighbor[i][j]*mBuf[0].stride);
-				if (pcurr->state == LIQUID){
-					dist = pcurr->pos;
-					dist -= p->pos;
-					float length  = dist.Length();
-					dist /= (length * length);
-
-					ice_force.x += ICE_WATER * K_ICE * dist.x;
-					ice_force.y += ICE_WATER * K_ICE * dist.y;
-					z_ice_force += ICE_WATER * K_ICE * dist.z;
-					//ice_force.z += ICE_WATER * K_ICE * dist.z;
-					liquid = true;
-				}
-			}  // END OF FINDING NEIGHBOR FOR-LOOP 
-		}  // END OF IF P->STATE IS SOLID
-	}  // EBD OF PARTICLE FOR-LOOP 	
+	for (int b = 0; b < blocks; b++) {
+		const BoundaryPartial& bp = job.part[b];
+		for (int a = 0; a < 3; a++)
+			if ( first[a] < 0 && bp.hit[a] ) first[a] = b;
+		ice_force.x += bp.ice.x;
+		ice_force.y += bp.ice.y;
+		z_ice_force += bp.ice_z;
+		if ( bp.liquid ) liquid = true;
+	}
+	if ( first[0] >= 0 ) anti_gravity = job.part[first[0]].wall[0];
+	if ( first[1] >= 0 ) anti_gravity += job.part[first[1]].wall[1];
+	if ( first[2] >= 0 ) anti_gravity += job.part[first[2]].wall[2];
+	touch_ground = ( first[0] >= 0 || first[1] >= 0 || first[2] >= 0 );
+
 	if (liquid) {
 		if (!touch_ground) {
 			double anti_g = 9.8 /(m_Param[SPH_PMASS]);
-			if (z_ice_force > 0 && z_ice_force <= BOUND_LIQUID) {
+			if (z_ice_force > 0 && z_ice_force <= bound_liquid) {
 				//std::cout << "GREATER FORCE " << std::endl;
 				ice_force.z = anti_g - z_ice_force; //- 500;
 			} else {
 				//std::cout << "Ice _force " << z_ice_force << std::endl;
-				ice_force.z = anti_g - BOUND_LIQUID; //force.z;
+				ice_force.z = anti_g - bound_liquid; //force.z;
 			}
 			// ice_force.z -= force_z;
 		}
@@ -885,6 +1231,12 @@ void FluidSystem::SPH_ComputeForceGridNC ()
 	//ice_force.z = 0.0;
 	//ice_force.y = 0.0;
 	//ice_force.x = 0.0;
+	boundary.Stop ();
+
+	// Forces, heat and phase change share the neighbor loop, and a particle
+	// that melts is seen as liquid by the particles after it
+	mint::ScopedTimer forces ( m_Profile, PHASE_FORCE );
+	forces.Items ( NumPoints() );
 	i = 0;
     for ( dat1 = mBuf[0].data; dat1 < dat1_end; dat1 += mBuf[0].stride, i++ ) {
         // reset all instance variables
@@ -923,7 +1275,7 @@ void FluidSystem::SPH_ComputeForceGridNC ()
             length = diff.Length();
 
             //lap_kern = m_LapKern * (m_Param[SPH_SMOOTHRADIUS] - length);
-			lap_kern =  45.0f/(3.141592 * pow(P_PRADIUS, 6)) * (P_PRADIUS - length);
+			lap_kern =  heat_kern * (heat_radius - length);
             neighbor_temp += m_Param [ SPH_PMASS ] * ((pcurr->temp - p->temp)/pcurr->density) * lap_kern; // Newtonian Heat Transfer
 
 			// Calculate interfacial force 
@@ -940,13 +1292,13 @@ void FluidSystem::SPH_ComputeForceGridNC ()
 				force.z += ( pterm * dz + vterm * (pcurr->vel_eval.z - p->vel_eval.z) ) * dterm;
 
 				if (pcurr->state == LIQUID) {
-					force.x += K_WATER * dist.x;
-					force.y += K_WATER * dist.y;
-					force.z += K_WATER * dist.z;
+					force.x += k_water * dist.x;
+					force.y += k_water * dist.y;
+					force.z += k_water * dist.z;
 				} else { //SOLID
-					force.x += K_ICE * dist.x;
-					force.y += K_ICE * dist.y;
-					force.z += K_ICE * dist.z;
+					force.x += k_ice * dist.x;
+					force.y += k_ice * dist.y;
+					force.z += k_ice * dist.z;
 				}
             }  // END IF p->state is LIQUID
         }  
@@ -954,9 +1306,9 @@ void FluidSystem::SPH_ComputeForceGridNC ()
         p->sph_force = force;
 		// Apply thermal diffusion based on the state of particle i
         if (p->state == LIQUID) {
-			neighbor_temp *= C_WATER;
+			neighbor_temp *= c_water;
         } else { 
-			neighbor_temp *= C_ICE;
+			neighbor_temp *= c_ice;
         }
 
 		p->temp_eval += neighbor_temp;
@@ -965,25 +1317,18 @@ void FluidSystem::SPH_ComputeForceGridNC ()
         if (p->state == SOLID) { // check surface particle?
             //sa = (6.0 - vgrid->adj[pi][pj][pk])/6.0; // * (edge * edge * 6.0);
 			//sa = (6.0 - vgrid->adj[pi][pj][pk])/(vgrid->voxelSize[0] * vgrid->voxelSize[0] * 6.0);// * (edge * edge * 6.0);
-            sa = (vgrid->voxelSize[0] * vgrid->voxelSize[0])*(6.0 - vgrid->adj[pi][pj][pk]);
-			Qi = THERMAL_CONDUCTIVITY * (AMBIENT_T - p->temp) * sa;
-            dT = Qi / (HEAT_CAPACITY_ICE * MASS_H2O);//m_Param [ SPH_PMASS ]);
+            sa = (vgrid->voxelSize[0] * vgrid->voxelSize[0])*(6.0 - vgrid->adj[vgrid->index(pi, pj, pk)]);
+			Qi = conductivity * (ambient_t - p->temp) * sa;
+            dT = Qi / cap_ice;//m_Param [ SPH_PMASS ]);
         } else if (p->state == LIQUID) {
-			Qi = THERMAL_CONDUCTIVITY * (AMBIENT_T - p->temp);
-            dT = Qi / (HEAT_CAPACITY_WATER * MASS_H2O);//m_Param [ SPH_PMASS ]);
+			Qi = conductivity * (ambient_t - p->temp);
+            dT = Qi / cap_water;//m_Param [ SPH_PMASS ]);
         }
         p->temp_eval += dT; //what?
 
         
-		if (p->temp > ICE_T && p->state == SOLID) { // change state and update neighboring voxels
-            vgrid->data[pi][pj][pk] = 0; // set to no particle
-			vgrid->adj[pi][pj][pk] = -1;
-            if (pi + 1 < vgrid->theDim[0]) vgrid->adj[pi+1][pj][pk]--;
-            if (pi - 1 > 0) vgrid->adj[pi-1][pj][pk]--;
-            if (pj + 1 < vgrid->theDim[2]) vgrid->adj[pi][pj+1][pk]--;
-            if (pj - 1 > 0) vgrid->adj[pi][pj-1][pk]--;
-            if (pk + 1 < vgrid->theDim[1]) vgrid->adj[pi][pj][pk+1]--;
-            if (pk - 1 > 0) vgrid->adj[pi][pj][pk-1]--;
+		if (p->temp > ice_t && p->state == SOLID) { // change state and update neighboring voxels
+            vgrid->removeVoxel(pi, pj, pk); // set to no particle, update neighbors
             p->state = LIQUID;
 		}
 	}
@@ -1032,12 +1377,349 @@ void FluidSystem::ComputeAngularVelocity(){
 
 void FluidSystem::SPH_DrawSurface()
 {
+	mint::ScopedTimer t ( m_Profile, PHASE_SURFACE );
+	t.Items ( NumPoints() );
+
 	// Change surface reconstructiong parm
-	m_marchCube->setThreshold(MARCH_THRESHOLD);
+	m_marchCube->setThreshold(m_Melt.march_threshold);
 	m_marchCube->setSize((m_Vec[SPH_VOLMAX].x-m_Vec[SPH_VOLMIN].x)+10,(m_Vec[SPH_VOLMAX].y-m_Vec[SPH_VOLMIN].y)+10,(m_Vec[SPH_VOLMAX].z-m_Vec[SPH_VOLMIN].z)+10);
-	m_marchCube->setRes(MARCH_RESO, MARCH_RESO, MARCH_RESO);
+	m_marchCube->setRes(m_Melt.march_reso, m_Melt.march_reso, m_Melt.march_reso);
 	m_marchCube->setCenter(0.0,0.0,0.0);
 	m_marchCube->march(*m_surface);
+	UpdateMemory ();
+}
+
+// Copies positions and densities so the surface can be meshed on another
+// thread while the simulation keeps stepping.
+void FluidSystem::SnapshotSurface ( SurfaceSnapshot& snap, int frame )
+{
+	mint::ScopedTimer t ( m_Profile, PHASE_SNAPSHOT );
+	t.Items ( NumPoints() );
+	char* dat = mBuf[0].data;
+	char* dat_end = dat + NumPoints()*mBuf[0].stride;
+	int n = 0;
+
+	snap.frame = frame;
+	snap.pos.resize ( NumPoints() );
+	snap.density.resize ( NumPoints() );
+	for ( ; dat < dat_end; dat += mBuf[0].stride, n++ ) {
+		snap.pos[n] = ((Fluid*) dat)->pos;
+		snap.density[n] = ((Fluid*) dat)->density;
+	}
+	snap.simscale = m_Param[SPH_SIMSCALE];
+	snap.radius = m_Param[SPH_SMOOTHRADIUS];
+	snap.pmass = m_Param[SPH_PMASS];
+	snap.poly6kern = m_Poly6Kern;
+	snap.volmin = m_Vec[SPH_VOLMIN];
+	snap.volmax = m_Vec[SPH_VOLMAX];
+	snap.threshold = m_Melt.march_threshold;
+	snap.reso = m_Melt.march_reso;
+}
+
+static unsigned int AlignSection ( unsigned int pos )
+{
+	return (pos + CHECKPOINT_ALIGN-1) & ~(CHECKPOINT_ALIGN-1);
+}
+
+namespace {
+	// Codes the particle attributes of buffer 0 as separate columns for a
+	// CHECKPOINT_QUANT particle section, one attribute per job.
+	class AttributeCodecJob : public mint::ParallelBody {
+	public:
+		AttributeCodecJob ( GeomX& geom, char* data, int num, double error )
+			: m_Geom ( geom ), m_Data ( data ), m_Num ( num ), m_Error ( error ), m_bDecode ( false ), m_bOk ( true )
+		{
+			m_Streams.resize ( geom.GetNumAttr() );
+			m_In.assign ( geom.GetNumAttr(), (const char*) 0x0 );
+			m_InSize.assign ( geom.GetNumAttr(), 0 );
+		}
+
+		unsigned int PackedSize ()
+		{
+			unsigned int size = 0;
+			for ( int a = 0; a < (int) m_Streams.size(); a++ )
+				if ( m_Geom.GetAttribute(a)->buf == 0 )
+					size += sizeof(unsigned int) + (unsigned int) m_Streams[a].size();
+			return size;
+		}
+		void Pack ( char* dest )
+		{
+			for ( int a = 0; a < (int) m_Streams.size(); a++ ) {
+				if ( m_Geom.GetAttribute(a)->buf != 0 ) continue;
+				unsigned int size = (unsigned int) m_Streams[a].size();
+				memcpy ( dest, &size, sizeof(size) );
+				if ( size > 0 ) memcpy ( dest + sizeof(size), &m_Streams[a][0], size );
+				dest += sizeof(size) + size;
+			}
+		}
+		// Points the jobs at the streams of a packed section
+		bool Unpack ( const char* src, unsigned int total )
+		{
+			m_bDecode = true;
+			const char* end = src + total;
+			for ( int a = 0; a < (int) m_In.size(); a++ ) {
+				if ( m_Geom.GetAttribute(a)->buf != 0 ) continue;
+				unsigned int size;
+				if ( end - src < (ptrdiff_t) sizeof(size) ) return false;
+				memcpy ( &size, src, sizeof(size) );
+				src += sizeof(size);
+				if ( (unsigned int) (end - src) < size ) return false;
+				m_In[a] = src;
+				m_InSize[a] = size;
+				src += size;
+			}
+			return true;
+		}
+		bool IsOk ()		{ return m_bOk; }
+
+		virtual void Run ( int begin, int end )
+		{
+			for ( int a = begin; a < end; a++ ) {
+				GeomAttr* attr = m_Geom.GetAttribute ( a );
+				if ( attr->buf != 0 ) continue;
+				mint::ColumnCodec codec;
+				codec.Setup ( attr->dtype, attr->stride, m_Error );
+				char* base = m_Data + attr->offset;
+				if ( !m_bDecode )
+					codec.Encode ( base, m_Num, true, m_Streams[a], m_Geom.GetStride(0) );
+				else if ( !codec.Decode ( m_In[a], m_InSize[a], m_Num, base, m_Geom.GetStride(0) ) )
+					m_bOk = false;
+			}
+		}
+
+	private:
+		GeomX&								m_Geom;
+		char*								m_Data;
+		int									m_Num;
+		double								m_Error;
+		bool								m_bDecode;
+		bool								m_bOk;
+		std::vector< std::vector<char> >	m_Streams;
+		std::vector< const char* >			m_In;
+		std::vector< unsigned int >			m_InSize;
+	};
+}
+
+void FluidSystem::SnapshotCheckpoint ( std::vector<char>& image, int frame, double error )
+{
+	mint::ScopedTimer t ( m_Profile, PHASE_CHECKPOINT );
+	t.Items ( NumPoints() );
+	checkpoint_header hdr;
+	memset ( &hdr, 0, sizeof(hdr) );
+	memcpy ( hdr.magic, CHECKPOINT_MAGIC, 4 );
+	hdr.version = CHECKPOINT_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.frame = frame;
+	hdr.time = m_Time;
+	hdr.dt = m_DT;
+	hdr.param_count = MAX_PARAM;
+	hdr.num_particles = NumPoints();
+	hdr.max_particles = mBuf[0].max;
+	hdr.particle_stride = mBuf[0].stride;
+	hdr.kernel_r2 = m_R2;
+	hdr.kernel_poly6 = m_Poly6Kern;
+	hdr.kernel_lap = m_LapKern;
+	hdr.kernel_spiky = m_SpikyKern;
+	hdr.on_ground = on_ground ? 1 : 0;
+	for (int a=0; a < 3; a++) {
+		hdr.center_of_mass[a] = center_of_mass[a];
+		hdr.particle_inertia[a] = local_particle_inertia[a];
+	}
+
+	unsigned int vox_words = 0, vox_cells = 0;
+	if ( vgrid != 0x0 ) {
+		for (int a=0; a < 3; a++) {
+			hdr.voxel_dim[a] = vgrid->theDim[a];
+			hdr.voxel_size[a] = vgrid->voxelSize[a];
+			hdr.voxel_offset[a] = vgrid->offset[a];
+		}
+		hdr.voxel_words_per_row = vgrid->wordsPerRow;
+		vox_words = (unsigned int) vgrid->data.size();
+		vox_cells = (unsigned int) vgrid->adj.size();
+	}
+
+	std::string melt = m_Melt.Format ();
+	hdr.melt_size = (unsigned int) melt.size();
+
+	// Particle section, coded per attribute when asked
+	AttributeCodecJob codec ( *this, mBuf[0].data, hdr.num_particles, error );
+	hdr.particle_codec = CHECKPOINT_RAW;
+	hdr.particles_size = hdr.num_particles * hdr.particle_stride;
+	if ( error >= 0 ) {
+		mint::ParallelFor ( &m_Workers, 0, GetNumAttr(), 1, codec );
+		hdr.particle_codec = CHECKPOINT_QUANT;
+		hdr.particle_error = (float) error;
+		hdr.particles_size = codec.PackedSize ();
+	}
+
+	unsigned int pos = AlignSection ( sizeof(hdr) );
+	hdr.params_offset = pos;		pos = AlignSection ( pos + MAX_PARAM * sizeof(double) );
+	hdr.vecs_offset = pos;			pos = AlignSection ( pos + MAX_PARAM * 3 * sizeof(float) );
+	hdr.toggles_offset = pos;		pos = AlignSection ( pos + MAX_PARAM );
+	hdr.particles_offset = pos;		pos = AlignSection ( pos + hdr.particles_size );
+	hdr.voxels_offset = pos;		pos = AlignSection ( pos + vox_words * sizeof(VoxelGrid::VoxelWord) );
+	hdr.adjacency_offset = pos;		pos = AlignSection ( pos + vox_cells * sizeof(short) );
+	hdr.melt_offset = pos;			pos += hdr.melt_size;
+	hdr.file_size = pos;
+
+	image.assign ( pos, 0 );
+	char* buf = &image[0];
+	memcpy ( buf, &hdr, sizeof(hdr) );
+	memcpy ( buf + hdr.params_offset, m_Param, MAX_PARAM * sizeof(double) );
+	float* vecs = (float*) (buf + hdr.vecs_offset);
+	for (int n=0; n < MAX_PARAM; n++) {
+		vecs[n*3] = m_Vec[n].x;	vecs[n*3+1] = m_Vec[n].y;	vecs[n*3+2] = m_Vec[n].z;
+	}
+	for (int n=0; n < MAX_PARAM; n++)
+		buf[hdr.toggles_offset + n] = m_Toggle[n] ? 1 : 0;
+	if ( hdr.particle_codec == CHECKPOINT_QUANT )
+		codec.Pack ( buf + hdr.particles_offset );
+	else if ( hdr.num_particles > 0 )
+		memcpy ( buf + hdr.particles_offset, mBuf[0].data, hdr.num_particles * hdr.particle_stride );
+	if ( vox_words > 0 )
+		memcpy ( buf + hdr.voxels_offset, &vgrid->data[0], vox_words * sizeof(VoxelGrid::VoxelWord) );
+	if ( vox_cells > 0 )
+		memcpy ( buf + hdr.adjacency_offset, &vgrid->adj[0], vox_cells * sizeof(short) );
+	memcpy ( buf + hdr.melt_offset, melt.data(), melt.size() );
+}
+
+bool FluidSystem::SaveCheckpoint ( const char* filename, int frame, double error )
+{
+	std::vector<char> image;
+	SnapshotCheckpoint ( image, frame, error );
+	return WriteCheckpointFile ( filename, image );
+}
+
+// True if length bytes from offset lie within the file. In double, so that
+// lengths computed from a corrupt header cannot wrap around.
+static bool InCheckpoint ( unsigned int offset, double length, unsigned int file_size )
+{
+	return (double) offset + length <= (double) file_size;
+}
+
+// Restores a checkpoint written by SnapshotCheckpoint, in place of
+// SPH_CreateExample. The file is mapped and copied straight into the
+// particle buffer and voxel grid; the spatial grid is rebuilt from it.
+bool FluidSystem::LoadCheckpoint ( const char* filename, int& frame )
+{
+	mint::MappedFile file;
+	if ( !file.Open ( filename ) ) {
+		printf ( "Checkpoint %s not found.\n", filename );
+		return false;
+	}
+	const char* buf = file.GetData ();
+	size_t size = file.GetSize ();
+	checkpoint_header hdr;
+	if ( size < sizeof(hdr) ) {
+		printf ( "Checkpoint %s is truncated.\n", filename );
+		return false;
+	}
+	memcpy ( &hdr, buf, sizeof(hdr) );
+	if ( memcmp ( hdr.magic, CHECKPOINT_MAGIC, 4 ) != 0 || hdr.version != CHECKPOINT_VERSION || hdr.header_size != sizeof(hdr) ) {
+		printf ( "%s is not a supported checkpoint.\n", filename );
+		return false;
+	}
+	if ( hdr.file_size > size ) {
+		printf ( "Checkpoint %s is truncated.\n", filename );
+		return false;
+	}
+	if ( hdr.param_count != MAX_PARAM || hdr.particle_stride != sizeof(Fluid) || hdr.num_particles < 0 ||
+		 ( hdr.particle_codec != CHECKPOINT_RAW && hdr.particle_codec != CHECKPOINT_QUANT ) ||
+		 hdr.voxel_dim[0] < 0 || hdr.voxel_dim[1] < 0 || hdr.voxel_dim[2] < 0 ) {
+		printf ( "Checkpoint %s was written by an incompatible build.\n", filename );
+		return false;
+	}
+
+	// Every section within the file and the sizes consistent, before any
+	// state is touched
+	const char* corrupt = 0x0;
+	double cells = (double) hdr.voxel_dim[0] * hdr.voxel_dim[1] * hdr.voxel_dim[2];
+	double rows = (double) hdr.voxel_dim[1] * hdr.voxel_dim[2];
+	double particles_size = ( hdr.particle_codec == CHECKPOINT_QUANT ) ? hdr.particles_size : (double) hdr.num_particles * hdr.particle_stride;
+	if ( hdr.num_particles > MAX_NEIGHBOR_ROWS )
+		corrupt = "more particles than the neighbor table holds";
+	else if ( hdr.voxel_words_per_row != hdr.voxel_dim[0] / 64 + ( hdr.voxel_dim[0] % 64 != 0 ) )
+		corrupt = "voxel row width does not match the grid";
+	else if ( !InCheckpoint ( hdr.params_offset, MAX_PARAM * sizeof(double), hdr.file_size ) ||
+			  !InCheckpoint ( hdr.vecs_offset, MAX_PARAM * 3 * sizeof(float), hdr.file_size ) ||
+			  !InCheckpoint ( hdr.toggles_offset, MAX_PARAM, hdr.file_size ) ||
+			  !InCheckpoint ( hdr.particles_offset, particles_size, hdr.file_size ) ||
+			  !InCheckpoint ( hdr.voxels_offset, rows * hdr.voxel_words_per_row * sizeof(VoxelGrid::VoxelWord), hdr.file_size ) ||
+			  !InCheckpoint ( hdr.adjacency_offset, cells * sizeof(short), hdr.file_size ) ||
+			  !InCheckpoint ( hdr.melt_offset, hdr.melt_size, hdr.file_size ) )
+		corrupt = "a section runs past the end of the file";
+	if ( corrupt != 0x0 ) {
+		printf ( "%s: corrupt checkpoint, %s.\n", filename, corrupt );
+		return false;
+	}
+
+	// Decode a coded particle section before touching any state
+	if ( m_Workers.NumThreads() == 0 ) m_Workers.Start ( 0 );
+	const char* particles = buf + hdr.particles_offset;
+	std::vector<char> decoded;
+	if ( hdr.particle_codec == CHECKPOINT_QUANT ) {
+		decoded.assign ( (size_t) hdr.num_particles * hdr.particle_stride + 1, 0 );
+		AttributeCodecJob codec ( *this, &decoded[0], hdr.num_particles, hdr.particle_error );
+		bool ok = codec.Unpack ( buf + hdr.particles_offset, hdr.particles_size );
+		if ( ok ) {
+			mint::ParallelFor ( &m_Workers, 0, GetNumAttr(), 1, codec );
+			ok = codec.IsOk ();
+		}
+		if ( !ok ) {
+			printf ( "Checkpoint %s has a corrupt particle section.\n", filename );
+			return false;
+		}
+		particles = &decoded[0];
+	}
+	MeltParams melt;
+	if ( !melt.Parse ( std::string ( buf + hdr.melt_offset, hdr.melt_size ).c_str(), filename ) ) {
+		printf ( "Checkpoint %s has corrupt melt parameters.\n", filename );
+		return false;
+	}
+
+	frame = hdr.frame;
+	m_Time = hdr.time;
+	m_DT = hdr.dt;
+	m_Melt = melt;
+	memcpy ( m_Param, buf + hdr.params_offset, MAX_PARAM * sizeof(double) );
+	const float* vecs = (const float*) (buf + hdr.vecs_offset);
+	for (int n=0; n < MAX_PARAM; n++)
+		m_Vec[n].Set ( vecs[n*3], vecs[n*3+1], vecs[n*3+2] );
+	for (int n=0; n < MAX_PARAM; n++)
+		m_Toggle[n] = buf[hdr.toggles_offset + n] != 0;
+
+	href first;
+	int max_particles = hdr.max_particles < MAX_NEIGHBOR_ROWS ? hdr.max_particles : MAX_NEIGHBOR_ROWS;
+	ResetBuffer ( 0, max_particles > hdr.num_particles ? max_particles : hdr.num_particles );
+	if ( hdr.num_particles > 0 )
+		memcpy ( AddElems ( 0, hdr.num_particles, first ), particles, hdr.num_particles * hdr.particle_stride );
+
+	if ( vgrid == 0x0 ) vgrid = new VoxelGrid ();
+	vgrid->allocate ( hdr.voxel_dim );
+	for (int a=0; a < 3; a++) {
+		vgrid->voxelSize[a] = hdr.voxel_size[a];
+		vgrid->offset[a] = hdr.voxel_offset[a];
+	}
+	if ( !vgrid->data.empty() )
+		memcpy ( &vgrid->data[0], buf + hdr.voxels_offset, vgrid->data.size() * sizeof(VoxelGrid::VoxelWord) );
+	if ( !vgrid->adj.empty() )
+		memcpy ( &vgrid->adj[0], buf + hdr.adjacency_offset, vgrid->adj.size() * sizeof(short) );
+
+	m_R2 = hdr.kernel_r2;
+	m_Poly6Kern = hdr.kernel_poly6;
+	m_LapKern = hdr.kernel_lap;
+	m_SpikyKern = hdr.kernel_spiky;
+	on_ground = hdr.on_ground != 0;
+	center_of_mass = Vector3 ( hdr.center_of_mass[0], hdr.center_of_mass[1], hdr.center_of_mass[2] );
+	local_particle_inertia = Vector3 ( hdr.particle_inertia[0], hdr.particle_inertia[1], hdr.particle_inertia[2] );
+
+	// Derived state, as SPH_CreateExample sets it up
+	float cell_size = m_Param[SPH_SMOOTHRADIUS]*2.0;
+	Grid_Setup ( m_Vec[SPH_VOLMIN], m_Vec[SPH_VOLMAX], m_Param[SPH_SIMSCALE], cell_size, 1.0 );
+	Grid_InsertParticles ();
+
+	printf ( "Restored %d particles at frame %d (t = %f) from %s\n", hdr.num_particles, frame, m_Time, filename );
+	return true;
 }
 
 Double FluidSystem::eval(const Point3d& location)
@@ -1079,4 +1761,51 @@ Double FluidSystem::eval(const Point3d& location)
 	}
     xi = sum * m_Param[SPH_PMASS] * m_Poly6Kern;
 	return xi;
-}
\ No newline at end of file
+}
+// Same field as eval, with the analytic gradient of the poly6 sum gathered
+// in the same neighbor walk:  d/dx (h^2 - r^2)^3 = -6 (h^2 - r^2)^2 * dx
+Double FluidSystem::evalGrad(const Point3d& location, Vector3d& gradient)
+{
+	Fluid *pcurr;
+	int pndx;
+	Vector3DF position;
+	double c, d, dsq, w;
+	double dx, dy, dz, sum, gx, gy, gz, scale;
+	double mR, mR2;
+	float radius = (m_Param[SPH_SMOOTHRADIUS]) / (m_Param[SPH_SIMSCALE]);
+
+	position = Vector3DF(location[0],location[1],location[2]);
+	d = m_Param[SPH_SIMSCALE];
+	mR = m_Param[SPH_SMOOTHRADIUS];
+	mR2 = (mR*mR);
+	sum = 0.0;
+	gx = 0.0; gy = 0.0; gz = 0.0;
+
+	Grid_FindCells (position, radius);
+	for (int cell=0; cell < 8; cell++) {
+		if ( m_GridCell[cell] != -1 ) {
+			pndx = m_Grid [ m_GridCell[cell] ];
+			while ( pndx != -1 ) {
+				pcurr = (Fluid*) (mBuf[0].data + pndx*mBuf[0].stride);
+				dx = ( position.x - pcurr->pos.x)*d;		// dist in cm
+				dy = ( position.y - pcurr->pos.y)*d;
+				dz = ( position.z - pcurr->pos.z)*d;
+				dsq = (dx*dx + dy*dy + dz*dz);
+
+				if ( mR2 > dsq ) {
+					c =  mR2 - dsq;
+					sum += (c * c * c) * pcurr->density;
+					w = c * c * pcurr->density;
+					gx += w * dx;
+					gy += w * dy;
+					gz += w * dz;
+				}
+				pndx = pcurr->next;
+			}
+		}
+		m_GridCell[cell] = -1;
+	}
+	scale = m_Param[SPH_PMASS] * m_Poly6Kern;
+	gradient = Vector3d(gx, gy, gz) * (-6.0 * d * scale);	// d(dx)/dx = sim scale
+	return sum * scale;
+}
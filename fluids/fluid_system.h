@@ -27,6 +27,7 @@
     #include <algorithm>
 	#include <iostream>
 	#include <vector>
+	#include <string>
 	#include <stdio.h>
 	#include <stdlib.h>
 	#include <math.h>
@@ -38,6 +39,9 @@
 	#include "fluid.h"
     #include "../my_defs.h"
 	#include "marchcubes.h"
+	#include "mthread.h"
+	#include "melt_params.h"
+	#include "mprofile.h"
 
     
 	// Scalar params
@@ -77,6 +81,49 @@
 	#define MAX_PARAM			21
 	#define BFLUID				2
 
+	// Timed phases, see m_Profile
+	#define PHASE_STEP			0			// all of Run
+	#define PHASE_INSERT		1			// spatial grid
+	#define PHASE_PRESSURE		2			// density, pressure and the neighbor table
+	#define PHASE_BOUNDARY		3			// wall contacts and the ice-water force
+	#define PHASE_FORCE			4			// forces, heat and phase change
+	#define PHASE_ADVANCE		5
+	#define PHASE_SURFACE		6			// SPH_DrawSurface
+	#define PHASE_SNAPSHOT		7			// SnapshotSurface
+	#define PHASE_CHECKPOINT	8			// SnapshotCheckpoint
+	#define PHASE_COUNT			9
+
+	// Particles per partial sum of a reduction in deterministic mode; partials
+	// are combined in index order, so the result is the same for any number
+	// of workers
+	#define REDUCE_BLOCK		1024
+
+	// Fewest particles per range of the parallel pressure pass
+	#define PRESSURE_GRAIN		256
+
+	// Load balance of the particle passes, see FluidSystem::Balance
+	#define BALANCE_INTERVAL	8			// steps between new ranges
+	#define BALANCE_BASE		4			// cost of a particle apart from its neighbors, in neighbors
+
+	// Neighbor counts of the last step, from SPH_ComputePressureGrid. A count
+	// is of every particle within the smoothing radius, including those past
+	// MAX_NEIGHBOR that the neighbor table has no room for.
+	#define NEIGHBOR_BINS		(2*MAX_NEIGHBOR+1)		// one per count; the last holds that many or more
+
+	struct NeighborStats {
+		int			particles;
+		int			hist[NEIGHBOR_BINS];	// particles by neighbor count
+		double		mean;
+		int			max;					// most neighbors of one particle
+		int			overflow;				// particles with more than MAX_NEIGHBOR
+		int			dropped;				// neighbors left out of the table, over all particles
+		int			max_cell;				// most particles in one grid cell
+		int			max_candidates;			// most particles tested for one particle, over its cells
+		int			overflow_steps;			// steps with overflow since the scene was created
+	};
+
+	struct SurfaceSnapshot;
+
 	class FluidSystem : public PointSet, public ImpSurface{
 	public:
 		FluidSystem ();
@@ -96,11 +143,21 @@
 		// Smoothed Particle Hydrodynamics
 		void SPH_Setup ();
 		void SPH_CreateExample ( int n, int nmax );
+		void SetScene ( const char* path )	{ m_Scene = path; }		// voxel file of SPH_CreateExample, OBJECT_PATH by default, or "cube:n"
+		void SetThreads ( int num );		// restarts m_Workers, one per processor when num <= 0
+		void SetDeterministic ( bool on )	{ m_bDeterministic = on; }	// bitwise the same state for any number of workers
+		bool IsDeterministic ()				{ return m_bDeterministic; }
+		unsigned long long StateHash ();	// FNV-1a of the particles, time and voxels
+		void SetMeltParams ( const MeltParams& p )	{ m_Melt = p; }	// scene layout applies from the next SPH_CreateExample
+		MeltParams& GetMeltParams ()		{ return m_Melt; }
 		void SPH_DrawDomain ();
 		void SPH_ComputeKernels ();
 
+		void Balance ();							// ranges of the particle passes, see BALANCE_INTERVAL
 		void SPH_ComputePressureGrid ();			// O(kn) - spatial grid
 		void SPH_ComputeForceGridNC ();				// O(cn) - neighbor table
+		const NeighborStats& GetNeighborStats ()	{ return m_NStats; }
+		void PrintNeighborStats ();
 		
 		// Calcualte torque for each ice particle 
 		Matrix3 ComputeInverseInertia(const Fluid* p);
@@ -110,10 +167,22 @@
 
 		VoxelGrid* vgrid;
 		float ss;
+		mint::ThreadPool m_Workers;			// shared by setup passes, started on first use
+		mint::Profiler m_Profile;			// PHASE_* timings, rolling statistics
+		mint::MemoryReport m_Memory;		// by subsystem, peaks since SPH_CreateExample
+		void UpdateMemory ();				// sets the simulation's items in m_Memory, done every step
 
 		// Marching cube
 		virtual Double eval	(const Point3d& location);
+		virtual Double evalGrad (const Point3d& location, Vector3d& gradient);
 		void SPH_DrawSurface ();
+		void SnapshotSurface ( SurfaceSnapshot& snap, int frame );	// copy of what the mesher reads, see surface_pipeline.h
+
+		// Checkpoint / restart, see checkpoint_format.h. With error >= 0 the
+		// particle section is coded with CHECKPOINT_QUANT.
+		void SnapshotCheckpoint ( std::vector<char>& image, int frame, double error = -1 );
+		bool SaveCheckpoint ( const char* filename, int frame, double error = -1 );
+		bool LoadCheckpoint ( const char* filename, int& frame );
 
 		MarchCube* m_marchCube;
 		IsoSurface* m_surface;
@@ -125,6 +194,12 @@
 	private:
 		// Smoothed Particle Hydrodynamics
 		double m_R2, m_Poly6Kern, m_LapKern, m_SpikyKern;		// Kernel functions
+		std::string m_Scene;
+		MeltParams m_Melt;
+		NeighborStats m_NStats;
+		bool m_bDeterministic;
+		std::vector<int> m_Balance;			// particle ranges of about equal neighbor count
+		int m_BalanceAge;					// steps since m_Balance was made
 		
 	};
 
@@ -1,4 +1,6 @@
-#include "GL/glut.h"
+#ifndef NO_GL
+	#include "GL/glut.h"
+#endif
 //#include "common.h"
 #include "geometry.h"
 
@@ -162,7 +164,9 @@ Point3d operator - (const Vector3d& v, const Point3d& p)
 
 void Point3d::glLoad()
 {
+#ifndef NO_GL
 	glVertex3dv(data);
+#endif
 }
 
 Vector3d::Vector3d ()
@@ -370,7 +374,9 @@ Double Vector3d::length()
 
 void Vector3d::glLoad ()
 {
+#ifndef NO_GL
     glNormal3dv(data);
+#endif
 }
 
 Color3d::Color3d ()
@@ -515,7 +521,9 @@ Double Color3d::intensity () const
 
 void Color3d::glLoad ()
 {
+#ifndef NO_GL
     glColor3dv(data);
+#endif
 }
 
 void Color3d::clampTo(Double min, Double max)
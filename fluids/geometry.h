@@ -187,6 +187,8 @@ public:
 	~MeshTriangle	();
 
 	unsigned int&	operator	[]	(int index);
+	unsigned int	operator	[]	(int index) const
+							{ return indices[index]; }
 private:
 	unsigned int	indices[3];
 
@@ -1,7 +1,11 @@
 #include "impsurface.h"
 //#include "MACGrid.h"
 //#include "camera.h"
-#include "GL/glut.h"
+#ifndef NO_GL
+	#include "GL/glut.h"
+#endif
+#include <stdio.h>
+#include <string.h>
 
 /*******************************************************************
  * Class ImpSurface
@@ -52,6 +56,12 @@ Double ImpSurface::eval (const Point3d& location, Double t)
 	return eval(location);
 }
 
+Double ImpSurface::evalGrad (const Point3d& location, Vector3d& gradient)
+{
+	gradient = grad(location);
+	return eval(location);
+}
+
 /*******************************************************************
  * Class IsoSurface
  * holds a tesselation of a specified implicit function representing
@@ -86,6 +96,24 @@ int IsoSurface::addVertex (Point3d& toAdd)
 	return index;
 }
 
+/*
+ * Adds a vertex together with the field gradient at that point. The
+ * gradients are turned into vertex normals by calcVNorms.
+ */
+int IsoSurface::addVertex (Point3d& toAdd, Vector3d& gradient)
+{
+	int index = addVertex(toAdd);
+	try
+	{
+		vNormals.push_back(gradient);
+	}
+	catch(...)
+	{
+		cerr << "couldn't push normal #" << index << endl;
+	}
+	return index;
+}
+
 void IsoSurface::addFace (int v1, int v2, int v3)
 {
 	try
@@ -112,6 +140,7 @@ void IsoSurface::addFace (MeshTriangle& toAdd)
 
 void IsoSurface::glDraw ()
 {
+#ifndef NO_GL
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glEnableClientState(GL_NORMAL_ARRAY);
 	glEnable(GL_COLOR_MATERIAL);
@@ -121,13 +150,30 @@ void IsoSurface::glDraw ()
 	glDrawElements(GL_TRIANGLES, (GLsizei) faces.size() * 3, GL_UNSIGNED_INT, &faces[0][0]);
 	glDisableClientState(GL_VERTEX_ARRAY); 
     glDisableClientState(GL_NORMAL_ARRAY); 
+#endif
 }
 
+/*
+ * Turns the gradients gathered by addVertex into unit normals. The field
+ * grows towards the particles, so the outward normal is the negated
+ * gradient. Surfaces built without gradients get zero normals.
+ */
 void IsoSurface::calcVNorms ()
 {
 	int numV = (int)vertices.size();
-	vNormals.clear();
 
+	if ((int)vNormals.size() == numV)
+	{
+		for (int i = 0; i < numV; ++i)
+		{
+			Double len = vNormals[i].length();
+			if (len > 0)
+				vNormals[i] *= -1.0 / len;
+		}
+		return;
+	}
+
+	vNormals.clear();
 	for (int i = 0; i < numV; ++i)
 	{
 		try
@@ -149,40 +195,165 @@ void IsoSurface::clear ()
 	vNormals.clear();
 }
 
+void IsoSurface::getMemory (size_t& resident, size_t& reserved) const
+{
+	resident = vertices.size() * sizeof(Point3d) + faces.size() * sizeof(MeshTriangle)
+			 + vNormals.size() * sizeof(Vector3d);
+	reserved = vertices.capacity() * sizeof(Point3d) + faces.capacity() * sizeof(MeshTriangle)
+			 + vNormals.capacity() * sizeof(Vector3d);
+}
+
 ImpSurface* IsoSurface::getFunction ()
 {
 	return function;
 }
 
 /* 
- * Prints the Mesh if Wavefront OBJ Format
+ * Prints the Mesh if Wavefront OBJ Format. Lines end in '\n' rather than
+ * endl so the stream is not flushed once per vertex.
  */ 
 ostream& operator << (ostream& out, const IsoSurface& s)
 {
-	out << "#Mesh Animation OBJ Exporter" << endl;
-	out << "#Vertices" << endl;
+	out << "#Mesh Animation OBJ Exporter\n";
+	out << "#Vertices\n";
 
 	int numVertices = (int)s.vertices.size();
 	
 	for (int i = 0; i < numVertices; ++i)
     {
-        out << "v " << s.vertices[i][0] << " " << s.vertices[i][1] << " " << s.vertices[i][2] << endl;
+        out << "v " << s.vertices[i][0] << " " << s.vertices[i][1] << " " << s.vertices[i][2] << '\n';
 	}
 
-	//out << "#Vertex Normals" << endl;
-	//for (int i = 0; i < numVertices; ++i)
-	//{
-	//	out << "vn " << s.vNormals[i][0] << " " << s.vNormals[i][1] << " " << s.vNormals[i][2] << endl;
-	//	out << endl;
-	//}
-	//out << endl;
+	bool hasNormals = ((int)s.vNormals.size() == numVertices);
+	if (hasNormals)
+	{
+		out << "#Vertex Normals\n";
+		for (int i = 0; i < numVertices; ++i)
+		{
+			out << "vn " << s.vNormals[i][0] << " " << s.vNormals[i][1] << " " << s.vNormals[i][2] << '\n';
+		}
+	}
 
-	out << "#Faces" << endl;
+	out << "#Faces\n";
 	int numFaces = (int) s.faces.size();
 	for (int i = 0; i < numFaces; ++i)
 	{
-		out << "f " << s.faces[i] << endl;
+		if (hasNormals)
+		{
+			const MeshTriangle& f = s.faces[i];
+			out << "f " << f[0] + 1 << "//" << f[0] + 1
+				<< " " << f[1] + 1 << "//" << f[1] + 1
+				<< " " << f[2] + 1 << "//" << f[2] + 1 << '\n';
+		}
+		else
+		{
+			out << "f " << s.faces[i] << '\n';
+		}
 	}
 
 	return out;
-}
\ No newline at end of file
+}
+
+/*
+ * Staging buffer for writePLY. Records are copied in and the buffer goes
+ * to disk in large blocks instead of one small write per value.
+ */
+namespace
+{
+	const int PLY_BUFFER_SIZE = 1 << 20;
+
+	class PlyBuffer
+	{
+	public:
+		PlyBuffer	(FILE* fp_) : fp(fp_), used(0), ok(true)
+								{ buf = new char[PLY_BUFFER_SIZE]; }
+		~PlyBuffer	()			{ flush(); delete [] buf; }
+
+		void	put		(const void* data, int bytes)
+		{
+			if (used + bytes > PLY_BUFFER_SIZE)
+				flush();
+			memcpy(buf + used, data, bytes);
+			used += bytes;
+		}
+		bool	flush	()
+		{
+			if (used > 0 && fwrite(buf, 1, used, fp) != (size_t) used)
+				ok = false;
+			used = 0;
+			return ok;
+		}
+	private:
+		FILE*	fp;
+		char*	buf;
+		int		used;
+		bool	ok;
+	};
+}
+
+/*
+ * Writes the mesh as binary PLY: float positions (and normals, when
+ * present) followed by indexed triangles. Data is written in the host's
+ * byte order and the header says which one that is.
+ */
+bool IsoSurface::writePLY (const char* filename) const
+{
+	FILE* fp = fopen(filename, "wb");
+	if (fp == 0)
+	{
+		cerr << "couldn't open " << filename << " for writing" << endl;
+		return false;
+	}
+
+	int numVertices = (int) vertices.size();
+	int numFaces = (int) faces.size();
+	bool hasNormals = ((int) vNormals.size() == numVertices);
+	unsigned int one = 1;
+	bool little = (*(unsigned char*) &one == 1);
+
+	fprintf(fp, "ply\nformat %s 1.0\n", little ? "binary_little_endian" : "binary_big_endian");
+	fprintf(fp, "element vertex %d\n", numVertices);
+	fprintf(fp, "property float x\nproperty float y\nproperty float z\n");
+	if (hasNormals)
+		fprintf(fp, "property float nx\nproperty float ny\nproperty float nz\n");
+	fprintf(fp, "element face %d\n", numFaces);
+	fprintf(fp, "property list uchar int vertex_indices\nend_header\n");
+
+	bool ok;
+	{
+		PlyBuffer out(fp);
+		float v[6];
+		int vsize = (hasNormals ? 6 : 3) * sizeof(float);
+		for (int i = 0; i < numVertices; ++i)
+		{
+			v[0] = (float) vertices[i][0];
+			v[1] = (float) vertices[i][1];
+			v[2] = (float) vertices[i][2];
+			if (hasNormals)
+			{
+				v[3] = (float) vNormals[i][0];
+				v[4] = (float) vNormals[i][1];
+				v[5] = (float) vNormals[i][2];
+			}
+			out.put(v, vsize);
+		}
+
+		unsigned char count = 3;
+		int idx[3];
+		for (int i = 0; i < numFaces; ++i)
+		{
+			idx[0] = (int) faces[i][0];
+			idx[1] = (int) faces[i][1];
+			idx[2] = (int) faces[i][2];
+			out.put(&count, 1);
+			out.put(idx, sizeof(idx));
+		}
+		ok = out.flush();
+	}
+
+	if (fclose(fp) != 0)
+		ok = false;
+	if (!ok)
+		cerr << "error writing " << filename << endl;
+	return ok;
+}
@@ -52,6 +52,13 @@ public:
 	virtual Double	eval	(const Point3d& location) = 0;
 	virtual Double	eval	(const Point3d& location, Double t);
 
+	/*
+	 * Evaluates the function and its gradient at the same location. The
+	 * default falls back on grad(); functions that can differentiate
+	 * analytically should override this to avoid the extra evaluations.
+	 */
+	virtual Double	evalGrad	(const Point3d& location, Vector3d& gradient);
+
 	Vector3d		grad	(const Point3d& location);
 	Vector3d		normal	(const Point3d& location);
 private:
@@ -66,6 +73,7 @@ public:
 	~IsoSurface			();
 
 	int		addVertex	(Point3d& toAdd);
+	int		addVertex	(Point3d& toAdd, Vector3d& gradient);
 	void	addFace		(int v1, int v2, int v3);
 	void	addFace		(MeshTriangle& toAdd);
 
@@ -77,6 +85,15 @@ public:
 
 	ImpSurface*	getFunction	();
 
+	vector<Point3d>&		getVertices	()	{ return vertices; }
+	vector<MeshTriangle>&	getFaces	()	{ return faces; }
+	vector<Vector3d>&		getVNormals	()	{ return vNormals; }
+
+	// Bytes of the vertex, face and normal arrays; clear() keeps the capacity.
+	void	getMemory	(size_t& resident, size_t& reserved) const;
+
+	bool	writePLY	(const char* filename) const;
+
 	friend ostream& operator <<		(ostream& out, const IsoSurface& s);
 private:
 	ImpSurface*				function;
@@ -1,10 +1,16 @@
 #include "marchcubes.h"
+#include <stdlib.h>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
 
 MarchCube::MarchCube ()
-: vtxGrid(NULL),
-  edgeGrid(NULL),
+: vtxStore(NULL),
+  edgeStore(NULL),
   edgeFlags(NULL),
   vtxFlags(NULL),
+  vtxCapacity(0),
+  cubeCapacity(0),
   threshold(0),
   sizex(1),
   sizey(1),
@@ -52,28 +58,28 @@ void MarchCube::march (IsoSurface& surface)
 	{
 		for (int j = 0; j < resy; ++j)
 		{
-			if (edgeFlags[i][j] & LEFTBACK)
-				edgeGrid[0][i][j][0] = 
-				  surface.addVertex(vtxGrid[0][i][j].findSurface(
-				                        vtxGrid[0][i][j + 1], threshold));
-			if (edgeFlags[i][j] & BOTBACK)
-				edgeGrid[0][i][j][2] =
-				  surface.addVertex(vtxGrid[0][i][j].findSurface(
-				                        vtxGrid[0][i + 1][j], threshold));
+			if (edgeFlags[cubeAt(i, j)] & LEFTBACK)
+				edgeAt(0, i, j)[0] = 
+				  addEdgeVertex(surface, vtxAt(0, i, j),
+				                        vtxAt(0, i, j + 1));
+			if (edgeFlags[cubeAt(i, j)] & BOTBACK)
+				edgeAt(0, i, j)[2] =
+				  addEdgeVertex(surface, vtxAt(0, i, j),
+				                        vtxAt(0, i + 1, j));
 
 		}
-		if (edgeFlags[i][resy - 1] & TOPBACK)
-			edgeGrid[0][i][resy][2] =
-				  surface.addVertex(vtxGrid[0][i][resy].findSurface(
-				                        vtxGrid[0][i + 1][resy], threshold));
+		if (edgeFlags[cubeAt(i, resy - 1)] & TOPBACK)
+			edgeAt(0, i, resy)[2] =
+				  addEdgeVertex(surface, vtxAt(0, i, resy),
+				                        vtxAt(0, i + 1, resy));
 	}
 
 	for (int i = 0; i < resy; ++i)
 	{
-		if (edgeFlags[resx - 1][i] & RIGHTBACK)
-			edgeGrid[0][resx][i][0] =
-				  surface.addVertex(vtxGrid[0][resx][i].findSurface(
-				                        vtxGrid[0][resx][i + 1], threshold));
+		if (edgeFlags[cubeAt(resx - 1, i)] & RIGHTBACK)
+			edgeAt(0, resx, i)[0] =
+				  addEdgeVertex(surface, vtxAt(0, resx, i),
+				                        vtxAt(0, resx, i + 1));
 	}
 
 	/*
@@ -96,53 +102,45 @@ void MarchCube::march (IsoSurface& surface)
 		{
 			for (int j = 0; j < resy; ++j)
 			{
-				if (edgeFlags[i][j] & BOTLEFT)
-					edgeGrid[0][i][j][1] = 
-					    surface.addVertex(vtxGrid[0][i][j].findSurface(
-							                       vtxGrid[1][i][j], 
-												   threshold));
-				if (edgeFlags[i][j] & LEFTFRONT)
-					edgeGrid[1][i][j][0] = 
-					    surface.addVertex(vtxGrid[1][i][j].findSurface(
-							                       vtxGrid[1][i][j + 1], 
-												   threshold));
-				if (edgeFlags[i][j] & BOTFRONT)
-					edgeGrid[1][i][j][2] = 
-					    surface.addVertex(vtxGrid[1][i][j].findSurface(
-							                       vtxGrid[1][i + 1][j], 
-												   threshold));
+				if (edgeFlags[cubeAt(i, j)] & BOTLEFT)
+					edgeAt(0, i, j)[1] = 
+					    addEdgeVertex(surface, vtxAt(0, i, j),
+				                        vtxAt(1, i, j));
+				if (edgeFlags[cubeAt(i, j)] & LEFTFRONT)
+					edgeAt(1, i, j)[0] = 
+					    addEdgeVertex(surface, vtxAt(1, i, j),
+				                        vtxAt(1, i, j + 1));
+				if (edgeFlags[cubeAt(i, j)] & BOTFRONT)
+					edgeAt(1, i, j)[2] = 
+					    addEdgeVertex(surface, vtxAt(1, i, j),
+				                        vtxAt(1, i + 1, j));
 
 			}
-			if (edgeFlags[i][resy - 1] & TOPLEFT)
-				edgeGrid[0][i][resy][1] = 
-				    surface.addVertex(vtxGrid[0][i][resy].findSurface(
-						                       vtxGrid[1][i][resy], 
-											   threshold));
-			if (edgeFlags[i][resy - 1] & TOPFRONT)
-				edgeGrid[1][i][resy][2] = 
-				    surface.addVertex(vtxGrid[1][i][resy].findSurface(
-						                       vtxGrid[1][i + 1][resy], 
-											   threshold));
+			if (edgeFlags[cubeAt(i, resy - 1)] & TOPLEFT)
+				edgeAt(0, i, resy)[1] = 
+				    addEdgeVertex(surface, vtxAt(0, i, resy),
+				                        vtxAt(1, i, resy));
+			if (edgeFlags[cubeAt(i, resy - 1)] & TOPFRONT)
+				edgeAt(1, i, resy)[2] = 
+				    addEdgeVertex(surface, vtxAt(1, i, resy),
+				                        vtxAt(1, i + 1, resy));
 		}
 
 		for (int i = 0; i < resy; ++i)
 		{
-			if (edgeFlags[resx - 1][i] & RIGHTFRONT)
-				edgeGrid[1][resx][i][0] = 
-				    surface.addVertex(vtxGrid[1][resx][i].findSurface(
-						                       vtxGrid[1][resx][i + 1], 
-											   threshold));
-			if (edgeFlags[resx - 1][i] & BOTRIGHT)
-				edgeGrid[0][resx][i][1] = 
-				    surface.addVertex(vtxGrid[0][resx][i].findSurface(
-						                       vtxGrid[1][resx][i], 
-											   threshold));
+			if (edgeFlags[cubeAt(resx - 1, i)] & RIGHTFRONT)
+				edgeAt(1, resx, i)[0] = 
+				    addEdgeVertex(surface, vtxAt(1, resx, i),
+				                        vtxAt(1, resx, i + 1));
+			if (edgeFlags[cubeAt(resx - 1, i)] & BOTRIGHT)
+				edgeAt(0, resx, i)[1] = 
+				    addEdgeVertex(surface, vtxAt(0, resx, i),
+				                        vtxAt(1, resx, i));
 		}
-		if (edgeFlags[resx - 1][resy - 1] & TOPRIGHT)
-			edgeGrid[0][resx][resy][1] =
-			    surface.addVertex(vtxGrid[0][resx][resy].findSurface(
-					                       vtxGrid[1][resx][resy], 
-										   threshold));
+		if (edgeFlags[cubeAt(resx - 1, resy - 1)] & TOPRIGHT)
+			edgeAt(0, resx, resy)[1] =
+			    addEdgeVertex(surface, vtxAt(0, resx, resy),
+				                        vtxAt(1, resx, resy));
 
 		/*
 		 * Now that we've found all the vertices on the edges of the cubes
@@ -156,7 +154,7 @@ void MarchCube::march (IsoSurface& surface)
 		{
 			for (int j = 0; j < resy; ++j)
 			{
-				indices = triTable[vtxFlags[i][j]];
+				indices = triTable[vtxFlags[cubeAt(i, j)]];
 				while(*indices != -1)
 				{
 					e0 = *indices++;
@@ -173,11 +171,11 @@ void MarchCube::march (IsoSurface& surface)
 		/*
 		 * Move the vertex/edge-index grids one step forward
 		 */
-		CubeVtx** vTemp = vtxGrid[0];
+		CubeVtx* vTemp = vtxGrid[0];
 		vtxGrid[0] = vtxGrid[1];
 		vtxGrid[1] = vTemp;
 
-		int*** eTemp = edgeGrid[0];
+		int* eTemp = edgeGrid[0];
 		edgeGrid[0] = edgeGrid[1];
 		edgeGrid[1] = eTemp;
 	}
@@ -204,7 +202,6 @@ void MarchCube::setRes (int x, int y, int z)
 	if ((x < 0) || (y < 0) || (z < 0))
 		return;
 
-	clearGrids();
 	resx = x;
 	resy = y;
 	resz = z;
@@ -224,93 +221,93 @@ void MarchCube::setCenter (Double x, Double y, Double z)
 	center[2] = z;
 }
 
-void MarchCube::clearGrids ()
+void MarchCube::getMemory (size_t& resident, size_t& reserved) const
 {
-	if (vtxGrid)
-	{
-		for (int i = 0; i < 2; ++i)
-		{
-			for (int j = 0; j <= resx; ++j)
-				delete[] vtxGrid[i][j];
-			delete[] vtxGrid[i];
-		}
-		delete[] vtxGrid;
-		vtxGrid = NULL;
-	}
+	size_t perVtx = sizeof(CubeVtx) + 3 * sizeof(int);
+	size_t numVtx = (size_t) (resx + 1) * (resy + 1);
+	size_t numCubes = (size_t) resx * resy;
+	if (numVtx > (size_t) vtxCapacity) numVtx = vtxCapacity;		// resolution set, not yet marched
+	if (numCubes > (size_t) cubeCapacity) numCubes = cubeCapacity;
+	resident = 2 * (numVtx * perVtx + numCubes * sizeof(int));
+	reserved = 2 * (vtxCapacity * perVtx + cubeCapacity * sizeof(int));
+}
 
-	if (edgeGrid)
-	{
-		for (int i = 0; i < 2; ++i)
-		{
-			for (int j = 0; j <= resx; ++j)
-			{
-				for (int k = 0; k <= resy; ++k)
-					delete[] edgeGrid[i][j][k];
-				delete[] edgeGrid[i][j];
-			}
-			delete[] edgeGrid[i];
-		}
-		delete[] edgeGrid;
-		edgeGrid = NULL;
-	}
+/*
+ * Slab storage is 64-byte aligned so rows start on a cache line. The
+ * CubeVtx slabs are plain new[] since CubeVtx has constructors.
+ */
+static int* allocInts (int count)
+{
+#ifdef _MSC_VER
+	return (int*) _aligned_malloc(count * sizeof(int), 64);
+#else
+	void* p = NULL;
+	return (posix_memalign(&p, 64, count * sizeof(int)) == 0) ? (int*) p : NULL;
+#endif
+}
 
-	if (edgeFlags)
-	{
-		for (int i = 0; i < resx; ++i)
-			delete[] edgeFlags[i];
-		delete[] edgeFlags;
-		edgeFlags = NULL;
-	}
+static void freeInts (int* p)
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
 
-	if (vtxFlags)
-	{
-		for (int i = 0; i < resx; ++i)
-			delete[] vtxFlags[i];
-		delete[] vtxFlags;
-		vtxFlags = NULL;
-	}
+void MarchCube::clearGrids ()
+{
+	delete[] vtxStore;
+	vtxStore = NULL;
+	freeInts(edgeStore);
+	edgeStore = NULL;
+	freeInts(edgeFlags);
+	edgeFlags = NULL;
+	vtxFlags = NULL;
+	vtxCapacity = 0;
+	cubeCapacity = 0;
 }
 
+/*
+ * Each grid is one flat array: two (resx + 1) x (resy + 1) slabs of
+ * vertices and edge indices, and a resx x resy slab each of edgeFlags and
+ * vtxFlags. Storage only grows, so re-marching at the same or a lower
+ * resolution reuses it without touching the allocator.
+ */
 void MarchCube::initGrids ()
 {
-	vtxGrid = new CubeVtx**[2];
-	for (int i = 0; i < 2; ++i)
+	int numVtx = (resx + 1) * (resy + 1);
+	int numCubes = resx * resy;
+
+	if (numVtx > vtxCapacity)
 	{
-		vtxGrid[i] = new CubeVtx*[resx + 1];
-		for (int j = 0; j <= resx; ++j)
-			vtxGrid[i][j] = new CubeVtx[resy + 1];
+		delete[] vtxStore;
+		freeInts(edgeStore);
+		vtxStore = new CubeVtx[2 * numVtx];
+		edgeStore = allocInts(2 * numVtx * 3);
+		for (int i = 0; i < 2 * numVtx * 3; ++i)
+			edgeStore[i] = -1;
+		vtxCapacity = numVtx;
 	}
-
-	edgeGrid = new int***[2];
-	for (int i = 0; i < 2; ++i)
+	if (numCubes > cubeCapacity)
 	{
-		edgeGrid[i] = new int**[resx + 1];
-		for (int j = 0; j <= resx; ++j)
-		{
-			edgeGrid[i][j] = new int*[resy + 1];
-			for (int k = 0; k <= resy; ++k)
-			{
-				edgeGrid[i][j][k] = new int[3];
-				for (int l = 0; l < 3; ++l)
-					edgeGrid[i][j][k][l] = -1;
-			}
-		}
+		freeInts(edgeFlags);
+		edgeFlags = allocInts(2 * numCubes);
+		cubeCapacity = numCubes;
 	}
 
-	edgeFlags = new int*[resx];
-	for (int i = 0; i < resx; ++i)
-		edgeFlags[i] = new int[resy];
-
-	vtxFlags = new int*[resx];
-	for (int i = 0; i < resx; ++i)
-		vtxFlags[i] = new int[resy];
+	vtxGrid[0] = vtxStore;
+	vtxGrid[1] = vtxStore + numVtx;
+	edgeGrid[0] = edgeStore;
+	edgeGrid[1] = edgeStore + numVtx * 3;
+	vtxFlags = edgeFlags + cubeCapacity;
 }
 
 /*
  * Set values and coordinates for each vertex in the grid of CubVtx passed in
  */
 void MarchCube::initVertices (int level, 
-							  CubeVtx** toSet, 
+							  CubeVtx* toSet, 
 							  ImpSurface* function)
 {
 	Point3d lowerLeft(center[0] - sizex / 2.0,
@@ -322,13 +319,16 @@ void MarchCube::initVertices (int level,
 	Double xInc = sizex / (Double) resx;
 	Double yInc = sizey / (Double) resy;
 	Double zCoord = lowerLeft[2];
+	Vector3d gradient;
 	for (int i = 0; i <= resx; ++i)
 	{
 		Double yCoord = lowerLeft[1];
 		for (int j = 0; j <= resy; ++j)
 		{
-			toSet[i][j].setPos(xCoord, yCoord, zCoord);
-			toSet[i][j].setVal(function->eval(toSet[i][j].getPos()));
+			CubeVtx& v = toSet[i * (resy + 1) + j];
+			v.setPos(xCoord, yCoord, zCoord);
+			v.setVal(function->evalGrad(v.getPos(), gradient));
+			v.setGrad(gradient);
 			yCoord += yInc;
 		}
 		xCoord += xInc;
@@ -346,24 +346,24 @@ void MarchCube::setCubeFlags ()
 		for (int j = 0; j < resy; ++j)
 		{
 			int index = 0;
-			if (vtxGrid[0][i][j].isInside(threshold))
+			if (vtxAt(0, i, j).isInside(threshold))
 				index |= VLLB;
-			if (vtxGrid[0][i][j + 1].isInside(threshold))
+			if (vtxAt(0, i, j + 1).isInside(threshold))
 				index |= VULB;
-			if (vtxGrid[0][i + 1][j].isInside(threshold))
+			if (vtxAt(0, i + 1, j).isInside(threshold))
 				index |= VLRB;
-			if (vtxGrid[0][i + 1][j + 1].isInside(threshold))
+			if (vtxAt(0, i + 1, j + 1).isInside(threshold))
 				index |= VURB;
-			if (vtxGrid[1][i][j].isInside(threshold))
+			if (vtxAt(1, i, j).isInside(threshold))
 				index |= VLLF;
-			if (vtxGrid[1][i][j + 1].isInside(threshold))
+			if (vtxAt(1, i, j + 1).isInside(threshold))
 				index |= VULF;
-			if (vtxGrid[1][i + 1][j].isInside(threshold))
+			if (vtxAt(1, i + 1, j).isInside(threshold))
 				index |= VLRF;
-			if (vtxGrid[1][i + 1][j + 1].isInside(threshold))
+			if (vtxAt(1, i + 1, j + 1).isInside(threshold))
 				index |= VURF;
-			edgeFlags[i][j] = edgeTable[index];
-			vtxFlags[i][j] = index;
+			edgeFlags[cubeAt(i, j)] = edgeTable[index];
+			vtxFlags[cubeAt(i, j)] = index;
 		}
 }
 
@@ -378,35 +378,46 @@ int MarchCube::getVertex (int cubeX, int cubeY, int edgeNum)
 	switch(edgeNum)
 	{
 	case 0:
-		return edgeGrid[0][cubeX][cubeY + 1][1];
+		return edgeAt(0, cubeX, cubeY + 1)[1];
 	case 1:
-		return edgeGrid[0][cubeX][cubeY][0];
+		return edgeAt(0, cubeX, cubeY)[0];
 	case 2:
-		return edgeGrid[0][cubeX][cubeY][1];
+		return edgeAt(0, cubeX, cubeY)[1];
 	case 3:
-		return edgeGrid[1][cubeX][cubeY][0];
+		return edgeAt(1, cubeX, cubeY)[0];
 	case 4:
-		return edgeGrid[0][cubeX + 1][cubeY + 1][1];
+		return edgeAt(0, cubeX + 1, cubeY + 1)[1];
 	case 5:
-		return edgeGrid[0][cubeX + 1][cubeY][0];
+		return edgeAt(0, cubeX + 1, cubeY)[0];
 	case 6:
-		return edgeGrid[0][cubeX + 1][cubeY][1];
+		return edgeAt(0, cubeX + 1, cubeY)[1];
 	case 7:
-		return edgeGrid[1][cubeX + 1][cubeY][0];
+		return edgeAt(1, cubeX + 1, cubeY)[0];
 	case 8:
-		return edgeGrid[1][cubeX][cubeY + 1][2];
+		return edgeAt(1, cubeX, cubeY + 1)[2];
 	case 9:
-		return edgeGrid[0][cubeX][cubeY + 1][2];
+		return edgeAt(0, cubeX, cubeY + 1)[2];
 	case 10:
-		return edgeGrid[0][cubeX][cubeY][2];
+		return edgeAt(0, cubeX, cubeY)[2];
 	case 11:
-		return edgeGrid[1][cubeX][cubeY][2];
+		return edgeAt(1, cubeX, cubeY)[2];
 	default:
         std::cout << "invalid edge index" << endl;
 		return -1;
 	}
 }
 
+/*
+ * Add the surface crossing on the edge between two lattice vertices along
+ * with the field gradient interpolated to that point.
+ */
+int MarchCube::addEdgeVertex (IsoSurface& surface, CubeVtx& start, CubeVtx& end)
+{
+	Vector3d gradient;
+	Point3d crossing = start.findSurface(end, gradient);
+	return surface.addVertex(crossing, gradient);
+}
+
 CubeVtx::CubeVtx ()
 {
 }
@@ -446,6 +457,15 @@ Point3d CubeVtx::findSurface (CubeVtx& endPoint,
 	
 }
 
+Point3d CubeVtx::findSurface (CubeVtx& endPoint, 
+						   Vector3d& gradient)
+{
+	Double alpha = (fabs(value) / 
+					(fabs(value) + fabs(endPoint.value)));
+	gradient = grad * (1 - alpha) + endPoint.grad * alpha;
+	return ((this->pos) * (1 - alpha) + endPoint.pos * alpha);
+}
+
 void CubeVtx::setPos (Double x, Double y, Double z)
 {
 	pos[0] = x;
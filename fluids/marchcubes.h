@@ -86,51 +86,75 @@ public:
 	void	setCenter		(const Point3d& center_);
 	void	setCenter		(Double x, Double y, Double z);
 
+	/*
+	 * Bytes of slab storage: resident is what the current resolution
+	 * marches over, reserved what has been allocated so far.
+	 */
+	void	getMemory		(size_t& resident, size_t& reserved) const;
+
 private:
 	void	clearGrids		();
 	void	initGrids		();
 	void	initVertices	(int level, 
-							 CubeVtx** toSet,
+							 CubeVtx* toSet,
 							 ImpSurface* function);
 	void	setCubeFlags	();
 
 	int		getVertex		(int cubeX, int cubeY, int edgeNum);
+	int		addEdgeVertex	(IsoSurface& surface,
+							 CubeVtx& start,
+							 CubeVtx& end);
+
+	/*
+	 * Flat slab accessors. Vertex and edge slabs are (resx + 1) x (resy + 1),
+	 * the per-cube flag slabs resx x resy; all are row-major in x.
+	 */
+	CubeVtx&	vtxAt		(int level, int i, int j);
+	int*		edgeAt		(int level, int i, int j)
+							{ return edgeGrid[level] + (i * (resy + 1) + j) * 3; }
+	int			cubeAt		(int i, int j) const
+							{ return i * resy + j; }
 
 	/*
-	 * vtxGrid is a 2x(width + 1)x(height + 1) array. It corresponds to all
+	 * vtxGrid holds two (width + 1)x(height + 1) slabs. They correspond to all
 	 * the vertices from all the cubes in a one-cube-deep slice of the volume
 	 * being marched. vtxGrid[0] contains those in the plane behind those in
 	 * vtxGrid[1] (where "forward" is measured in the +z direction). Looking in
-	 * the -z direction, vtxGrid[1][0][0] corresponds to the front-lower-left corner
-	 * of the lower-left cube in the slice. vtxGrid[0][0][0] the rear-lower-left from
-	 * the same cube, and vtxGrid[1][width][0] the front-lower-right of the lower-right
-	 * cube.
+	 * the -z direction, vtxAt(1, 0, 0) corresponds to the front-lower-left corner
+	 * of the lower-left cube in the slice. vtxAt(0, 0, 0) the rear-lower-left from
+	 * the same cube, and vtxAt(1, width, 0) the front-lower-right of the lower-right
+	 * cube. Both slabs live in vtxStore.
 	 */
-	CubeVtx***	vtxGrid;
+	CubeVtx*	vtxGrid[2];
+	CubeVtx*	vtxStore;
 
 	/*
-	 * The first three dimensions of edgeGrid correspond exactly with those from vtxGrid.
-	 * edgeGrid[0][0][0] points to an int* corresponding to the rear-lower-left-corner
-	 * of the lower-left cube and so forth. edgeGrid[0][0][0][0] points in the +y direction
-	 * from this vertex, edgeGrid[0][0][0][1] points in the +x direction, and 
-	 * edgeGrid[0][0][0][2] in the +z. The values in edgeGrid are indices into the vertex
+	 * The slabs of edgeGrid correspond exactly with those from vtxGrid, with
+	 * three ints per vertex. edgeAt(0, 0, 0) belongs to the rear-lower-left-corner
+	 * of the lower-left cube and so forth. edgeAt(0, 0, 0)[0] points in the +y direction
+	 * from this vertex, edgeAt(0, 0, 0)[1] points in the +x direction, and 
+	 * edgeAt(0, 0, 0)[2] in the +z. The values in edgeGrid are indices into the vertex
 	 * array which correspond to the vertices on the aforementioned edges on the isosurface.
 	 */
-	int****		edgeGrid;
+	int*		edgeGrid[2];
+	int*		edgeStore;
 
 	/*
 	 * edgeFlags is an array of values from edgeTable. It's a width x height array where 
 	 * each value corresponds to a set of twelve bit-flags, each flag corresponding to
-	 * one edge of the cube at index [i][j]. If a flag is '1' the edge under consideration 
+	 * one edge of the cube at cubeAt(i, j). If a flag is '1' the edge under consideration 
 	 * crosses the isosurface, otherwise the flag will be zero.
 	 */
-	int**		edgeFlags;
+	int*		edgeFlags;
 
 	/*
-	 * Each int in vtxFlags contains a set of 8 one-bit flags, each corresponding to a vertex
-	 * 
+	 * Each int in vtxFlags contains a set of 8 one-bit flags, each corresponding to a vertex.
+	 * It shares its allocation with edgeFlags.
 	 */
-	int**		vtxFlags;
+	int*		vtxFlags;
+
+	int			vtxCapacity;		// vertices per slab the storage can hold
+	int			cubeCapacity;		// cubes per flag slab
 
 	Double		threshold;
 	Double		sizex;
@@ -154,6 +178,8 @@ public:
 
 	Point3d				findSurface	(CubeVtx& endPoint,
 									 Double threshold);
+	Point3d				findSurface	(CubeVtx& endPoint,
+									 Vector3d& gradient);
 
 	const Point3d&	getPos		() 
 							{ return pos; }
@@ -161,11 +187,19 @@ public:
 
 	void			setVal		(Double value_)
     { value = value_; if (value != value) std::cout << "bad setVal" << std::endl;}
+	void			setGrad		(const Vector3d& grad_)
+							{ grad = grad_; }
 	bool			isInside	(Double threshold) 
 							{ return (value <= threshold); }
 private:
 	Point3d		pos;
 	Double		value;
+	Vector3d	grad;
 };
 
+inline CubeVtx& MarchCube::vtxAt (int level, int i, int j)
+{
+	return vtxGrid[level][i * (resy + 1) + j];
+}
+
 #endif // MARCHCUBES_H
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "melt_params.h"
+#include "../my_defs.h"
+
+#define PARAM_FLOAT		0
+#define PARAM_DOUBLE	1
+#define PARAM_VEC		2
+
+namespace {
+	struct ParamInfo {
+		const char*		name;
+		int				type;
+		size_t			offset;
+	};
+
+	#define PARAM(name, type, field)	{ name, type, offsetof ( MeltParams, field ) }
+
+	const ParamInfo g_Params[] = {
+		PARAM ( "AMBIENT_T",			PARAM_FLOAT,	ambient_t ),
+		PARAM ( "MIN_T",				PARAM_FLOAT,	min_t ),
+		PARAM ( "MAX_T",				PARAM_FLOAT,	max_t ),
+		PARAM ( "ICE_T",				PARAM_FLOAT,	ice_t ),
+		PARAM ( "C_ICE",				PARAM_FLOAT,	c_ice ),
+		PARAM ( "C_WATER",				PARAM_FLOAT,	c_water ),
+		PARAM ( "THERMAL_CONDUCTIVITY",	PARAM_FLOAT,	thermal_conductivity ),
+		PARAM ( "HEAT_CAPACITY_ICE",	PARAM_FLOAT,	heat_capacity_ice ),
+		PARAM ( "HEAT_CAPACITY_WATER",	PARAM_FLOAT,	heat_capacity_water ),
+		PARAM ( "MASS_H2O",				PARAM_FLOAT,	mass_h2o ),
+		PARAM ( "P_PRADIUS",			PARAM_FLOAT,	p_pradius ),
+		PARAM ( "K_ICE",				PARAM_FLOAT,	k_ice ),
+		PARAM ( "K_WATER",				PARAM_FLOAT,	k_water ),
+		PARAM ( "ICE_WATER",			PARAM_FLOAT,	ice_water ),
+		PARAM ( "BOUND_LIQUID",			PARAM_FLOAT,	bound_liquid ),
+		PARAM ( "VISC_WATER",			PARAM_FLOAT,	visc_water ),
+		PARAM ( "EFFECTIVE_RADIUS",		PARAM_FLOAT,	effective_radius ),
+		PARAM ( "INT_STIFF_ICE",		PARAM_FLOAT,	int_stiff_ice ),
+		PARAM ( "INT_STIFF_WATER",		PARAM_FLOAT,	int_stiff_water ),
+		PARAM ( "EXT_STIFF",			PARAM_FLOAT,	ext_stiff ),
+		PARAM ( "INERTIA_FACTOR",		PARAM_DOUBLE,	inertia_factor ),
+		PARAM ( "VOLMIN",				PARAM_VEC,		volmin ),
+		PARAM ( "VOLMAX",				PARAM_VEC,		volmax ),
+		PARAM ( "INITMIN",				PARAM_VEC,		initmin ),
+		PARAM ( "INITMAX",				PARAM_VEC,		initmax ),
+		PARAM ( "MARCH_THRESHOLD",		PARAM_DOUBLE,	march_threshold ),
+		PARAM ( "MARCH_RESO",			PARAM_DOUBLE,	march_reso ),
+	};
+
+	#undef PARAM
+
+	const int g_NumParams = sizeof(g_Params) / sizeof(g_Params[0]);
+
+	const ParamInfo* FindParam ( const char* name )
+	{
+		for (int n=0; n < g_NumParams; n++) {
+			#ifdef _MSC_VER
+				if ( _stricmp ( g_Params[n].name, name ) == 0 ) return &g_Params[n];
+			#else
+				if ( strcasecmp ( g_Params[n].name, name ) == 0 ) return &g_Params[n];
+			#endif
+		}
+		return 0x0;
+	}
+
+	// Reads count numbers separated by spaces, commas or tabs, and nothing else
+	bool ParseNumbers ( const char* value, double* out, int count )
+	{
+		const char* s = value;
+		for (int n=0; n < count; n++) {
+			while ( *s == ' ' || *s == '\t' || (*s == ',' && n > 0) ) s++;
+			char* end;
+			out[n] = strtod ( s, &end );
+			if ( end == s ) return false;
+			s = end;
+		}
+		while ( *s == ' ' || *s == '\t' || *s == '\r' ) s++;
+		return *s == '\0';
+	}
+}
+
+MeltParams::MeltParams ()
+{
+	ambient_t = AMBIENT_T;
+	min_t = MIN_T;
+	max_t = MAX_T;
+	ice_t = ICE_T;
+	c_ice = C_ICE;
+	c_water = C_WATER;
+	thermal_conductivity = THERMAL_CONDUCTIVITY;
+	heat_capacity_ice = HEAT_CAPACITY_ICE;
+	heat_capacity_water = HEAT_CAPACITY_WATER;
+	mass_h2o = MASS_H2O;
+	p_pradius = P_PRADIUS;
+
+	k_ice = K_ICE;
+	k_water = K_WATER;
+	ice_water = ICE_WATER;
+	bound_liquid = BOUND_LIQUID;
+	visc_water = VISC_WATER;
+	effective_radius = EFFECTIVE_RADIUS;
+	int_stiff_ice = INT_STIFF_ICE;
+	int_stiff_water = INT_STIFF_WATER;
+	ext_stiff = EXT_STIFF;
+	inertia_factor = INERTIA_FACTOR;
+
+	volmin.Set ( VOLMIN_X, VOLMIN_Y, VOLMIN_Z );
+	volmax.Set ( VOLMAX_X, VOLMAX_Y, VOLMAX_Z );
+	initmin.Set ( INITMIN_X, INITMIN_Y, INITMIN_Z );
+	initmax.Set ( INITMAX_X, INITMAX_Y, INITMAX_Z );
+
+	march_threshold = MARCH_THRESHOLD;
+	march_reso = MARCH_RESO;
+}
+
+int MeltParams::NumParams ()
+{
+	return g_NumParams;
+}
+
+const char* MeltParams::GetName ( int n )
+{
+	return ( n >= 0 && n < g_NumParams ) ? g_Params[n].name : 0x0;
+}
+
+bool MeltParams::Set ( const char* name, const char* value )
+{
+	const ParamInfo* info = FindParam ( name );
+	if ( info == 0x0 ) return false;
+	double v[3];
+	if ( !ParseNumbers ( value, v, info->type == PARAM_VEC ? 3 : 1 ) ) return false;
+
+	char* field = (char*) this + info->offset;
+	switch ( info->type ) {
+	case PARAM_FLOAT:	*(float*) field = (float) v[0];			break;
+	case PARAM_DOUBLE:	*(double*) field = v[0];				break;
+	case PARAM_VEC:		((Vector3DF*) field)->Set ( (float) v[0], (float) v[1], (float) v[2] );	break;
+	}
+	return true;
+}
+
+bool MeltParams::Parse ( const char* text, const char* source )
+{
+	int line = 0;
+	const char* s = text;
+	while ( *s != '\0' ) {
+		const char* eol = strchr ( s, '\n' );
+		size_t len = ( eol != 0x0 ) ? (size_t) (eol - s) : strlen ( s );
+		std::string ln ( s, len );
+		s += len;
+		if ( *s == '\n' ) s++;
+		line++;
+
+		size_t hash = ln.find ( '#' );
+		if ( hash != std::string::npos ) ln.erase ( hash );
+		size_t a = ln.find_first_not_of ( " \t\r" );
+		if ( a == std::string::npos ) continue;
+		size_t b = ln.find_first_of ( " \t=", a );
+		std::string name = ln.substr ( a, b == std::string::npos ? std::string::npos : b - a );
+		size_t v = ( b == std::string::npos ) ? ln.size() : ln.find_first_not_of ( " \t=", b );
+		std::string value = ( v == std::string::npos ) ? std::string() : ln.substr ( v );
+
+		if ( FindParam ( name.c_str() ) == 0x0 ) {
+			printf ( "ERROR: %s:%d: unknown parameter %s.\n", source, line, name.c_str() );
+			return false;
+		}
+		if ( !Set ( name.c_str(), value.c_str() ) ) {
+			printf ( "ERROR: %s:%d: bad value for %s.\n", source, line, name.c_str() );
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MeltParams::Load ( const char* filename )
+{
+	FILE* fp = fopen ( filename, "rb" );
+	if ( fp == 0x0 ) {
+		printf ( "ERROR: Cannot open parameter file %s.\n", filename );
+		return false;
+	}
+	std::string text;
+	char buf[4096];
+	size_t got;
+	while ( (got = fread ( buf, 1, sizeof(buf), fp )) > 0 )
+		text.append ( buf, got );
+	fclose ( fp );
+	return Parse ( text.c_str(), filename );
+}
+
+bool MeltParams::Save ( const char* filename )
+{
+	FILE* fp = fopen ( filename, "wb" );
+	if ( fp == 0x0 ) {
+		printf ( "ERROR: Cannot write parameter file %s.\n", filename );
+		return false;
+	}
+	std::string text = Format ();
+	bool ok = fwrite ( text.data(), 1, text.size(), fp ) == text.size();
+	if ( fclose ( fp ) != 0 ) ok = false;
+	return ok;
+}
+
+// Floats with 9 and doubles with 17 significant digits, so Parse restores
+// exactly what was formatted
+std::string MeltParams::Format ()
+{
+	std::string text;
+	char buf[256];
+	for (int n=0; n < g_NumParams; n++) {
+		const char* field = (const char*) this + g_Params[n].offset;
+		switch ( g_Params[n].type ) {
+		case PARAM_FLOAT:	sprintf ( buf, "%-24s %.9g\n", g_Params[n].name, *(const float*) field );	break;
+		case PARAM_DOUBLE:	sprintf ( buf, "%-24s %.17g\n", g_Params[n].name, *(const double*) field );	break;
+		case PARAM_VEC: {
+			const Vector3DF* vec = (const Vector3DF*) field;
+			sprintf ( buf, "%-24s %.9g %.9g %.9g\n", g_Params[n].name, vec->x, vec->y, vec->z );
+			} break;
+		}
+		text += buf;
+	}
+	return text;
+}
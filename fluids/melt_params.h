@@ -0,0 +1,66 @@
+#ifndef DEF_MELT_PARAMS
+	#define DEF_MELT_PARAMS
+
+	#include <string>
+
+	#include "vector.h"
+
+	// Physical constants and scene layout of the melting simulation.
+	//
+	// The defaults are the constants of my_defs.h; a config file overrides
+	// any of them at run time, so tuning runs do not need a rebuild. Names
+	// are those of my_defs.h, one per line, followed by the value (three
+	// values for vectors); '#' starts a comment:
+	//
+	//   K_ICE         40
+	//   AMBIENT_T     310     # kelvin
+	//   VOLMAX        40 20 40
+	//
+	// FluidSystem reads the block in Reset, SPH_CreateExample and every step,
+	// and stores it in checkpoints in the same text form.
+	class MeltParams {
+	public:
+		MeltParams ();							// my_defs.h defaults
+
+		bool Load ( const char* filename );
+		bool Save ( const char* filename );
+
+		// Parses config text; source names it in error messages. Stops at the
+		// first bad line, leaving the earlier lines applied.
+		bool Parse ( const char* text, const char* source );
+		bool Set ( const char* name, const char* value );
+		std::string Format ();					// every value, in config form
+
+		static int NumParams ();
+		static const char* GetName ( int n );
+
+		// Heat
+		float		ambient_t;					// air temperature (K)
+		float		min_t, max_t;				// starting temperature, and the range of the color ramp
+		float		ice_t;						// melting point (K)
+		float		c_ice, c_water;				// diffusion between neighbors, per state
+		float		thermal_conductivity;		// air to particle
+		float		heat_capacity_ice, heat_capacity_water;
+		float		mass_h2o;
+		float		p_pradius;					// radius of the heat diffusion kernel
+
+		// Forces
+		float		k_ice, k_water;				// interfacial attraction of a liquid particle to ice / water
+		float		ice_water;					// scale of the ice-water force on the solid
+		float		bound_liquid;				// limit of that force along z
+		float		visc_water;
+		float		effective_radius;			// smoothing radius (m)
+		float		int_stiff_ice, int_stiff_water;
+		float		ext_stiff;					// container walls
+		double		inertia_factor;
+
+		// Scene
+		Vector3DF	volmin, volmax;				// container
+		Vector3DF	initmin, initmax;			// box seeded from the voxels
+
+		// Surface
+		double		march_threshold;
+		double		march_reso;
+	};
+
+#endif
@@ -0,0 +1,361 @@
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <fstream>
+
+#include "surface_pipeline.h"
+#include "mfile.h"
+#include "../my_defs.h"
+
+//------------------------------------------------------ ParticleField
+
+ParticleField::ParticleField ()
+{
+	m_Snap = 0x0;
+	m_CellSize = 1.0;
+	m_Res[0] = m_Res[1] = m_Res[2] = 0;
+}
+
+void ParticleField::GetMemory ( size_t& resident, size_t& reserved ) const
+{
+	resident = ( m_Head.size() + m_Next.size() ) * sizeof(int);
+	reserved = ( m_Head.capacity() + m_Next.capacity() ) * sizeof(int);
+}
+
+void ParticleField::Build ( const SurfaceSnapshot* snap )
+{
+	int n = (int) snap->pos.size();
+	Vector3DF mx;
+
+	m_Snap = snap;
+	m_CellSize = (float) (snap->radius / snap->simscale);
+	m_Head.clear ();
+	m_Next.resize ( n );
+	if ( n == 0 ) { m_Res[0] = m_Res[1] = m_Res[2] = 0; return; }
+
+	m_Min = snap->pos[0];
+	mx = snap->pos[0];
+	for (int i=1; i < n; i++) {
+		const Vector3DF& p = snap->pos[i];
+		if ( p.x < m_Min.x ) m_Min.x = p.x;
+		if ( p.x > mx.x ) mx.x = p.x;
+		if ( p.y < m_Min.y ) m_Min.y = p.y;
+		if ( p.y > mx.y ) mx.y = p.y;
+		if ( p.z < m_Min.z ) m_Min.z = p.z;
+		if ( p.z > mx.z ) mx.z = p.z;
+	}
+	m_Res[0] = (int) ((mx.x - m_Min.x) / m_CellSize) + 1;
+	m_Res[1] = (int) ((mx.y - m_Min.y) / m_CellSize) + 1;
+	m_Res[2] = (int) ((mx.z - m_Min.z) / m_CellSize) + 1;
+	m_Head.assign ( m_Res[0]*m_Res[1]*m_Res[2], -1 );
+
+	int gx, gy, gz, c;
+	for (int i=0; i < n; i++) {
+		const Vector3DF& p = snap->pos[i];
+		gx = (int) ((p.x - m_Min.x) / m_CellSize);	if ( gx >= m_Res[0] ) gx = m_Res[0]-1;
+		gy = (int) ((p.y - m_Min.y) / m_CellSize);	if ( gy >= m_Res[1] ) gy = m_Res[1]-1;
+		gz = (int) ((p.z - m_Min.z) / m_CellSize);	if ( gz >= m_Res[2] ) gz = m_Res[2]-1;
+		c = (gz*m_Res[1] + gy)*m_Res[0] + gx;
+		m_Next[i] = m_Head[c];
+		m_Head[c] = i;
+	}
+}
+
+Double ParticleField::eval (const Point3d& location)
+{
+	return Gather ( location, 0x0 );
+}
+
+Double ParticleField::evalGrad (const Point3d& location, Vector3d& gradient)
+{
+	return Gather ( location, &gradient );
+}
+
+// Kernel sum of FluidSystem::eval / evalGrad; cells are one radius wide,
+// so the support of any sample covers at most 3x3x3 cells.
+Double ParticleField::Gather ( const Point3d& location, Vector3d* gradient )
+{
+	double sum = 0.0, gx = 0.0, gy = 0.0, gz = 0.0;
+	double d, mR2, dx, dy, dz, dsq, c, w, scale;
+	int lo[3], hi[3], pndx;
+	const double loc[3] = { location[0], location[1], location[2] };
+	const float mn[3] = { m_Min.x, m_Min.y, m_Min.z };
+
+	if ( gradient ) *gradient = Vector3d(0, 0, 0);
+	if ( m_Head.empty() ) return 0.0;
+
+	for (int a=0; a < 3; a++) {
+		lo[a] = (int) floor ( (loc[a] - m_CellSize - mn[a]) / m_CellSize );
+		hi[a] = (int) floor ( (loc[a] + m_CellSize - mn[a]) / m_CellSize );
+		if ( lo[a] < 0 ) lo[a] = 0;
+		if ( hi[a] > m_Res[a]-1 ) hi[a] = m_Res[a]-1;
+		if ( lo[a] > hi[a] ) return 0.0;
+	}
+	d = m_Snap->simscale;
+	mR2 = m_Snap->radius * m_Snap->radius;
+
+	for (int z=lo[2]; z <= hi[2]; z++)
+		for (int y=lo[1]; y <= hi[1]; y++)
+			for (int x=lo[0]; x <= hi[0]; x++) {
+				pndx = m_Head [ (z*m_Res[1] + y)*m_Res[0] + x ];
+				while ( pndx != -1 ) {
+					const Vector3DF& p = m_Snap->pos[pndx];
+					dx = ( loc[0] - p.x)*d;
+					dy = ( loc[1] - p.y)*d;
+					dz = ( loc[2] - p.z)*d;
+					dsq = (dx*dx + dy*dy + dz*dz);
+					if ( mR2 > dsq ) {
+						c = mR2 - dsq;
+						w = c * c * m_Snap->density[pndx];
+						sum += c * w;
+						gx += w * dx;
+						gy += w * dy;
+						gz += w * dz;
+					}
+					pndx = m_Next[pndx];
+				}
+			}
+
+	scale = m_Snap->pmass * m_Snap->poly6kern;
+	if ( gradient ) *gradient = Vector3d(gx, gy, gz) * (-6.0 * d * scale);
+	return sum * scale;
+}
+
+//------------------------------------------------------ SurfacePipeline
+
+SurfacePipeline::SurfacePipeline ()
+{
+	m_bRunning = false;
+	m_bStopWriter = false;
+	m_bPLY = false;
+	m_Written = 0;
+	m_Failed = 0;
+	m_DecimateRatio = 1.0;
+	m_DecimateError = 0.0;
+	m_Shared = 0x0;
+	SetProfiler ( 0x0 );
+}
+
+void SurfacePipeline::SetProfiler ( mint::Profiler* prof )
+{
+	m_Prof = ( prof != 0x0 ) ? prof : &m_Profile;
+	m_PhaseField = m_Prof->AddPhase ( "field" );
+	m_PhaseMarch = m_Prof->AddPhase ( "march" );
+	m_PhaseDecimate = m_Prof->AddPhase ( "decimate" );
+	m_PhaseWrite = m_Prof->AddPhase ( "write" );
+}
+
+SurfacePipeline::~SurfacePipeline ()
+{
+	Stop ();
+}
+
+bool SurfacePipeline::Start ( int meshers, int max_in_flight, const char* path_fmt )
+{
+	if ( m_bRunning ) return true;
+	if ( !mint::IsFramePattern ( path_fmt ) ) {
+		printf ( "SurfacePipeline: %s must take one integer frame number, e.g. Melting%%04d.obj.\n", path_fmt );
+		return false;
+	}
+	if ( max_in_flight < 1 ) max_in_flight = 1;
+
+	m_PathFmt = path_fmt;
+	m_bPLY = ( m_PathFmt.size() > 4 && strcmp ( m_PathFmt.c_str() + m_PathFmt.size() - 4, ".ply" ) == 0 );
+	m_Written = 0;
+	m_Failed = 0;
+	m_bStopWriter = false;
+	for (int n=0; n < max_in_flight; n++) {
+		Slot* s = new Slot;
+		s->job.pipe = this;
+		s->job.slot = s;
+		m_Slots.push_back ( s );
+		m_Free.push_back ( s );
+	}
+	if ( m_Shared != 0x0 && m_Shared->NumThreads() == 0 ) m_Shared = 0x0;		// nothing would run the jobs
+	if ( m_Shared == 0x0 ) {
+		m_Meshers.SetName ( "mesher" );
+		m_Meshers.Start ( meshers );
+	}
+	m_Writer.Start ( WriterEntry, this );
+	m_bRunning = true;
+	return true;
+}
+
+void SurfacePipeline::Stop ()
+{
+	if ( !m_bRunning ) return;
+	Flush ();
+	m_Meshers.Stop ();
+
+	m_Lock.Lock ();
+	m_bStopWriter = true;
+	m_WriteReady.Signal ();
+	m_Lock.Unlock ();
+	m_Writer.Join ();
+
+	for (int n=0; n < (int) m_Slots.size(); n++)
+		delete m_Slots[n];
+	m_Slots.clear ();
+	m_Free.clear ();
+	m_bRunning = false;
+}
+
+// Back-pressure: with every slot busy the caller either waits for the
+// writer to hand one back or skips this frame.
+SurfaceSnapshot* SurfacePipeline::Acquire ( bool wait )
+{
+	mint::ScopedLock lock ( m_Lock );
+	if ( !m_bRunning ) return 0x0;
+	while ( m_Free.empty() ) {
+		if ( !wait ) return 0x0;
+		m_SlotFree.Wait ( m_Lock );
+	}
+	Slot* s = m_Free.back ();
+	m_Free.pop_back ();
+	return &s->snap;
+}
+
+void SurfacePipeline::Submit ( SurfaceSnapshot* snap )
+{
+	for (int n=0; n < (int) m_Slots.size(); n++) {
+		if ( &m_Slots[n]->snap == snap ) {
+			Pool()->Submit ( &m_Slots[n]->job );
+			return;
+		}
+	}
+	printf ( "SurfacePipeline: submitted snapshot was not acquired from this pipeline.\n" );
+}
+
+// Every acquired snapshot must have been submitted, or this never returns.
+void SurfacePipeline::Flush ()
+{
+	mint::ScopedLock lock ( m_Lock );
+	while ( m_Free.size() < m_Slots.size() )
+		m_SlotFree.Wait ( m_Lock );
+}
+
+void SurfacePipeline::GetMemory ( mint::MemoryReport& rep )
+{
+	size_t resident = 0, reserved = 0;
+	{
+		mint::ScopedLock lock ( m_Lock );
+		for (int n=0; n < (int) m_Slots.size(); n++) {
+			resident += m_Slots[n]->resident;
+			reserved += m_Slots[n]->reserved;
+		}
+	}
+	rep.Set ( "surface pipeline", resident, reserved );
+}
+
+int SurfacePipeline::NumInFlight ()
+{
+	mint::ScopedLock lock ( m_Lock );
+	return (int) (m_Slots.size() - m_Free.size());
+}
+
+void SurfacePipeline::MeshJob::Run ()
+{
+	pipe->Mesh ( slot );
+}
+
+void SurfacePipeline::Mesh ( Slot* s )
+{
+	// Same volume and resolution as FluidSystem::SPH_DrawSurface
+	const SurfaceSnapshot& snap = s->snap;
+	mint::ScopedTimer field ( *m_Prof, m_PhaseField );
+	field.Items ( (double) snap.pos.size() );		// particles, for counts per particle
+	s->field.Build ( &snap );
+	field.Stop ();
+	mint::ScopedTimer march ( *m_Prof, m_PhaseMarch );
+	march.Items ( (double) snap.pos.size() );
+	s->march.setThreshold ( snap.threshold );
+	s->march.setSize ( (snap.volmax.x-snap.volmin.x)+10, (snap.volmax.y-snap.volmin.y)+10, (snap.volmax.z-snap.volmin.z)+10 );
+	s->march.setRes ( snap.reso, snap.reso, snap.reso );
+	s->march.setCenter ( 0.0, 0.0, 0.0 );
+	s->march.march ( s->surface );
+	march.Stop ();
+
+	// Slabs of the decimation go to the same pool; Wait() inside ParallelFor
+	// runs queued work itself, so a mesher job can block on it safely.
+	if ( m_DecimateRatio < 1.0 || m_DecimateError > 0 ) {
+		mint::ScopedTimer t ( *m_Prof, m_PhaseDecimate );
+		Decimator dec;
+		int target = ( m_DecimateRatio < 1.0 ) ? (int) ( s->surface.getFaces().size() * m_DecimateRatio ) : 0;
+		dec.decimate ( s->surface, target, m_DecimateError, Pool() );
+	}
+
+	// The slot at its largest, with the mesh still in it
+	size_t resident = sizeof(Slot), reserved = sizeof(Slot);
+	size_t res, rsv;
+	resident += snap.pos.size() * sizeof(Vector3DF) + snap.density.size() * sizeof(float);
+	reserved += snap.pos.capacity() * sizeof(Vector3DF) + snap.density.capacity() * sizeof(float);
+	s->field.GetMemory ( res, rsv );		resident += res;	reserved += rsv;
+	s->surface.getMemory ( res, rsv );		resident += res;	reserved += rsv;
+	s->march.getMemory ( res, rsv );		resident += res;	reserved += rsv;
+
+	mint::ScopedLock lock ( m_Lock );
+	s->resident = resident;
+	s->reserved = reserved;
+	m_WriteQueue.push_back ( s );
+	m_WriteReady.Signal ();
+}
+
+bool SurfacePipeline::Write ( Slot* s )
+{
+	mint::ScopedTimer t ( *m_Prof, m_PhaseWrite );
+	char filename[2048];
+	if ( !mint::FramePath ( filename, sizeof(filename), m_PathFmt.c_str(), s->snap.frame ) ) {
+		printf ( "SurfacePipeline: file name of frame %d too long.\n", s->snap.frame );
+		return false;
+	}
+
+	if ( m_bPLY )
+		return s->surface.writePLY ( filename );		// reports its own errors
+
+	std::ofstream out ( filename );
+	if ( !out ) {
+		printf ( "SurfacePipeline: cannot open %s for writing.\n", filename );
+		return false;
+	}
+	out << s->surface;
+	out.close ();
+	if ( !out ) {
+		printf ( "SurfacePipeline: error writing %s.\n", filename );
+		return false;
+	}
+	return true;
+}
+
+void SurfacePipeline::WriterEntry ( void* arg )
+{
+	mint::GetTracer().SetThreadName ( "surface writer" );
+	((SurfacePipeline*) arg)->WriterLoop ();
+}
+
+void SurfacePipeline::WriterLoop ()
+{
+	Slot* s;
+	for (;;) {
+		m_Lock.Lock ();
+		while ( m_WriteQueue.empty() && !m_bStopWriter )
+			m_WriteReady.Wait ( m_Lock );
+		if ( m_WriteQueue.empty() ) {
+			m_Lock.Unlock ();
+			return;
+		}
+		s = m_WriteQueue.front ();
+		m_WriteQueue.pop_front ();
+		m_Lock.Unlock ();
+
+		bool ok = Write ( s );
+		s->surface.clear ();
+
+		m_Lock.Lock ();
+		m_Free.push_back ( s );
+		if ( ok ) m_Written++;
+		else m_Failed++;
+		m_SlotFree.Broadcast ();
+		m_Lock.Unlock ();
+	}
+}
@@ -0,0 +1,147 @@
+
+#ifndef DEF_SURFACE_PIPELINE
+	#define DEF_SURFACE_PIPELINE
+
+	#include <vector>
+	#include <deque>
+	#include <string>
+
+	#include "vector.h"
+	#include "mthread.h"
+	#include "mprofile.h"
+	#include "marchcubes.h"
+	#include "decimate.h"
+
+	// Everything the mesher needs from one simulation step. Filled on the
+	// simulation thread by FluidSystem::SnapshotSurface, after which the
+	// simulation is free to keep stepping.
+	struct SurfaceSnapshot {
+		int						frame;
+		std::vector<Vector3DF>	pos;
+		std::vector<float>		density;		// inverse density, as stored in Fluid
+		double					simscale;
+		double					radius;			// smoothing radius (m)
+		double					pmass;
+		double					poly6kern;
+		Vector3DF				volmin, volmax;
+		double					threshold;		// marching cubes iso value and resolution
+		double					reso;
+	};
+
+	// Density field over a snapshot. Same kernel sum as FluidSystem::eval,
+	// but with its own uniform grid so it does not touch m_Grid / m_GridCell
+	// of the live system and can be evaluated from any thread.
+	class ParticleField : public ImpSurface {
+	public:
+		ParticleField ();
+
+		void Build ( const SurfaceSnapshot* snap );
+
+		virtual Double eval		(const Point3d& location);
+		virtual Double evalGrad (const Point3d& location, Vector3d& gradient);
+
+		void GetMemory ( size_t& resident, size_t& reserved ) const;
+
+	private:
+		Double Gather ( const Point3d& location, Vector3d* gradient );
+
+		const SurfaceSnapshot*	m_Snap;
+		std::vector<int>		m_Head;			// first particle per cell, -1 empty
+		std::vector<int>		m_Next;			// next particle in same cell
+		Vector3DF				m_Min;
+		float					m_CellSize;		// one smoothing radius in world units
+		int						m_Res[3];
+	};
+
+	// Snapshot -> mesh -> file, off the simulation thread.
+	//
+	// A fixed number of slots bounds memory and in-flight work: Acquire()
+	// blocks (or fails, when not waiting) while every slot is either being
+	// meshed or written. Meshing runs on a thread pool, writing on a single
+	// writer thread so the disk sees one sequential stream.
+	class SurfacePipeline {
+	public:
+		SurfacePipeline ();
+		~SurfacePipeline ();
+
+		// path_fmt takes the frame number, e.g. "OBJ/Melting%04d.obj". A .ply
+		// extension selects the binary PLY writer, anything else ASCII OBJ.
+		// False if path_fmt is not a frame pattern (see mint::IsFramePattern).
+		bool Start ( int meshers, int max_in_flight, const char* path_fmt );
+		void Stop ();							// drains all submitted frames, then joins
+
+		// Meshes on the workers of pool, e.g. FluidSystem::m_Workers, rather
+		// than on meshers threads of its own; the pool must be started and
+		// outlive the pipeline. 0x0, the default, for its own. Before Start.
+		void SetPool ( mint::ThreadPool* pool )	{ m_Shared = pool; }
+
+		// Simplify each mesh before it is written: keep ratio of the marched
+		// triangles and/or stay within max_error (world units). 1 / 0 = off.
+		void SetDecimation ( float ratio, double max_error )	{ m_DecimateRatio = ratio; m_DecimateError = max_error; }
+		bool IsRunning ()				{ return m_bRunning; }
+
+		SurfaceSnapshot* Acquire ( bool wait );
+		void Submit ( SurfaceSnapshot* snap );
+		void Flush ();							// waits until every submitted frame is on disk
+
+		int NumInFlight ();
+		int NumWritten ()				{ return m_Written; }
+		int NumFailed ()				{ return m_Failed; }		// frames that could not be written
+
+		// Times "field", "march", "decimate" and "write" of every frame into
+		// prof, e.g. FluidSystem::m_Profile; the pipeline's own by default.
+		// Set before Start.
+		void SetProfiler ( mint::Profiler* prof );
+		mint::Profiler& GetProfiler ()	{ return *m_Prof; }
+
+		// Sets "surface pipeline" in rep: the snapshots, fields, meshes and
+		// marching slabs of every slot, as of the last frame each meshed.
+		void GetMemory ( mint::MemoryReport& rep );
+
+	private:
+		struct Slot;
+		class MeshJob : public mint::Job {
+		public:
+			virtual void Run ();
+			SurfacePipeline*	pipe;
+			Slot*				slot;
+		};
+		struct Slot {
+			Slot () : surface ( &field ), resident ( 0 ), reserved ( 0 )	{}
+			SurfaceSnapshot		snap;
+			ParticleField		field;
+			IsoSurface			surface;
+			MarchCube			march;
+			MeshJob				job;
+			size_t				resident, reserved;		// bytes, set by Mesh under m_Lock
+		};
+
+		void Mesh ( Slot* s );
+		mint::ThreadPool* Pool ()		{ return m_Shared != 0x0 ? m_Shared : &m_Meshers; }
+		bool Write ( Slot* s );
+		static void WriterEntry ( void* arg );
+		void WriterLoop ();
+
+		std::vector<Slot*>		m_Slots;
+		std::vector<Slot*>		m_Free;
+		std::deque<Slot*>		m_WriteQueue;
+		mint::ThreadPool		m_Meshers;
+		mint::ThreadPool*		m_Shared;		// used instead of m_Meshers, if set
+		mint::Thread			m_Writer;
+		mint::Mutex				m_Lock;
+		mint::Condition			m_SlotFree;
+		mint::Condition			m_WriteReady;
+		std::string				m_PathFmt;
+		float					m_DecimateRatio;
+		double					m_DecimateError;
+		bool					m_bPLY;
+		bool					m_bRunning;
+		bool					m_bStopWriter;
+		int						m_Written;
+		int						m_Failed;
+		mint::Profiler			m_Profile;
+		mint::Profiler*			m_Prof;
+		int						m_PhaseField, m_PhaseMarch, m_PhaseDecimate, m_PhaseWrite;
+	};
+
+#endif
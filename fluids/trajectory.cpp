@@ -0,0 +1,444 @@
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+
+#include "trajectory.h"
+#include "mtrace.h"
+
+static bool SeekTo ( FILE* fp, unsigned long long pos )
+{
+	#ifdef _MSC_VER
+		return _fseeki64 ( fp, (__int64) pos, SEEK_SET ) == 0;
+	#else
+		return fseeko ( fp, (off_t) pos, SEEK_SET ) == 0;
+	#endif
+}
+
+//------------------------------------------------------ TrajectoryWriter
+
+TrajectoryWriter::TrajectoryWriter ()
+{
+	m_File = 0x0;
+	m_Pos = 0;
+	m_NumFrames = 0;
+	m_Interval = 1;
+	m_Error = -1;
+	m_KeyInterval = 32;
+	m_Shared = 0x0;
+	m_bOpen = false;
+	m_bError = false;
+	m_bStop = false;
+}
+
+TrajectoryWriter::~TrajectoryWriter ()
+{
+	Close ();
+}
+
+void TrajectoryWriter::SetCompression ( double error, int key_interval )
+{
+	m_Error = error;
+	m_KeyInterval = key_interval > 0 ? key_interval : 1;
+}
+
+bool TrajectoryWriter::Open ( const char* filename, PointSet& psys, const char* attrs, int interval )
+{
+	if ( m_bOpen ) return false;
+
+	// Resolve the attribute names
+	m_Columns.clear ();
+	std::string list = attrs;
+	size_t start = 0;
+	while ( start <= list.size() ) {
+		size_t end = list.find ( ',', start );
+		if ( end == std::string::npos ) end = list.size();
+		std::string name = list.substr ( start, end-start );
+		start = end + 1;
+		double error = m_Error;
+		size_t colon = name.find ( ':' );
+		if ( colon != std::string::npos ) {
+			error = atof ( name.c_str() + colon + 1 );
+			name = name.substr ( 0, colon );
+		}
+		if ( name.empty() ) continue;
+		int a = psys.GetAttribute ( name );
+		if ( a < 0 || name.size() >= sizeof(m_Columns[0].desc.name) ) {
+			printf ( "Trajectory: no particle attribute '%s'.\n", name.c_str() );
+			return false;
+		}
+		GeomAttr* attr = psys.GetAttribute ( a );
+		Column c;
+		memset ( &c.desc, 0, sizeof(c.desc) );
+		strcpy ( c.desc.name, name.c_str() );
+		c.desc.dtype = attr->dtype;
+		c.desc.elem_size = attr->stride;
+		c.offset = attr->offset;
+		c.codec.Setup ( attr->dtype, attr->stride, error );
+		c.desc.error = (float) c.codec.GetError ();
+		m_Columns.push_back ( c );
+	}
+	if ( m_Columns.empty() ) {
+		printf ( "Trajectory: no attributes selected.\n" );
+		return false;
+	}
+
+	m_File = fopen ( filename, "wb" );
+	if ( m_File == 0x0 ) {
+		printf ( "Trajectory: cannot open %s for writing.\n", filename );
+		return false;
+	}
+	setvbuf ( m_File, 0x0, _IOFBF, 1 << 20 );
+
+	trajectory_header hdr;
+	memset ( &hdr, 0, sizeof(hdr) );
+	memcpy ( hdr.magic, TRAJECTORY_MAGIC, 4 );
+	hdr.version = TRAJECTORY_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.num_columns = (int) m_Columns.size();
+	hdr.key_interval = ( m_Error >= 0 ) ? m_KeyInterval : 0;
+	m_Pos = 0;
+	m_bError = false;
+	Put ( &hdr, sizeof(hdr) );
+	for (int c=0; c < (int) m_Columns.size(); c++)
+		Put ( &m_Columns[c].desc, sizeof(trajectory_column) );
+
+	m_Index.clear ();
+	m_NumFrames = 0;
+	m_Interval = interval > 0 ? interval : 1;
+	for (int n=0; n < 2; n++) {
+		Frame* f = new Frame;
+		f->data.resize ( m_Columns.size() );
+		f->packed.resize ( m_Columns.size() );
+		m_Slots.push_back ( f );
+		m_Free.push_back ( f );
+	}
+	if ( m_Shared != 0x0 && m_Shared->NumThreads() == 0 ) m_Shared = 0x0;
+	if ( m_Error >= 0 && m_Shared == 0x0 ) {
+		int workers = (int) m_Columns.size();
+		if ( workers > mint::NumProcessors() ) workers = mint::NumProcessors();
+		m_Encoders.SetName ( "trajectory encoder" );
+		m_Encoders.Start ( workers );
+	}
+	m_bStop = false;
+	m_Writer.Start ( WriterEntry, this );
+	m_bOpen = true;
+	return true;
+}
+
+void TrajectoryWriter::Close ()
+{
+	if ( !m_bOpen ) return;
+	m_Lock.Lock ();
+	m_bStop = true;
+	m_Ready.Signal ();
+	m_Lock.Unlock ();
+	m_Writer.Join ();
+	m_Encoders.Stop ();
+
+	// Frame index, then point the header at it
+	trajectory_header hdr;
+	memset ( &hdr, 0, sizeof(hdr) );
+	memcpy ( hdr.magic, TRAJECTORY_MAGIC, 4 );
+	hdr.version = TRAJECTORY_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.num_columns = (int) m_Columns.size();
+	hdr.key_interval = ( m_Error >= 0 ) ? m_KeyInterval : 0;
+	hdr.num_frames = m_NumFrames;
+	hdr.index_offset = m_Pos;
+	if ( !m_Index.empty() ) Put ( &m_Index[0], m_Index.size() );
+	if ( !SeekTo ( m_File, 0 ) || fwrite ( &hdr, sizeof(hdr), 1, m_File ) != 1 ) m_bError = true;
+	if ( fclose ( m_File ) != 0 ) m_bError = true;
+	if ( m_bError ) printf ( "Trajectory: write error, the file is incomplete.\n" );
+	m_File = 0x0;
+
+	for (int n=0; n < (int) m_Slots.size(); n++)
+		delete m_Slots[n];
+	m_Slots.clear ();
+	m_Free.clear ();
+	m_bOpen = false;
+}
+
+bool TrajectoryWriter::Step ( PointSet& psys, int frame )
+{
+	if ( !m_bOpen || frame % m_Interval != 0 ) return false;
+	Submit ( psys, frame );
+	return true;
+}
+
+void TrajectoryWriter::Submit ( PointSet& psys, int frame )
+{
+	m_Lock.Lock ();
+	while ( m_Free.empty() )
+		m_SlotFree.Wait ( m_Lock );
+	Frame* f = m_Free.back ();
+	m_Free.pop_back ();
+	m_Lock.Unlock ();
+
+	// Gather each attribute into its own column
+	int num = psys.NumPoints ();
+	int stride = psys.GetStride ( 0 );
+	const char* base = psys.GetStart ( 0 );
+	f->frame = frame;
+	f->time = psys.GetTime ();
+	f->num = num;
+	for (int c=0; c < (int) m_Columns.size(); c++) {
+		int size = m_Columns[c].desc.elem_size;
+		std::vector<char>& col = f->data[c];
+		col.resize ( (size_t) num * size );
+		const char* src = base + m_Columns[c].offset;
+		char* dst = col.empty() ? 0x0 : &col[0];
+		for (int n=0; n < num; n++, src += stride, dst += size)
+			memcpy ( dst, src, size );
+	}
+
+	m_Lock.Lock ();
+	m_Queue.push_back ( f );
+	m_Ready.Signal ();
+	m_Lock.Unlock ();
+}
+
+bool TrajectoryWriter::Put ( const void* data, size_t size )
+{
+	if ( size > 0 && fwrite ( data, 1, size, m_File ) != size ) m_bError = true;
+	m_Pos += size;
+	return !m_bError;
+}
+
+void TrajectoryWriter::WriteFrame ( Frame* f )
+{
+	mint::ScopedTrace t ( "trajectory write" );
+	trajectory_frame rec;
+	rec.frame = f->frame;
+	rec.num_particles = f->num;
+	rec.time = f->time;
+	size_t at = m_Index.size();
+	m_Index.resize ( at + sizeof(rec) + m_Columns.size() * sizeof(unsigned long long) );
+	memcpy ( &m_Index[at], &rec, sizeof(rec) );
+	unsigned long long* offsets = (unsigned long long*) &m_Index[at + sizeof(rec)];
+
+	bool quant = ( m_Error >= 0 );
+	if ( quant ) {
+		EncodeBody body ( this, f, m_NumFrames % m_KeyInterval == 0 );
+		mint::ParallelFor ( m_Shared != 0x0 ? m_Shared : &m_Encoders, 0, (int) m_Columns.size(), 1, body );
+	}
+
+	for (int c=0; c < (int) m_Columns.size(); c++) {
+		const std::vector<char>& raw = f->data[c];
+		const std::vector<char>& col = quant ? f->packed[c] : raw;
+		trajectory_chunk chunk;
+		memcpy ( chunk.magic, TRAJECTORY_CHUNK_MAGIC, 4 );
+		chunk.frame = f->frame;
+		chunk.column = c;
+		chunk.num_particles = f->num;
+		chunk.time = f->time;
+		chunk.codec = quant ? TRAJECTORY_QUANT : TRAJECTORY_RAW;
+		chunk.raw_size = (unsigned int) raw.size();
+		chunk.stored_size = (unsigned int) col.size();
+		memcpy ( offsets + c, &m_Pos, sizeof(m_Pos) );
+		Put ( &chunk, sizeof(chunk) );
+		if ( !col.empty() ) Put ( &col[0], col.size() );
+	}
+	m_NumFrames++;
+}
+
+void TrajectoryWriter::EncodeBody::Run ( int begin, int end )
+{
+	for (int c=begin; c < end; c++) {
+		mint::ScopedTrace t ( "trajectory encode" );
+		std::vector<char>& raw = m_F->data[c];
+		m_F->packed[c].clear ();
+		m_W->m_Columns[c].codec.Encode ( raw.empty() ? 0x0 : &raw[0], m_F->num, m_bKey, m_F->packed[c] );
+	}
+}
+
+void TrajectoryWriter::WriterEntry ( void* arg )
+{
+	mint::GetTracer().SetThreadName ( "trajectory writer" );
+	((TrajectoryWriter*) arg)->WriterLoop ();
+}
+
+void TrajectoryWriter::WriterLoop ()
+{
+	Frame* f;
+	for (;;) {
+		m_Lock.Lock ();
+		while ( m_Queue.empty() && !m_bStop )
+			m_Ready.Wait ( m_Lock );
+		if ( m_Queue.empty() ) {
+			m_Lock.Unlock ();
+			return;
+		}
+		f = m_Queue.front ();
+		m_Queue.pop_front ();
+		m_Lock.Unlock ();
+
+		WriteFrame ( f );
+
+		m_Lock.Lock ();
+		m_Free.push_back ( f );
+		m_SlotFree.Signal ();
+		m_Lock.Unlock ();
+	}
+}
+
+//------------------------------------------------------ TrajectoryReader
+
+TrajectoryReader::TrajectoryReader ()
+{
+	m_File = 0x0;
+}
+
+TrajectoryReader::~TrajectoryReader ()
+{
+	Close ();
+}
+
+bool TrajectoryReader::Open ( const char* filename )
+{
+	Close ();
+	m_File = fopen ( filename, "rb" );
+	if ( m_File == 0x0 ) {
+		printf ( "Trajectory %s not found.\n", filename );
+		return false;
+	}
+	trajectory_header hdr;
+	if ( fread ( &hdr, sizeof(hdr), 1, m_File ) != 1 || memcmp ( hdr.magic, TRAJECTORY_MAGIC, 4 ) != 0 ||
+		 hdr.version != TRAJECTORY_VERSION || hdr.header_size != sizeof(hdr) || hdr.num_columns <= 0 ) {
+		printf ( "%s is not a supported trajectory.\n", filename );
+		Close ();
+		return false;
+	}
+	m_Columns.resize ( hdr.num_columns );
+	if ( fread ( &m_Columns[0], sizeof(trajectory_column), hdr.num_columns, m_File ) != (size_t) hdr.num_columns ) {
+		printf ( "Trajectory %s is truncated.\n", filename );
+		Close ();
+		return false;
+	}
+	m_Codecs.resize ( hdr.num_columns );
+	m_Decoded.assign ( hdr.num_columns, -1 );
+	for (int c=0; c < hdr.num_columns; c++) {
+		m_Columns[c].name[sizeof(m_Columns[c].name)-1] = '\0';
+		m_Codecs[c].Setup ( m_Columns[c].dtype, m_Columns[c].elem_size, m_Columns[c].error );
+	}
+
+	unsigned long long data_start = sizeof(hdr) + hdr.num_columns * sizeof(trajectory_column);
+	if ( hdr.index_offset == 0 ) {
+		printf ( "Trajectory %s was not closed; rebuilding its index.\n", filename );
+		return Scan ( data_start );
+	}
+
+	// Frame index
+	size_t rec = sizeof(trajectory_frame) + hdr.num_columns * sizeof(unsigned long long);
+	std::vector<char> index ( rec * hdr.num_frames );
+	if ( !SeekTo ( m_File, hdr.index_offset ) ||
+		 ( !index.empty() && fread ( &index[0], 1, index.size(), m_File ) != index.size() ) ) {
+		printf ( "Trajectory %s has a bad frame index; rebuilding it.\n", filename );
+		return Scan ( data_start );
+	}
+	m_Frames.resize ( hdr.num_frames );
+	m_Chunks.resize ( (size_t) hdr.num_frames * hdr.num_columns );
+	for (int i=0; i < hdr.num_frames; i++) {
+		memcpy ( &m_Frames[i], &index[i*rec], sizeof(trajectory_frame) );
+		if ( hdr.num_columns > 0 )
+			memcpy ( &m_Chunks[(size_t) i*hdr.num_columns], &index[i*rec + sizeof(trajectory_frame)], hdr.num_columns * sizeof(unsigned long long) );
+	}
+	return true;
+}
+
+// Walks the chunks from pos, keeping every frame whose columns are all present.
+bool TrajectoryReader::Scan ( unsigned long long pos )
+{
+	int ncol = (int) m_Columns.size();
+	trajectory_chunk chunk;
+	std::vector<unsigned long long> pending ( ncol );
+	int have = 0;
+
+	m_Frames.clear ();
+	m_Chunks.clear ();
+	while ( SeekTo ( m_File, pos ) && fread ( &chunk, sizeof(chunk), 1, m_File ) == 1 ) {
+		if ( memcmp ( chunk.magic, TRAJECTORY_CHUNK_MAGIC, 4 ) != 0 || chunk.column != have )
+			break;
+		pending[have++] = pos;
+		pos += sizeof(chunk) + chunk.stored_size;
+		if ( have == ncol ) {
+			if ( !SeekTo ( m_File, pos - 1 ) || fgetc ( m_File ) == EOF )
+				break;								// last chunk cut short
+			trajectory_frame f;
+			f.frame = chunk.frame;
+			f.num_particles = chunk.num_particles;
+			f.time = chunk.time;
+			m_Frames.push_back ( f );
+			m_Chunks.insert ( m_Chunks.end(), pending.begin(), pending.end() );
+			have = 0;
+		}
+	}
+	return true;
+}
+
+void TrajectoryReader::Close ()
+{
+	if ( m_File != 0x0 ) fclose ( m_File );
+	m_File = 0x0;
+	m_Columns.clear ();
+	m_Frames.clear ();
+	m_Chunks.clear ();
+	m_Codecs.clear ();
+	m_Decoded.clear ();
+}
+
+int TrajectoryReader::FindColumn ( const char* name )
+{
+	for (int c=0; c < (int) m_Columns.size(); c++)
+		if ( strcmp ( m_Columns[c].name, name ) == 0 )
+			return c;
+	return -1;
+}
+
+bool TrajectoryReader::ReadChunk ( int i, int c, trajectory_chunk& chunk, std::vector<char>& payload )
+{
+	if ( !SeekTo ( m_File, m_Chunks[(size_t) i*m_Columns.size() + c] ) ||
+		 fread ( &chunk, sizeof(chunk), 1, m_File ) != 1 ||
+		 memcmp ( chunk.magic, TRAJECTORY_CHUNK_MAGIC, 4 ) != 0 || chunk.column != c ) {
+		printf ( "Trajectory: bad chunk for frame %d, column %s.\n", m_Frames[i].frame, m_Columns[c].name );
+		return false;
+	}
+	if ( ( chunk.codec != TRAJECTORY_RAW && chunk.codec != TRAJECTORY_QUANT ) ||
+		 ( chunk.codec == TRAJECTORY_RAW && chunk.stored_size != chunk.raw_size ) ||
+		 chunk.raw_size != (unsigned int) chunk.num_particles * m_Columns[c].elem_size ) {
+		printf ( "Trajectory: unsupported chunk encoding %d.\n", chunk.codec );
+		return false;
+	}
+	payload.resize ( chunk.stored_size );
+	return payload.empty() || fread ( &payload[0], 1, payload.size(), m_File ) == payload.size();
+}
+
+bool TrajectoryReader::Read ( int i, int c, std::vector<char>& out )
+{
+	if ( m_File == 0x0 || i < 0 || i >= NumFrames() || c < 0 || c >= NumColumns() ) return false;
+	trajectory_chunk chunk;
+	if ( !ReadChunk ( i, c, chunk, m_Payload ) ) return false;
+	if ( chunk.codec == TRAJECTORY_RAW ) {
+		out.swap ( m_Payload );
+		return true;
+	}
+
+	// Back to a key frame, or to the frame the codec holds
+	int from = i;
+	while ( !mint::ColumnCodec::IsKey ( m_Payload.empty() ? 0x0 : &m_Payload[0], m_Payload.size() ) && ( m_Decoded[c] < 0 || m_Decoded[c] != from-1 ) ) {
+		if ( --from < 0 || !ReadChunk ( from, c, chunk, m_Payload ) ) {
+			printf ( "Trajectory: no key frame before frame %d, column %s.\n", m_Frames[i].frame, m_Columns[c].name );
+			return false;
+		}
+	}
+	for (int j=from; j <= i; j++) {
+		if ( j != from && !ReadChunk ( j, c, chunk, m_Payload ) ) return false;
+		out.resize ( chunk.raw_size );
+		m_Decoded[c] = -1;
+		if ( !m_Codecs[c].Decode ( m_Payload.empty() ? 0x0 : &m_Payload[0], m_Payload.size(), chunk.num_particles, out.empty() ? 0x0 : &out[0] ) ) {
+			printf ( "Trajectory: corrupt chunk for frame %d, column %s.\n", m_Frames[j].frame, m_Columns[c].name );
+			return false;
+		}
+		m_Decoded[c] = j;
+	}
+	return true;
+}
@@ -0,0 +1,136 @@
+#ifndef DEF_TRAJECTORY
+	#define DEF_TRAJECTORY
+
+	#include <stdio.h>
+	#include <vector>
+	#include <deque>
+
+	#include "mthread.h"
+	#include "mcodec.h"
+	#include "point_set.h"
+	#include "trajectory_format.h"
+
+	// Streams selected particle attributes to a columnar trajectory file
+	// (see trajectory_format.h) every interval frames.
+	//
+	// Submit() gathers each attribute into its own contiguous column on the
+	// simulation thread and queues the frame; a writer thread appends the
+	// chunks. Two frame buffers are kept, so the simulation only waits when
+	// the disk falls a whole frame behind.
+	//
+	// With compression on, the writer thread encodes the columns of a frame
+	// in parallel, on its own pool or a shared one, before appending them.
+	class TrajectoryWriter {
+	public:
+		TrajectoryWriter ();
+		~TrajectoryWriter ();
+
+		// Codes the chunks of the next Open with TRAJECTORY_QUANT, float
+		// columns within error of the original (0 for lossless) and a key
+		// frame every key_interval recorded frames. error < 0 stores raw chunks.
+		void SetCompression ( double error, int key_interval );
+
+		// attrs is a comma separated list of GeomX attribute names of buffer 0,
+		// e.g. "pos,vel,temp,state,density". A name may carry its own error
+		// bound, as in "pos:0.0005".
+		bool Open ( const char* filename, PointSet& psys, const char* attrs, int interval );
+
+		// Encodes on the workers of pool rather than on threads of its own;
+		// the pool must be started and outlive the writer. 0x0, the default,
+		// for its own. Before Open.
+		void SetPool ( mint::ThreadPool* pool )	{ m_Shared = pool; }
+		void Close ();							// drains queued frames, writes the frame index
+		bool IsOpen ()					{ return m_bOpen; }
+
+		bool Step ( PointSet& psys, int frame );	// records when frame is due
+		void Submit ( PointSet& psys, int frame );	// records now
+
+		int NumFrames ()				{ return m_NumFrames; }
+
+	private:
+		struct Column {
+			trajectory_column	desc;
+			int					offset;			// within the particle record
+			mint::ColumnCodec	codec;
+		};
+		struct Frame {
+			int									frame;
+			double								time;
+			int									num;
+			std::vector< std::vector<char> >	data;		// one per column
+			std::vector< std::vector<char> >	packed;		// encoded data
+		};
+		class EncodeBody : public mint::ParallelBody {
+		public:
+			EncodeBody ( TrajectoryWriter* w, Frame* f, bool key ) : m_W(w), m_F(f), m_bKey(key)	{}
+			virtual void Run ( int begin, int end );
+			TrajectoryWriter*	m_W;
+			Frame*				m_F;
+			bool				m_bKey;
+		};
+
+		void WriteFrame ( Frame* f );
+		bool Put ( const void* data, size_t size );
+		static void WriterEntry ( void* arg );
+		void WriterLoop ();
+
+		FILE*					m_File;
+		unsigned long long		m_Pos;
+		std::vector<Column>		m_Columns;
+		std::vector<char>		m_Index;
+		int						m_NumFrames;
+		int						m_Interval;
+		double					m_Error;
+		int						m_KeyInterval;
+		mint::ThreadPool		m_Encoders;
+		mint::ThreadPool*		m_Shared;		// used instead of m_Encoders, if set
+		bool					m_bOpen;
+		bool					m_bError;
+
+		std::vector<Frame*>		m_Slots;
+		std::vector<Frame*>		m_Free;
+		std::deque<Frame*>		m_Queue;
+		mint::Thread			m_Writer;
+		mint::Mutex				m_Lock;
+		mint::Condition			m_SlotFree;
+		mint::Condition			m_Ready;
+		bool					m_bStop;
+	};
+
+	// Random access to the frames and columns of a trajectory file.
+	class TrajectoryReader {
+	public:
+		TrajectoryReader ();
+		~TrajectoryReader ();
+
+		bool Open ( const char* filename );
+		void Close ();
+
+		int NumFrames ()				{ return (int) m_Frames.size(); }
+		int NumColumns ()				{ return (int) m_Columns.size(); }
+		const trajectory_column& GetColumn ( int c )	{ return m_Columns[c]; }
+		int FindColumn ( const char* name );		// -1 if not recorded
+
+		int GetFrame ( int i )			{ return m_Frames[i].frame; }
+		double GetTime ( int i )		{ return m_Frames[i].time; }
+		int NumParticles ( int i )		{ return m_Frames[i].num_particles; }
+
+		// Reads column c of the i-th recorded frame: NumParticles(i) elements
+		// of GetColumn(c).elem_size bytes. Reading a column frame after frame
+		// decodes each chunk once; a jump decodes from the last key frame.
+		bool Read ( int i, int c, std::vector<char>& out );
+
+	private:
+		bool Scan ( unsigned long long pos );
+		bool ReadChunk ( int i, int c, trajectory_chunk& chunk, std::vector<char>& payload );
+
+		FILE*								m_File;
+		std::vector<trajectory_column>		m_Columns;
+		std::vector<trajectory_frame>		m_Frames;
+		std::vector<unsigned long long>		m_Chunks;	// frames x columns
+		std::vector<mint::ColumnCodec>		m_Codecs;	// per column
+		std::vector<int>					m_Decoded;	// frame last decoded by each codec
+		std::vector<char>					m_Payload;
+	};
+
+#endif
@@ -0,0 +1,106 @@
+// Trajectory file format for particle output (.mtj)
+//
+// Columnar: every recorded frame stores each selected Fluid attribute as a
+// separate chunk, so a reader can pull one attribute over many frames
+// without touching the others. The file is
+//
+//   trajectory_header
+//   trajectory_column[num_columns]
+//   chunks, in frame order, columns in descriptor order within a frame
+//   frame index (written on close)
+//
+// A chunk is a trajectory_chunk followed by stored_size bytes. With
+// TRAJECTORY_RAW they are num_particles elements of elem_size bytes each,
+// in particle order. With TRAJECTORY_QUANT they are a mint::ColumnCodec
+// stream (see mcodec.h): float columns quantized to the column's error
+// bound, predicted from the previous frame and Rice coded. Such a chunk
+// can only be decoded after the chunks of its column back to the last key
+// frame; the writer codes one every key_interval frames.
+//
+// The frame index holds num_frames records of a trajectory_frame followed
+// by num_columns 64-bit file offsets of that frame's chunks. index_offset
+// is 0 while the file is being written; a reader of such a file (e.g. after
+// a crash) rebuilds the index by walking the chunks.
+//
+// All offsets are in bytes from the start of the file. All data is aligned
+// to one byte (no padding) and in host byte order (little-endian).
+
+#ifndef _TRAJECTORY_FORMAT_H_
+#define _TRAJECTORY_FORMAT_H_
+
+#define TRAJECTORY_MAGIC		"MTJ1"
+#define TRAJECTORY_CHUNK_MAGIC	"CHNK"
+#define TRAJECTORY_VERSION		2
+
+// Chunk codecs
+#define TRAJECTORY_RAW			0
+#define TRAJECTORY_QUANT		1
+
+#pragma pack(push)
+#pragma pack(1)
+
+struct trajectory_header {
+
+  // TRAJECTORY_MAGIC, not null terminated
+  char magic[4];
+
+  int version;
+
+  // Size of this structure
+  int header_size;
+
+  int num_columns;
+
+  // Recorded frames between key frames of TRAJECTORY_QUANT chunks
+  int key_interval;
+
+  // Frame index, 0 until the writer has closed the file
+  int num_frames;
+  unsigned long long index_offset;
+
+};
+
+struct trajectory_column {
+
+  // GeomX attribute name, null terminated
+  char name[32];
+
+  // ATTR_FLOAT, ATTR_INT or ATTR_BYTES (see geomx.h)
+  int dtype;
+
+  // Bytes per particle
+  int elem_size;
+
+  // Absolute error bound of a float column, 0 when stored exactly
+  float error;
+
+};
+
+struct trajectory_chunk {
+
+  // TRAJECTORY_CHUNK_MAGIC, not null terminated
+  char magic[4];
+
+  int frame;
+  int column;
+  int num_particles;
+  double time;
+
+  // TRAJECTORY_* codec of the payload
+  int codec;
+  unsigned int raw_size;
+  unsigned int stored_size;
+
+};
+
+struct trajectory_frame {
+
+  int frame;
+  int num_particles;
+  double time;
+
+};
+
+#pragma pack(pop)
+
+#endif
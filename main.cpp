@@ -31,6 +31,9 @@
 #include "include\fps.h"
 
 #include "fluid_system.h"
+#include "surface_pipeline.h"
+#include "checkpoint.h"
+#include "trajectory.h"
 #include "gl_helper.h"
 
 #ifdef _MSC_VER						// Windows
@@ -49,6 +52,9 @@ bool bRec = false;
 
 // Globals
 FluidSystem			psys;
+SurfacePipeline		surf_pipe;				// background surface export, toggled with O
+CheckpointWriter	ckpt;					// periodic checkpoints, toggled with K
+TrajectoryWriter	traj;					// particle attribute output, toggled with J
 
 float window_width  = 1024;
 float window_height = 768;
@@ -61,12 +67,14 @@ int		psys_rate = 0;							// Particle stuff
 int		psys_freq = 1;
 int		psys_demo = 0;
 int		psys_nmax = 4096;
+const char* psys_params = 0x0;				// parameter file, first argument
 
 bool	bHelp = false;						// Toggles
 int		iShade = 1;			
 int		iClrMode = 0;
 bool	bPntDraw = false;
 bool    bPause = false;
+bool	bNeighbors = false;					// neighbor statistics overlay
 
 // View matricies
 float view_matrix[16];					// View matrix (V)
@@ -172,6 +180,41 @@ void drawScene ( float* viewmat, bool bShade )
 	drawAxes();
 }
 
+// Neighbor counts of the last step: totals, and the histogram as bars with
+// MAX_NEIGHBOR marked in red. Pixel coordinates, as set up by draw2D.
+void drawNeighborStats ()
+{
+	const NeighborStats& ns = psys.GetNeighborStats ();
+	char disp[200];
+	float x0 = window_width - 20 - 2*NEIGHBOR_BINS;
+	float y0 = 150;								// bottom of the bars
+	float h = 100;
+
+	glColor4f ( 1.0, 1.0, 1.0, 1.0 );
+	sprintf ( disp, "Neighbors: %.1f mean, %d max", ns.mean, ns.max );							drawText ( (int) x0, 20, disp );
+	sprintf ( disp, "Over %d: %d particles, %d dropped", MAX_NEIGHBOR, ns.overflow, ns.dropped );	drawText ( (int) x0, 30, disp );
+	sprintf ( disp, "Cell max %d, candidates max %d", ns.max_cell, ns.max_candidates );			drawText ( (int) x0, 40, disp );
+
+	int top = 1;
+	for (int n=0; n < NEIGHBOR_BINS; n++)
+		if ( ns.hist[n] > top ) top = ns.hist[n];
+	glBegin ( GL_QUADS );
+	for (int n=0; n < NEIGHBOR_BINS; n++) {
+		float x = x0 + 2*n;
+		float y = y0 - h * ns.hist[n] / top;
+		if ( n > MAX_NEIGHBOR ) glColor3f ( 1.0, 0.3, 0.3 );
+		else					glColor3f ( 0.6, 0.8, 1.0 );
+		glVertex2f ( x, y0 );	glVertex2f ( x+2, y0 );
+		glVertex2f ( x+2, y );	glVertex2f ( x, y );
+	}
+	glEnd ();
+	glColor3f ( 1.0, 0.0, 0.0 );
+	glBegin ( GL_LINES );
+	glVertex2f ( x0 + 2*MAX_NEIGHBOR, y0 );	glVertex2f ( x0 + 2*MAX_NEIGHBOR, y0 - h );
+	glEnd ();
+	glColor4f ( 1.0, 1.0, 1.0, 1.0 );
+}
+
 void draw2D ()
 {
 	
@@ -222,26 +265,35 @@ void draw2D ()
 		//sprintf ( disp,	"O      Change emitter angle" );	drawText ( 20, 150,  disp );	
 		//sprintf ( disp,	"L      Move light /w mouse" );				drawText ( 20, 160,  disp );			
 		sprintf ( disp,	"X      Draw velocity/pressure/color" );	drawText ( 20, 140,  disp );
+		sprintf ( disp,	"O      Export surface (PLY, background)" );	drawText ( 20, 150,  disp );
+		sprintf ( disp,	"K L    Checkpoints on/off, restore" );	drawText ( 20, 160,  disp );
+		sprintf ( disp,	"J      Record trajectory" );	drawText ( 20, 170,  disp );
+		sprintf ( disp,	"P      Write phase timings" );	drawText ( 20, 180,  disp );
+		sprintf ( disp,	"V      Neighbor statistics" );	drawText ( 20, 190,  disp );
+		sprintf ( disp,	"B      Memory report" );	drawText ( 20, 200,  disp );
+		sprintf ( disp,	"E      Record event timeline" );	drawText ( 20, 210,  disp );
 
 		Vector3DF vol = psys.GetVec(SPH_VOLMAX);
 		vol -= psys.GetVec(SPH_VOLMIN);
-		sprintf ( disp,	"Volume Size:           %3.5f %3.2f %3.2f", vol.x, vol.y, vol.z );	drawText ( 20, 190,  disp );
-		sprintf ( disp,	"Time Step (dt):        %3.5f", psys.GetDT () );					drawText ( 20, 200,  disp );
-		sprintf ( disp,	"Num Particles:         %d", psys.NumPoints() );					drawText ( 20, 210,  disp );		
-		sprintf ( disp,	"Simulation Scale:      %3.5f", psys.GetParam(SPH_SIMSIZE) );		drawText ( 20, 220,  disp );
-		sprintf ( disp,	"Simulation Size (m):   %3.5f", psys.GetParam(SPH_SIMSCALE) );		drawText ( 20, 230,  disp );
-		sprintf ( disp,	"Smooth Radius (m):     %3.3f", psys.GetParam(SPH_SMOOTHRADIUS) );	drawText ( 20, 240,  disp );
-		sprintf ( disp,	"Particle Radius (m):   %3.3f", psys.GetParam(SPH_PRADIUS) );		drawText ( 20, 250,  disp );
-		sprintf ( disp,	"Particle Mass (kg):    %0.8f", psys.GetParam(SPH_PMASS) );			drawText ( 20, 260,  disp );
-		sprintf ( disp,	"Rest Density (kg/m^3): %3.3f", psys.GetParam(SPH_RESTDENSITY) );	drawText ( 20, 270,  disp );
-		sprintf ( disp,	"Viscosity:             %3.3f", psys.GetParam(SPH_VISC) );			drawText ( 20, 280,  disp );
-		sprintf ( disp,	"Internal Stiffness:    %3.3f", psys.GetParam(SPH_INTSTIFF) );		drawText ( 20, 290,  disp );
-		sprintf ( disp,	"Boundary Stiffness:    %6.0f", psys.GetParam(SPH_EXTSTIFF) );		drawText ( 20, 300,  disp );
-		sprintf ( disp,	"Boundary Dampening:    %4.3f", psys.GetParam(SPH_EXTDAMP) );		drawText ( 20, 310,  disp );
-		sprintf ( disp,	"Speed Limiting:        %4.3f", psys.GetParam(SPH_LIMIT) );			drawText ( 20, 320,  disp );
+		sprintf ( disp,	"Volume Size:           %3.5f %3.2f %3.2f", vol.x, vol.y, vol.z );	drawText ( 20, 220,  disp );
+		sprintf ( disp,	"Time Step (dt):        %3.5f", psys.GetDT () );					drawText ( 20, 230,  disp );
+		sprintf ( disp,	"Num Particles:         %d", psys.NumPoints() );					drawText ( 20, 240,  disp );		
+		sprintf ( disp,	"Simulation Scale:      %3.5f", psys.GetParam(SPH_SIMSIZE) );		drawText ( 20, 250,  disp );
+		sprintf ( disp,	"Simulation Size (m):   %3.5f", psys.GetParam(SPH_SIMSCALE) );		drawText ( 20, 260,  disp );
+		sprintf ( disp,	"Smooth Radius (m):     %3.3f", psys.GetParam(SPH_SMOOTHRADIUS) );	drawText ( 20, 270,  disp );
+		sprintf ( disp,	"Particle Radius (m):   %3.3f", psys.GetParam(SPH_PRADIUS) );		drawText ( 20, 280,  disp );
+		sprintf ( disp,	"Particle Mass (kg):    %0.8f", psys.GetParam(SPH_PMASS) );			drawText ( 20, 290,  disp );
+		sprintf ( disp,	"Rest Density (kg/m^3): %3.3f", psys.GetParam(SPH_RESTDENSITY) );	drawText ( 20, 300,  disp );
+		sprintf ( disp,	"Viscosity:             %3.3f", psys.GetParam(SPH_VISC) );			drawText ( 20, 310,  disp );
+		sprintf ( disp,	"Internal Stiffness:    %3.3f", psys.GetParam(SPH_INTSTIFF) );		drawText ( 20, 320,  disp );
+		sprintf ( disp,	"Boundary Stiffness:    %6.0f", psys.GetParam(SPH_EXTSTIFF) );		drawText ( 20, 330,  disp );
+		sprintf ( disp,	"Boundary Dampening:    %4.3f", psys.GetParam(SPH_EXTDAMP) );		drawText ( 20, 340,  disp );
+		sprintf ( disp,	"Speed Limiting:        %4.3f", psys.GetParam(SPH_LIMIT) );			drawText ( 20, 350,  disp );
 		vol = psys.GetVec ( PLANE_GRAV_DIR );
-		sprintf ( disp,	"Gravity:               %3.2f %3.2f %3.2f", vol.x, vol.y, vol.z );	drawText ( 20, 330,  disp );
+		sprintf ( disp,	"Gravity:               %3.2f %3.2f %3.2f", vol.x, vol.y, vol.z );	drawText ( 20, 360,  disp );
 	}
+	if ( bNeighbors ) drawNeighborStats ();
+
 	char info[1024];
 	sprintf(info, "FPS: %3.1f %s",
 		fps_tracker.fpsAverage(),
@@ -336,6 +388,16 @@ void display ()
 		//exportOBJ();
 	}
 	
+	// Hand this step's particles to the mesher; blocks only while every
+	// snapshot slot is still being meshed or written.
+	if ( surf_pipe.IsRunning() && !bPause ) {
+		SurfaceSnapshot* snap = surf_pipe.Acquire ( true );
+		psys.SnapshotSurface ( *snap, frame );
+		surf_pipe.Submit ( snap );
+	}
+	if ( ckpt.IsRunning() && !bPause ) ckpt.Step ( psys, frame );
+	if ( traj.IsOpen() && !bPause ) traj.Step ( psys, frame );
+
 	// Do simulation!
 	if ( !bPause ) psys.Run ();
 
@@ -429,7 +491,72 @@ void keyboard_func ( unsigned char key, int x, int y )
 			frame = 0;
 		}
 		break;
-	case 27:			    exit( 0 ); break;
+	case 'o': case 'O':
+		if ( surf_pipe.IsRunning() ) {
+			surf_pipe.Stop ();
+			printf ( "Surface export off (%d frames written, %d failed).\n", surf_pipe.NumWritten(), surf_pipe.NumFailed() );
+		} else {
+			surf_pipe.SetDecimation ( 0.25, 0.0 );
+			surf_pipe.Start ( mint::NumProcessors()-1, 2, "OBJ/Melting%0d.ply" );
+			printf ( "Surface export on.\n" );
+		}
+		break;
+	case 'k': case 'K':
+		if ( ckpt.IsRunning() ) {
+			ckpt.Stop ();
+			printf ( "Checkpoints off (%d written).\n", ckpt.NumWritten() );
+		} else {
+			ckpt.SetCompression ( CHECKPOINT_ERROR );
+			ckpt.Start ( CHECKPOINT_PATH, CHECKPOINT_INTERVAL );
+			ckpt.Submit ( psys, frame );
+			printf ( "Checkpoints on, every %d frames to %s.\n", CHECKPOINT_INTERVAL, CHECKPOINT_PATH );
+		}
+		break;
+	case 'j': case 'J':
+		if ( traj.IsOpen() ) {
+			traj.Close ();
+			printf ( "Trajectory off (%d frames written).\n", traj.NumFrames() );
+		} else {
+			traj.SetCompression ( TRAJECTORY_ERROR, TRAJECTORY_KEYFRAMES );
+			if ( traj.Open ( TRAJECTORY_PATH, psys, TRAJECTORY_ATTRS, TRAJECTORY_INTERVAL ) )
+				printf ( "Trajectory on, %s every %d frames to %s.\n", TRAJECTORY_ATTRS, TRAJECTORY_INTERVAL, TRAJECTORY_PATH );
+		}
+		break;
+	case 'l': case 'L':
+		ckpt.Flush ();
+		psys.LoadCheckpoint ( CHECKPOINT_PATH, frame );
+		break;
+	case 'p': case 'P':
+		psys.m_Profile.Print ( "Phase timings (ms)" );
+		if ( psys.m_Profile.Write ( PROFILE_PATH ) ) printf ( "Phase timings written to %s.\n", PROFILE_PATH );
+		break;
+	case 'v': case 'V':
+		bNeighbors = !bNeighbors;
+		if ( bNeighbors ) psys.PrintNeighborStats ();
+		break;
+	case 'b': case 'B':
+		surf_pipe.GetMemory ( psys.m_Memory );
+		psys.m_Memory.Print ( "Memory (MB)" );
+		break;
+	case 'e': case 'E':
+		if ( mint::GetTracer().IsEnabled() ) {
+			mint::GetTracer().SetEnabled ( false );
+			if ( mint::GetTracer().Write ( TRACE_PATH ) ) printf ( "Event timeline written to %s.\n", TRACE_PATH );
+		} else {
+			mint::GetTracer().Clear ();
+			mint::GetTracer().SetEnabled ( true );
+			printf ( "Recording the event timeline, E again to write it.\n" );
+		}
+		break;
+	case 27:
+		surf_pipe.Stop (); ckpt.Stop (); traj.Close ();
+		psys.m_Profile.Write ( PROFILE_PATH );
+		if ( mint::GetTracer().IsEnabled() ) {
+			mint::GetTracer().SetEnabled ( false );
+			mint::GetTracer().Write ( TRACE_PATH );
+		}
+		exit( 0 );
+		break;
 	
 	case '`':
 		bRec = !bRec; break;
@@ -577,8 +704,13 @@ void init ()
 		setShadowLightColor ( .7, .7, .7, 0.2, 0.2, 0.2 );		
 	#endif
 
+	if ( psys_params != 0x0 ) {
+		MeltParams params;
+		if ( params.Load ( psys_params ) ) psys.SetMeltParams ( params );
+	}
 	psys.Initialize ( BFLUID, psys_nmax );
 	psys.SPH_CreateExample ( psys_demo, psys_nmax );
+	surf_pipe.SetProfiler ( &psys.m_Profile );
 
 	psys.SetParam ( PNT_DRAWMODE, int(bPntDraw ? 1:0) );
 	psys.SetParam ( CLR_MODE, iClrMode );	
@@ -595,6 +727,9 @@ int main ( int argc, char **argv )
 	glutCreateWindow ( "Fluids v.1 (c) 2008, R. Hoetzlein (ZLib) extended by Gianni and Yui" );
 
 	//glutFullScreen ();
+
+	if ( argc > 1 ) psys_params = argv[1];
+	mint::GetTracer().SetThreadName ( "main" );
  
 	// initialize parameters
 	init();
@@ -0,0 +1,373 @@
+/*
+  Runs the melting simulation without a window or GL context, for batch
+  jobs on compute nodes. Outputs are written on a schedule of simulation
+  steps; timing statistics are printed on exit.
+
+  usage: meltbatch [options] scene.voxels
+         meltbatch [options] cube:n     (a solid cube of n*n*n particles)
+    -steps n           steps to run (default 1000)
+    -seconds t         run until t seconds of simulated time instead
+    -threads n         worker threads, 0 for one per processor (default)
+    -pin first,count   run on processors first .. first+count-1 only
+    -pin-workers first bind worker n to processor first+n
+    -shared-pool       mesh surfaces and encode trajectories on the simulation's
+                       workers instead of threads of their own
+    -params file       parameter file, see fluids/melt_params.h
+    -set NAME=value    override one parameter, after -params (repeatable)
+    -restore file      start from a checkpoint instead of the scene
+    -traj file         record a trajectory (see trajectory_format.h)
+    -traj-attrs list   attributes to record (default TRAJECTORY_ATTRS)
+    -traj-every n      steps between trajectory frames (default TRAJECTORY_INTERVAL)
+    -traj-error e      absolute error bound, < 0 for raw chunks (default TRAJECTORY_ERROR)
+    -ckpt path         write checkpoints; path may take the step, e.g. run_%06d.mck
+    -ckpt-every n      steps between checkpoints (default CHECKPOINT_INTERVAL)
+    -surface path      export the surface mesh, e.g. OBJ/melt%04d.ply
+    -surface-every n   steps between meshes (default 10)
+    -report n          progress line every n steps, 0 for none (default 100)
+    -out dir           directory of relative -traj, -ckpt, -surface, -summary,
+                       -profile and -memory paths, created if needed
+    -summary file      write the totals as "name value" lines, for meltsweep
+    -profile file      write the phase timings, JSON for a .json name, else CSV
+    -memory file       write the memory report, JSON for a .json name, else CSV
+    -deterministic     bitwise the same run for any -threads, see SetDeterministic
+    -seed n            seed of the random streams (default RANDOM_SEED)
+    -hash file         write "frame hash" of the state before and after every
+                       step; equal files mean runs stayed bitwise identical
+    -trace file        record the event timeline of every thread, Chrome trace
+                       JSON for chrome://tracing or ui.perfetto.dev
+    -counters          count cycles, instructions, cache and branch misses per
+                       phase (Linux perf events), reported next to the timings
+    -counters-dtlb     the same, with data TLB misses
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fluid_system.h"
+#include "surface_pipeline.h"
+#include "checkpoint.h"
+#include "trajectory.h"
+#include "mtime.h"
+#include "mfile.h"
+
+static FluidSystem		psys;				// large neighbor tables, keep it off the stack
+
+static double Elapsed ( mint::Time& start )
+{
+	mint::Time now;
+	now.SetSystemTime ( ACC_NSEC );
+	return double ( now.GetSJT() - start.GetSJT() ) / SEC_SCALAR;
+}
+
+// Output path under the -out directory, unless absolute
+static std::string OutPath ( const char* out, const char* path )
+{
+	if ( out == 0x0 || path[0] == '/' || path[0] == '\\' || ( path[0] != '\0' && path[1] == ':' ) )
+		return path;
+	return std::string ( out ) + "/" + path;
+}
+
+static void Usage ()
+{
+	printf ( "usage: meltbatch [-steps n | -seconds t] [-threads n] [-pin first,count]\n" );
+	printf ( "                 [-pin-workers first] [-shared-pool]\n" );
+	printf ( "                 [-params file] [-set NAME=value ...] [-restore file]\n" );
+	printf ( "                 [-traj file] [-traj-attrs list] [-traj-every n] [-traj-error e]\n" );
+	printf ( "                 [-ckpt path] [-ckpt-every n] [-surface path] [-surface-every n]\n" );
+	printf ( "                 [-report n] [-out dir] [-summary file] [-profile file]\n" );
+	printf ( "                 [-memory file] [-deterministic] [-seed n] [-hash file]\n" );
+	printf ( "                 [-trace file] [-counters | -counters-dtlb] scene.voxels\n" );
+}
+
+int main ( int argc, char **argv )
+{
+	const char* scene = 0x0;
+	const char* restore = 0x0;
+	const char* traj_path = 0x0;
+	const char* traj_attrs = TRAJECTORY_ATTRS;
+	const char* ckpt_path = 0x0;
+	const char* surf_path = 0x0;
+	const char* params_path = 0x0;
+	const char* out_dir = 0x0;
+	const char* summary_path = 0x0;
+	const char* profile_path = 0x0;
+	const char* memory_path = 0x0;
+	const char* hash_path = 0x0;
+	const char* trace_path = 0x0;
+	bool deterministic = false;
+	bool counters = false, counters_dtlb = false;
+	unsigned long long seed = RANDOM_SEED;
+	std::vector<std::string> sets;
+	int pin_first = -1, pin_count = 0;
+	int pin_workers = -1;
+	bool shared_pool = false;
+	int steps = 1000;
+	double seconds = -1;
+	int threads = 0;
+	int traj_every = TRAJECTORY_INTERVAL;
+	double traj_error = TRAJECTORY_ERROR;
+	int ckpt_every = CHECKPOINT_INTERVAL;
+	int surf_every = 10;
+	int report = 100;
+
+	for (int n=1; n < argc; n++) {
+		bool arg = ( n+1 < argc );
+		if ( strcmp ( argv[n], "-steps" ) == 0 && arg )					steps = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-seconds" ) == 0 && arg )			seconds = atof ( argv[++n] );
+		else if ( strcmp ( argv[n], "-threads" ) == 0 && arg )			threads = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-pin" ) == 0 && arg )				sscanf ( argv[++n], "%d,%d", &pin_first, &pin_count );
+		else if ( strcmp ( argv[n], "-pin-workers" ) == 0 && arg )		pin_workers = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-shared-pool" ) == 0 )			shared_pool = true;
+		else if ( strcmp ( argv[n], "-params" ) == 0 && arg )			params_path = argv[++n];
+		else if ( strcmp ( argv[n], "-set" ) == 0 && arg )				sets.push_back ( argv[++n] );
+		else if ( strcmp ( argv[n], "-out" ) == 0 && arg )				out_dir = argv[++n];
+		else if ( strcmp ( argv[n], "-summary" ) == 0 && arg )			summary_path = argv[++n];
+		else if ( strcmp ( argv[n], "-profile" ) == 0 && arg )			profile_path = argv[++n];
+		else if ( strcmp ( argv[n], "-memory" ) == 0 && arg )			memory_path = argv[++n];
+		else if ( strcmp ( argv[n], "-restore" ) == 0 && arg )			restore = argv[++n];
+		else if ( strcmp ( argv[n], "-traj" ) == 0 && arg )				traj_path = argv[++n];
+		else if ( strcmp ( argv[n], "-traj-attrs" ) == 0 && arg )		traj_attrs = argv[++n];
+		else if ( strcmp ( argv[n], "-traj-every" ) == 0 && arg )		traj_every = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-traj-error" ) == 0 && arg )		traj_error = atof ( argv[++n] );
+		else if ( strcmp ( argv[n], "-ckpt" ) == 0 && arg )				ckpt_path = argv[++n];
+		else if ( strcmp ( argv[n], "-ckpt-every" ) == 0 && arg )		ckpt_every = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-surface" ) == 0 && arg )			surf_path = argv[++n];
+		else if ( strcmp ( argv[n], "-surface-every" ) == 0 && arg )	surf_every = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-report" ) == 0 && arg )			report = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-deterministic" ) == 0 )			deterministic = true;
+		else if ( strcmp ( argv[n], "-seed" ) == 0 && arg )				seed = strtoul ( argv[++n], 0x0, 0 );
+		else if ( strcmp ( argv[n], "-hash" ) == 0 && arg )				hash_path = argv[++n];
+		else if ( strcmp ( argv[n], "-trace" ) == 0 && arg )			trace_path = argv[++n];
+		else if ( strcmp ( argv[n], "-counters" ) == 0 )				counters = true;
+		else if ( strcmp ( argv[n], "-counters-dtlb" ) == 0 )			counters = counters_dtlb = true;
+		else if ( argv[n][0] != '-' && scene == 0x0 )					scene = argv[n];
+		else { Usage (); return 1; }
+	}
+	if ( scene == 0x0 && restore == 0x0 ) {
+		Usage ();
+		return 1;
+	}
+	if ( traj_every < 1 ) traj_every = 1;
+	if ( ckpt_every < 1 ) ckpt_every = 1;
+	if ( surf_every < 1 ) surf_every = 1;
+
+	// Parameters
+	MeltParams params;
+	if ( params_path != 0x0 && !params.Load ( params_path ) ) return 1;
+	for (int n=0; n < (int) sets.size(); n++) {
+		std::string name = sets[n].substr ( 0, sets[n].find ( '=' ) );
+		std::string value = sets[n].find ( '=' ) == std::string::npos ? "" : sets[n].substr ( sets[n].find ( '=' ) + 1 );
+		if ( !params.Set ( name.c_str(), value.c_str() ) ) {
+			printf ( "ERROR: bad parameter setting %s.\n", sets[n].c_str() );
+			return 1;
+		}
+	}
+	if ( out_dir != 0x0 && !mint::MakeDir ( out_dir ) ) {
+		printf ( "ERROR: Cannot create %s.\n", out_dir );
+		return 1;
+	}
+	std::string traj_file = traj_path ? OutPath ( out_dir, traj_path ) : "";
+	std::string ckpt_file = ckpt_path ? OutPath ( out_dir, ckpt_path ) : "";
+	std::string surf_file = surf_path ? OutPath ( out_dir, surf_path ) : "";
+	std::string hash_file = hash_path ? OutPath ( out_dir, hash_path ) : "";
+	std::string trace_file = trace_path ? OutPath ( out_dir, trace_path ) : "";
+	if ( pin_first >= 0 && !mint::PinProcess ( pin_first, pin_count ) )
+		printf ( "Cannot pin to processors %d..%d, running unpinned.\n", pin_first, pin_first + pin_count - 1 );
+
+	// Scene
+	mint::GetTracer().SetThreadName ( "main" );
+	if ( trace_path != 0x0 ) mint::GetTracer().SetEnabled ( true );
+	if ( counters ) {
+		mint::GetCounters().SetEnabled ( true, counters_dtlb );
+		if ( !mint::GetCounters().IsAvailable () )
+			printf ( "Hardware counters unavailable (no PMU, or perf_event_paranoid too high), timings only.\n" );
+	}
+	mint::Time start;
+	start.SetSystemTime ( ACC_NSEC );
+	int frame = 0;
+	psys.SetMeltParams ( params );
+	psys.Initialize ( BFLUID, 65535 );
+	psys.m_Workers.SetPinning ( pin_workers );
+	psys.SetThreads ( threads );
+	psys.SetDeterministic ( deterministic );
+	psys.SetSeed ( seed );
+	if ( restore != 0x0 ) {
+		if ( !psys.LoadCheckpoint ( restore, frame ) ) return 1;
+		if ( params_path != 0x0 || !sets.empty() ) psys.SetMeltParams ( params );		// checkpoints carry their own
+	} else {
+		psys.SetScene ( scene );
+		psys.SPH_CreateExample ( 0, 65535 );
+	}
+	if ( psys.NumPoints() == 0 ) {
+		printf ( "No particles to simulate.\n" );
+		return 1;
+	}
+	double setup_time = Elapsed ( start );
+	printf ( "%d particles, %d workers, setup %.3f s%s\n", psys.NumPoints(), psys.m_Workers.NumThreads(), setup_time,
+			 deterministic ? ", deterministic" : "" );
+
+	// Outputs
+	TrajectoryWriter traj;
+	CheckpointWriter ckpt;
+	SurfacePipeline surf;
+	if ( traj_path != 0x0 ) {
+		traj.SetCompression ( traj_error, TRAJECTORY_KEYFRAMES );
+		if ( shared_pool ) traj.SetPool ( &psys.m_Workers );
+		if ( !traj.Open ( traj_file.c_str(), psys, traj_attrs, traj_every ) ) return 1;
+	}
+	if ( ckpt_path != 0x0 ) {
+		ckpt.SetCompression ( CHECKPOINT_ERROR );
+		if ( !ckpt.Start ( ckpt_file.c_str(), ckpt_every ) ) return 1;
+	}
+	FILE* hash_fp = 0x0;
+	if ( hash_path != 0x0 ) {
+		hash_fp = fopen ( hash_file.c_str(), "w" );
+		if ( hash_fp == 0x0 ) {
+			printf ( "ERROR: Cannot write %s.\n", hash_file.c_str() );
+			return 1;
+		}
+		fprintf ( hash_fp, "%d %016llx\n", frame, psys.StateHash() );
+	}
+	if ( surf_path != 0x0 ) {
+		surf.SetProfiler ( &psys.m_Profile );
+		if ( shared_pool ) surf.SetPool ( &psys.m_Workers );
+		int meshers = mint::NumProcessors() - 1;
+		if ( !surf.Start ( meshers > 0 ? meshers : 1, 2, surf_file.c_str() ) ) return 1;
+	}
+
+	// Run, timing each step and the time the outputs hold the simulation up
+	double step_min = 1e30, step_max = 0, step_total = 0, output_total = 0;
+	int done = 0;
+	int first = frame;
+	mint::Time t0, t1, t2;
+	start.SetSystemTime ( ACC_NSEC );
+	while ( seconds >= 0 ? psys.GetTime() < seconds : done < steps ) {
+		t0.SetSystemTime ( ACC_NSEC );
+		if ( surf_path != 0x0 && frame % surf_every == 0 ) {
+			surf.GetMemory ( psys.m_Memory );
+			SurfaceSnapshot* snap = surf.Acquire ( true );
+			psys.SnapshotSurface ( *snap, frame );
+			surf.Submit ( snap );
+		}
+		if ( ckpt_path != 0x0 && frame % ckpt_every == 0 && frame != first ) {
+			ckpt.Flush ();						// a batch run keeps every scheduled checkpoint
+			ckpt.Submit ( psys, frame );
+		}
+		if ( traj_path != 0x0 ) traj.Step ( psys, frame );
+		t1.SetSystemTime ( ACC_NSEC );
+
+		psys.Run ();
+
+		t2.SetSystemTime ( ACC_NSEC );
+		double step = double ( t2.GetSJT() - t1.GetSJT() ) / SEC_SCALAR;
+		output_total += double ( t1.GetSJT() - t0.GetSJT() ) / SEC_SCALAR;
+		step_total += step;
+		if ( step < step_min ) step_min = step;
+		if ( step > step_max ) step_max = step;
+		frame++;
+		done++;
+		if ( hash_fp != 0x0 ) fprintf ( hash_fp, "%d %016llx\n", frame, psys.StateHash() );
+		if ( report > 0 && done % report == 0 )
+			printf ( "step %d  t = %.4f s  %.2f ms/step\n", frame, psys.GetTime(), 1000.0 * step_total / done );
+	}
+	double run_time = Elapsed ( start );
+
+	// Drain the writers before the totals
+	start.SetSystemTime ( ACC_NSEC );
+	if ( surf_path != 0x0 ) {
+		surf.Flush ();
+		surf.GetMemory ( psys.m_Memory );
+		surf.Stop ();
+	}
+	if ( ckpt_path != 0x0 ) ckpt.Stop ();
+	if ( traj_path != 0x0 ) traj.Close ();
+	if ( hash_fp != 0x0 && fclose ( hash_fp ) != 0 ) {
+		printf ( "ERROR: Cannot write %s.\n", hash_file.c_str() );
+		return 1;
+	}
+	double drain_time = Elapsed ( start );
+	if ( trace_path != 0x0 ) {
+		mint::GetTracer().SetEnabled ( false );
+		if ( !mint::GetTracer().Write ( trace_file.c_str() ) ) {
+			printf ( "ERROR: Cannot write %s.\n", trace_file.c_str() );
+			return 1;
+		}
+	}
+
+	int liquid = 0;
+	for (int n=0; n < psys.NumPoints(); n++)
+		if ( psys.GetFluid(n)->state == LIQUID ) liquid++;
+
+	printf ( "\n" );
+	printf ( "steps          %d (frames %d to %d), simulated %.4f s\n", done, first, frame, psys.GetTime() );
+	printf ( "particles      %d, %d liquid\n", psys.NumPoints(), liquid );
+	printf ( "wall time      %.3f s run, %.3f s setup, %.3f s draining output\n", run_time, setup_time, drain_time );
+	if ( done > 0 ) {
+		printf ( "step time      %.3f ms mean, %.3f min, %.3f max\n", 1000.0 * step_total / done, 1000.0 * step_min, 1000.0 * step_max );
+		printf ( "throughput     %.2f steps/s, %.3g particle steps/s\n", done / run_time, (double) done * psys.NumPoints() / run_time );
+		printf ( "output stalls  %.3f s (%.1f%% of the run)\n", output_total, 100.0 * output_total / run_time );
+	}
+	if ( traj_path != 0x0 ) printf ( "trajectory     %d frames to %s\n", traj.NumFrames(), traj_file.c_str() );
+	if ( ckpt_path != 0x0 ) {
+		if ( ckpt.NumWritten() > 1 && ckpt.FirstFile() != ckpt.LastFile() )
+			printf ( "checkpoints    %d, %s to %s\n", ckpt.NumWritten(), ckpt.FirstFile().c_str(), ckpt.LastFile().c_str() );
+		else
+			printf ( "checkpoints    %d%s%s\n", ckpt.NumWritten(), ckpt.NumWritten() > 0 ? " to " : "", ckpt.LastFile().c_str() );
+	}
+	if ( surf_path != 0x0 ) {
+		printf ( "surfaces       %d to %s\n", surf.NumWritten(), surf_file.c_str() );
+		if ( surf.NumFailed() > 0 ) printf ( "ERROR: %d surfaces could not be written.\n", surf.NumFailed() );
+	}
+	if ( trace_path != 0x0 ) printf ( "timeline       %s\n", trace_file.c_str() );
+	if ( hash_path != 0x0 ) printf ( "state hash     %016llx, every step in %s\n", psys.StateHash(), hash_file.c_str() );
+	if ( done > 0 ) psys.PrintNeighborStats ();
+	printf ( "\n" );
+	psys.m_Profile.Print ( "phase timings (ms), rolling over the last steps" );
+	if ( profile_path != 0x0 ) {
+		std::string file = OutPath ( out_dir, profile_path );
+		if ( !psys.m_Profile.Write ( file.c_str() ) ) {
+			printf ( "ERROR: Cannot write %s.\n", file.c_str() );
+			return 1;
+		}
+	}
+	printf ( "\n" );
+	psys.m_Memory.Print ( "memory (MB)" );
+	if ( memory_path != 0x0 ) {
+		std::string file = OutPath ( out_dir, memory_path );
+		if ( !psys.m_Memory.Write ( file.c_str() ) ) {
+			printf ( "ERROR: Cannot write %s.\n", file.c_str() );
+			return 1;
+		}
+	}
+
+	if ( summary_path != 0x0 ) {
+		std::string file = OutPath ( out_dir, summary_path );
+		FILE* fp = fopen ( file.c_str(), "w" );
+		if ( fp == 0x0 ) {
+			printf ( "ERROR: Cannot write %s.\n", file.c_str() );
+			return 1;
+		}
+		fprintf ( fp, "steps %d\n", done );
+		fprintf ( fp, "frame %d\n", frame );
+		fprintf ( fp, "sim_time %.9g\n", psys.GetTime() );
+		fprintf ( fp, "particles %d\n", psys.NumPoints() );
+		fprintf ( fp, "liquid %d\n", liquid );
+		fprintf ( fp, "setup_time %.6f\n", setup_time );
+		fprintf ( fp, "run_time %.6f\n", run_time );
+		fprintf ( fp, "drain_time %.6f\n", drain_time );
+		fprintf ( fp, "step_mean %.6f\n", done > 0 ? step_total / done : 0.0 );
+		fprintf ( fp, "step_max %.6f\n", step_max );
+		fprintf ( fp, "output_stall %.6f\n", output_total );
+		const NeighborStats& ns = psys.GetNeighborStats ();
+		fprintf ( fp, "neighbors_mean %.3f\n", ns.mean );
+		fprintf ( fp, "neighbors_max %d\n", ns.max );
+		fprintf ( fp, "neighbor_overflow %d\n", ns.overflow );
+		fprintf ( fp, "overflow_steps %d\n", ns.overflow_steps );
+		mint::MemoryItem mem = psys.m_Memory.GetTotal ();
+		fprintf ( fp, "mem_peak_resident %lu\n", (unsigned long) mem.peak_resident );
+		fprintf ( fp, "mem_peak_reserved %lu\n", (unsigned long) mem.peak_reserved );
+		fclose ( fp );
+	}
+	return ( surf_path != 0x0 && surf.NumFailed() > 0 ) ? 1 : 0;
+}
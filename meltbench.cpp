@@ -0,0 +1,228 @@
+/*
+  Benchmark of the melting simulation on fixed scenes. Each scene is one
+  of the voxel models, run from its starting state with the default
+  parameters: some warm-up steps first, then the measured steps. Reports
+  steps per second, nanoseconds per particle per step of each phase of
+  FluidSystem::Run, peak memory of the process and of each subsystem, and
+  neighbor counts, as JSON or CSV, so runs before and after a change can
+  be compared.
+
+  usage: meltbench [options]
+    -scenes list       comma-separated models (default cube_4,cube_10,cube_25,
+                       dragon_30,dragon_40,happy)
+    -voxels dir        where the models are (default voxel)
+    -warmup n          steps before measuring (default 20)
+    -steps n           measured steps (default 100)
+    -threads n         worker threads, 0 for one per processor (default)
+    -pin first,count   run on processors first .. first+count-1 only
+    -out file          results, CSV for a .csv name, else JSON (default melt_bench.json)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fluid_system.h"
+#include "mprofile.h"
+#include "mtime.h"
+
+static FluidSystem		psys;				// large neighbor tables, keep it off the stack
+
+#define BENCH_SCENES	"cube_4,cube_10,cube_25,dragon_30,dragon_40,happy"
+
+// Phases reported per particle, those of Run
+static const int g_Phases[] = { PHASE_STEP, PHASE_INSERT, PHASE_PRESSURE, PHASE_BOUNDARY, PHASE_FORCE, PHASE_ADVANCE };
+static const int g_NumPhases = sizeof(g_Phases) / sizeof(g_Phases[0]);
+
+struct SceneResult {
+	std::string		name;
+	int				particles;
+	int				liquid;					// after the run, a check that scenes ran alike
+	double			setup_time;				// seconds
+	double			run_time;				// seconds, measured steps only
+	double			steps_per_sec;
+	double			phase_ns[g_NumPhases];	// per particle per step
+	size_t			peak_mem;				// bytes
+	size_t			resident_mem;			// bytes, at the end of the scene
+	NeighborStats	neighbors;				// of the last step
+	std::vector<mint::MemoryItem> memory;	// by subsystem, the total last
+};
+
+static double Elapsed ( mint::Time& start )
+{
+	mint::Time now;
+	now.SetSystemTime ( ACC_NSEC );
+	return double ( now.GetSJT() - start.GetSJT() ) / SEC_SCALAR;
+}
+
+static bool RunScene ( const std::string& name, const char* voxels, int threads, int warmup, int steps, SceneResult& res )
+{
+	std::string file = std::string ( voxels ) + "/" + name + ".voxels";
+	res.name = name;
+	bool peak_reset = mint::ResetPeakMemory ();
+
+	mint::Time start;
+	start.SetSystemTime ( ACC_NSEC );
+	psys.SetMeltParams ( MeltParams() );
+	psys.Initialize ( BFLUID, 65535 );
+	psys.SetThreads ( threads );
+	psys.SetScene ( file.c_str() );
+	psys.SPH_CreateExample ( 0, 65535 );
+	if ( psys.NumPoints() == 0 ) {
+		printf ( "ERROR: No particles in %s.\n", file.c_str() );
+		return false;
+	}
+	res.setup_time = Elapsed ( start );
+	res.particles = psys.NumPoints();
+
+	for (int n=0; n < warmup; n++)
+		psys.Run ();
+
+	psys.m_Profile.Reset ();
+	start.SetSystemTime ( ACC_NSEC );
+	for (int n=0; n < steps; n++)
+		psys.Run ();
+	res.run_time = Elapsed ( start );
+	res.steps_per_sec = res.run_time > 0 ? steps / res.run_time : 0;
+
+	double scale = 1e9 / ( (double) steps * res.particles );
+	for (int n=0; n < g_NumPhases; n++) {
+		mint::PhaseStats st;
+		psys.m_Profile.GetStats ( g_Phases[n], st );
+		res.phase_ns[n] = st.total * scale;
+	}
+	res.liquid = 0;
+	for (int n=0; n < psys.NumPoints(); n++)
+		if ( psys.GetFluid(n)->state == LIQUID ) res.liquid++;
+	res.neighbors = psys.GetNeighborStats ();
+	res.memory.clear ();
+	for (int n=0; n < psys.m_Memory.NumItems(); n++)
+		res.memory.push_back ( psys.m_Memory.GetItem ( n ) );
+	res.memory.push_back ( psys.m_Memory.GetTotal () );
+	res.peak_mem = mint::PeakMemory ();
+	res.resident_mem = mint::ResidentMemory ();
+	if ( !peak_reset ) res.peak_mem = 0;		// would include the scenes before
+	return true;
+}
+
+static bool WriteJSON ( const char* filename, const std::vector<SceneResult>& results, int threads, int warmup, int steps )
+{
+	FILE* fp = fopen ( filename, "w" );
+	if ( fp == 0x0 ) return false;
+	fprintf ( fp, "{\n  \"benchmark\": \"meltbench\",\n" );
+	fprintf ( fp, "  \"threads\": %d,\n  \"processors\": %d,\n  \"warmup\": %d,\n  \"steps\": %d,\n",
+			  threads, mint::NumProcessors(), warmup, steps );
+	fprintf ( fp, "  \"scenes\": [\n" );
+	for (int n=0; n < (int) results.size(); n++) {
+		const SceneResult& r = results[n];
+		fprintf ( fp, "    {\n      \"scene\": \"%s\",\n      \"particles\": %d,\n      \"liquid\": %d,\n",
+				  r.name.c_str(), r.particles, r.liquid );
+		fprintf ( fp, "      \"setup_s\": %.6f,\n      \"run_s\": %.6f,\n      \"steps_per_s\": %.4f,\n",
+				  r.setup_time, r.run_time, r.steps_per_sec );
+		fprintf ( fp, "      \"peak_bytes\": %lu,\n      \"resident_bytes\": %lu,\n",
+				  (unsigned long) r.peak_mem, (unsigned long) r.resident_mem );
+		fprintf ( fp, "      \"neighbors_mean\": %.3f,\n      \"neighbors_max\": %d,\n      \"neighbor_overflow\": %d,\n      \"max_cell\": %d,\n",
+				  r.neighbors.mean, r.neighbors.max, r.neighbors.overflow, r.neighbors.max_cell );
+		fprintf ( fp, "      \"memory\": [\n" );
+		for (int m=0; m < (int) r.memory.size(); m++) {
+			const mint::MemoryItem& it = r.memory[m];
+			fprintf ( fp, "        { \"subsystem\": \"%s\", \"resident\": %lu, \"reserved\": %lu, \"peak_resident\": %lu, \"peak_reserved\": %lu }%s\n",
+					  it.name.c_str(), (unsigned long) it.resident, (unsigned long) it.reserved,
+					  (unsigned long) it.peak_resident, (unsigned long) it.peak_reserved, m+1 < (int) r.memory.size() ? "," : "" );
+		}
+		fprintf ( fp, "      ],\n" );
+		fprintf ( fp, "      \"ns_per_particle_step\": {" );
+		for (int p=0; p < g_NumPhases; p++)
+			fprintf ( fp, "%s \"%s\": %.3f", p > 0 ? "," : "", psys.m_Profile.GetName ( g_Phases[p] ).c_str(), r.phase_ns[p] );
+		fprintf ( fp, " }\n    }%s\n", n+1 < (int) results.size() ? "," : "" );
+	}
+	fprintf ( fp, "  ]\n}\n" );
+	return fclose ( fp ) == 0;
+}
+
+static bool WriteCSV ( const char* filename, const std::vector<SceneResult>& results )
+{
+	FILE* fp = fopen ( filename, "w" );
+	if ( fp == 0x0 ) return false;
+	fprintf ( fp, "scene,particles,liquid,setup_s,run_s,steps_per_s,peak_bytes,resident_bytes,neighbors_mean,neighbors_max,neighbor_overflow,max_cell,"
+			  "mem_peak_resident,mem_peak_reserved" );
+	for (int p=0; p < g_NumPhases; p++)
+		fprintf ( fp, ",%s_ns", psys.m_Profile.GetName ( g_Phases[p] ).c_str() );
+	fprintf ( fp, "\n" );
+	for (int n=0; n < (int) results.size(); n++) {
+		const SceneResult& r = results[n];
+		const mint::MemoryItem& mem = r.memory.back ();
+		fprintf ( fp, "%s,%d,%d,%.6f,%.6f,%.4f,%lu,%lu,%.3f,%d,%d,%d,%lu,%lu", r.name.c_str(), r.particles, r.liquid, r.setup_time,
+				  r.run_time, r.steps_per_sec, (unsigned long) r.peak_mem, (unsigned long) r.resident_mem,
+				  r.neighbors.mean, r.neighbors.max, r.neighbors.overflow, r.neighbors.max_cell,
+				  (unsigned long) mem.peak_resident, (unsigned long) mem.peak_reserved );
+		for (int p=0; p < g_NumPhases; p++)
+			fprintf ( fp, ",%.3f", r.phase_ns[p] );
+		fprintf ( fp, "\n" );
+	}
+	return fclose ( fp ) == 0;
+}
+
+static void Usage ()
+{
+	printf ( "usage: meltbench [-scenes list] [-voxels dir] [-warmup n] [-steps n]\n" );
+	printf ( "                 [-threads n] [-pin first,count] [-out file]\n" );
+}
+
+int main ( int argc, char **argv )
+{
+	const char* scenes = BENCH_SCENES;
+	const char* voxels = "voxel";
+	const char* out = "melt_bench.json";
+	int warmup = 20;
+	int steps = 100;
+	int threads = 0;
+	int pin_first = -1, pin_count = 0;
+
+	for (int n=1; n < argc; n++) {
+		bool arg = ( n+1 < argc );
+		if ( strcmp ( argv[n], "-scenes" ) == 0 && arg )				scenes = argv[++n];
+		else if ( strcmp ( argv[n], "-voxels" ) == 0 && arg )			voxels = argv[++n];
+		else if ( strcmp ( argv[n], "-warmup" ) == 0 && arg )			warmup = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-steps" ) == 0 && arg )			steps = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-threads" ) == 0 && arg )			threads = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-pin" ) == 0 && arg )				sscanf ( argv[++n], "%d,%d", &pin_first, &pin_count );
+		else if ( strcmp ( argv[n], "-out" ) == 0 && arg )				out = argv[++n];
+		else { Usage (); return 1; }
+	}
+	if ( warmup < 0 ) warmup = 0;
+	if ( steps < 1 ) steps = 1;
+	if ( pin_first >= 0 && !mint::PinProcess ( pin_first, pin_count ) )
+		printf ( "Cannot pin to processors %d..%d, running unpinned.\n", pin_first, pin_first + pin_count - 1 );
+
+	std::vector<std::string> names;
+	for (const char* s = scenes; *s != '\0'; ) {
+		const char* comma = strchr ( s, ',' );
+		size_t len = comma ? (size_t) (comma - s) : strlen ( s );
+		if ( len > 0 ) names.push_back ( std::string ( s, len ) );
+		s += len;
+		if ( *s == ',' ) s++;
+	}
+
+	std::vector<SceneResult> results;
+	printf ( "%-12s %9s %10s %10s  ns per particle per step\n", "scene", "particles", "steps/s", "peak MB" );
+	for (int n=0; n < (int) names.size(); n++) {
+		SceneResult res;
+		if ( !RunScene ( names[n], voxels, threads, warmup, steps, res ) ) return 1;
+		results.push_back ( res );
+		printf ( "%-12s %9d %10.2f %10.1f ", res.name.c_str(), res.particles, res.steps_per_sec, res.peak_mem / 1048576.0 );
+		for (int p=0; p < g_NumPhases; p++)
+			printf ( " %s %.1f", psys.m_Profile.GetName ( g_Phases[p] ).c_str(), res.phase_ns[p] );
+		printf ( "\n" );
+	}
+	int workers = psys.m_Workers.NumThreads();
+
+	size_t len = strlen ( out );
+	bool csv = ( len >= 4 && strcmp ( out + len - 4, ".csv" ) == 0 );
+	if ( !( csv ? WriteCSV ( out, results ) : WriteJSON ( out, results, workers, warmup, steps ) ) ) {
+		printf ( "ERROR: Cannot write %s.\n", out );
+		return 1;
+	}
+	printf ( "Results in %s\n", out );
+	return 0;
+}
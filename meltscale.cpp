@@ -0,0 +1,309 @@
+/*
+  Strong and weak scaling of the melting simulation on one machine. Runs
+  every scene once per worker count, in one process, and reports the time
+  per step of each phase of FluidSystem::Run with the speedup and the
+  parallel efficiency against the first worker count, so it shows where
+  adding threads stops paying.
+
+  Strong scaling keeps the scene and adds workers. Weak scaling grows a
+  procedural cube (scene "cube:n", see CUBE_SCENE_SIZE) with the workers,
+  keeping the particles per worker about the same. Both use one measure:
+  efficiency is the particle steps per second per worker, over that of
+  the first worker count; 1 is perfect scaling. Cube sides are whole
+  voxels, so weak particle counts only approximate the ideal ones and the
+  per-particle measure keeps them comparable.
+
+  usage: meltscale [options]
+    -threads list      worker counts, e.g. 1,2,4,8 or 1:16 for every count
+                       between (default 1,2,4,... and the processors)
+    -strong list       scenes of the strong sweep, model names or cube:n
+                       (default cube_25,dragon_40,cube:40), none to skip
+    -weak n            cube side of the weak sweep at the first worker count,
+                       0 to skip (default 20, 8000 particles per worker);
+                       worker counts whose cube would outgrow the neighbor
+                       table (MAX_NEIGHBOR_ROWS particles) are left out
+    -voxels dir        where the models are (default voxel)
+    -warmup n          steps before measuring (default 20)
+    -steps n           measured steps (default 100)
+    -pin first,count   run on processors first .. first+count-1 only
+    -out dir           where strong.csv and weak.csv go, created if needed
+                       (default scaling)
+
+  Each table has one row per scene and worker count: particles, steps per
+  second, speedup and efficiency of the whole step, then the milliseconds
+  per step and efficiency of every phase, for plotting against threads.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fluid_system.h"
+#include "mprofile.h"
+#include "mtime.h"
+#include "mfile.h"
+
+static FluidSystem		psys;				// large neighbor tables, keep it off the stack
+
+// Phases reported, those of Run
+static const int g_Phases[] = { PHASE_STEP, PHASE_INSERT, PHASE_PRESSURE, PHASE_BOUNDARY, PHASE_FORCE, PHASE_ADVANCE };
+static const int g_NumPhases = sizeof(g_Phases) / sizeof(g_Phases[0]);
+
+struct ScaleResult {
+	std::string		scene;
+	int				threads;				// workers
+	int				particles;
+	double			steps_per_sec;
+	double			phase_ms[g_NumPhases];	// per step
+	double			speedup;				// of the step, against the first row of the scene
+	double			efficiency[g_NumPhases];	// per worker, per particle, against the same
+};
+
+static double Elapsed ( mint::Time& start )
+{
+	mint::Time now;
+	now.SetSystemTime ( ACC_NSEC );
+	return double ( now.GetSJT() - start.GetSJT() ) / SEC_SCALAR;
+}
+
+static std::string ScenePath ( const std::string& name, const char* voxels )
+{
+	if ( name.compare ( 0, 5, "cube:" ) == 0 ) return name;
+	return std::string ( voxels ) + "/" + name + ".voxels";
+}
+
+static bool RunScene ( const std::string& name, const char* voxels, int threads, int warmup, int steps, ScaleResult& res )
+{
+	std::string file = ScenePath ( name, voxels );
+	res.scene = name;
+	res.threads = threads;
+
+	psys.SetMeltParams ( MeltParams() );
+	psys.Initialize ( BFLUID, 65535 );
+	psys.SetThreads ( threads );
+	psys.SetScene ( file.c_str() );
+	psys.SPH_CreateExample ( 0, 65535 );
+	if ( psys.NumPoints() == 0 ) {
+		printf ( "ERROR: No particles in %s.\n", file.c_str() );
+		return false;
+	}
+	res.particles = psys.NumPoints();
+
+	for (int n=0; n < warmup; n++)
+		psys.Run ();
+
+	psys.m_Profile.Reset ();
+	mint::Time start;
+	start.SetSystemTime ( ACC_NSEC );
+	for (int n=0; n < steps; n++)
+		psys.Run ();
+	double run_time = Elapsed ( start );
+	res.steps_per_sec = run_time > 0 ? steps / run_time : 0;
+
+	for (int n=0; n < g_NumPhases; n++) {
+		mint::PhaseStats st;
+		psys.m_Profile.GetStats ( g_Phases[n], st );
+		res.phase_ms[n] = st.total * 1000.0 / steps;
+	}
+	return true;
+}
+
+// Speedup and efficiency of each row against the first, time per particle
+// per worker so the rows of a weak sweep compare too
+static void Compare ( std::vector<ScaleResult>& rows )
+{
+	if ( rows.empty () ) return;
+	const ScaleResult& base = rows[0];
+	for (int n=0; n < (int) rows.size(); n++) {
+		ScaleResult& r = rows[n];
+		double ratio = double ( base.threads ) / r.threads * double ( r.particles ) / base.particles;
+		r.speedup = base.phase_ms[0] > 0 && r.phase_ms[0] > 0 ? base.phase_ms[0] / r.phase_ms[0] : 0;
+		for (int p=0; p < g_NumPhases; p++)
+			r.efficiency[p] = base.phase_ms[p] > 0 && r.phase_ms[p] > 0 ? base.phase_ms[p] / r.phase_ms[p] * ratio : 0;
+	}
+}
+
+static bool WriteCSV ( const std::string& filename, const std::vector<ScaleResult>& results )
+{
+	FILE* fp = fopen ( filename.c_str(), "w" );
+	if ( fp == 0x0 ) return false;
+	fprintf ( fp, "scene,threads,particles,steps_per_s,speedup,efficiency" );
+	for (int p=0; p < g_NumPhases; p++)
+		fprintf ( fp, ",%s_ms,%s_eff", psys.m_Profile.GetName ( g_Phases[p] ).c_str(), psys.m_Profile.GetName ( g_Phases[p] ).c_str() );
+	fprintf ( fp, "\n" );
+	for (int n=0; n < (int) results.size(); n++) {
+		const ScaleResult& r = results[n];
+		fprintf ( fp, "%s,%d,%d,%.4f,%.4f,%.4f", r.scene.c_str(), r.threads, r.particles, r.steps_per_sec, r.speedup, r.efficiency[0] );
+		for (int p=0; p < g_NumPhases; p++)
+			fprintf ( fp, ",%.6f,%.4f", r.phase_ms[p], r.efficiency[p] );
+		fprintf ( fp, "\n" );
+	}
+	return fclose ( fp ) == 0;
+}
+
+static void PrintHeader ( const char* title )
+{
+	printf ( "\n%s\n", title );
+	printf ( "  %-12s %7s %9s %9s %7s %5s ", "scene", "threads", "particles", "steps/s", "speedup", "eff" );
+	for (int p=1; p < g_NumPhases; p++)
+		printf ( " %9s", psys.m_Profile.GetName ( g_Phases[p] ).c_str() );
+	printf ( "   (ms per step, eff)\n" );
+}
+
+static void PrintRow ( const ScaleResult& r )
+{
+	printf ( "  %-12s %7d %9d %9.2f %7.2f %5.2f ", r.scene.c_str(), r.threads, r.particles, r.steps_per_sec, r.speedup, r.efficiency[0] );
+	for (int p=1; p < g_NumPhases; p++)
+		printf ( " %5.2f %3.0f%%", r.phase_ms[p], r.efficiency[p] * 100 );
+	printf ( "\n" );
+}
+
+// "a,b,c" of names
+static std::vector<std::string> SplitList ( const char* s )
+{
+	std::vector<std::string> names;
+	while ( *s != '\0' ) {
+		const char* comma = strchr ( s, ',' );
+		size_t len = comma ? (size_t) (comma - s) : strlen ( s );
+		if ( len > 0 ) names.push_back ( std::string ( s, len ) );
+		s += len;
+		if ( *s == ',' ) s++;
+	}
+	return names;
+}
+
+// "1,2,4" or "lo:hi"; empty if malformed
+static std::vector<int> ParseThreads ( const char* s )
+{
+	std::vector<int> counts;
+	int lo, hi;
+	char c;
+	if ( sscanf ( s, "%d:%d%c", &lo, &hi, &c ) == 2 ) {
+		for (int n = lo; n <= hi; n++)
+			if ( n > 0 ) counts.push_back ( n );
+		return counts;
+	}
+	std::vector<std::string> items = SplitList ( s );
+	for (int n=0; n < (int) items.size(); n++) {
+		int v = atoi ( items[n].c_str() );
+		if ( v <= 0 ) return std::vector<int> ();
+		counts.push_back ( v );
+	}
+	return counts;
+}
+
+static void Usage ()
+{
+	printf ( "usage: meltscale [-threads list | -threads lo:hi] [-strong list] [-weak n]\n" );
+	printf ( "                 [-voxels dir] [-warmup n] [-steps n] [-pin first,count]\n" );
+	printf ( "                 [-out dir]\n" );
+}
+
+int main ( int argc, char **argv )
+{
+	const char* threads_list = 0x0;
+	const char* strong = "cube_25,dragon_40,cube:40";
+	const char* voxels = "voxel";
+	const char* out = "scaling";
+	int weak = 20;
+	int warmup = 20;
+	int steps = 100;
+	int pin_first = -1, pin_count = 0;
+
+	for (int n=1; n < argc; n++) {
+		bool arg = ( n+1 < argc );
+		if ( strcmp ( argv[n], "-threads" ) == 0 && arg )				threads_list = argv[++n];
+		else if ( strcmp ( argv[n], "-strong" ) == 0 && arg )			strong = argv[++n];
+		else if ( strcmp ( argv[n], "-weak" ) == 0 && arg )				weak = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-voxels" ) == 0 && arg )			voxels = argv[++n];
+		else if ( strcmp ( argv[n], "-warmup" ) == 0 && arg )			warmup = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-steps" ) == 0 && arg )			steps = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-pin" ) == 0 && arg )				sscanf ( argv[++n], "%d,%d", &pin_first, &pin_count );
+		else if ( strcmp ( argv[n], "-out" ) == 0 && arg )				out = argv[++n];
+		else { Usage (); return 1; }
+	}
+	if ( warmup < 0 ) warmup = 0;
+	if ( steps < 1 ) steps = 1;
+	if ( pin_first >= 0 && !mint::PinProcess ( pin_first, pin_count ) )
+		printf ( "Cannot pin to processors %d..%d, running unpinned.\n", pin_first, pin_first + pin_count - 1 );
+
+	std::vector<int> counts;
+	if ( threads_list != 0x0 ) {
+		counts = ParseThreads ( threads_list );
+		if ( counts.empty () ) { Usage (); return 1; }
+	} else {
+		int procs = mint::NumProcessors ();
+		for (int n = 1; n < procs; n *= 2)
+			counts.push_back ( n );
+		counts.push_back ( procs > 0 ? procs : 1 );
+	}
+	std::vector<std::string> scenes;
+	if ( strcmp ( strong, "none" ) != 0 ) scenes = SplitList ( strong );
+
+	if ( !mint::MakeDir ( out ) ) {
+		printf ( "ERROR: Cannot create %s.\n", out );
+		return 1;
+	}
+
+	// Strong: every scene at every worker count
+	std::vector<ScaleResult> strong_rows;
+	if ( !scenes.empty () ) PrintHeader ( "strong scaling, efficiency against the first worker count" );
+	for (int s=0; s < (int) scenes.size(); s++) {
+		std::vector<ScaleResult> rows;
+		for (int t=0; t < (int) counts.size(); t++) {
+			ScaleResult res;
+			if ( !RunScene ( scenes[s], voxels, counts[t], warmup, steps, res ) ) return 1;
+			rows.push_back ( res );
+		}
+		Compare ( rows );
+		for (int t=0; t < (int) rows.size(); t++) {
+			PrintRow ( rows[t] );
+			strong_rows.push_back ( rows[t] );
+		}
+	}
+
+	// Written now, so a failure in the weak sweep does not lose it
+	std::string strong_file = std::string ( out ) + "/strong.csv";
+	std::string weak_file = std::string ( out ) + "/weak.csv";
+	if ( !strong_rows.empty () && !WriteCSV ( strong_file, strong_rows ) ) {
+		printf ( "ERROR: Cannot write %s.\n", strong_file.c_str() );
+		return 1;
+	}
+
+	// Weak: a cube with about weak^3 particles per counts[0] workers, as
+	// long as the cube fits the neighbor table
+	std::vector<ScaleResult> weak_rows;
+	if ( weak > 0 ) {
+		int max_side = 1;
+		while ( (double) (max_side+1) * (max_side+1) * (max_side+1) <= MAX_NEIGHBOR_ROWS )
+			max_side++;
+		int skipped = 0, first_skipped = 0;
+		for (int t=0; t < (int) counts.size(); t++) {
+			int side = (int) floor ( weak * pow ( double ( counts[t] ) / counts[0], 1/3.0 ) + 0.5 );
+			if ( side > max_side ) {
+				if ( skipped++ == 0 ) first_skipped = counts[t];
+				continue;
+			}
+			char name[32];
+			sprintf ( name, "cube:%d", side );
+			ScaleResult res;
+			if ( !RunScene ( name, voxels, counts[t], warmup, steps, res ) ) return 1;
+			weak_rows.push_back ( res );
+		}
+		Compare ( weak_rows );
+		PrintHeader ( "weak scaling, efficiency per particle against the first worker count" );
+		for (int t=0; t < (int) weak_rows.size(); t++)
+			PrintRow ( weak_rows[t] );
+		if ( skipped > 0 )
+			printf ( "  %d worker count%s from %d left out: cubes past cube:%d outgrow the neighbor table (%d particles)\n",
+					 skipped, skipped > 1 ? "s" : "", first_skipped, max_side, MAX_NEIGHBOR_ROWS );
+	}
+
+	if ( !weak_rows.empty () && !WriteCSV ( weak_file, weak_rows ) ) {
+		printf ( "ERROR: Cannot write %s.\n", weak_file.c_str() );
+		return 1;
+	}
+	printf ( "\nTables in %s/\n", out );
+	return 0;
+}
@@ -0,0 +1,347 @@
+/*
+  Parameter sweeps of the melting simulation. Expands a grid of parameter
+  values into independent meltbatch runs and runs them concurrently on one
+  machine, each on its own processors and in its own directory, then
+  prints a table of timings and outcomes.
+
+  usage: meltsweep [options] -- [meltbatch options] scene.voxels
+    -vary NAME=a,b,c   values of one parameter (see fluids/melt_params.h);
+    -vary NAME=lo:hi:n n evenly spaced values. Every combination of the
+                       -vary options is one job.
+    -params file       base parameter file of every job
+    -threads n         worker threads per job (default 1)
+    -jobs n            jobs at a time (default processors / threads)
+    -out dir           sweep directory (default sweep); job k runs in
+                       dir/job_NNN, k zero-padded to three digits (job_000,
+                       job_001, ...), with its params.cfg, log.txt and outputs
+    -batch path        meltbatch executable (default meltbatch next to meltsweep)
+
+  Options after -- go to every meltbatch run, relative output paths landing
+  in the job's directory, e.g.
+
+    meltsweep -vary K_ICE=10,20,40 -vary AMBIENT_T=290:310:3 -threads 2
+              -- -steps 2000 -traj melt.mtj voxel/cube_25.voxels
+
+  The table is also written to dir/summary.csv.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifndef _MSC_VER
+	#include <sys/wait.h>
+#endif
+
+#include "melt_params.h"
+#include "mthread.h"
+#include "mtime.h"
+#include "mfile.h"
+
+struct SweepAxis {
+	std::string					name;
+	std::vector<std::string>	values;
+};
+
+struct SweepJob {
+	int							index;
+	std::vector<std::string>	values;			// one per axis
+	std::string					dir;
+	int							status;			// exit code, -1 if it could not start
+	double						wall;			// seconds
+	bool						bSummary;		// summary.txt read
+	int							steps, particles, liquid;
+	double						sim_time, run_time;
+};
+
+struct Sweep {
+	std::vector<SweepAxis>		axes;
+	std::vector<SweepJob>		jobs;
+	MeltParams					base;
+	std::string					batch;
+	std::string					args;			// passed to every run, quoted
+	int							threads;
+	int							slots;
+	bool						bPin;
+
+	mint::Mutex					lock;
+	int							next;			// first job not started
+	int							finished;
+};
+
+struct SweepSlot {
+	Sweep*						sweep;
+	int							index;
+	mint::Thread				thread;
+};
+
+static std::string Quote ( const std::string& s )
+{
+	return "\"" + s + "\"";
+}
+
+static bool ParseAxis ( const char* arg, SweepAxis& axis )
+{
+	const char* eq = strchr ( arg, '=' );
+	if ( eq == 0x0 || eq == arg ) return false;
+	axis.name.assign ( arg, eq - arg );
+	axis.values.clear ();
+	std::string list ( eq + 1 );
+
+	double lo, hi;
+	int num;
+	char end;
+	if ( sscanf ( list.c_str(), "%lf:%lf:%d%c", &lo, &hi, &num, &end ) == 3 && num > 0 ) {
+		char buf[64];
+		for (int n=0; n < num; n++) {
+			sprintf ( buf, "%.9g", ( num == 1 ) ? lo : lo + (hi - lo) * n / (num - 1) );
+			axis.values.push_back ( buf );
+		}
+		return true;
+	}
+	size_t start = 0;
+	while ( start <= list.size() ) {
+		size_t comma = list.find ( ',', start );
+		if ( comma == std::string::npos ) comma = list.size();
+		if ( comma > start ) axis.values.push_back ( list.substr ( start, comma - start ) );
+		start = comma + 1;
+	}
+	return !axis.values.empty();
+}
+
+// Reads the "name value" lines meltbatch writes with -summary
+static bool ReadSummary ( const std::string& file, SweepJob& job )
+{
+	FILE* fp = fopen ( file.c_str(), "r" );
+	if ( fp == 0x0 ) return false;
+	char name[64];
+	double value;
+	while ( fscanf ( fp, "%63s %lf", name, &value ) == 2 ) {
+		if ( strcmp ( name, "steps" ) == 0 )			job.steps = (int) value;
+		else if ( strcmp ( name, "particles" ) == 0 )	job.particles = (int) value;
+		else if ( strcmp ( name, "liquid" ) == 0 )		job.liquid = (int) value;
+		else if ( strcmp ( name, "sim_time" ) == 0 )	job.sim_time = value;
+		else if ( strcmp ( name, "run_time" ) == 0 )	job.run_time = value;
+	}
+	fclose ( fp );
+	return true;
+}
+
+static void RunJob ( Sweep& sw, SweepJob& job, int slot )
+{
+	job.status = -1;
+	if ( !mint::MakeDir ( job.dir.c_str() ) ) {
+		printf ( "ERROR: Cannot create %s.\n", job.dir.c_str() );
+		return;
+	}
+	MeltParams params = sw.base;
+	for (int a=0; a < (int) sw.axes.size(); a++)
+		params.Set ( sw.axes[a].name.c_str(), job.values[a].c_str() );
+	std::string cfg = job.dir + "/params.cfg";
+	if ( !params.Save ( cfg.c_str() ) ) return;
+
+	char opts[128];
+	sprintf ( opts, " -threads %d -report 0", sw.threads );
+	std::string cmd = Quote ( sw.batch ) + opts;
+	if ( sw.bPin ) {
+		sprintf ( opts, " -pin %d,%d", slot * sw.threads, sw.threads );
+		cmd += opts;
+	}
+	cmd += " -params " + Quote ( cfg ) + " -out " + Quote ( job.dir ) + " -summary summary.txt" + sw.args;
+	cmd += " > " + Quote ( job.dir + "/log.txt" ) + " 2>&1";
+	#ifdef _MSC_VER
+		cmd = "\"" + cmd + "\"";			// cmd.exe strips the outer quotes
+	#endif
+
+	mint::Time start, stop;
+	start.SetSystemTime ( ACC_NSEC );
+	int rc = system ( cmd.c_str() );
+	stop.SetSystemTime ( ACC_NSEC );
+	job.wall = double ( stop.GetSJT() - start.GetSJT() ) / SEC_SCALAR;
+	#ifdef _MSC_VER
+		job.status = rc;
+	#else
+		job.status = ( rc != -1 && WIFEXITED ( rc ) ) ? WEXITSTATUS ( rc ) : -1;
+	#endif
+	job.bSummary = ( job.status == 0 ) && ReadSummary ( job.dir + "/summary.txt", job );
+}
+
+static void SlotEntry ( void* arg )
+{
+	SweepSlot* slot = (SweepSlot*) arg;
+	Sweep& sw = *slot->sweep;
+	for (;;) {
+		int n;
+		{
+			mint::ScopedLock lock ( sw.lock );
+			if ( sw.next >= (int) sw.jobs.size() ) return;
+			n = sw.next++;
+		}
+		SweepJob& job = sw.jobs[n];
+		RunJob ( sw, job, slot->index );
+
+		mint::ScopedLock lock ( sw.lock );
+		sw.finished++;
+		printf ( "[%d/%d] job_%03d %s (%.1f s)\n", sw.finished, (int) sw.jobs.size(), job.index,
+				 job.status == 0 ? "done" : "FAILED", job.wall );
+		fflush ( stdout );
+	}
+}
+
+static std::string Outcome ( const SweepJob& job )
+{
+	char buf[64];
+	if ( job.status == -1 )		return "not run";
+	if ( job.status != 0 )		{ sprintf ( buf, "exit %d", job.status ); return buf; }
+	if ( !job.bSummary )		return "no summary";
+	return "ok";
+}
+
+static void Usage ()
+{
+	printf ( "usage: meltsweep -vary NAME=a,b,.. | -vary NAME=lo:hi:n [-vary ...] [-params file]\n" );
+	printf ( "                 [-threads n] [-jobs n] [-out dir] [-batch path]\n" );
+	printf ( "                 -- [meltbatch options] scene.voxels\n" );
+}
+
+int main ( int argc, char **argv )
+{
+	Sweep sw;
+	std::string out = "sweep";
+	sw.threads = 1;
+	sw.slots = 0;
+	sw.next = 0;
+	sw.finished = 0;
+
+	// Default to the meltbatch next to this executable
+	std::string self ( argv[0] );
+	size_t slash = self.find_last_of ( "/\\" );
+	sw.batch = ( slash == std::string::npos ) ? "" : self.substr ( 0, slash + 1 );
+	#ifdef _MSC_VER
+		sw.batch += "meltbatch.exe";
+	#else
+		sw.batch = ( slash == std::string::npos ) ? "./meltbatch" : sw.batch + "meltbatch";
+	#endif
+
+	int n = 1;
+	for ( ; n < argc; n++) {
+		bool arg = ( n+1 < argc );
+		if ( strcmp ( argv[n], "--" ) == 0 ) { n++; break; }
+		if ( strcmp ( argv[n], "-vary" ) == 0 && arg ) {
+			SweepAxis axis;
+			MeltParams check;
+			bool ok = ParseAxis ( argv[++n], axis );
+			for (int v=0; ok && v < (int) axis.values.size(); v++)
+				ok = check.Set ( axis.name.c_str(), axis.values[v].c_str() );
+			if ( !ok ) {
+				printf ( "ERROR: bad -vary %s.\n", argv[n] );
+				return 1;
+			}
+			sw.axes.push_back ( axis );
+		}
+		else if ( strcmp ( argv[n], "-params" ) == 0 && arg )	{ if ( !sw.base.Load ( argv[++n] ) ) return 1; }
+		else if ( strcmp ( argv[n], "-threads" ) == 0 && arg )	sw.threads = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-jobs" ) == 0 && arg )		sw.slots = atoi ( argv[++n] );
+		else if ( strcmp ( argv[n], "-out" ) == 0 && arg )		out = argv[++n];
+		else if ( strcmp ( argv[n], "-batch" ) == 0 && arg )	sw.batch = argv[++n];
+		else { Usage (); return 1; }
+	}
+	for ( ; n < argc; n++)
+		sw.args += " " + Quote ( argv[n] );
+	if ( sw.axes.empty() ) {
+		Usage ();
+		return 1;
+	}
+
+	// Every combination of the axes, the last axis varying fastest
+	int total = 1;
+	for (int a=0; a < (int) sw.axes.size(); a++)
+		total *= (int) sw.axes[a].values.size();
+	sw.jobs.resize ( total );
+	for (int j=0; j < total; j++) {
+		SweepJob& job = sw.jobs[j];
+		job.index = j;
+		job.values.resize ( sw.axes.size() );
+		for (int a = (int) sw.axes.size()-1, k = j; a >= 0; a--) {
+			int num = (int) sw.axes[a].values.size();
+			job.values[a] = sw.axes[a].values[k % num];
+			k /= num;
+		}
+		char name[32];
+		sprintf ( name, "/job_%03d", j );
+		job.dir = out + name;
+		job.status = -1;
+		job.wall = 0;
+		job.bSummary = false;
+		job.steps = job.particles = job.liquid = 0;
+		job.sim_time = job.run_time = 0;
+	}
+
+	// Cores: each concurrent job gets its own threads-wide range of
+	// processors, when they are enough to go round
+	int cores = mint::NumProcessors ();
+	if ( sw.threads < 1 ) sw.threads = 1;
+	if ( sw.slots <= 0 ) sw.slots = ( cores / sw.threads > 0 ) ? cores / sw.threads : 1;
+	if ( sw.slots > total ) sw.slots = total;
+	sw.bPin = ( sw.slots * sw.threads <= cores );
+	if ( !mint::MakeDir ( out.c_str() ) ) {
+		printf ( "ERROR: Cannot create %s.\n", out.c_str() );
+		return 1;
+	}
+	printf ( "%d jobs, %d at a time with %d threads each on %d processors%s\n", total, sw.slots, sw.threads, cores,
+			 sw.bPin ? ", pinned" : ", oversubscribed" );
+
+	mint::Time start, stop;
+	start.SetSystemTime ( ACC_NSEC );
+	std::vector<SweepSlot> slots ( sw.slots );
+	for (int s=0; s < sw.slots; s++) {
+		slots[s].sweep = &sw;
+		slots[s].index = s;
+		slots[s].thread.Start ( SlotEntry, &slots[s] );
+	}
+	for (int s=0; s < sw.slots; s++)
+		slots[s].thread.Join ();
+	stop.SetSystemTime ( ACC_NSEC );
+	double wall = double ( stop.GetSJT() - start.GetSJT() ) / SEC_SCALAR;
+
+	// Summary table
+	std::string csv_path = out + "/summary.csv";
+	FILE* csv = fopen ( csv_path.c_str(), "w" );
+	if ( csv != 0x0 ) {
+		fprintf ( csv, "job" );
+		for (int a=0; a < (int) sw.axes.size(); a++) fprintf ( csv, ",%s", sw.axes[a].name.c_str() );
+		fprintf ( csv, ",outcome,wall_s,run_s,steps,steps_per_s,sim_time,particles,liquid\n" );
+	}
+	printf ( "\n%-8s", "job" );
+	for (int a=0; a < (int) sw.axes.size(); a++) printf ( " %14s", sw.axes[a].name.c_str() );
+	printf ( " %-10s %9s %8s %9s %9s %8s\n", "outcome", "wall s", "steps", "steps/s", "sim s", "liquid" );
+
+	int failed = 0;
+	double busy = 0;
+	for (int j=0; j < total; j++) {
+		const SweepJob& job = sw.jobs[j];
+		double rate = ( job.run_time > 0 ) ? job.steps / job.run_time : 0;
+		double melted = ( job.particles > 0 ) ? 100.0 * job.liquid / job.particles : 0;
+		std::string outcome = Outcome ( job );
+		if ( outcome != "ok" ) failed++;
+		busy += job.wall;
+
+		printf ( "job_%03d ", j );
+		for (int a=0; a < (int) sw.axes.size(); a++) printf ( " %14s", job.values[a].c_str() );
+		printf ( " %-10s %9.1f %8d %9.2f %9.4f %7.1f%%\n", outcome.c_str(), job.wall, job.steps, rate, job.sim_time, melted );
+		if ( csv != 0x0 ) {
+			fprintf ( csv, "%d", j );
+			for (int a=0; a < (int) sw.axes.size(); a++) fprintf ( csv, ",%s", job.values[a].c_str() );
+			fprintf ( csv, ",%s,%.3f,%.3f,%d,%.3f,%.6f,%d,%d\n", outcome.c_str(), job.wall, job.run_time, job.steps, rate,
+					  job.sim_time, job.particles, job.liquid );
+		}
+	}
+	if ( csv != 0x0 ) fclose ( csv );
+
+	printf ( "\n%d of %d jobs ok, %.1f s wall, %.1f s of runs (%.2fx)\n", total - failed, total, wall, busy,
+			 wall > 0 ? busy / wall : 0.0 );
+	printf ( "summary in %s\n", csv_path.c_str() );
+	return failed > 0 ? 1 : 0;
+}
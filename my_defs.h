@@ -8,9 +8,15 @@
 //#define OBJECT_PATH "voxel/happy_30.voxels"
 //#define OBJECT_PATH "voxel/triangle_30.voxels"
 
+// Scene "cube:n": a solid cube of n voxels a side seeded without a file (n <= 40),
+// as large as the voxel/cube_n models, for particle counts between theirs
+#define CUBE_SCENE_SIZE 14.4f
+
 // State of particle
 enum Status { SOLID, LIQUID};
 
+// Defaults of the runtime parameters down to MARCH_RESO, see MeltParams
+// (fluids/melt_params.h); a parameter file overrides them without a rebuild
 static const float AMBIENT_T = 300; //283; //373;
 static const float C_ICE = 0.5;
 static const float C_WATER = 0.1;
@@ -74,4 +80,23 @@ static const double MARCH_RESO = 800;
 
 static const double INERTIA_FACTOR = 1E20;
 
+// Checkpoints (K toggles them, L restores the latest)
+#define CHECKPOINT_PATH "melt.mck"
+static const int CHECKPOINT_INTERVAL = 500;		// frames
+static const double CHECKPOINT_ERROR = 0;		// particle coding error bound, 0 exact, < 0 uncoded
+
+// Trajectory output (J toggles it)
+#define TRAJECTORY_PATH "melt.mtj"
+#define TRAJECTORY_ATTRS "pos,vel,temp,state,density"
+static const int TRAJECTORY_INTERVAL = 10;		// frames
+static const double TRAJECTORY_ERROR = 1e-4;	// absolute, per float component; < 0 uncoded
+static const int TRAJECTORY_KEYFRAMES = 32;		// recorded frames between key frames
+
+// Phase timings, written on P and at exit (.json for JSON, else CSV)
+#define PROFILE_PATH "melt_profile.csv"
+
+// Event timeline in Chrome trace JSON, recorded between presses of E, see
+// common/mtrace.h
+#define TRACE_PATH "melt_trace.json"
+
 #endif MYDEFS
\ No newline at end of file
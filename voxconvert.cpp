@@ -0,0 +1,31 @@
+/*
+  Converts voxelizer output (.voxels) to the compact .vxc format read by
+  VoxelGrid::loadGrid.
+
+  usage: voxconvert [-distance] [-border] input.voxels output.vxc
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "voxel_grid.h"
+#include "voxel_compact_format.h"
+
+int main ( int argc, char **argv )
+{
+	int channels = 0;
+	const char* files[2];
+	int nfiles = 0;
+
+	for (int n=1; n < argc; n++) {
+		if ( strcmp ( argv[n], "-distance" ) == 0 )		channels |= VOXELCOMPACT_DISTANCE;
+		else if ( strcmp ( argv[n], "-border" ) == 0 )	channels |= VOXELCOMPACT_BORDER;
+		else if ( nfiles < 2 )							files[nfiles++] = argv[n];
+		else											nfiles = 3;
+	}
+	if ( nfiles != 2 ) {
+		printf ( "usage: voxconvert [-distance] [-border] input.voxels output.vxc\n" );
+		return 1;
+	}
+	return VoxelGrid::convertGrid ( files[0], files[1], channels ) ? 0 : 1;
+}
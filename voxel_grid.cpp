@@ -1,132 +1,376 @@
 #include "voxel_grid.h"
-#include <GL/glew.h>
-#include <GL/glut.h>
 #include <string>
+#include <string.h>
 #include <stdlib.h>
 #include "voxel_file_format.h"
+#include "voxel_compact_format.h"
 #include <iostream>
 #include <stdio.h>
 #include <vector>
+#include <algorithm>
 #include "my_defs.h"
+#include "mfile.h"
 
 VoxelGrid::~VoxelGrid() {
-	for(int i=0;i<theDim[0];i++){
-		for(int j=0;j<theDim[2];j++){
-			delete[] data[i][j];
-		}
-		delete[] data[i];
-	}
-	delete[] data;
 }
 
 void VoxelGrid::loadGrid(const char* filename) {  
-	FILE* voxel_file = fopen(filename, "rb");
-	if (voxel_file != NULL) {
-		float scaleFactor[3];
-		float zeroCoord[3];
-
-		//Read in Header File
-		voxelfile_file_header file_hdr;
-		fread(&file_hdr,sizeof(file_hdr),1,voxel_file);
-
-		//Read in Object Header
-		voxelfile_object_header object_hdr;
-		fread(&object_hdr,sizeof(object_hdr),1,voxel_file);
-		
-		//Set Resolution
-		theDim[0] = object_hdr.voxel_resolution[0];
-		theDim[1] = object_hdr.voxel_resolution[1];
-		theDim[2] = object_hdr.voxel_resolution[2];
-		
-		//Set Scale Factor
-		scaleFactor[0] = object_hdr.model_scale_factor*ADJUST_SCALE;
-		scaleFactor[1] = object_hdr.model_scale_factor*ADJUST_SCALE;
-		scaleFactor[2] = object_hdr.model_scale_factor*ADJUST_SCALE;
-		
-		//Set Voxel Grid Size
-		voxelSize[0] = object_hdr.voxel_size[0]*scaleFactor[0];
-		voxelSize[1] = object_hdr.voxel_size[1]*scaleFactor[1];
-		voxelSize[2] = object_hdr.voxel_size[2]*scaleFactor[2];
-
-		//Set Voxel Grid Size
-		offset[0] = object_hdr.model_offset[0]+ADJUST_OFFSET_X;
-		offset[1] = object_hdr.model_offset[1]+ADJUST_OFFSET_Y;
-		offset[2] = object_hdr.model_offset[2]+ADJUST_OFFSET_Z;
-
-		printf("Loading Voxel Grid...");
-		printf("Resolution %d x %d x %d \n",theDim[0],theDim[1],theDim[2]);
-		printf("Voxel Size %f x %f x %f \n",voxelSize[0],voxelSize[1],voxelSize[2]);
-		printf("Scale Factor %f x %f x %f \n",scaleFactor[0],scaleFactor[1],scaleFactor[2]);
-		printf("Origin Offset %f x %f x %f \n",offset[0],offset[1],offset[2]);
-		
-		float size_x = theDim[0];
-		float size_y = theDim[2];
-		float size_z = theDim[1];
-
-		data = new bool**[size_x];
-		for (int i = 0; i < size_x; ++i) {
-			data[i] = new bool*[size_y];
-			for (int j = 0; j < size_y; ++j) {
-				data[i][j] = new bool[size_z];
-				for (int k = 0; k < size_z; ++k) {
-					data[i][j][k] = false;
-				}
-			}
-		}
+	mint::MappedFile voxel_file;
+	if (!voxel_file.Open(filename)) {
+		std::cout << "File Does not Exist" << std::endl;
+		return;
+	}
+	const char* buf = voxel_file.GetData();
+	size_t buf_size = voxel_file.GetSize();
+
+	if (buf_size >= 4 && memcmp(buf, VOXELCOMPACT_MAGIC, 4) == 0)
+		loadCompact(buf, buf_size, filename);
+	else
+		loadVoxels(buf, buf_size, filename);
+}
+
+// Sets the dimensions and transform from a file header and allocates the
+// (empty) occupancy and adjacency grids. The header is in file axes; the
+// grid keeps world axes, so file j (depth) becomes z and file k (up) y.
+void VoxelGrid::initGrid(const int resolution[3], const float size[3], float scale, const float model_offset[3]) {
+	float scaleFactor[3];
+
+	//Set Resolution
+	theDim[0] = resolution[0];
+	theDim[1] = resolution[2];
+	theDim[2] = resolution[1];
 	
-		adj = new short**[theDim[0]];
-		for (int i = 0; i < size_x; ++i) {
-			adj[i] = new short*[size_y];
-			for (int j = 0; j < size_y; ++j) {
-				adj[i][j] = new short[size_z];
-				for (int k = 0; k < size_z; ++k) {
-					adj[i][j][k] = 0;
-				}
-			}
+	//Set Scale Factor
+	scaleFactor[0] = scale*ADJUST_SCALE;
+	scaleFactor[1] = scale*ADJUST_SCALE;
+	scaleFactor[2] = scale*ADJUST_SCALE;
+	
+	//Set Voxel Grid Size
+	voxelSize[0] = size[0]*scaleFactor[0];
+	voxelSize[1] = size[2]*scaleFactor[1];
+	voxelSize[2] = size[1]*scaleFactor[2];
+
+	//Set Voxel Grid Size
+	offset[0] = model_offset[0]+ADJUST_OFFSET_X;
+	offset[1] = model_offset[1]+ADJUST_OFFSET_Y;
+	offset[2] = model_offset[2]+ADJUST_OFFSET_Z;
+
+	printf("Loading Voxel Grid...");
+	printf("Resolution %d x %d x %d \n",theDim[0],theDim[1],theDim[2]);
+	printf("Voxel Size %f x %f x %f \n",voxelSize[0],voxelSize[1],voxelSize[2]);
+	printf("Scale Factor %f x %f x %f \n",scaleFactor[0],scaleFactor[1],scaleFactor[2]);
+	printf("Origin Offset %f x %f x %f \n",offset[0],offset[1],offset[2]);
+
+	allocate(theDim);
+}
+
+void VoxelGrid::allocate(const int dim[3]) {
+	if (dim != theDim) {
+		theDim[0] = dim[0];
+		theDim[1] = dim[1];
+		theDim[2] = dim[2];
+	}
+	wordsPerRow = (theDim[0] + 63) / 64;
+	data.assign((size_t) wordsPerRow * theDim[1] * theDim[2], 0);
+	adj.assign((size_t) theDim[0] * theDim[1] * theDim[2], -1);
+	distance.clear();
+	border.clear();
+}
+
+void VoxelGrid::makeCube(int n, float size) {
+	int dim[3] = { n, n, n };
+	allocate(dim);
+	voxelSize[0] = voxelSize[1] = voxelSize[2] = size / n;
+	offset[0] = ADJUST_OFFSET_X;
+	offset[1] = ADJUST_OFFSET_Y;
+	offset[2] = ADJUST_OFFSET_Z;
+	for (int z = 0; z < n; z++)
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++)
+				setOccupied(x, y, z);
+	printf("Cube Voxel Grid...Resolution %d x %d x %d \n", n, n, n);
+}
+
+// Marks voxel (i,j,k), in the axes of the file, as occupied.
+void VoxelGrid::markVoxel(int i, int j, int k) {
+	setOccupied(i, k, j);
+}
+
+// Reads the voxelizer's .voxels stream (see voxel_file_format.h). The file is
+// memory mapped and walked once: a '0' byte is an empty voxel, anything else
+// is followed by a packed voxelfile_voxel of which only i,j,k are used.
+// Records have no offset index (a record may itself contain '0' bytes), so
+// the stream cannot be split for parallel parsing.
+void VoxelGrid::loadVoxels(const char* buf, size_t buf_size, const char* filename) {
+	//Read in and check the File Header
+	voxelfile_file_header file_hdr;
+	voxelfile_object_header object_hdr;
+	if (buf_size < sizeof(file_hdr) + sizeof(object_hdr)) {
+		std::cout << "Voxel file is truncated: " << filename << std::endl;
+		return;
+	}
+	memcpy(&file_hdr, buf, sizeof(file_hdr));
+	if (file_hdr.header_size != sizeof(file_hdr) || file_hdr.num_objects < 1 ||
+		file_hdr.object_header_size != sizeof(object_hdr) ||
+		file_hdr.voxel_struct_size != sizeof(voxelfile_voxel)) {
+		std::cout << "Not a supported voxel file: " << filename << std::endl;
+		return;
+	}
+
+	//Read in Object Header
+	memcpy(&object_hdr, buf + file_hdr.header_size, sizeof(object_hdr));
+	if (object_hdr.voxel_resolution[0] <= 0 || object_hdr.voxel_resolution[1] <= 0 ||
+		object_hdr.voxel_resolution[2] <= 0) {
+		std::cout << "Voxel file has an empty grid: " << filename << std::endl;
+		return;
+	}
+	initGrid(object_hdr.voxel_resolution, object_hdr.voxel_size, object_hdr.model_scale_factor, object_hdr.model_offset);
+
+	const char* p = buf + file_hdr.header_size + file_hdr.object_header_size;
+	const char* end = buf + buf_size;
+	const int record = 1 + file_hdr.voxel_struct_size;
+	short ijk[3];
+	int count = 0, outside = 0;
+	while (count < object_hdr.num_voxels) {
+		while (p < end && *p == ASCIIVOXEL_NOVOXEL)
+			++p;
+		if (end - p < record)
+			break;
+		memcpy(ijk, p + 1, sizeof(ijk));		// i,j,k lead the record
+		p += record;
+		count++;
+		if (!contains(ijk[0], ijk[2], ijk[1])) {
+			outside++;
+			continue;
 		}
+		markVoxel(ijk[0], ijk[1], ijk[2]);
+	}
+	if (count < object_hdr.num_voxels)
+		std::cout << "Voxel file ends after " << count << " of " << object_hdr.num_voxels << " voxels" << std::endl;
+	if (outside > 0)
+		std::cout << outside << " voxels outside the grid were skipped" << std::endl;
+	std::cout << " count in voxel grid " << count << std::endl;
+}
 
-		/* Original version
-		data = new bool**[theDim[0]];
-		for (int i = 0; i < theDim[0]; i++) {
-			data[i] = new bool*[theDim[2]];
-			for (int j = 0; j < theDim[2]; j++) {
-				data[i][j] = new bool[theDim[1]];
-				for (int k = 0; k < theDim[1]; k++) {
-					data[i][j][k] = false;
-				}
+static bool readRun(const unsigned char*& p, const unsigned char* end, unsigned int& value) {
+	value = 0;
+	for (int shift = 0; p < end && shift < 32; shift += 7) {
+		unsigned char b = *p++;
+		value |= (unsigned int) (b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static void writeRun(std::vector<unsigned char>& out, unsigned int value) {
+	while (value >= 0x80) {
+		out.push_back((unsigned char) (value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char) value);
+}
+
+// Reads the compact .vxc format (see voxel_compact_format.h).
+void VoxelGrid::loadCompact(const char* buf, size_t buf_size, const char* filename) {
+	voxelcompact_header hdr;
+	if (buf_size < sizeof(hdr)) {
+		std::cout << "Voxel file is truncated: " << filename << std::endl;
+		return;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.version != VOXELCOMPACT_VERSION || hdr.header_size != sizeof(hdr) ||
+		hdr.voxel_resolution[0] <= 0 || hdr.voxel_resolution[1] <= 0 || hdr.voxel_resolution[2] <= 0) {
+		std::cout << "Not a supported voxel file: " << filename << std::endl;
+		return;
+	}
+	unsigned int rows = (unsigned int) hdr.voxel_resolution[1] * hdr.voxel_resolution[2];
+	if (hdr.rows_offset + (rows + 1) * (size_t) sizeof(unsigned int) > buf_size ||
+		hdr.runs_offset + (size_t) hdr.runs_size > buf_size ||
+		(hdr.distance_offset && hdr.distance_offset + hdr.num_voxels * sizeof(float) > buf_size) ||
+		(hdr.border_offset && hdr.border_offset + (hdr.num_voxels + 7) / 8 > buf_size)) {
+		std::cout << "Voxel file is truncated: " << filename << std::endl;
+		return;
+	}
+	initGrid(hdr.voxel_resolution, hdr.voxel_size, hdr.model_scale_factor, hdr.model_offset);
+
+	int numCells = theDim[0] * theDim[1] * theDim[2];
+	if (hdr.distance_offset)
+		distance.assign(numCells, 0.0f);
+	if (hdr.border_offset)
+		border.assign(numCells, 0);
+
+	const unsigned char* runs = (const unsigned char*) buf + hdr.runs_offset;
+	const unsigned int* rowStart = (const unsigned int*) (buf + hdr.rows_offset);
+	const unsigned char* borderBits = (const unsigned char*) buf + hdr.border_offset;
+	int count = 0;
+	for (unsigned int r = 0; r < rows; r++) {
+		int j = r % hdr.voxel_resolution[1];
+		int k = r / hdr.voxel_resolution[1];
+		unsigned int first, last;
+		memcpy(&first, rowStart + r, sizeof(first));
+		memcpy(&last, rowStart + r + 1, sizeof(last));
+		if (first > last || last > hdr.runs_size) {
+			std::cout << "Voxel file has a bad row table: " << filename << std::endl;
+			break;
+		}
+		const unsigned char* p = runs + first;
+		const unsigned char* end = runs + last;
+		unsigned int empty, full;
+		int i = 0;
+		while (p < end && readRun(p, end, empty) && readRun(p, end, full)) {
+			i += empty;
+			if (i + (int) full > theDim[0] || count + (int) full > hdr.num_voxels) {
+				std::cout << "Voxel file has a bad run: " << filename << std::endl;
+				break;
+			}
+			for (unsigned int n = 0; n < full; n++, i++, count++) {
+				int cell = index(i, k, j);
+				markVoxel(i, j, k);
+				if (hdr.distance_offset)
+					memcpy(&distance[cell], buf + hdr.distance_offset + count * sizeof(float), sizeof(float));
+				if (hdr.border_offset)
+					border[cell] = (borderBits[count >> 3] >> (count & 7)) & 1;
 			}
 		}
+	}
+	std::cout << " count in voxel grid " << count << std::endl;
+}
 
-		adj = new short**[theDim[0]];
-		for (int i = 0; i < theDim[0]; i++) {
-			adj[i] = new short*[theDim[2]];
-			for (int j = 0; j < theDim[2]; j++) {
-				adj[i][j] = new short[theDim[1]];
-				for (int k = 0; k < theDim[1]; k++) {
-					adj[i][j][k] = 0; // all sides have ice
-				}
-			}
-		}*/
-
-		char v;
-		voxelfile_voxel c_voxel;
-		//Alternative Method
-		int count=0;
-		while(count<object_hdr.num_voxels)
-		{
-			fread(&v,sizeof(char),1,voxel_file);
-			if(v != ASCIIVOXEL_NOVOXEL){
-				fread(&c_voxel,sizeof(c_voxel),1,voxel_file);
-				data[c_voxel.i][c_voxel.k][c_voxel.j] = true;
-				count++;
+// Converts a .voxels file to the compact format. channels selects the side
+// channels to keep (VOXELCOMPACT_DISTANCE, VOXELCOMPACT_BORDER).
+bool VoxelGrid::convertGrid(const char* src, const char* dst, int channels) {
+	mint::MappedFile in;
+	if (!in.Open(src)) {
+		std::cout << "File Does not Exist: " << src << std::endl;
+		return false;
+	}
+	const char* buf = in.GetData();
+	size_t buf_size = in.GetSize();
+
+	voxelfile_file_header file_hdr;
+	voxelfile_object_header object_hdr;
+	if (buf_size < sizeof(file_hdr) + sizeof(object_hdr)) {
+		std::cout << "Voxel file is truncated: " << src << std::endl;
+		return false;
+	}
+	memcpy(&file_hdr, buf, sizeof(file_hdr));
+	memcpy(&object_hdr, buf + sizeof(file_hdr), sizeof(object_hdr));
+	if (file_hdr.header_size != sizeof(file_hdr) || file_hdr.object_header_size != sizeof(object_hdr) ||
+		file_hdr.voxel_struct_size != sizeof(voxelfile_voxel) ||
+		object_hdr.voxel_resolution[0] <= 0 || object_hdr.voxel_resolution[1] <= 0 || object_hdr.voxel_resolution[2] <= 0) {
+		std::cout << "Not a supported voxel file: " << src << std::endl;
+		return false;
+	}
+
+	// Gather occupancy and side channels on a dense grid, in file axes
+	const int* res = object_hdr.voxel_resolution;
+	int numCells = res[0] * res[1] * res[2];
+	std::vector<unsigned char> occ(numCells, 0), onBorder(numCells, 0);
+	std::vector<float> dist(numCells, 0.0f);
+	const char* p = buf + sizeof(file_hdr) + sizeof(object_hdr);
+	const char* end = buf + buf_size;
+	voxelfile_voxel v;
+	for (int count = 0; count < object_hdr.num_voxels; count++) {
+		while (p < end && *p == ASCIIVOXEL_NOVOXEL)
+			++p;
+		if (end - p < 1 + (int) sizeof(v))
+			break;
+		memcpy(&v, p + 1, sizeof(v));
+		p += 1 + sizeof(v);
+		if (v.i < 0 || v.j < 0 || v.k < 0 || v.i >= res[0] || v.j >= res[1] || v.k >= res[2])
+			continue;
+		int cell = (v.k * res[1] + v.j) * res[0] + v.i;
+		occ[cell] = 1;
+		dist[cell] = v.has_distance ? v.distance_to_surface : 0.0f;
+		onBorder[cell] = v.is_on_border ? 1 : 0;
+	}
+
+	// Encode rows
+	int rows = res[1] * res[2];
+	std::vector<unsigned int> rowStart(rows + 1);
+	std::vector<unsigned char> runs;
+	std::vector<float> distOut;
+	std::vector<unsigned char> borderOut;
+	int numVoxels = 0;
+	for (int r = 0; r < rows; r++) {
+		const unsigned char* row = &occ[r * res[0]];
+		rowStart[r] = (unsigned int) runs.size();
+		int i = 0;
+		while (i < res[0]) {
+			int e = i;
+			while (e < res[0] && !row[e]) e++;
+			if (e == res[0])
+				break;							// trailing empty run is implied
+			int f = e;
+			while (f < res[0] && row[f]) f++;
+			writeRun(runs, e - i);
+			writeRun(runs, f - e);
+			for (int n = e; n < f; n++, numVoxels++) {
+				int cell = r * res[0] + n;
+				distOut.push_back(dist[cell]);
+				if ((numVoxels & 7) == 0)
+					borderOut.push_back(0);
+				borderOut.back() |= onBorder[cell] << (numVoxels & 7);
 			}
+			i = f;
 		}
-		std::cout << " count in voxel grid " << count << std::endl;
+	}
+	rowStart[rows] = (unsigned int) runs.size();
 
-		fclose(voxel_file);
-	} else {
-		std::cout << "File Does not Exist" << std::endl;
+	voxelcompact_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, VOXELCOMPACT_MAGIC, 4);
+	hdr.version = VOXELCOMPACT_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.channels = channels & (VOXELCOMPACT_DISTANCE | VOXELCOMPACT_BORDER);
+	hdr.num_voxels = numVoxels;
+	for (int a = 0; a < 3; a++) {
+		hdr.voxel_resolution[a] = res[a];
+		hdr.voxel_size[a] = object_hdr.voxel_size[a];
+		hdr.model_offset[a] = object_hdr.model_offset[a];
+		hdr.zero_coordinate[a] = object_hdr.zero_coordinate[a];
 	}
+	hdr.model_scale_factor = object_hdr.model_scale_factor;
+	hdr.rows_offset = sizeof(hdr);
+	hdr.runs_offset = hdr.rows_offset + (rows + 1) * sizeof(unsigned int);
+	hdr.runs_size = (unsigned int) runs.size();
+	unsigned int next = hdr.runs_offset + hdr.runs_size;
+	if (hdr.channels & VOXELCOMPACT_DISTANCE) {
+		hdr.distance_offset = next;
+		next += numVoxels * sizeof(float);
+	}
+	if (hdr.channels & VOXELCOMPACT_BORDER)
+		hdr.border_offset = next;
+
+	FILE* out = fopen(dst, "wb");
+	if (out == NULL) {
+		std::cout << "Cannot open " << dst << " for writing" << std::endl;
+		return false;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1;
+	ok = ok && fwrite(&rowStart[0], sizeof(unsigned int), rows + 1, out) == (size_t) rows + 1;
+	if (!runs.empty())
+		ok = ok && fwrite(&runs[0], 1, runs.size(), out) == runs.size();
+	if (hdr.distance_offset && numVoxels > 0)
+		ok = ok && fwrite(&distOut[0], sizeof(float), numVoxels, out) == (size_t) numVoxels;
+	if (hdr.border_offset && numVoxels > 0)
+		ok = ok && fwrite(&borderOut[0], 1, borderOut.size(), out) == borderOut.size();
+	if (fclose(out) != 0)
+		ok = false;
+	if (!ok)
+		std::cout << "Error writing " << dst << std::endl;
+	else
+		printf("%s: %d voxels, %u bytes\n", dst, numVoxels, next + (hdr.border_offset ? (unsigned int) borderOut.size() : 0));
+	return ok;
+}
+
+void VoxelGrid::getMemory(size_t& resident, size_t& reserved) const
+{
+	resident = data.size() * sizeof(VoxelWord) + adj.size() * sizeof(short)
+			 + distance.size() * sizeof(float) + border.size();
+	reserved = data.capacity() * sizeof(VoxelWord) + adj.capacity() * sizeof(short)
+			 + distance.capacity() * sizeof(float) + border.capacity();
 }
 
 Vector3DF VoxelGrid::getCellCenter(int i, int j, int k)
@@ -139,21 +383,85 @@ Vector3DF VoxelGrid::getCellCenter(int i, int j, int k)
 }
 
 Vector3DF VoxelGrid::inVoxelGrid(double x, double y, double z) {
-	float size_x = theDim[0];
-	float size_y = theDim[2];
-	float size_z = theDim[1];
-
 	int i = (x-offset[0])/voxelSize[0];
-	int j = (y-offset[1])/voxelSize[2]; // intentional switch of axis
-	int k = (z-offset[2])/voxelSize[1];
+	int j = (y-offset[1])/voxelSize[1];
+	int k = (z-offset[2])/voxelSize[2];
 	
-	//if (i < 0 || j < 0 || k < 0 || i >= theDim[0]-1 || j >= theDim[2]-1 || k >= theDim[1]-1)
-	if (i < 0 || j < 0 || k < 0 || i >= size_x|| j >= size_y|| k >= size_z)
+	if (!contains(i, j, k) || !isOccupied(i, j, k))
 		return Vector3DF(-1.0, -1.0, -1.0);
+	return Vector3DF(i,j,k);
+}
+
+namespace {
+	class AdjacencyJob : public mint::ParallelBody {
+	public:
+		AdjacencyJob ( VoxelGrid* grid, void (VoxelGrid::*slab)(int, int) ) : m_Grid ( grid ), m_Slab ( slab ) {}
+		virtual void Run ( int begin, int end )		{ (m_Grid->*m_Slab) ( begin, end ); }
+	private:
+		VoxelGrid*	m_Grid;
+		void (VoxelGrid::*m_Slab)(int, int);
+	};
+}
+
+void VoxelGrid::computeAdjacency(mint::ThreadPool* pool) {
+	AdjacencyJob job(this, &VoxelGrid::adjacencySlab);
+	mint::ParallelFor(pool, 0, theDim[2], 1, job);
+}
 
-	//std::cout << "(" << i << "," << j << "," << k << ")" << std::endl;
-    if(data[i][j][k])
-        return Vector3DF(i,j,k);
-    else 
-        return Vector3DF(-1.0, -1.0, -1.0);
-}
\ No newline at end of file
+// Neighbor counts for the z range [zBegin,zEnd). The six neighbor masks of
+// a word are shifts of the same row and loads from the four adjacent rows;
+// they are summed per bit with carry-save adders into three count planes,
+// so only the occupied bits are visited one at a time. Rows outside the
+// grid read as empty, and so do the pad bits past theDim[0].
+void VoxelGrid::adjacencySlab(int zBegin, int zEnd) {
+	const int rowStride = wordsPerRow;
+	const int sliceStride = theDim[1] * wordsPerRow;
+	for (int z = zBegin; z < zEnd; z++) {
+		for (int y = 0; y < theDim[1]; y++) {
+			const VoxelWord* row = &data[(z*theDim[1] + y)*wordsPerRow];
+			const VoxelWord* down = y > 0 ? row - rowStride : 0x0;
+			const VoxelWord* up = y < theDim[1] - 1 ? row + rowStride : 0x0;
+			const VoxelWord* back = z > 0 ? row - sliceStride : 0x0;
+			const VoxelWord* front = z < theDim[2] - 1 ? row + sliceStride : 0x0;
+			short* out = &adj[index(0, y, z)];
+			std::fill(out, out + theDim[0], (short) -1);
+
+			for (int w = 0; w < wordsPerRow; w++) {
+				VoxelWord cur = row[w];
+				if (cur == 0)
+					continue;
+				VoxelWord a = (cur << 1) | (w > 0 ? row[w-1] >> 63 : 0);					// x-1
+				VoxelWord b = (cur >> 1) | (w < wordsPerRow - 1 ? row[w+1] << 63 : 0);	// x+1
+				VoxelWord c = down ? down[w] : 0;
+				VoxelWord d = up ? up[w] : 0;
+				VoxelWord e = back ? back[w] : 0;
+				VoxelWord f = front ? front[w] : 0;
+
+				VoxelWord s0 = a ^ b ^ c, c0 = (a & b) | (c & (a ^ b));
+				VoxelWord s1 = d ^ e ^ f, c1 = (d & e) | (f & (d ^ e));
+				VoxelWord ones = s0 ^ s1, carry = s0 & s1;
+				VoxelWord twos = c0 ^ c1 ^ carry;
+				VoxelWord fours = (c0 & c1) | (carry & (c0 ^ c1));
+
+				short* cell = out + w*64;
+				for (int bit = 0; cur != 0; bit++, cur >>= 1, ones >>= 1, twos >>= 1, fours >>= 1) {
+					if (cur & 1)
+						cell[bit] = (short) ((ones & 1) + 2*(twos & 1) + 4*(fours & 1));
+				}
+			}
+		}
+	}
+}
+
+void VoxelGrid::removeVoxel(int x, int y, int z) {
+	if (!contains(x, y, z) || !isOccupied(x, y, z))
+		return;
+	clearOccupied(x, y, z);
+	adj[index(x, y, z)] = -1;
+	if (x + 1 < theDim[0] && isOccupied(x+1, y, z)) adj[index(x+1, y, z)]--;
+	if (x > 0 && isOccupied(x-1, y, z)) adj[index(x-1, y, z)]--;
+	if (y + 1 < theDim[1] && isOccupied(x, y+1, z)) adj[index(x, y+1, z)]--;
+	if (y > 0 && isOccupied(x, y-1, z)) adj[index(x, y-1, z)]--;
+	if (z + 1 < theDim[2] && isOccupied(x, y, z+1)) adj[index(x, y, z+1)]--;
+	if (z > 0 && isOccupied(x, y, z-1)) adj[index(x, y, z-1)]--;
+}
@@ -1,33 +1,92 @@
 #ifndef VOXEL_GRID_H
 #define VOXEL_GRID_H
 
+#include <stddef.h>
+#include <vector>
 #include "vector.h"
+#include "mthread.h"
 
 class VoxelGrid {
 
 public:
 	// Constructor
-	VoxelGrid();
-	VoxelGrid(const char* filename) {
+	VoxelGrid() : wordsPerRow(0) {
+		theDim[0] = theDim[1] = theDim[2] = 0;
+	}
+	VoxelGrid(const char* filename) : wordsPerRow(0) {
+		theDim[0] = theDim[1] = theDim[2] = 0;
 		loadGrid(filename);
 	}
 	~VoxelGrid();
 
 	// Function
-	void loadGrid(const char* filename);
+	void loadGrid(const char* filename);		// .voxels or compact .vxc, by content
+
+	// Writes a .voxels file in the compact format; channels is a mask of
+	// VOXELCOMPACT_DISTANCE / VOXELCOMPACT_BORDER side channels to keep.
+	static bool convertGrid(const char* src, const char* dst, int channels);
     
     // If it is not in the voxelgrid then return vector of -1 
 	Vector3DF inVoxelGrid(double x, double y, double z);
 
 	Vector3DF getCellCenter(int i, int j, int k);
+
+	// Sizes an empty grid (world axes) and drops any side channels.
+	void allocate(const int dim[3]);
+
+	// A solid cube of n voxels a side and size world units across, placed
+	// where the loaded models are; n*n*n particles when seeded.
+	void makeCube(int n, float size);
+
+	// Counts the occupied face neighbors of every voxel into adj (-1 for
+	// empty cells), a word of 64 cells at a time, z slabs spread over pool.
+	void computeAdjacency(mint::ThreadPool* pool = 0x0);
+	// Melts voxel (x,y,z): clears it and updates the counts around it.
+	void removeVoxel(int x, int y, int z);
+
+	// Bytes in use and allocated by the per-cell arrays.
+	void getMemory(size_t& resident, size_t& reserved) const;
+
+	// All per-cell storage is in world axes (x,y,z); the file's j and k axes
+	// are swapped on load so y is up. Cells are x-fastest, then y, then z.
+	bool contains(int x, int y, int z) const {
+		return x >= 0 && y >= 0 && z >= 0 && x < theDim[0] && y < theDim[1] && z < theDim[2];
+	}
+	int index(int x, int y, int z) const { return (z*theDim[1] + y)*theDim[0] + x; }
+	bool isOccupied(int x, int y, int z) const {
+		return (data[(z*theDim[1] + y)*wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+	}
+	void setOccupied(int x, int y, int z) {
+		data[(z*theDim[1] + y)*wordsPerRow + (x >> 6)] |= (VoxelWord) 1 << (x & 63);
+	}
+	void clearOccupied(int x, int y, int z) {
+		data[(z*theDim[1] + y)*wordsPerRow + (x >> 6)] &= ~((VoxelWord) 1 << (x & 63));
+	}
 	
-	//Dimensions of the Grid (Resolution)
+	//Dimensions of the Grid (Resolution), world axes
 	int theDim[3];
 	//The Size of a voxel along each axis.
 	float voxelSize[3];
 	float offset[3];
-	bool ***data;
-    short ***adj; //adjacency list
+
+	// Occupancy bitset, one bit per cell: each x row is padded to
+	// wordsPerRow 64-bit words, rows are y-fastest then z.
+	typedef unsigned long long VoxelWord;
+	std::vector<VoxelWord> data;
+	int wordsPerRow;
+	std::vector<short> adj; //adjacency list, per cell at index()
+
+	// Side channels of compact files, per cell at index(); empty if the
+	// file did not carry them.
+	std::vector<float> distance;
+	std::vector<unsigned char> border;
+
+private:
+	void initGrid(const int resolution[3], const float size[3], float scale, const float model_offset[3]);
+	void markVoxel(int i, int j, int k);
+	void adjacencySlab(int zBegin, int zEnd);
+	void loadVoxels(const char* buf, size_t buf_size, const char* filename);
+	void loadCompact(const char* buf, size_t buf_size, const char* filename);
 };
 
 #endif